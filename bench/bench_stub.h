@@ -0,0 +1,329 @@
+#ifndef BENCH_STUB_H
+#define BENCH_STUB_H
+
+/* Shared by the benchmarks: run a gdbstub in a thread over a unix socket,
+ * or TCP on the loopback, and talk to it as a minimal GDB client. */
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gdbstub.h"
+
+/* The registers of the default target, 64-bit with the PC last */
+#define BENCH_NR_REGS 33
+#define BENCH_REG_PC 32
+
+typedef struct {
+    gdbstub_t gdbstub;
+    struct target_ops *ops;
+    arch_info_t arch;
+    size_t packet_size;
+    bool rle;
+    int io_uring; /* 1: use io_uring, -1: do not, 0: the default */
+    int port;     /* listen on 127.0.0.1:port rather than a unix socket */
+    size_t mem_cache_line; /* see gdbstub_set_mem_cache() */
+    int mem_cache_lines;
+    void *args; /* the stub itself unless set */
+    char path[64];
+    pthread_t tid;
+    gdbstub_io_stats_t stats; /* taken when gdbstub_run() returns */
+    gdbstub_mem_stats_t mem_stats;
+    uint64_t regs[BENCH_NR_REGS]; /* of the default target */
+    uint8_t *mem;
+    size_t mem_size;
+} bench_stub_t;
+
+static inline size_t bench_get_reg_bytes(int regno __attribute__((unused)))
+{
+    return sizeof(uint64_t);
+}
+
+static inline int bench_read_reg(void *args, int regno, void *value)
+{
+    bench_stub_t *stub = args;
+    memcpy(value, &stub->regs[regno], sizeof(uint64_t));
+    return 0;
+}
+
+static inline int bench_write_reg(void *args, int regno, void *value)
+{
+    bench_stub_t *stub = args;
+    memcpy(&stub->regs[regno], value, sizeof(uint64_t));
+    return 0;
+}
+
+static inline int bench_read_mem(void *args,
+                                 size_t addr,
+                                 size_t len,
+                                 void *val)
+{
+    bench_stub_t *stub = args;
+    if (addr > stub->mem_size || len > stub->mem_size - addr)
+        return EFAULT;
+    memcpy(val, stub->mem + addr, len);
+    return 0;
+}
+
+static inline gdb_action_t bench_cont(void *args __attribute__((unused)))
+{
+    return ACT_RESUME;
+}
+
+static inline gdb_action_t bench_stepi(void *args)
+{
+    bench_stub_t *stub = args;
+    stub->regs[BENCH_REG_PC] += 4;
+    return ACT_RESUME;
+}
+
+static inline size_t bench_get_pc(void *args)
+{
+    bench_stub_t *stub = args;
+    return stub->regs[BENCH_REG_PC];
+}
+
+/* The default target, on the registers and memory of the stub, running
+ * straight-line code. A benchmark starts from it and overrides the ops it
+ * measures. */
+static inline struct target_ops bench_target_ops(void)
+{
+    return (struct target_ops){
+        .get_reg_bytes = bench_get_reg_bytes,
+        .read_reg = bench_read_reg,
+        .write_reg = bench_write_reg,
+        .read_mem = bench_read_mem,
+        .cont = bench_cont,
+        .stepi = bench_stepi,
+        .get_pc = bench_get_pc,
+    };
+}
+
+typedef struct {
+    int fd;
+    bool ack;
+    char *buf;
+    size_t cap;
+    size_t len;
+    size_t used;    /* bytes of the packet returned last */
+    size_t nr_sent; /* packets sent, i.e. round trips */
+} bench_client_t;
+
+static inline double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *bench_stub_thread(void *arg)
+{
+    bench_stub_t *stub = arg;
+    char path[sizeof(stub->path)];
+
+    /* gdbstub_init() cuts the port off, the client still needs it */
+    memcpy(path, stub->path, sizeof(path));
+    if (!gdbstub_init(&stub->gdbstub, stub->ops, stub->arch, path)) {
+        fprintf(stderr, "bench: gdbstub_init failed\n");
+        exit(1);
+    }
+    if (stub->packet_size &&
+        !gdbstub_set_packet_size(&stub->gdbstub, stub->packet_size)) {
+        fprintf(stderr, "bench: bad packet size %zu\n", stub->packet_size);
+        exit(1);
+    }
+    gdbstub_set_rle(&stub->gdbstub, stub->rle);
+    if (stub->io_uring &&
+        !gdbstub_set_io_uring(&stub->gdbstub, stub->io_uring > 0)) {
+        fprintf(stderr, "bench: io_uring unavailable\n");
+        exit(1);
+    }
+    if (stub->mem_cache_line &&
+        !gdbstub_set_mem_cache(&stub->gdbstub, stub->mem_cache_line,
+                               stub->mem_cache_lines)) {
+        fprintf(stderr, "bench: bad memory cache %zu x %d\n",
+                stub->mem_cache_line, stub->mem_cache_lines);
+        exit(1);
+    }
+    gdbstub_run(&stub->gdbstub, stub->args);
+    gdbstub_get_io_stats(&stub->gdbstub, &stub->stats);
+    gdbstub_get_mem_stats(&stub->gdbstub, &stub->mem_stats);
+    gdbstub_close(&stub->gdbstub);
+    return NULL;
+}
+
+static inline void bench_stub_start(bench_stub_t *stub)
+{
+    if (!stub->args)
+        stub->args = stub;
+    if (stub->port) {
+        snprintf(stub->path, sizeof(stub->path), "127.0.0.1:%d", stub->port);
+    } else {
+        snprintf(stub->path, sizeof(stub->path),
+                 "/tmp/gdbstub-bench-%d.sock", (int) getpid());
+        unlink(stub->path);
+    }
+    assert(pthread_create(&stub->tid, NULL, bench_stub_thread, stub) == 0);
+}
+
+static inline void bench_stub_join(bench_stub_t *stub)
+{
+    pthread_join(stub->tid, NULL);
+    if (!stub->port)
+        unlink(stub->path);
+}
+
+static inline void bench_client_connect(bench_client_t *client,
+                                        const char *path)
+{
+    struct sockaddr_un un = {.sun_family = AF_UNIX};
+    struct sockaddr_in in = {.sin_family = AF_INET};
+    const char *port = strchr(path, ':');
+    struct sockaddr *addr = (struct sockaddr *) &un;
+    socklen_t addr_len = sizeof(un);
+
+    if (port) {
+        in.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        in.sin_port = htons(atoi(port + 1));
+        addr = (struct sockaddr *) &in;
+        addr_len = sizeof(in);
+    } else {
+        strncpy(un.sun_path, path, sizeof(un.sun_path) - 1);
+    }
+
+    memset(client, 0, sizeof(*client));
+    client->ack = true;
+    client->cap = 1 << 16;
+    client->buf = malloc(client->cap);
+    assert(client->buf);
+
+    /* The stub thread may not be listening yet */
+    for (int retry = 0;; retry++) {
+        client->fd = socket(addr->sa_family, SOCK_STREAM, 0);
+        assert(client->fd >= 0);
+        if (!connect(client->fd, addr, addr_len)) {
+            int one = 1;
+            if (port)
+                setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one,
+                           sizeof(one));
+            return;
+        }
+        close(client->fd);
+        assert(retry < 1000);
+        usleep(1000);
+    }
+}
+
+static inline void bench_client_write(bench_client_t *client,
+                                      const void *data,
+                                      size_t len)
+{
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t nwrite = write(client->fd, ptr, len);
+        assert(nwrite > 0);
+        ptr += nwrite;
+        len -= nwrite;
+    }
+}
+
+static inline void bench_client_send(bench_client_t *client,
+                                     const char *payload,
+                                     size_t len)
+{
+    char *frame = malloc(len + 5); /* the terminator of snprintf() too */
+    uint8_t csum = 0;
+
+    frame[0] = '$';
+    for (size_t i = 0; i < len; i++)
+        csum += (uint8_t) payload[i];
+    memcpy(frame + 1, payload, len);
+    snprintf(frame + len + 1, 4, "#%02x", csum);
+    bench_client_write(client, frame, len + 4);
+    client->nr_sent++;
+    free(frame);
+}
+
+/* Receive the next packet and return its payload, which stays valid until
+ * the next call. The checksum is trusted. */
+static inline char *bench_client_recv(bench_client_t *client, size_t *len)
+{
+    /* Drop the packet returned by the last call */
+    memmove(client->buf, client->buf + client->used,
+            client->len - client->used);
+    client->len -= client->used;
+    client->used = 0;
+
+    char *head = NULL;
+    size_t scan = 0;
+    while (true) {
+        if (!head) {
+            head = memchr(client->buf + scan, '$', client->len - scan);
+            scan = head ? (size_t) (head - client->buf) : client->len;
+        }
+        if (head) {
+            char *csum = memchr(client->buf + scan, '#', client->len - scan);
+            scan = csum ? (size_t) (csum - client->buf) : client->len;
+            if (csum && csum + 3 <= client->buf + client->len) {
+                if (client->ack)
+                    bench_client_write(client, "+", 1);
+                *len = csum - head - 1;
+                *csum = '\0';
+                client->used = csum + 3 - client->buf;
+                return head + 1;
+            }
+        }
+
+        if (client->len == client->cap) {
+            size_t head_off = head ? (size_t) (head - client->buf) : 0;
+            client->cap *= 2;
+            client->buf = realloc(client->buf, client->cap);
+            assert(client->buf);
+            if (head)
+                head = client->buf + head_off;
+        }
+        ssize_t nread = read(client->fd, client->buf + client->len,
+                             client->cap - client->len);
+        assert(nread > 0);
+        client->len += nread;
+    }
+}
+
+/* Send a request and wait for its reply */
+static inline char *bench_client_cmd(bench_client_t *client,
+                                     const char *payload,
+                                     size_t *len)
+{
+    bench_client_send(client, payload, strlen(payload));
+    return bench_client_recv(client, len);
+}
+
+/* Switch to no-ack mode, which is how GDB talks to a fast stub */
+static inline void bench_client_noack(bench_client_t *client)
+{
+    size_t len;
+    char *reply = bench_client_cmd(client, "QStartNoAckMode", &len);
+    assert(!strcmp(reply, "OK"));
+    client->ack = false;
+}
+
+static inline void bench_client_close(bench_client_t *client)
+{
+    size_t len;
+    bench_client_cmd(client, "D", &len);
+    close(client->fd);
+    free(client->buf);
+}
+
+#endif
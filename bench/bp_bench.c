@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "bps.h"
+
+/* The code executed, in 4-byte instructions, looped over */
+#define CODE_SIZE (1 << 20)
+#define INSTS_PER_RUN (1 << 26)
+
+/* Breakpoints are spread over this much code around what runs, so that
+ * they are never hit but share buckets of the filter with it */
+#define TEXT_SIZE (64 << 20)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t pc_at(size_t i)
+{
+    return (i * 4) & (CODE_SIZE - 1);
+}
+
+int main()
+{
+    static int nr_bps[] = {0, 1, 100, 10000};
+    static gdbstub_t gdbstub;
+    static size_t linear[10000];
+    uint32_t *code = malloc(CODE_SIZE);
+
+    for (size_t i = 0; i < CODE_SIZE / 4; i++)
+        code[i] = rand();
+
+    printf("%8s %14s %14s %14s\n", "bps", "none ns/inst", "table ns/inst",
+           "linear ns/inst");
+    for (size_t n = 0; n < sizeof(nr_bps) / sizeof(nr_bps[0]); n++) {
+        int nr = nr_bps[n];
+        srand(nr);
+        bps_destroy(&gdbstub.bps);
+        for (int i = 0; i < nr; i++) {
+            size_t addr = CODE_SIZE + rand() % (TEXT_SIZE - CODE_SIZE) / 4 * 4;
+            linear[i] = addr;
+            bps_insert(&gdbstub.bps, addr, NULL);
+        }
+
+        /* What an execution loop does besides the check */
+        uint32_t acc = 0;
+        double start = now();
+        for (size_t i = 0; i < INSTS_PER_RUN; i++)
+            acc += code[pc_at(i) / 4];
+        double none = now() - start;
+
+        start = now();
+        for (size_t i = 0; i < INSTS_PER_RUN; i++) {
+            size_t pc = pc_at(i);
+            if (gdbstub_bp_hit(&gdbstub, pc))
+                break;
+            acc += code[pc / 4];
+        }
+        double table = now() - start;
+
+        /* The loop the target would otherwise write, over fewer
+         * instructions as it slows down */
+        size_t insts = INSTS_PER_RUN / (1 + nr / 16);
+        start = now();
+        for (size_t i = 0; i < insts; i++) {
+            size_t pc = pc_at(i);
+            int j;
+            for (j = 0; j < nr && linear[j] != pc; j++)
+                ;
+            if (j < nr)
+                break;
+            acc += code[pc / 4];
+        }
+        double lin = now() - start;
+
+        __asm__ volatile("" : : "r"(acc));
+        printf("%8d %14.3f %14.3f %14.3f\n", nr, none * 1e9 / INSTS_PER_RUN,
+               table * 1e9 / INSTS_PER_RUN, lin * 1e9 / insts);
+    }
+
+    bps_destroy(&gdbstub.bps);
+    free(code);
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include "bench_stub.h"
+
+/* A loop of LOOP_LEN instructions counting its iterations in a0, with a
+ * breakpoint on its first instruction conditioned on a0 */
+#define REG_A0 10
+#define LOOP_PC 0x1000
+#define LOOP_LEN 16
+#define HOST_HITS 20000
+#define TARGET_HITS 10000000
+
+static bench_stub_t stub;
+
+static void exec_one(void)
+{
+    uint64_t *pc = &stub.regs[BENCH_REG_PC];
+
+    if (*pc == LOOP_PC)
+        stub.regs[REG_A0]++;
+    *pc += 4;
+    if (*pc == LOOP_PC + 4 * LOOP_LEN)
+        *pc = LOOP_PC;
+}
+
+/* Run at least one instruction, as GDB steps off a breakpoint anyway */
+static gdb_action_t cont(void *args __attribute__((unused)))
+{
+    do
+        exec_one();
+    while (!gdbstub_bp_hit(&stub.gdbstub, stub.regs[BENCH_REG_PC]));
+    return ACT_RESUME;
+}
+
+static gdb_action_t stepi(void *args __attribute__((unused)))
+{
+    exec_one();
+    return ACT_RESUME;
+}
+
+/* What GDB does at each hit when it evaluates the condition itself: read
+ * the registers, find the condition false, and resume, taking the
+ * breakpoint out to step off it */
+static void run_host(bench_client_t *client)
+{
+    size_t len;
+
+    assert(!strcmp(bench_client_cmd(client, "Z0,1000,4", &len), "OK"));
+    double start = bench_now();
+    for (int i = 0; i < HOST_HITS; i++) {
+        assert(!strcmp(bench_client_cmd(client, "c", &len), "S05"));
+        assert(bench_client_cmd(client, "g", &len)[0] != 'E');
+        assert(!strcmp(bench_client_cmd(client, "z0,1000,4", &len), "OK"));
+        assert(!strcmp(bench_client_cmd(client, "s", &len), "S05"));
+        assert(!strcmp(bench_client_cmd(client, "Z0,1000,4", &len), "OK"));
+    }
+    double elapsed = bench_now() - start;
+    assert(!strcmp(bench_client_cmd(client, "z0,1000,4", &len), "OK"));
+
+    printf("%-8s %12d %14.0f\n", "host", HOST_HITS, HOST_HITS / elapsed);
+}
+
+/* The same breakpoint with "$a0 == a0 + TARGET_HITS" evaluated by the stub,
+ * which stops once */
+static void run_target(bench_client_t *client)
+{
+    uint64_t until = stub.regs[REG_A0] + TARGET_HITS;
+    char req[64];
+    size_t len;
+
+    /* reg a0; const32 until; equal; end */
+    snprintf(req, sizeof(req), "Z0,1000,4;Xa,260%03x24%08x1327", REG_A0,
+             (unsigned) until);
+    assert(!strcmp(bench_client_cmd(client, req, &len), "OK"));
+    double start = bench_now();
+    assert(!strcmp(bench_client_cmd(client, "c", &len), "S05"));
+    double elapsed = bench_now() - start;
+    assert(stub.regs[REG_A0] == until);
+    assert(!strcmp(bench_client_cmd(client, "z0,1000,4", &len), "OK"));
+
+    printf("%-8s %12d %14.0f\n", "target", TARGET_HITS,
+           TARGET_HITS / elapsed);
+}
+
+int main()
+{
+    struct target_ops ops = bench_target_ops();
+    bench_client_t client;
+    size_t len;
+
+    ops.cont = cont;
+    ops.stepi = stepi;
+    stub.ops = &ops;
+    stub.arch = (arch_info_t){.smp = 1, .reg_num = BENCH_NR_REGS};
+    stub.regs[BENCH_REG_PC] = LOOP_PC;
+
+    bench_stub_start(&stub);
+    bench_client_connect(&client, stub.path);
+    bench_client_noack(&client);
+    char *features = bench_client_cmd(&client, "qSupported", &len);
+    assert(strstr(features, "ConditionalBreakpoints+"));
+
+    printf("%-8s %12s %14s\n", "cond", "hits", "hits/s");
+    run_host(&client);
+    run_target(&client);
+
+    bench_client_close(&client);
+    bench_stub_join(&stub);
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "utils/translate.h"
+
+#define MAX_BYTES (1 << 20)
+
+/* Amount of data converted for each measurement, whatever the buffer size */
+#define BYTES_PER_RUN (256 << 20)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main()
+{
+    static size_t sizes[] = {1, 4, 8, 16, 64, 256, 1024, 4096, 65536, 1 << 20};
+    uint8_t *num = malloc(MAX_BYTES);
+    char *str = malloc(MAX_BYTES * 2);
+    int nr_kernels;
+    const hex_kernel_t *kernels = hex_kernels(&nr_kernels);
+
+    for (size_t i = 0; i < MAX_BYTES; i++)
+        num[i] = rand();
+    kernels[0].encode(num, str, MAX_BYTES);
+
+    printf("%-8s %10s %14s %14s\n", "kernel", "bytes", "encode MB/s",
+           "decode MB/s");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t len = sizes[s];
+        size_t iters = BYTES_PER_RUN / len;
+        if (iters > (1 << 24))
+            iters = 1 << 24;
+
+        for (int k = 0; k < nr_kernels; k++) {
+            double start = now();
+            for (size_t it = 0; it < iters; it++) {
+                kernels[k].encode(num, str, len);
+                __asm__ volatile("" : : "r"(str) : "memory");
+            }
+            double enc = now() - start;
+
+            start = now();
+            for (size_t it = 0; it < iters; it++) {
+                kernels[k].decode(str, num, len);
+                __asm__ volatile("" : : "r"(num) : "memory");
+            }
+            double dec = now() - start;
+
+            double mb = (double) len * iters / 1e6;
+            printf("%-8s %10zu %14.1f %14.1f\n", kernels[k].name, len,
+                   mb / enc, mb / dec);
+        }
+    }
+
+    free(num);
+    free(str);
+    return 0;
+}
@@ -0,0 +1,230 @@
+#include "bench_stub.h"
+
+/* A RISC-V program in 1 MiB of RAM: code, then read-only data, then the
+ * stack at the top */
+#define RAM_BASE 0x80000000UL
+#define RAM_SIZE (1 << 20)
+#define ROUNDS 2000
+#define STEPS 20000
+#define STACK_TOP (RAM_BASE + RAM_SIZE - 0x1000)
+
+static uint8_t *ram;
+static size_t nr_reads;
+static long read_cost_ns; /* of each read_mem() call */
+static size_t nr_steps;
+static mem_range_t dirty; /* the store of the last step */
+
+/* The memory requests of "bt full" through six frames, in the order GDB
+ * makes them: the instruction at the pc of the frame, the prologue of its
+ * function one instruction at a time, a 2 byte read telling a compressed
+ * instruction, then the saved ra and fp, the locals, a struct and a
+ * string the locals point to. */
+static const char *trace[] = {
+    /* frame #0 */
+    "m800001ec,4", "m800001a4,2", "m800001a4,4", "m800001a8,2", "m800001a8,4",
+    "m800001ac,2", "m800001ac,4", "m800001b0,2", "m800001b0,4", "m800001b4,2",
+    "m800001b4,4", "m800001b8,2", "m800001b8,4", "m800001bc,2", "m800001bc,4",
+    "m800001c0,2", "m800001c0,4", "m800001c4,2", "m800001c4,4", "m800001c8,2",
+    "m800001c8,4", "m800001cc,2", "m800001cc,4", "m800001d0,2", "m800001d0,4",
+    "m800fee98,8", "m800fee90,8", "m800fee8c,4", "m800fee88,4", "m800fee80,8",
+    "m800fee78,8", "m800fee60,20", "m80010328,40",
+    /* frame #1 */
+    "m8000032c,4", "m80000310,2", "m80000310,4", "m80000314,2", "m80000314,4",
+    "m80000318,2", "m80000318,4", "m8000031c,2", "m8000031c,4", "m80000320,2",
+    "m80000320,4", "m80000324,2", "m80000324,4", "m80000328,2", "m80000328,4",
+    "m800feec8,8", "m800feec0,8", "m800feebc,4", "m800feeb8,4", "m800feeb0,8",
+    "m800feea8,8", "m800feea0,20", "m800100c0,40",
+    /* frame #2 */
+    "m80000510,4", "m800004c8,2", "m800004c8,4", "m800004cc,2", "m800004cc,4",
+    "m800004d0,2", "m800004d0,4", "m800004d4,2", "m800004d4,4", "m800004d8,2",
+    "m800004d8,4", "m800004dc,2", "m800004dc,4", "m800004e0,2", "m800004e0,4",
+    "m800004e4,2", "m800004e4,4", "m800004e8,2", "m800004e8,4", "m800004ec,2",
+    "m800004ec,4", "m800004f0,2", "m800004f0,4", "m800004f4,2", "m800004f4,4",
+    "m800feef8,8", "m800feef0,8", "m800feeec,4", "m800feee8,4", "m800feee0,8",
+    "m800feed8,8", "m800feed0,20", "m800101b0,40",
+    /* frame #3 */
+    "m8000063e,4", "m80000622,2", "m80000622,4", "m80000626,2", "m80000626,4",
+    "m8000062a,2", "m8000062a,4", "m8000062e,2", "m8000062e,4", "m80000632,2",
+    "m80000632,4", "m80000636,2", "m80000636,4", "m8000063a,2", "m8000063a,4",
+    "m800fef28,8", "m800fef20,8", "m800fef1c,4", "m800fef18,4", "m800fef10,8",
+    "m800fef08,8", "m800fef00,20", "m80010378,40",
+    /* frame #4 */
+    "m8000084e,4", "m800007f0,2", "m800007f0,4", "m800007f4,2", "m800007f4,4",
+    "m800007f8,2", "m800007f8,4", "m800007fc,2", "m800007fc,4", "m80000800,2",
+    "m80000800,4", "m80000804,2", "m80000804,4", "m80000808,2", "m80000808,4",
+    "m8000080c,2", "m8000080c,4", "m80000810,2", "m80000810,4", "m80000814,2",
+    "m80000814,4", "m80000818,2", "m80000818,4", "m8000081c,2", "m8000081c,4",
+    "m800fef58,8", "m800fef50,8", "m800fef4c,4", "m800fef48,4", "m800fef40,8",
+    "m800fef38,8", "m800fef30,20", "m800101e8,40",
+    /* frame #5 */
+    "m80000920,4", "m80000904,2", "m80000904,4", "m80000908,2", "m80000908,4",
+    "m8000090c,2", "m8000090c,4", "m80000910,2", "m80000910,4", "m80000914,2",
+    "m80000914,4", "m80000918,2", "m80000918,4", "m8000091c,2", "m8000091c,4",
+    "m800fefb8,8", "m800fefb0,8", "m800fefac,4", "m800fefa8,4", "m800fefa0,8",
+    "m800fef98,8", "m800fef80,20", "m80010078,40",
+};
+
+static void spin(long ns)
+{
+    double until = bench_now() + ns * 1e-9;
+    while (bench_now() < until)
+        ;
+}
+
+static int read_mem(void *args __attribute__((unused)),
+                    size_t addr,
+                    size_t len,
+                    void *val)
+{
+    nr_reads++;
+    if (read_cost_ns)
+        spin(read_cost_ns);
+    if (addr < RAM_BASE || addr - RAM_BASE + len > RAM_SIZE)
+        return 14; /* EFAULT */
+    memcpy(val, ram + (addr - RAM_BASE), len);
+    return 0;
+}
+
+/* Each step stores 8 bytes to one of the 32 slots below STACK_TOP */
+static gdb_action_t stepi(void *args __attribute__((unused)))
+{
+    nr_steps++;
+    dirty.addr = STACK_TOP - 8 * (1 + nr_steps % 32);
+    dirty.len = 8;
+    memcpy(ram + (dirty.addr - RAM_BASE), &nr_steps, 8);
+    return ACT_RESUME;
+}
+
+static int get_dirty_ranges(void *args __attribute__((unused)),
+                            mem_range_t *ranges,
+                            int nr __attribute__((unused)))
+{
+    ranges[0] = dirty;
+    return 1;
+}
+
+static struct target_ops ops = {
+    .read_mem = read_mem,
+    .stepi = stepi,
+};
+
+/* Replay the trace after each of ROUNDS stops, which the target does not
+ * tell the changes of, so each one starts with nothing cached */
+static void run(size_t line_size, int nr_lines)
+{
+    bench_stub_t stub = {
+        .ops = &ops,
+        .mem_cache_line = line_size,
+        .mem_cache_lines = nr_lines,
+    };
+    bench_client_t client;
+    size_t nr = sizeof(trace) / sizeof(trace[0]);
+    size_t len;
+
+    ops.get_dirty_ranges = NULL;
+
+    bench_stub_start(&stub);
+    bench_client_connect(&client, stub.path);
+    bench_client_noack(&client);
+
+    nr_reads = 0;
+    double start = bench_now();
+    for (int i = 0; i < ROUNDS; i++) {
+        for (size_t j = 0; j < nr; j++)
+            assert(bench_client_cmd(&client, trace[j], &len)[0] != 'E');
+        assert(!strcmp(bench_client_cmd(&client, "s", &len), "S05"));
+    }
+    double elapsed = bench_now() - start;
+
+    bench_client_close(&client);
+    bench_stub_join(&stub);
+
+    char name[32] = "off";
+    if (line_size)
+        snprintf(name, sizeof(name), "%zu x %d", line_size, nr_lines);
+    size_t nr_lookups = stub.mem_stats.nr_hits + stub.mem_stats.nr_misses;
+    printf("%-12s %8ld %12.1f %12.2f %10.1f\n", name, read_cost_ns,
+           elapsed * 1e6 / ROUNDS, (double) nr_reads / ROUNDS,
+           nr_lookups ? 100.0 * stub.mem_stats.nr_hits / nr_lookups : 0.0);
+}
+
+/* Step STEPS times, reading the stack slots and the instruction at the pc
+ * after each step as a display of the locals would */
+static void run_step(size_t line_size, int nr_lines, bool track)
+{
+    bench_stub_t stub = {
+        .ops = &ops,
+        .mem_cache_line = line_size,
+        .mem_cache_lines = nr_lines,
+    };
+    bench_client_t client;
+    char req[32];
+    size_t len;
+
+    ops.get_dirty_ranges = track ? get_dirty_ranges : NULL;
+    bench_stub_start(&stub);
+    bench_client_connect(&client, stub.path);
+    bench_client_noack(&client);
+
+    nr_reads = 0;
+    double start = bench_now();
+    for (int i = 0; i < STEPS; i++) {
+        assert(!strcmp(bench_client_cmd(&client, "s", &len), "S05"));
+        for (int slot = 1; slot <= 32; slot++) {
+            snprintf(req, sizeof(req), "m%lx,8", STACK_TOP - 8 * slot);
+            char *reply = bench_client_cmd(&client, req, &len);
+            assert(len == 16);
+            /* The slot stored to by this step must not be stale */
+            if (STACK_TOP - 8 * slot == dirty.addr)
+                assert(strtoull(reply, NULL, 16) ==
+                       __builtin_bswap64(nr_steps));
+        }
+        snprintf(req, sizeof(req), "m%lx,4", RAM_BASE + 0x1a4 + 4 * (i % 8));
+        assert(bench_client_cmd(&client, req, &len)[0] != 'E');
+    }
+    double elapsed = bench_now() - start;
+
+    bench_client_close(&client);
+    bench_stub_join(&stub);
+
+    char name[32] = "off";
+    if (line_size)
+        snprintf(name, sizeof(name), "%zu x %d%s", line_size, nr_lines,
+                 track ? ", dirty" : "");
+    size_t nr_lookups = stub.mem_stats.nr_hits + stub.mem_stats.nr_misses;
+    printf("%-20s %12.1f %12.2f %10.1f\n", name, elapsed * 1e6 / STEPS,
+           (double) nr_reads / STEPS,
+           nr_lookups ? 100.0 * stub.mem_stats.nr_hits / nr_lookups : 0.0);
+}
+
+int main()
+{
+    static const struct {
+        size_t line_size;
+        int nr_lines;
+    } configs[] = {{0, 0}, {256, 16}, {1024, 16}, {4096, 8}};
+    static const long costs[] = {0, 2000};
+
+    ram = malloc(RAM_SIZE);
+    assert(ram);
+    for (size_t i = 0; i < RAM_SIZE; i++)
+        ram[i] = i * 13;
+
+    printf("%-12s %8s %12s %12s %10s\n", "cache", "cost/ns", "us/replay",
+           "reads/replay", "hit %");
+    for (size_t c = 0; c < sizeof(costs) / sizeof(costs[0]); c++) {
+        read_cost_ns = costs[c];
+        for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++)
+            run(configs[i].line_size, configs[i].nr_lines);
+    }
+
+    read_cost_ns = 0;
+    printf("\n%-20s %12s %12s %10s\n", "stepping", "us/step", "reads/step",
+           "hit %");
+    run_step(0, 0, false);
+    run_step(256, 16, false);
+    run_step(256, 16, true);
+
+    free(ram);
+    return 0;
+}
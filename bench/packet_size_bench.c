@@ -0,0 +1,63 @@
+#include "bench_stub.h"
+
+/* Dump this much memory with 'm' packets as large as each packet size */
+#define MEM_SIZE (64 << 20)
+
+static uint8_t *mem;
+
+int main()
+{
+    static const size_t sizes[] = {0x400,   0x1000,  0x4000,
+                                   0x10000, 0x40000, 0x100000};
+    struct target_ops ops = bench_target_ops();
+
+    mem = malloc(MEM_SIZE);
+    assert(mem);
+    for (size_t i = 0; i < MEM_SIZE; i++)
+        mem[i] = i * 7;
+
+    printf("%-12s %12s %12s %10s\n", "PacketSize", "round trips", "seconds",
+           "MB/s");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        bench_stub_t stub = {
+            .ops = &ops,
+            .packet_size = sizes[s],
+            .mem = mem,
+            .mem_size = MEM_SIZE,
+        };
+        bench_client_t client;
+        char req[64];
+        size_t len;
+
+        bench_stub_start(&stub);
+        bench_client_connect(&client, stub.path);
+
+        /* Ask for as much as the advertised PacketSize allows, the way GDB
+         * sizes its memory reads */
+        char *reply = bench_client_cmd(&client, "qSupported", &len);
+        size_t packet_size = strtoul(strstr(reply, "PacketSize=") + 11,
+                                     NULL, 16);
+        size_t chunk = (packet_size - 4) / 2;
+        bench_client_noack(&client);
+
+        client.nr_sent = 0;
+        double start = bench_now();
+        for (size_t addr = 0; addr < MEM_SIZE;) {
+            size_t want = MEM_SIZE - addr < chunk ? MEM_SIZE - addr : chunk;
+            snprintf(req, sizeof(req), "m%zx,%zx", addr, want);
+            reply = bench_client_cmd(&client, req, &len);
+            assert(len > 0 && len % 2 == 0);
+            addr += len / 2;
+        }
+        double elapsed = bench_now() - start;
+
+        printf("%-#12zx %12zu %12.3f %10.1f\n", packet_size, client.nr_sent,
+               elapsed, MEM_SIZE / elapsed / 1e6);
+
+        bench_client_close(&client);
+        bench_stub_join(&stub);
+    }
+
+    free(mem);
+    return 0;
+}
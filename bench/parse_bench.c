@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils/parse.h"
+
+#define ITERS (1 << 22)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Argument strings as GDB sends them, after the packet letter */
+static const char *mem_args[] = {
+    "80000000,4",
+    "ffffffff80201000,200",
+    "7ffd5c3a1e70,8",
+    "0,fff",
+};
+static const char *bp_args[] = {
+    "0,80000044,4",
+    "0,ffffffff80201abc,2",
+};
+
+static void bench_mem(void)
+{
+    size_t nr = sizeof(mem_args) / sizeof(mem_args[0]);
+    unsigned long addr, len, sum = 0;
+
+    double start = now();
+    for (size_t i = 0; i < ITERS; i++) {
+        const char *s = mem_args[i % nr];
+        if (sscanf(s, "%lx,%lx", &addr, &len) == 2)
+            sum += addr + len;
+    }
+    double t_sscanf = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < ITERS; i++) {
+        const char *s = mem_args[i % nr];
+        uint64_t a, l;
+        parse_t p;
+        parse_init(&p, s, strlen(s));
+        if (parse_hex_u64(&p, &a) && parse_expect_char(&p, ',') &&
+            parse_hex_u64(&p, &l) && parse_at_end(&p))
+            sum -= a + l;
+    }
+    double t_parse = now() - start;
+
+    printf("%-16s %12.1f %12.1f %8lu\n", "addr,len", t_sscanf * 1e9 / ITERS,
+           t_parse * 1e9 / ITERS, sum);
+}
+
+static void bench_bp(void)
+{
+    size_t nr = sizeof(bp_args) / sizeof(bp_args[0]);
+    size_t type, addr, kind, sum = 0;
+
+    double start = now();
+    for (size_t i = 0; i < ITERS; i++) {
+        const char *s = bp_args[i % nr];
+        if (sscanf(s, "%zx,%zx,%zx", &type, &addr, &kind) == 3)
+            sum += type + addr + kind;
+    }
+    double t_sscanf = now() - start;
+
+    start = now();
+    for (size_t i = 0; i < ITERS; i++) {
+        const char *s = bp_args[i % nr];
+        uint64_t t, a, k;
+        parse_t p;
+        parse_init(&p, s, strlen(s));
+        if (parse_hex_u64(&p, &t) && parse_expect_char(&p, ',') &&
+            parse_hex_u64(&p, &a) && parse_expect_char(&p, ',') &&
+            parse_hex_u64(&p, &k) && parse_at_end(&p))
+            sum -= t + a + k;
+    }
+    double t_parse = now() - start;
+
+    printf("%-16s %12.1f %12.1f %8zu\n", "type,addr,kind",
+           t_sscanf * 1e9 / ITERS, t_parse * 1e9 / ITERS, sum);
+}
+
+int main()
+{
+    /* The sums must come out 0, which also keeps the loops alive */
+    printf("%-16s %12s %12s %8s\n", "arguments", "sscanf ns", "parse ns",
+           "check");
+    bench_mem();
+    bench_bp();
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "pktqueue.h"
+
+#define PINGS 20000
+#define PACKETS (1 << 21)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* The queue pktqueue_t used to be, a mutex and a condition variable around
+ * a list with a node allocated per packet, for comparison */
+typedef struct node {
+    packet_t pkt;
+    struct node *next;
+} node_t;
+
+typedef struct {
+    node_t *head;
+    node_t *tail;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} locked_queue_t;
+
+static void locked_init(locked_queue_t *q)
+{
+    q->head = q->tail = NULL;
+    pthread_mutex_init(&q->mutex, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+static bool locked_push(locked_queue_t *q, packet_t *pkt)
+{
+    node_t *node = malloc(sizeof(node_t));
+    node->pkt = *pkt;
+    node->next = NULL;
+
+    pthread_mutex_lock(&q->mutex);
+    if (q->tail)
+        q->tail->next = node;
+    else
+        q->head = node;
+    q->tail = node;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->mutex);
+    return true;
+}
+
+static bool locked_pop(locked_queue_t *q, packet_t *pkt)
+{
+    pthread_mutex_lock(&q->mutex);
+    while (!q->head)
+        pthread_cond_wait(&q->cond, &q->mutex);
+    node_t *node = q->head;
+    q->head = node->next;
+    if (!q->head)
+        q->tail = NULL;
+    pthread_mutex_unlock(&q->mutex);
+
+    *pkt = node->pkt;
+    free(node);
+    return true;
+}
+
+typedef struct {
+    const char *name;
+    void *(*alloc)(void);
+    bool (*push)(void *q, packet_t *pkt);
+    bool (*pop)(void *q, packet_t *pkt);
+} queue_impl_t;
+
+static void *locked_alloc(void)
+{
+    locked_queue_t *q = malloc(sizeof(locked_queue_t));
+    locked_init(q);
+    return q;
+}
+
+static void *spsc_alloc(void)
+{
+    pktqueue_t *q = aligned_alloc(64, sizeof(pktqueue_t));
+    pktqueue_init(q);
+    return q;
+}
+
+static bool spsc_push(void *q, packet_t *pkt)
+{
+    /* The reader waits for space, the benchmark just yields */
+    while (!pktqueue_push(q, pkt))
+        sched_yield();
+    return true;
+}
+
+static const queue_impl_t impls[] = {
+    {"mutex", locked_alloc, (void *) locked_push, (void *) locked_pop},
+    {"spsc", spsc_alloc, spsc_push, (void *) pktqueue_pop},
+};
+
+typedef struct {
+    const queue_impl_t *impl;
+    void *to, *from;
+    long n;
+} peer_t;
+
+/* Send every packet back where it came from */
+static void *echo(void *arg)
+{
+    peer_t *peer = arg;
+    packet_t pkt;
+
+    for (long i = 0; i < peer->n; i++) {
+        peer->impl->pop(peer->to, &pkt);
+        peer->impl->push(peer->from, &pkt);
+    }
+    return NULL;
+}
+
+static void *drain(void *arg)
+{
+    peer_t *peer = arg;
+    packet_t pkt;
+
+    for (long i = 0; i < peer->n; i++)
+        peer->impl->pop(peer->to, &pkt);
+    return NULL;
+}
+
+int main()
+{
+    printf("%-8s %16s %16s\n", "queue", "round trip us", "packets/s");
+    for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        const queue_impl_t *impl = &impls[i];
+        packet_t pkt = {0};
+        pthread_t tid;
+
+        /* Handoff latency: bounce one packet between two threads */
+        peer_t peer = {impl, impl->alloc(), impl->alloc(), PINGS};
+        pthread_create(&tid, NULL, echo, &peer);
+        double start = now();
+        for (long n = 0; n < PINGS; n++) {
+            impl->push(peer.to, &pkt);
+            impl->pop(peer.from, &pkt);
+        }
+        double rtt = (now() - start) / PINGS;
+        pthread_join(tid, NULL);
+
+        /* Throughput: a stream of packets to a consumer */
+        peer.n = PACKETS;
+        pthread_create(&tid, NULL, drain, &peer);
+        start = now();
+        for (long n = 0; n < PACKETS; n++)
+            impl->push(peer.to, &pkt);
+        pthread_join(tid, NULL);
+        double rate = PACKETS / (now() - start);
+
+        printf("%-8s %16.2f %16.0f\n", impl->name, rtt * 1e6, rate);
+    }
+
+    return 0;
+}
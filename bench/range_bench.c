@@ -0,0 +1,91 @@
+#include "bench_stub.h"
+
+/* A source line of LINE_LEN instructions, stepped over again and again as
+ * GDB's next does */
+#define LINE_PC 0x1000
+#define LINE_LEN 200
+#define NR_NEXTS 2000
+
+static bench_stub_t stub;
+
+static void line_start(bench_client_t *client)
+{
+    size_t len;
+
+    /* "p20" would do, but GDB reads them all after a stop */
+    assert(!strcmp(bench_client_cmd(client, "P20=0010000000000000", &len),
+                   "OK"));
+}
+
+static void report(const char *name, double elapsed, size_t nr_sent)
+{
+    printf("%-8s %12.1f %14.1f\n", name, elapsed / NR_NEXTS * 1e6,
+           (double) nr_sent / NR_NEXTS);
+}
+
+/* Without range stepping GDB steps each instruction, and reads the
+ * registers to find whether the PC left the line */
+static void run_step(bench_client_t *client)
+{
+    size_t len;
+
+    size_t nr_sent = client->nr_sent;
+    double start = bench_now();
+    for (int i = 0; i < NR_NEXTS; i++) {
+        line_start(client);
+        for (int j = 0; j < LINE_LEN; j++) {
+            assert(!strcmp(bench_client_cmd(client, "vCont;s:1", &len),
+                           "S05"));
+            assert(bench_client_cmd(client, "g", &len)[0] != 'E');
+        }
+    }
+    double elapsed = bench_now() - start;
+    assert(stub.regs[BENCH_REG_PC] == LINE_PC + 4 * LINE_LEN);
+
+    report("vCont;s", elapsed, client->nr_sent - nr_sent);
+}
+
+/* With it the stub steps the whole line itself and replies once */
+static void run_range(bench_client_t *client)
+{
+    char req[64];
+    size_t len;
+
+    snprintf(req, sizeof(req), "vCont;r%x,%x:1", LINE_PC,
+             LINE_PC + 4 * LINE_LEN);
+    size_t nr_sent = client->nr_sent;
+    double start = bench_now();
+    for (int i = 0; i < NR_NEXTS; i++) {
+        line_start(client);
+        assert(!strcmp(bench_client_cmd(client, req, &len), "S05"));
+        assert(bench_client_cmd(client, "g", &len)[0] != 'E');
+    }
+    double elapsed = bench_now() - start;
+    assert(stub.regs[BENCH_REG_PC] == LINE_PC + 4 * LINE_LEN);
+
+    report("vCont;r", elapsed, client->nr_sent - nr_sent);
+}
+
+int main()
+{
+    struct target_ops ops = bench_target_ops();
+    bench_client_t client;
+    size_t len;
+
+    stub.ops = &ops;
+    stub.arch = (arch_info_t){.smp = 1, .reg_num = BENCH_NR_REGS};
+
+    bench_stub_start(&stub);
+    bench_client_connect(&client, stub.path);
+    bench_client_noack(&client);
+    char *actions = bench_client_cmd(&client, "vCont?", &len);
+    assert(strstr(actions, "r;"));
+
+    printf("%-8s %12s %14s\n", "next", "us/line", "packets/line");
+    run_step(&client);
+    run_range(&client);
+
+    bench_client_close(&client);
+    bench_stub_join(&stub);
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include "bench_stub.h"
+
+#define MEM_SIZE (1 << 20)
+#define ROUNDS 2000
+
+static uint8_t mem[MEM_SIZE];
+
+/* Size of the payload once the run-length encoding is expanded */
+static size_t rle_expanded_len(const char *payload, size_t len)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (payload[i] == '*')
+            n += payload[++i] - 29;
+        else
+            n++;
+    }
+    return n;
+}
+
+int main()
+{
+    /* Typical requests of a debugging session: a register dump of a core
+     * which has just started, the stack which is mostly zero, the code and
+     * a large dump of zeroed memory. */
+    static const struct {
+        const char *name;
+        const char *req;
+    } reqs[] = {
+        {"g", "g"},
+        {"m stack 256", "m8000,100"},
+        {"m code 256", "m0,100"},
+        {"m zero 4k", "m10000,1000"},
+        {"m zero 16k", "m20000,4000"},
+    };
+    struct target_ops ops = bench_target_ops();
+
+    /* Code: random bytes, stack: a few non-zero words among zeros */
+    srand(1);
+    for (int i = 0; i < 0x1000; i++)
+        mem[i] = rand();
+    for (int i = 0x8000; i < 0x8100; i += 24)
+        mem[i] = rand();
+
+    printf("%-12s %4s %12s %12s %12s\n", "request", "rle", "wire bytes",
+           "payload", "latency us");
+    for (size_t r = 0; r < sizeof(reqs) / sizeof(reqs[0]); r++) {
+        for (int rle = 0; rle <= 1; rle++) {
+            bench_stub_t stub = {
+                .ops = &ops,
+                .arch = {.reg_num = BENCH_NR_REGS},
+                .rle = rle,
+                .mem = mem,
+                .mem_size = MEM_SIZE,
+            };
+            bench_client_t client;
+            size_t len = 0;
+
+            stub.regs[1] = 0x80000040;
+            stub.regs[2] = 0x8000fff0;
+            stub.regs[BENCH_REG_PC] = 0x80000000;
+
+            bench_stub_start(&stub);
+            bench_client_connect(&client, stub.path);
+            bench_client_noack(&client);
+
+            double start = bench_now();
+            for (int i = 0; i < ROUNDS; i++) {
+                char *reply = bench_client_cmd(&client, reqs[r].req, &len);
+                assert(reply[0] != 'E');
+                if (i == 0)
+                    printf("%-12s %4s %12zu %12zu", reqs[r].name,
+                           rle ? "on" : "off", len + 4,
+                           rle_expanded_len(reply, len));
+            }
+            double elapsed = bench_now() - start;
+            printf(" %12.2f\n", elapsed / ROUNDS * 1e6);
+
+            bench_client_close(&client);
+            bench_stub_join(&stub);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+#include "bench_stub.h"
+
+#define MEM_SIZE (1 << 16)
+#define PORT 12345
+#define ROUNDS 20000
+#define PIPELINE_DEPTH 32
+
+static uint8_t mem[MEM_SIZE];
+
+/* Send nr small reads over TCP on the loopback, depth of them in flight at
+ * a time, and report the rate and the system calls the stub made for them */
+static void run(const char *name, int io_uring, int depth)
+{
+    struct target_ops ops = bench_target_ops();
+    bench_stub_t stub = {
+        .ops = &ops,
+        .io_uring = io_uring,
+        .port = PORT,
+        .mem = mem,
+        .mem_size = MEM_SIZE,
+    };
+    bench_client_t client;
+    size_t len;
+
+    bench_stub_start(&stub);
+    bench_client_connect(&client, stub.path);
+    bench_client_noack(&client);
+
+    double start = bench_now();
+    for (int i = 0; i < ROUNDS; i += depth) {
+        for (int j = 0; j < depth; j++)
+            bench_client_send(&client, "m100,10", 7);
+        for (int j = 0; j < depth; j++)
+            assert(bench_client_recv(&client, &len)[0] != 'E');
+    }
+    double elapsed = bench_now() - start;
+
+    bench_client_close(&client);
+    bench_stub_join(&stub);
+
+    /* Counted over the whole session, which has a few more packets */
+    size_t nr_pkts = client.nr_sent;
+    printf("%-8s %6d %12.0f %12.2f %12.2f\n", name, depth, ROUNDS / elapsed,
+           (double) stub.stats.nr_recv_syscalls / nr_pkts,
+           (double) stub.stats.nr_send_syscalls / nr_pkts);
+}
+
+int main()
+{
+#ifndef CONFIG_IO_URING
+    printf("uring_bench: built without IO_URING=1, only poll is measured\n");
+#endif
+
+    printf("%-8s %6s %12s %12s %12s\n", "backend", "depth", "packets/s",
+           "recv sys/pkt", "send sys/pkt");
+    for (int depth = 1; depth <= PIPELINE_DEPTH; depth *= PIPELINE_DEPTH) {
+        run("poll", -1, depth);
+#ifdef CONFIG_IO_URING
+        run("io_uring", 1, depth);
+#endif
+    }
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "watch.h"
+
+/* The memory loaded from and stored to, in 8-byte accesses */
+#define MEM_SIZE (1 << 20)
+#define ACCESSES_PER_RUN (1 << 26)
+
+/* The shadow pages of an emulator, see emu_watch() in emu/src/emu.c */
+#define PAGE_SHIFT (12)
+#define NR_PAGES (MEM_SIZE >> PAGE_SHIFT)
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* A strided walk over the memory, every other access a store */
+static size_t addr_at(size_t i)
+{
+    return (i * 8 * 4099) & (MEM_SIZE - 1);
+}
+
+int main()
+{
+    static int nr_watches[] = {0, 1, 64};
+    static gdbstub_t gdbstub;
+    static uint8_t pages[NR_PAGES];
+    uint64_t *mem = calloc(MEM_SIZE / 8, sizeof(uint64_t));
+
+    printf("%8s %12s %12s %12s %12s   ns/access\n", "watches", "none",
+           "naive", "index", "pages");
+    for (size_t n = 0; n < sizeof(nr_watches) / sizeof(nr_watches[0]); n++) {
+        int nr = nr_watches[n];
+        srand(nr);
+        watch_destroy(&gdbstub.watches);
+        memset(pages, 0, sizeof(pages));
+        for (int i = 0; i < nr; i++) {
+            size_t addr = rand() % MEM_SIZE / 8 * 8;
+            watch_insert(&gdbstub.watches, addr, 8, WP_WRITE);
+            pages[addr >> PAGE_SHIFT] = 1;
+        }
+        const gdbstub_watches_t *watches = &gdbstub.watches;
+        uint64_t acc = 0;
+        size_t hits = 0;
+
+#define RUN(check)                                            \
+    ({                                                        \
+        double start = now();                                 \
+        for (size_t i = 0; i < ACCESSES_PER_RUN; i++) {       \
+            size_t addr = addr_at(i);                         \
+            bool is_write = i & 1;                            \
+            if (is_write)                                     \
+                mem[addr / 8] = i;                            \
+            else                                              \
+                acc += mem[addr / 8];                         \
+            if (check)                                        \
+                hits++;                                       \
+        }                                                     \
+        (now() - start) * 1e9 / ACCESSES_PER_RUN;             \
+    })
+
+        double none = RUN(false);
+        /* Every watchpoint against every access */
+        double naive = RUN(({
+            bool hit = false;
+            for (int j = 0; j < watches->nr && !hit; j++) {
+                const gdbstub_watch_t *w = &watches->watches[j];
+                hit = is_write && addr < w->range.addr + w->range.len &&
+                      addr + 8 > w->range.addr;
+            }
+            hit;
+        }));
+        double index = RUN(gdbstub_watch_check(&gdbstub, addr, 8, is_write));
+        double paged = RUN(is_write && pages[addr >> PAGE_SHIFT] &&
+                           gdbstub_watch_check(&gdbstub, addr, 8, is_write));
+#undef RUN
+
+        __asm__ volatile("" : : "r"(acc), "r"(hits));
+        printf("%8d %12.3f %12.3f %12.3f %12.3f\n", nr, none, naive, index,
+               paged);
+    }
+
+    watch_destroy(&gdbstub.watches);
+    free(mem);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "bench_stub.h"
+
+/* Dump this much memory with 'm' and with 'x' packets */
+#define MEM_SIZE (64 << 20)
+
+static uint8_t *mem;
+
+static bool get_mem_ptr(void *args, size_t addr, size_t len, void **ptr)
+{
+    bench_stub_t *stub = args;
+    if (addr > stub->mem_size || len > stub->mem_size - addr)
+        return false;
+    *ptr = stub->mem + addr;
+    return true;
+}
+
+/* The number of memory bytes in the reply to 'x', after its 'b' */
+static size_t unescaped_len(const char *reply, size_t len)
+{
+    const char *end = reply + len;
+    size_t n = len - 1;
+    for (const char *p = reply + 1; (p = memchr(p, '}', end - p)); p += 2)
+        n--;
+    return n;
+}
+
+/* Read through read_mem(), or in place with get_mem_ptr() if direct */
+static void run(const char *name,
+                size_t packet_size,
+                bool binary,
+                bool direct)
+{
+    struct target_ops ops = bench_target_ops();
+    bench_stub_t stub = {
+        .ops = &ops,
+        .packet_size = packet_size,
+        .mem = mem,
+        .mem_size = MEM_SIZE,
+    };
+    bench_client_t client;
+    size_t len, wire = 0;
+    char req[64];
+
+    if (direct)
+        ops.get_mem_ptr = get_mem_ptr;
+    bench_stub_start(&stub);
+    bench_client_connect(&client, stub.path);
+    bench_client_noack(&client);
+
+    /* Ask for as much as fits in a packet, as GDB does */
+    size_t chunk = binary ? packet_size - 5 : (packet_size - 4) / 2;
+    double start = bench_now();
+    for (size_t addr = 0; addr < MEM_SIZE;) {
+        size_t want = MEM_SIZE - addr < chunk ? MEM_SIZE - addr : chunk;
+        snprintf(req, sizeof(req), "%c%zx,%zx", binary ? 'x' : 'm', addr,
+                 want);
+        char *reply = bench_client_cmd(&client, req, &len);
+        if (binary) {
+            assert(len > 1 && reply[0] == 'b');
+            addr += unescaped_len(reply, len);
+        } else {
+            assert(len > 0 && len % 2 == 0);
+            addr += len / 2;
+        }
+        wire += len + 4;
+    }
+    double elapsed = bench_now() - start;
+
+    printf("%-12s %#10zx %c %-8s %12zu %12.2f %10.1f\n", name, packet_size,
+           binary ? 'x' : 'm', direct ? "direct" : "read_mem", client.nr_sent,
+           (double) wire / MEM_SIZE, MEM_SIZE / elapsed / 1e6);
+
+    bench_client_close(&client);
+    bench_stub_join(&stub);
+}
+
+int main()
+{
+    static const size_t sizes[] = {0x4000, 0x10000, 0x100000};
+
+    mem = malloc(MEM_SIZE);
+    assert(mem);
+
+    printf("%-12s %10s %c %-8s %12s %12s %10s\n", "memory", "PacketSize",
+           ' ', "path", "round trips", "wire/byte", "MB/s");
+    for (int pass = 0; pass < 2; pass++) {
+        /* Random bytes have 1 in 64 to escape, code and data fewer */
+        srand(1);
+        for (size_t i = 0; i < MEM_SIZE; i++)
+            mem[i] = pass ? (size_t) rand() : i * 7 + (i >> 12);
+        const char *name = pass ? "random" : "pattern";
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            for (int direct = 0; direct < 2; direct++) {
+                run(name, sizes[s], false, direct);
+                run(name, sizes[s], true, direct);
+            }
+        }
+    }
+
+    free(mem);
+    return 0;
+}
@@ -22,6 +22,11 @@
 
 #define MEM_SIZE (0x1000)
 #define TOHOST_ADDR (MEM_SIZE - 4)
+/* The memory is a single page, so watchpoints are tracked in smaller ones */
+#define WATCH_PAGE_SHIFT (6)
+#define NR_WATCH_PAGES (MEM_SIZE >> WATCH_PAGE_SHIFT)
+#define WATCH_READ (1 << 0)
+#define WATCH_WRITE (1 << 1)
 #ifdef RV32
 #define REGSZ 4  // 32-bit registers = 4 bytes
 #else
@@ -38,11 +43,14 @@ struct emu {
     uint64_t x[32];
     uint64_t pc;
 
-    bool bp_is_set;
-    uint64_t bp_addr;
-
     bool halt;
 
+    /* The WATCH_* accesses which may hit a watchpoint in each page, as of
+     * the watch_gen of the watchpoints of gdbstub. Addresses beyond the
+     * memory wrap around, which only sends more accesses to the stub. */
+    uint8_t watch_pages[NR_WATCH_PAGES];
+    unsigned watch_gen;
+
     gdbstub_t gdbstub;
 };
 
@@ -61,6 +69,52 @@ static inline bool emu_is_halt(struct emu *emu)
     return __atomic_load_n(&emu->halt, __ATOMIC_RELAXED);
 }
 
+static inline size_t emu_watch_page(size_t addr)
+{
+    return (addr >> WATCH_PAGE_SHIFT) & (NR_WATCH_PAGES - 1);
+}
+
+/* Catch up with the watchpoints GDB set or removed since the last run */
+static void emu_sync_watch(struct emu *emu)
+{
+    const gdbstub_watches_t *watches = &emu->gdbstub.watches;
+
+    if (emu->watch_gen == watches->gen)
+        return;
+
+    memset(emu->watch_pages, 0, sizeof(emu->watch_pages));
+    for (int i = 0; i < watches->nr; i++) {
+        const gdbstub_watch_t *w = &watches->watches[i];
+        uint8_t flags = w->type == WP_WRITE  ? WATCH_WRITE
+                        : w->type == WP_READ ? WATCH_READ
+                                             : WATCH_READ | WATCH_WRITE;
+        size_t first = w->range.addr >> WATCH_PAGE_SHIFT;
+        size_t last = (w->range.addr + w->range.len - 1) >> WATCH_PAGE_SHIFT;
+        size_t nr = last - first + 1;
+        if (last < first || nr > NR_WATCH_PAGES)
+            nr = NR_WATCH_PAGES;
+        for (size_t j = 0; j < nr; j++)
+            emu->watch_pages[(first + j) & (NR_WATCH_PAGES - 1)] |= flags;
+    }
+    emu->watch_gen = watches->gen;
+}
+
+/* Stop after this instruction if the access hits a watchpoint. Only the
+ * accesses to a page with one in it are checked by the stub. */
+static inline void emu_watch(struct emu *emu,
+                             size_t addr,
+                             size_t len,
+                             bool is_write)
+{
+    uint8_t flags = emu->watch_pages[emu_watch_page(addr)] |
+                    emu->watch_pages[emu_watch_page(addr + len - 1)];
+
+    if (!(flags & (is_write ? WATCH_WRITE : WATCH_READ)))
+        return;
+    if (gdbstub_watch_check(&emu->gdbstub, addr, len, is_write))
+        emu_halt(emu);
+}
+
 typedef struct inst {
     uint64_t inst;
 
@@ -76,19 +130,22 @@ static inline int opcode_3(struct emu *emu, inst_t *inst)
     uint8_t *ptr;
     uint64_t value;
     uint64_t imm = (int32_t) (inst->inst & 0xfff00000) >> 20;
+    uint64_t addr = emu->x[inst->rs1] + imm;
 
     switch (inst->funct3) {
     case 0x2:
         // lw
-        ptr = emu->m.mem + emu->x[inst->rs1] + imm;
+        ptr = emu->m.mem + addr;
         read_len(32, ptr, value);
         emu->x[inst->rd] = value;
+        emu_watch(emu, addr, 4, false);
         return 0;
     case 0x3:
         // ld
-        ptr = emu->m.mem + emu->x[inst->rs1] + imm;
+        ptr = emu->m.mem + addr;
         read_len(64, ptr, value);
         emu->x[inst->rd] = value;
+        emu_watch(emu, addr, 8, false);
         return 0;
     default:
         break;
@@ -153,16 +210,19 @@ static inline int opcode_23(struct emu *emu, inst_t *inst)
         // sb
         ptr = emu->m.mem + emu->x[inst->rs1] + imm;
         write_len(8, ptr, emu->x[inst->rs2]);
+        emu_watch(emu, emu->x[inst->rs1] + imm, 1, true);
         return 0;
     case 0x2:
         // sw
         ptr = emu->m.mem + emu->x[inst->rs1] + imm;
         write_len(32, ptr, emu->x[inst->rs2]);
+        emu_watch(emu, emu->x[inst->rs1] + imm, 4, true);
         return 0;
     case 0x3:
         // sd
         ptr = emu->m.mem + emu->x[inst->rs1] + imm;
         write_len(64, ptr, emu->x[inst->rs2]);
+        emu_watch(emu, emu->x[inst->rs1] + imm, 8, true);
         return 0;
     default:
         break;
@@ -331,7 +391,6 @@ static void emu_init(struct emu *emu)
     memset(emu, 0, sizeof(struct emu));
     emu->pc = 0;
     emu->x[2] = TOHOST_ADDR;
-    emu->bp_addr = -1;
     emu_halt(emu);
 }
 
@@ -376,10 +435,29 @@ static void free_mem(struct mem *m)
     free(m->mem);
 }
 
-static size_t emu_get_reg_bytes(int regno __attribute__((unused)))
-{
-    return REGSZ;
-}
+#define RV_REG(name, type) \
+    {name, REGSZ * 8, type, NULL, "org.gnu.gdb.riscv.cpu"}
+
+/* x0 to x31 then pc, under their ABI names as in GDB's riscv/64bit-cpu.xml */
+static const reg_desc_t emu_reg_descs[] = {
+    RV_REG("zero", "int"),     RV_REG("ra", "code_ptr"),
+    RV_REG("sp", "data_ptr"),  RV_REG("gp", "data_ptr"),
+    RV_REG("tp", "data_ptr"),  RV_REG("t0", "int"),
+    RV_REG("t1", "int"),       RV_REG("t2", "int"),
+    RV_REG("fp", "data_ptr"),  RV_REG("s1", "int"),
+    RV_REG("a0", "int"),       RV_REG("a1", "int"),
+    RV_REG("a2", "int"),       RV_REG("a3", "int"),
+    RV_REG("a4", "int"),       RV_REG("a5", "int"),
+    RV_REG("a6", "int"),       RV_REG("a7", "int"),
+    RV_REG("s2", "int"),       RV_REG("s3", "int"),
+    RV_REG("s4", "int"),       RV_REG("s5", "int"),
+    RV_REG("s6", "int"),       RV_REG("s7", "int"),
+    RV_REG("s8", "int"),       RV_REG("s9", "int"),
+    RV_REG("s10", "int"),      RV_REG("s11", "int"),
+    RV_REG("t3", "int"),       RV_REG("t4", "int"),
+    RV_REG("t5", "int"),       RV_REG("t6", "int"),
+    RV_REG("pc", "code_ptr"),
+};
 
 static int emu_read_reg(void *args, int regno, void *reg_value)
 {
@@ -412,6 +490,39 @@ static int emu_write_reg(void *args, int regno, void *data)
     return 0;
 }
 
+/* x0-x31 then pc, as in the 'g' and 'G' packets */
+static int emu_read_regs(void *args, void *buf, size_t len)
+{
+    struct emu *emu = (struct emu *) args;
+    uint8_t *regs = buf;
+
+    if (len != 33 * REGSZ) {
+        return EINVAL;
+    }
+
+    for (int i = 0; i < 32; i++) {
+        memcpy(&regs[i * REGSZ], &emu->x[i], REGSZ);
+    }
+    memcpy(&regs[32 * REGSZ], &emu->pc, REGSZ);
+    return 0;
+}
+
+static int emu_write_regs(void *args, void *buf, size_t len)
+{
+    struct emu *emu = (struct emu *) args;
+    uint8_t *regs = buf;
+
+    if (len != 33 * REGSZ) {
+        return EINVAL;
+    }
+
+    for (int i = 0; i < 32; i++) {
+        memcpy(&emu->x[i], &regs[i * REGSZ], REGSZ);
+    }
+    memcpy(&emu->pc, &regs[32 * REGSZ], REGSZ);
+    return 0;
+}
+
 static int emu_read_mem(void *args, size_t addr, size_t len, void *val)
 {
     struct emu *emu = (struct emu *) args;
@@ -422,6 +533,15 @@ static int emu_read_mem(void *args, size_t addr, size_t len, void *val)
     return 0;
 }
 
+static bool emu_get_mem_ptr(void *args, size_t addr, size_t len, void **ptr)
+{
+    struct emu *emu = (struct emu *) args;
+    if (addr > MEM_SIZE || len > MEM_SIZE - addr)
+        return false;
+    *ptr = emu->m.mem + addr;
+    return true;
+}
+
 static int emu_write_mem(void *args, size_t addr, size_t len, void *val)
 {
     struct emu *emu = (struct emu *) args;
@@ -439,8 +559,10 @@ static gdb_action_t emu_cont(void *args)
     uint8_t *tohost_addr = emu->m.mem + TOHOST_ADDR;
 
     emu_start_run(emu);
-    while (emu->pc < emu->m.code_size && emu->pc != emu->bp_addr &&
-           !emu_is_halt(emu)) {
+    emu_sync_watch(emu);
+    /* Run at least one instruction, as GDB steps off a breakpoint anyway and
+     * a tracepoint here was collected when it was reached */
+    while (emu->pc < emu->m.code_size) {
         uint32_t inst;
         uint8_t value;
         emu_read_mem(args, emu->pc, 4, &inst);
@@ -455,6 +577,9 @@ static gdb_action_t emu_cont(void *args)
         read_len(8, tohost_addr, value);
         if (value)
             return ACT_SHUTDOWN;
+
+        if (gdbstub_bp_hit(&emu->gdbstub, emu->pc) || emu_is_halt(emu))
+            break;
     }
 
     return ACT_RESUME;
@@ -465,6 +590,7 @@ static gdb_action_t emu_stepi(void *args)
     struct emu *emu = (struct emu *) args;
 
     emu_start_run(emu);
+    emu_sync_watch(emu);
     if (emu->pc < emu->m.code_size) {
         uint32_t inst;
         emu_read_mem(args, emu->pc, 4, &inst);
@@ -475,28 +601,10 @@ static gdb_action_t emu_stepi(void *args)
     return ACT_RESUME;
 }
 
-static bool emu_set_bp(void *args, size_t addr, bp_type_t type)
+static size_t emu_get_pc(void *args)
 {
     struct emu *emu = (struct emu *) args;
-    if (type != BP_SOFTWARE || emu->bp_is_set)
-        return false;
-
-    emu->bp_is_set = true;
-    emu->bp_addr = addr;
-    return true;
-}
-
-static bool emu_del_bp(void *args, size_t addr, bp_type_t type)
-{
-    struct emu *emu = (struct emu *) args;
-
-    // It's fine when there's no matching breakpoint, just doing nothing
-    if (type != BP_SOFTWARE || !emu->bp_is_set || emu->bp_addr != addr)
-        return true;
-
-    emu->bp_is_set = false;
-    emu->bp_addr = 0;
-    return true;
+    return emu->pc;
 }
 
 static void emu_on_interrupt(void *args)
@@ -506,16 +614,17 @@ static void emu_on_interrupt(void *args)
 }
 
 struct target_ops emu_ops = {
-    .get_reg_bytes = emu_get_reg_bytes,
     .read_reg = emu_read_reg,
     .write_reg = emu_write_reg,
+    .read_regs = emu_read_regs,
+    .write_regs = emu_write_regs,
     .read_mem = emu_read_mem,
     .write_mem = emu_write_mem,
     .cont = emu_cont,
     .stepi = emu_stepi,
-    .set_bp = emu_set_bp,
-    .del_bp = emu_del_bp,
     .on_interrupt = emu_on_interrupt,
+    .get_mem_ptr = emu_get_mem_ptr,
+    .get_pc = emu_get_pc,
 };
 
 int main(int argc, char *argv[])
@@ -535,10 +644,11 @@ int main(int argc, char *argv[])
                       (arch_info_t){
                           .smp = 1,
                           .reg_num = 33,
+                          .reg_descs = emu_reg_descs,
 #ifdef RV32
-                          .target_desc = TARGET_RV32,
+                          .arch_name = "riscv:rv32",
 #else
-                          .target_desc = TARGET_RV64,
+                          .arch_name = "riscv:rv64",
 #endif
                       },
                       "127.0.0.1:1234")) {
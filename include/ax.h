@@ -0,0 +1,35 @@
+#ifndef AX_H
+#define AX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The bytecode of GDB's agent expressions, see "Agent Expressions" in the
+ * GDB manual. Values are 64 bits wide, and memory is read little-endian. */
+#define AX_MAX_STACK 64
+/* Bytecodes run at most, so that a loop cannot hang the target */
+#define AX_MAX_STEPS 100000
+
+typedef struct {
+    uint8_t *code;
+    size_t len;
+} ax_expr_t;
+
+/* Where an expression reads the target from, each returning zero or an
+ * errno */
+typedef struct {
+    int (*read_reg)(void *ctx, int regno, uint64_t *value);
+    int (*read_mem)(void *ctx, size_t addr, size_t len, void *buf);
+    /* Optional, collect the memory of the trace bytecodes of a tracepoint */
+    int (*trace)(void *ctx, size_t addr, size_t len);
+    void *ctx;
+} ax_env_t;
+
+/* Run expr until its end bytecode and take the top of the stack, unless
+ * result is NULL as for a collection, which may leave the stack empty.
+ * Return zero, or an errno if it is malformed, uses a bytecode which is not
+ * implemented, or fails to read the target. */
+int ax_eval(const ax_expr_t *expr, const ax_env_t *env, uint64_t *result);
+
+#endif
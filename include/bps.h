@@ -0,0 +1,26 @@
+#ifndef BPS_H
+#define BPS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ax.h"
+#include "gdbstub.h"
+
+struct gdbstub_bp_cond {
+    int nr;
+    ax_expr_t exprs[];
+};
+
+gdbstub_bp_cond_t *bps_cond_alloc(int nr);
+void bps_cond_free(gdbstub_bp_cond_t *cond);
+
+/* Maintain the gdbstub_bps_t of gdbstub_bp_hit(). bps_insert() returns zero
+ * or an errno, adding a breakpoint which is already there replacing its
+ * conditions, and bps_remove() returns whether the breakpoint was there.
+ * The breakpoint owns cond, which may be NULL, once it is inserted. */
+int bps_insert(gdbstub_bps_t *bps, size_t addr, gdbstub_bp_cond_t *cond);
+bool bps_remove(gdbstub_bps_t *bps, size_t addr);
+void bps_destroy(gdbstub_bps_t *bps);
+
+#endif
@@ -0,0 +1,80 @@
+/* Generated by scripts/gen-cmd-table.py, do not edit */
+
+#ifndef CMD_TABLE_H
+#define CMD_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef enum {
+    CMD_NONE,
+    CMD_START_NO_ACK_MODE,
+    CMD_TRACE_BUFFER,
+    CMD_TRACE_DP,
+    CMD_TRACE_DISCONNECTED,
+    CMD_TRACE_FRAME,
+    CMD_TRACE_START,
+    CMD_TRACE_STOP,
+    CMD_TRACE_INIT,
+    CMD_TRACE_RO,
+    CMD_ATTACHED,
+    CMD_CURRENT_THREAD,
+    CMD_SUPPORTED,
+    CMD_SYMBOL,
+    CMD_TRACE_POINT,
+    CMD_TRACE_STATUS,
+    CMD_XFER,
+    CMD_THREAD_INFO_FIRST,
+    CMD_THREAD_INFO_NEXT,
+    CMD_VCONT,
+    CMD_VCONT_SUPPORTED,
+    CMD_NR,
+} cmd_id_t;
+
+#define CMD_HASH_SEED 0x00001725u
+#define CMD_HASH_BITS 5
+
+static const struct {
+    const char *key;
+    uint8_t len;
+    uint8_t id;
+} cmd_slots[1 << CMD_HASH_BITS] = {
+    [0] = {"qSymbol", 7, CMD_SYMBOL},
+    [2] = {"qTP", 3, CMD_TRACE_POINT},
+    [4] = {"qAttached", 9, CMD_ATTACHED},
+    [5] = {"QTFrame", 7, CMD_TRACE_FRAME},
+    [8] = {"qfThreadInfo", 12, CMD_THREAD_INFO_FIRST},
+    [9] = {"vCont?", 6, CMD_VCONT_SUPPORTED},
+    [11] = {"QTStop", 6, CMD_TRACE_STOP},
+    [12] = {"QTDP", 4, CMD_TRACE_DP},
+    [13] = {"qSupported", 10, CMD_SUPPORTED},
+    [14] = {"qTStatus", 8, CMD_TRACE_STATUS},
+    [16] = {"vCont", 5, CMD_VCONT},
+    [18] = {"QTDisconnected", 14, CMD_TRACE_DISCONNECTED},
+    [19] = {"QTro", 4, CMD_TRACE_RO},
+    [21] = {"QTinit", 6, CMD_TRACE_INIT},
+    [23] = {"QTStart", 7, CMD_TRACE_START},
+    [26] = {"QStartNoAckMode", 15, CMD_START_NO_ACK_MODE},
+    [27] = {"QTBuffer", 8, CMD_TRACE_BUFFER},
+    [28] = {"qsThreadInfo", 12, CMD_THREAD_INFO_NEXT},
+    [29] = {"qXfer", 5, CMD_XFER},
+    [30] = {"qC", 2, CMD_CURRENT_THREAD},
+};
+
+/* Look a named packet up, the name being len bytes long and not
+ * necessarily terminated. Return CMD_NONE if the stub has no such command. */
+static inline cmd_id_t cmd_lookup(char type, const char *name, size_t len)
+{
+    uint32_t h = (CMD_HASH_SEED ^ (uint8_t) type) * 0x01000193u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (uint8_t) name[i]) * 0x01000193u;
+
+    unsigned slot = h >> (32 - CMD_HASH_BITS);
+    if (cmd_slots[slot].len != len + 1 || cmd_slots[slot].key[0] != type ||
+        memcmp(cmd_slots[slot].key + 1, name, len))
+        return CMD_NONE;
+    return cmd_slots[slot].id;
+}
+
+#endif
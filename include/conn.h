@@ -3,31 +3,106 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include "outq.h"
 #include "packet.h"
 
-#define MAX_SEND_PACKET_SIZE (0x1000)
-#define MAX_DATA_PAYLOAD (MAX_SEND_PACKET_SIZE - (2 + CSUM_SIZE + 2))
+/* Sent instead of a reply which does not fit in the packet size */
+#define REPLY_OVERFLOW_ERR "E07" /* E2BIG */
+
+/* A reply built in place: buf[0] is the leading '$' and the checksum of the
+ * payload is kept up to date while it grows, so sending only needs to add
+ * the trailing "#xx". The buffer grows on demand up to max_size, the whole
+ * packet included. */
+typedef struct {
+    char *buf;
+    size_t cap;
+    size_t max_size;
+    size_t len;
+    uint8_t csum;
+    bool overflow; /* something did not fit, send REPLY_OVERFLOW_ERR */
+} conn_reply_t;
+
+/* Events of conn_wait(), CONN_WOKEN is only ever returned */
+#define CONN_READABLE (1 << 0)
+#define CONN_WRITABLE (1 << 1)
+#define CONN_WOKEN (1 << 2)
+
+/* Outbound frames queued at most */
+#define CONN_OUTQ_SLOTS 256
 
 typedef struct {
     int listen_fd;
     int socket_fd;
 
-    pthread_mutex_t send_mutex; /* Serialize socket writes */
+    /* Lets conn_wake() interrupt conn_wait(). On Linux both ends are the
+     * same eventfd watched by epoll_fd, elsewhere they form a pipe. */
+    int epoll_fd;
+    int wake_rfd;
+    int wake_wfd;
+    int wait_events; /* what conn_wait() watches the socket for */
+
+    /* Outbound frames from any thread. They are sent by whichever thread
+     * holds the writer role, and by the reader thread once the socket
+     * takes more when it could not. */
+    outq_t outq;
+    bool writing;       /* the writer role is held */
+    bool want_writable; /* the socket took only part of the frames */
 
-    /* Protocol state */
+    /* Protocol state, the reader thread acknowledges packets with it */
     bool no_ack_mode;  /* true after QStartNoAckMode negotiation */
-    int failure_count; /* consecutive checksum/protocol failures */
+    int failure_count; /* consecutive checksum failures */
+
+    conn_reply_t reply; /* Owned by the main thread */
+    bool rle;           /* Run-length encode the replies */
 
+    struct conn_uring *uring; /* io_uring transport, or NULL */
+
+    /* System calls made for I/O, counted by the thread doing each side */
+    size_t nr_recv_syscalls;
+    size_t nr_send_syscalls; /* by the holder of the writer role */
 } conn_t;
 
 bool conn_init(conn_t *conn, char *addr_str, int port);
+/* Queue a frame and send what is queued, without blocking on the socket */
 void conn_send_str(conn_t *conn, char *str);
 void conn_send_pktstr(conn_t *conn, char *pktstr);
+/* Queue a frame to go out with the next one sent, or conn_flush() */
+bool conn_queue_str(conn_t *conn, char *str);
+void conn_flush(conn_t *conn);
+
+/* Limit the size of the packets we send, the framing included */
+void conn_set_packet_size(conn_t *conn, size_t size);
+void conn_set_rle(conn_t *conn, bool enable);
+/* Move the I/O to io_uring, or back to the portable path. Return false if
+ * io_uring is not built in or not supported by the kernel. */
+bool conn_set_io_uring(conn_t *conn, bool enable);
+
+/* Build and send a reply packet piece by piece */
+void conn_reply_begin(conn_t *conn);
+size_t conn_reply_room(conn_t *conn);
+void conn_reply_append_str(conn_t *conn, const char *str);
+void conn_reply_append_bin(conn_t *conn, const void *data, size_t len);
+void conn_reply_append_hex(conn_t *conn, const void *data, size_t len);
+/* Append as much of data as fits, escaped as binary data, and return how
+ * many of its bytes that is */
+size_t conn_reply_append_escaped(conn_t *conn, const void *data, size_t len);
+void conn_reply_send(conn_t *conn);
 void conn_close(conn_t *conn);
 
-/* Non-blocking send for ACKs.
- * Returns true if sent successfully, false if would block or error.
- * Used by reader thread to avoid blocking on send_mutex. */
-bool conn_try_send_str(conn_t *conn, char *str);
+/* Sleep until the socket is ready for one of the events or conn_wake() is
+ * called, and return which of them happened. Return -1 with errno set on
+ * error. */
+int conn_wait(conn_t *conn, int events);
+void conn_wake(conn_t *conn);
+
+/* Whether queued frames wait for the socket to be writable, in which case
+ * conn_wake() is called, and the flush to do once it is */
+bool conn_want_writable(conn_t *conn);
+void conn_on_writable(conn_t *conn);
+
+/* Read what has arrived on the socket into the pktbuf_t after conn_wait()
+ * returned CONN_READABLE, like pktbuf_fill_from_file() */
+ssize_t conn_recv(conn_t *conn, pktbuf_t *pktbuf);
 
 #endif
@@ -0,0 +1,21 @@
+#ifndef CONN_URING_H
+#define CONN_URING_H
+
+#ifdef CONFIG_IO_URING
+
+#include <sys/uio.h>
+#include "conn.h"
+
+/* The io_uring transport behind conn_t, see conn_set_io_uring() */
+bool conn_uring_init(conn_t *conn);
+void conn_uring_destroy(conn_t *conn);
+int conn_uring_wait(conn_t *conn, int events);
+ssize_t conn_uring_recv(conn_t *conn, pktbuf_t *pktbuf);
+
+/* Send the iovecs without blocking. Return the number of bytes sent, which
+ * may be short, or -1 on a fatal error. */
+ssize_t conn_uring_send(conn_t *conn, struct iovec *iov, int iovcnt);
+
+#endif
+
+#endif
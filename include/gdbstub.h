@@ -3,6 +3,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #define TARGET_RV32 \
     "<target version=\"1.0\"><architecture>riscv:rv32</architecture></target>"
@@ -12,11 +13,21 @@
     "<target "        \
     "version=\"1.0\"><architecture>i386:x86-64</architecture></target>"
 
+/* Bounds and default of the packet size, see gdbstub_set_packet_size() */
+#define GDBSTUB_MIN_PACKET_SIZE (0x400)
+#define GDBSTUB_MAX_PACKET_SIZE (0x100000)
+#define GDBSTUB_DEFAULT_PACKET_SIZE (0x10000)
+
+/* Bounds of the line size of the memory cache, see gdbstub_set_mem_cache() */
+#define GDBSTUB_MIN_MEM_CACHE_LINE (16)
+#define GDBSTUB_MAX_MEM_CACHE_LINE (0x10000)
+
 typedef enum {
     EVENT_NONE,
     EVENT_CONT,
     EVENT_DETACH,
     EVENT_STEP,
+    EVENT_RANGE_STEP,
 } gdb_event_t;
 
 typedef enum {
@@ -25,10 +36,20 @@ typedef enum {
     ACT_SHUTDOWN,
 } gdb_action_t;
 
+/* The type of a Z or z packet */
 typedef enum {
     BP_SOFTWARE = 0,
+    BP_HARDWARE = 1,
+    WP_WRITE = 2,
+    WP_READ = 3,
+    WP_ACCESS = 4,
 } bp_type_t;
 
+typedef struct {
+    size_t addr;
+    size_t len;
+} mem_range_t;
+
 struct target_ops {
     gdb_action_t (*cont)(void *args);
     gdb_action_t (*stepi)(void *args);
@@ -43,26 +64,243 @@ struct target_ops {
 
     void (*set_cpu)(void *args, int cpuid);
     int (*get_cpu)(void *args);
+
+    /* Optional, the whole register file in regno order for 'g' and 'G' */
+    int (*read_regs)(void *args, void *buf, size_t len);
+    int (*write_regs)(void *args, void *buf, size_t len);
+
+    /* Optional, the memory written since it was last called, so that the
+     * memory cache outlives resumes. Fill at most nr ranges and return how
+     * many, or -1 if they do not fit. */
+    int (*get_dirty_ranges)(void *args, mem_range_t *ranges, int nr);
+
+    /* Optional, point *ptr at the len bytes of memory at addr if they are
+     * plain host memory, readable and writable, so that the packets are
+     * encoded from and decoded to them in place. The pointer is only used
+     * until the target resumes. Return false to go through read_mem() and
+     * write_mem() instead, e.g. for memory-mapped I/O. */
+    bool (*get_mem_ptr)(void *args, size_t addr, size_t len, void **ptr);
+
+    /* Optional, the PC of the current CPU, so that vCont;r steps through a
+     * range of addresses, e.g. a source line, without a packet after each
+     * stepi(). Only used when the stub keeps the breakpoints. */
+    size_t (*get_pc)(void *args);
 };
 
 typedef struct gdbstub_private gdbstub_private_t;
 
+/* System calls made so far to talk with GDB */
+typedef struct {
+    size_t nr_recv_syscalls;
+    size_t nr_send_syscalls;
+} gdbstub_io_stats_t;
+
+/* Lines of the memory cache served from it and read from the target */
+typedef struct {
+    size_t nr_hits;
+    size_t nr_misses;
+} gdbstub_mem_stats_t;
+
+/* Describes one register to GDB, see "Target Description Format" in the GDB
+ * manual. Registers are numbered in the order of the table, and so are they
+ * laid out in the 'g' packet. */
+typedef struct {
+    const char *name;
+    int bitsize;
+    const char *type;    /* e.g. "int", "code_ptr" or "ieee_double" */
+    const char *group;   /* e.g. "general", "float" or "vector", or NULL */
+    const char *feature; /* e.g. "org.gnu.gdb.riscv.cpu" */
+} reg_desc_t;
+
 typedef struct {
     char *target_desc;
     int smp;
     int reg_num;
+
+    /* Optional, reg_num entries. They take over from get_reg_bytes(), and
+     * without target_desc a description is generated from them, with one
+     * annex for each feature, which goes under the name arch_name. */
+    const reg_desc_t *reg_descs;
+    const char *arch_name; /* e.g. "riscv:rv64" */
 } arch_info_t;
 
+/* The buckets of the filter in front of the breakpoint table, a power of
+ * two */
+#define GDBSTUB_BP_FILTER_BITS (1 << 18)
+#define GDBSTUB_BP_FREE ((size_t) -1)
+
+/* The conditions GDB attached to a breakpoint, as agent expressions */
+typedef struct gdbstub_bp_cond gdbstub_bp_cond_t;
+
+/* The software breakpoints, which the stub keeps itself when the target
+ * has no set_bp(). They are looked up with gdbstub_bp_hit(). */
+typedef struct {
+    /* A bit for each bucket of (addr >> 1) with a breakpoint in it, or with
+     * one of the nr_stale removed since the filter was rebuilt */
+    uint64_t *filter;
+    size_t *slots; /* open addressing, GDBSTUB_BP_FREE when free */
+    /* The conditions of the breakpoint in each slot, NULL until one has */
+    gdbstub_bp_cond_t **conds;
+    int bits;      /* log2 of the number of slots */
+    size_t nr;
+    size_t nr_stale;
+} gdbstub_bps_t;
+
+/* The watchpoints triggered by one kind of access */
+typedef struct {
+    mem_range_t *ranges; /* sorted by addr */
+    size_t *max_lasts;   /* the furthest last byte of ranges[0] to [i] */
+    int nr;
+    /* The first and last bytes of all of them, both 0 when there is none */
+    size_t lo, last;
+} gdbstub_watch_index_t;
+
+typedef struct {
+    mem_range_t range;
+    bp_type_t type;
+} gdbstub_watch_t;
+
+/* The watchpoints, which the stub keeps itself when the target has no
+ * set_bp(). They are looked up with gdbstub_watch_check(). */
+typedef struct {
+    gdbstub_watch_t *watches;
+    int nr;
+    unsigned gen; /* bumped whenever a watchpoint is added or removed */
+    gdbstub_watch_index_t reads, writes;
+
+    /* The first watchpoint triggered since the target resumed, and the
+     * address accessed in it */
+    bool hit;
+    bp_type_t hit_type;
+    size_t hit_addr;
+} gdbstub_watches_t;
+
 typedef struct {
     struct target_ops *ops;
     arch_info_t arch;
     gdbstub_private_t *priv;
+    gdbstub_bps_t bps;
+    gdbstub_watches_t watches;
+    /* The addresses of the tracepoints while tracing runs */
+    gdbstub_bps_t tps;
 } gdbstub_t;
 
+static inline size_t gdbstub_bp_slot(const gdbstub_bps_t *bps, size_t addr)
+{
+    return (uint64_t) addr * 0x9e3779b97f4a7c15ULL >> (64 - bps->bits);
+}
+
+/* Find the slot of addr in bps */
+static inline bool gdbstub_bps_find(const gdbstub_bps_t *bps,
+                                    size_t addr,
+                                    size_t *slot)
+{
+    if (!bps->nr)
+        return false;
+    size_t bucket = (addr >> 1) & (GDBSTUB_BP_FILTER_BITS - 1);
+    if (!(bps->filter[bucket / 64] >> (bucket % 64) & 1))
+        return false;
+
+    size_t mask = ((size_t) 1 << bps->bits) - 1;
+    for (size_t i = gdbstub_bp_slot(bps, addr);; i = (i + 1) & mask) {
+        if (bps->slots[i] == addr) {
+            *slot = i;
+            return true;
+        }
+        if (bps->slots[i] == GDBSTUB_BP_FREE)
+            return false;
+    }
+}
+
+/* The slow path of gdbstub_bp_hit(), whether any of the conditions holds */
+bool gdbstub_bp_cond_eval(gdbstub_t *gdbstub, const gdbstub_bp_cond_t *cond);
+
+/* The slow path of gdbstub_bp_hit() for a tracepoint, collecting a frame */
+void gdbstub_trace_collect(gdbstub_t *gdbstub, size_t pc);
+
+/* Whether GDB set a breakpoint at pc, for the execution loop of cont().
+ * Most addresses are told apart by the filter alone. A breakpoint with
+ * conditions is only hit when one of them is true, which is evaluated
+ * reading the target through read_reg() and read_mem(), and so are the
+ * tracepoints collected, without stopping. */
+static inline bool gdbstub_bp_hit(gdbstub_t *gdbstub, size_t pc)
+{
+    const gdbstub_bps_t *bps = &gdbstub->bps;
+    size_t i;
+
+    if (gdbstub_bps_find(&gdbstub->tps, pc, &i))
+        gdbstub_trace_collect(gdbstub, pc);
+    if (!gdbstub_bps_find(bps, pc, &i))
+        return false;
+    return !bps->conds || !bps->conds[i] ||
+           gdbstub_bp_cond_eval(gdbstub, bps->conds[i]);
+}
+
+/* The slow path of gdbstub_watch_check() */
+bool gdbstub_watch_lookup(gdbstub_t *gdbstub,
+                          size_t addr,
+                          size_t len,
+                          bool is_write);
+
+/* Whether an access of len bytes at addr triggers a watchpoint GDB set, for
+ * the loads and stores of the target. If so, the target should stop once the
+ * access is done, and the stop reply tells GDB which watchpoint it was. */
+static inline bool gdbstub_watch_check(gdbstub_t *gdbstub,
+                                       size_t addr,
+                                       size_t len,
+                                       bool is_write)
+{
+    const gdbstub_watch_index_t *index =
+        is_write ? &gdbstub->watches.writes : &gdbstub->watches.reads;
+
+    /* Written not to overflow next to the end of the address space */
+    if (addr > index->last || (addr < index->lo && index->lo - addr >= len))
+        return false;
+    return gdbstub_watch_lookup(gdbstub, addr, len, is_write);
+}
+
+/* Handle a q, Q or v packet which the stub does not implement itself, params
+ * being what follows its name and separator. Reply with gdbstub_send_reply()
+ * and return zero, otherwise return an errno which is sent as the reply. */
+typedef int (*gdbstub_handler_t)(gdbstub_t *gdbstub, char *params, void *args);
+
 bool gdbstub_init(gdbstub_t *gdbstub,
                   struct target_ops *ops,
                   arch_info_t arch,
                   char *s);
+/* Set the largest payload of the packets exchanged with GDB, which leaves
+ * the '$', '#' and checksum out as GDB does. It is advertised as PacketSize
+ * in qSupported, so it must be called between gdbstub_init() and
+ * gdbstub_run(). */
+bool gdbstub_set_packet_size(gdbstub_t *gdbstub, size_t size);
+/* Run-length encode the replies, which GDB always understands */
+void gdbstub_set_rle(gdbstub_t *gdbstub, bool enable);
+/* Use io_uring for the socket, which is the default when built with
+ * IO_URING=1. Return false if it is unavailable or gdbstub_run() has
+ * started. */
+bool gdbstub_set_io_uring(gdbstub_t *gdbstub, bool enable);
+/* The counters are updated without locking, read them once gdbstub_run()
+ * has returned */
+void gdbstub_get_io_stats(gdbstub_t *gdbstub, gdbstub_io_stats_t *stats);
+/* Cache the memory GDB reads, in nr_lines aligned lines of line_size bytes
+ * read at once, both powers of two. It is dropped whenever the target runs,
+ * unless get_dirty_ranges() tells what changed. A line_size of 0 turns it
+ * off, which is the default. Do not use it if reading the memory has side
+ * effects, e.g. with memory-mapped I/O. It must be called before
+ * gdbstub_run(). */
+bool gdbstub_set_mem_cache(gdbstub_t *gdbstub, size_t line_size, int nr_lines);
+/* Like gdbstub_get_io_stats() */
+void gdbstub_get_mem_stats(gdbstub_t *gdbstub, gdbstub_mem_stats_t *stats);
+/* Add a handler for the q, Q or v (type) packet called name, which must be
+ * done before gdbstub_run(). The name of a q packet is what follows the 'q'
+ * up to the first ':', ';' or ',', e.g. "Rcmd" for monitor commands. Return
+ * false if the stub implements the packet itself. */
+bool gdbstub_register_handler(gdbstub_t *gdbstub,
+                              char type,
+                              const char *name,
+                              gdbstub_handler_t handler);
+/* Send the reply to a packet from a gdbstub_handler_t */
+void gdbstub_send_reply(gdbstub_t *gdbstub, const char *reply);
 bool gdbstub_run(gdbstub_t *gdbstub, void *args);
 void gdbstub_close(gdbstub_t *gdbstub);
 
@@ -0,0 +1,57 @@
+#ifndef MEMCACHE_H
+#define MEMCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Aligned lines of target memory, direct mapped. As in regcache_t, a line
+ * is valid while the generation it was filled in is the current one. The
+ * lines the target writes are dropped with memcache_write(), or all of
+ * them if it is not known which. */
+struct memcache_line {
+    uint64_t addr;
+    uint32_t gen;
+};
+
+typedef struct {
+    size_t line_size; /* a power of two, 0 when the cache is off */
+    int nr_lines;     /* a power of two */
+    struct memcache_line *lines;
+    uint8_t *data; /* nr_lines * line_size */
+    uint32_t gen;
+
+    size_t nr_hits;
+    size_t nr_misses;
+} memcache_t;
+
+bool memcache_init(memcache_t *cache, size_t line_size, int nr_lines);
+void memcache_destroy(memcache_t *cache);
+
+static inline bool memcache_enabled(memcache_t *cache)
+{
+    return cache->line_size != 0;
+}
+
+static inline uint64_t memcache_line_addr(memcache_t *cache, uint64_t addr)
+{
+    return addr & ~(uint64_t) (cache->line_size - 1);
+}
+
+/* The data of the line at line_addr, NULL if it is not cached. A miss is
+ * counted only when the line is then filled. */
+uint8_t *memcache_find(memcache_t *cache, uint64_t line_addr);
+/* The place to read the line at line_addr to, which evicts whatever line
+ * it held, then memcache_set_valid() once it is filled */
+uint8_t *memcache_slot(memcache_t *cache, uint64_t line_addr);
+void memcache_set_valid(memcache_t *cache, uint64_t line_addr);
+
+/* Update the cached lines with len bytes written at addr, or forget them
+ * if data is NULL because the write failed */
+void memcache_write(memcache_t *cache,
+                    uint64_t addr,
+                    size_t len,
+                    const void *data);
+void memcache_invalidate(memcache_t *cache);
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef OUTQ_H
+#define OUTQ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+/* A frame of this size or less is copied into its slot */
+#define OUTQ_INLINE_SIZE 32
+
+/* Buffers of sent frames kept for outq_push_buf() to hand back */
+#define OUTQ_NR_SPARE 4
+
+typedef struct {
+    size_t seq;
+    size_t len;
+    char *buf;  /* the frame if it does not fit in data, owned by the slot */
+    size_t cap; /* of buf */
+    char data[OUTQ_INLINE_SIZE];
+} outq_slot_t;
+
+typedef struct {
+    char *buf;
+    size_t cap;
+} outq_spare_t;
+
+/* Bounded lock-free ring of outbound frames. Any thread may push, while one
+ * consumer at a time sends them out, and frames are sent in the order they
+ * were pushed. A slot is ready once its seq is one past its position and
+ * free again once seq wraps to the next lap.
+ */
+typedef struct {
+    outq_slot_t *slots;
+    size_t mask;
+    size_t tail; /* next position to claim, shared by the producers */
+    size_t head; /* oldest frame not fully sent, owned by the consumer */
+    size_t off;  /* bytes of the head frame already sent */
+
+    /* The consumer gives the buffers of sent frames back through here */
+    outq_spare_t spare[OUTQ_NR_SPARE];
+    size_t spare_head;
+    size_t spare_tail;
+} outq_t;
+
+bool outq_init(outq_t *q, size_t nr_slots);
+void outq_destroy(outq_t *q);
+
+/* Copy a frame into the ring. Return false if it is full. */
+bool outq_push(outq_t *q, const void *frame, size_t len);
+
+/* Hand a frame over to the ring without copying it. *buf and *cap are
+ * replaced by the buffer of a sent frame, or NULL and 0. Only one thread
+ * may use this. Return false, keeping the buffer, if the ring is full. */
+bool outq_push_buf(outq_t *q, char **buf, size_t *cap, size_t len);
+
+/* Whether there is any frame left to send, from any thread */
+bool outq_pending(outq_t *q);
+
+/* Consumer: describe up to max frames which are ready to go, and drop the
+ * first n bytes of them once they are sent */
+int outq_peek(outq_t *q, struct iovec *iov, int max);
+void outq_consume(outq_t *q, size_t n);
+
+#endif
@@ -11,23 +11,71 @@
 
 #define CSUM_SIZE (2)
 
+/* '$' + '#' + checksum digits around the payload of a packet */
+#define PACKET_OVERHEAD (2 + CSUM_SIZE)
+
+/* A view of one complete packet inside the pktbuf_t ring: data[0] is the
+ * leading '$' and data[end_pos] is the last checksum digit. The bytes remain
+ * owned by the ring until the view is handed back with pktbuf_release(). */
 typedef struct {
+    uint8_t *data;
     int end_pos;
-    uint8_t data[];
+    uint64_t ring_end; /* ring position right after the packet */
+    bool csum_ok;      /* the checksum matches the payload */
 } packet_t;
 
-/* A naive packet buffer: maintain a big array to fill the packet */
+#define PKTBUF_NONE UINT64_MAX
+
+/* A fixed-capacity ring buffer that frames packets in place.
+ *
+ * The reader thread fills the ring and cuts packets out of it as views, the
+ * main thread hands them back with pktbuf_release() in the order it got
+ * them. Every position is a monotonic byte count, the physical offset being
+ * (pos & (cap - 1)). A packet never wraps around the end of the ring: once
+ * the reader reaches the end while a packet is still partial, only that
+ * partial packet is moved to the beginning, so a packet may occupy at most
+ * half of the ring.
+ *
+ * Each received byte is scanned once: the scan cursor frames the packets,
+ * sums up their checksum and counts the interrupt characters between them.
+ */
 typedef struct {
-    int size;    /* the size for all valid characters in data buffer */
-    int cap;     /* the capacity (1 << cap) of the data buffer */
-    int end_pos; /* the end position of the first packet in data buffer */
     uint8_t *data;
+    size_t cap;        /* capacity in bytes, a power of two */
+    uint64_t wr;       /* end of the received data */
+    uint64_t scan;     /* next byte to be scanned */
+    uint64_t head;     /* '$' of the packet being framed, or PKTBUF_NONE */
+    uint64_t csum_pos; /* '#' of the packet being framed, or PKTBUF_NONE */
+    uint8_t csum;      /* checksum of the payload scanned so far */
+    int nr_intr;       /* interrupt characters seen, cleared by the reader */
+    uint64_t nr_popped;
+
+    /* Written by the consumer only */
+    uint64_t released; /* end of the most recently released view */
+    uint64_t nr_released;
+
+    bool want_release; /* the reader sleeps until a view is released */
 } pktbuf_t;
 
-bool pktbuf_init(pktbuf_t *pktbuf);
+static inline uint8_t *pktbuf_ptr(pktbuf_t *pktbuf, uint64_t pos)
+{
+    return pktbuf->data + (pos & (pktbuf->cap - 1));
+}
+
+/* The capacity of a ring which takes packets of up to payload_size bytes,
+ * escapes included, as the framing around them must fit in half of it */
+#define PKTBUF_CAP_FOR(payload_size) (2 * ((payload_size) + PACKET_OVERHEAD))
+
+bool pktbuf_init(pktbuf_t *pktbuf, size_t cap);
+bool pktbuf_has_space(pktbuf_t *pktbuf);
 ssize_t pktbuf_fill_from_file(pktbuf_t *pktbuf, int fd);
+/* Copy as much of data as fits, for data already received by other means */
+ssize_t pktbuf_fill_from_mem(pktbuf_t *pktbuf, const void *data, size_t len);
 bool pktbuf_is_complete(pktbuf_t *pktbuf);
-packet_t *pktbuf_pop_packet(pktbuf_t *pktbuf);
+bool pktbuf_pop_packet(pktbuf_t *pktbuf, packet_t *pkt);
+void pktbuf_discard(pktbuf_t *pktbuf);
+bool pktbuf_want_release(pktbuf_t *pktbuf);
+bool pktbuf_release(pktbuf_t *pktbuf, packet_t *pkt);
 void pktbuf_destroy(pktbuf_t *pktbuf);
 
 #endif
@@ -3,46 +3,75 @@
 
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include "packet.h"
 
-/* Thread-safe packet queue for inter-thread packet handoff.
+/* Packet queue for inter-thread packet handoff.
  *
  * Reader thread pushes complete packets; main thread pops and processes.
  * This eliminates the race condition where both threads call recv() on
  * the same socket.
+ *
+ * There is exactly one producer and one consumer, so the queue is a ring
+ * of packet views indexed by two counters, each written by one side. The
+ * consumer sleeps on a futex, or a condition variable where there is no
+ * futex, and the producer only makes a system call when it is asleep.
  */
 
-typedef struct pktqueue_node {
-    packet_t *pkt;
-    struct pktqueue_node *next;
-} pktqueue_node_t;
+#define PKTQUEUE_SIZE 1024 /* a power of two */
 
 typedef struct {
-    pktqueue_node_t *head;
-    pktqueue_node_t *tail;
+    packet_t *ring;
+
+    /* Written by the producer. head_cache is its last look at head. */
+    uint64_t tail __attribute__((aligned(64)));
+    uint64_t head_cache;
+    bool want_space; /* the producer waits for a pop */
+
+    /* Written by the consumer. tail_cache is its last look at tail. */
+    uint64_t head __attribute__((aligned(64)));
+    uint64_t tail_cache;
+    bool idle; /* the consumer sleeps in pktqueue_pop() */
+
+    uint32_t wakeups __attribute__((aligned(64))); /* futex word */
+    bool shutdown;    /* signal reader to stop */
+    bool interrupted; /* interrupt character received */
+#ifndef __linux__
     pthread_mutex_t mutex;
-    pthread_cond_t cond; /* for blocking pop */
-    bool shutdown;       /* signal reader to stop */
-    bool interrupted;    /* interrupt character received */
+    pthread_cond_t cond;
+#endif
 } pktqueue_t;
 
 /* Initialize packet queue. Returns true on success. */
 bool pktqueue_init(pktqueue_t *queue);
 
-/* Destroy packet queue and free all pending packets. */
+/* Destroy packet queue and drop all pending packets. */
 void pktqueue_destroy(pktqueue_t *queue);
 
-/* Push a packet to the queue (called by reader thread).
- * Takes ownership of pkt on success - caller must not free it.
- * Returns true on success, false on allocation failure (pkt NOT freed).
+/* Push a packet view to the queue (called by reader thread).
+ * Returns false if the queue is full, see pktqueue_want_space().
  */
 bool pktqueue_push(pktqueue_t *queue, packet_t *pkt);
 
-/* Pop a packet from the queue (called by main thread).
+/* Check whether a push would fail (called by reader thread). */
+bool pktqueue_is_full(pktqueue_t *queue);
+
+/* Called by the reader once the queue is full. Return true if it may sleep:
+ * the consumer then learns from pktqueue_space_wanted() after its next pop
+ * that it has to wake the reader up. Return false if something was popped
+ * in the meantime. */
+bool pktqueue_want_space(pktqueue_t *queue);
+
+/* Pop a packet view from the queue (called by main thread).
  * Blocks until a packet is available or shutdown is signaled.
- * Returns NULL on shutdown, otherwise returns packet (caller must free).
+ * Returns false on shutdown or interrupt, otherwise fills *pkt, which the
+ * caller must hand back to its pktbuf_t with pktbuf_release().
  */
-packet_t *pktqueue_pop(pktqueue_t *queue);
+bool pktqueue_pop(pktqueue_t *queue, packet_t *pkt);
+
+/* Called by the main thread after a pop. Return true if the reader waits
+ * for space and needs a wakeup. */
+bool pktqueue_space_wanted(pktqueue_t *queue);
 
 /* Signal shutdown to unblock any waiting pop operation. */
 void pktqueue_signal_shutdown(pktqueue_t *queue);
@@ -58,4 +87,8 @@ bool pktqueue_check_interrupt(pktqueue_t *queue);
 /* Check if shutdown was signaled. */
 bool pktqueue_is_shutdown(pktqueue_t *queue);
 
+/* Check whether the main thread waits for a packet, so the next one pushed
+ * is handled right away. */
+bool pktqueue_is_idle(pktqueue_t *queue);
+
 #endif
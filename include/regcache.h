@@ -0,0 +1,57 @@
+#ifndef REGCACHE_H
+#define REGCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The register files read from the target since it last ran, one per CPU
+ * plus a scratch one, laid out as in the 'g' packet. A register is valid
+ * while the generation it was filled in is the current one, so dropping
+ * everything on resume is a single increment. */
+struct regcache_cpu {
+    uint8_t *regs;
+    uint32_t *gen;         /* per register */
+    uint32_t nr_valid_gen; /* the generation nr_valid counts for */
+    int nr_valid;
+};
+
+typedef struct {
+    int reg_num;
+    size_t *offset; /* reg_num + 1 entries, the last is the total size */
+    int nr_cpus;
+    struct regcache_cpu *cpus; /* nr_cpus + 1, filled in on first use */
+    uint32_t gen;
+} regcache_t;
+
+bool regcache_init(regcache_t *cache,
+                   const size_t *reg_bytes,
+                   int reg_num,
+                   int nr_cpus);
+void regcache_destroy(regcache_t *cache);
+
+/* The index of the scratch register file, which is not kept for a CPU */
+static inline int regcache_scratch(regcache_t *cache)
+{
+    return cache->nr_cpus;
+}
+
+static inline size_t regcache_size(regcache_t *cache)
+{
+    return cache->offset[cache->reg_num];
+}
+
+/* The register file of cpu, NULL if it cannot be allocated */
+uint8_t *regcache_regs(regcache_t *cache, int cpu);
+
+bool regcache_valid(regcache_t *cache, int cpu, int regno);
+bool regcache_all_valid(regcache_t *cache, int cpu);
+void regcache_set_valid(regcache_t *cache, int cpu, int regno);
+void regcache_set_all_valid(regcache_t *cache, int cpu);
+
+/* Forget one register of cpu, all registers of cpu, or everything */
+void regcache_drop_reg(regcache_t *cache, int cpu, int regno);
+void regcache_drop_cpu(regcache_t *cache, int cpu);
+void regcache_invalidate(regcache_t *cache);
+
+#endif
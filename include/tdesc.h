@@ -0,0 +1,28 @@
+#ifndef TDESC_H
+#define TDESC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "gdbstub.h"
+
+/* The target description, as the annexes of qXfer:features:read */
+typedef struct {
+    char *name; /* e.g. "target.xml" */
+    char *data;
+    size_t len;
+} tdesc_annex_t;
+
+typedef struct {
+    tdesc_annex_t *annexes; /* target.xml first */
+    int nr_annexes;         /* 0 without any description */
+} tdesc_t;
+
+/* Take arch->target_desc as target.xml, or generate it and an annex for
+ * each feature from arch->reg_descs */
+bool tdesc_init(tdesc_t *tdesc, const arch_info_t *arch);
+void tdesc_destroy(tdesc_t *tdesc);
+
+/* Find the annex called name, which is len bytes long */
+const tdesc_annex_t *tdesc_find(tdesc_t *tdesc, const char *name, size_t len);
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ax.h"
+#include "gdbstub.h"
+
+/* The size of the trace buffer unless QTBuffer:size tells otherwise */
+#define TRACE_DEFAULT_BUF_SIZE (1 << 20)
+#define TRACE_MIN_BUF_SIZE (1 << 10)
+#define TRACE_MAX_BUF_SIZE (1 << 30)
+
+/* What a tracepoint collects besides the registers, which it always does */
+typedef struct {
+    char type;       /* 'M' for memory, 'X' for an agent expression */
+    int basereg;     /* 'M' from offset itself if -1, else from the reg */
+    uint64_t offset; /* 'M' */
+    uint64_t len;    /* 'M' */
+    ax_expr_t expr;  /* 'X', collecting with its trace bytecodes */
+} trace_action_t;
+
+typedef struct {
+    int num;
+    size_t addr;
+    bool enabled;
+    uint64_t pass; /* tracing stops after so many hits, never if 0 */
+    ax_expr_t cond; /* collect only if it is true, code is NULL if none */
+    trace_action_t *actions;
+    int nr_actions;
+
+    /* Since tracing started */
+    uint64_t hits;
+    uint64_t bytes; /* of the frames collected */
+} tracepoint_t;
+
+/* A ring of frames, each with the blocks collected at one hit. The oldest
+ * frames make room for the new ones if it is circular, otherwise tracing
+ * stops once it is full. */
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t head;       /* where the oldest frame starts */
+    size_t used;       /* by the frames */
+    size_t pending;    /* by the frame being collected, which follows them */
+    size_t nr_frames;
+    size_t nr_created; /* the frames evicted since included */
+    bool circular;
+} trace_buf_t;
+
+/* A frame in the ring, numbered from the oldest one on */
+typedef struct {
+    size_t num;
+    size_t pos;
+    size_t size;
+    int tpnum;
+    uint64_t addr;
+} trace_frame_t;
+
+/* Why tracing is not running, reported by qTStatus */
+typedef enum {
+    TRACE_NOT_RUN,
+    TRACE_RUNNING,
+    TRACE_STOP,      /* by QTStop */
+    TRACE_FULL,      /* the buffer is full */
+    TRACE_PASSCOUNT, /* stop_tp hit its pass count */
+    TRACE_ERROR,     /* stop_tp failed to evaluate its condition */
+} trace_status_t;
+
+typedef struct {
+    tracepoint_t *tps;
+    int nr_tps;
+
+    trace_buf_t buf;
+    size_t buf_size; /* allocated at the next start */
+    bool circular;
+    bool disconnected; /* QTDisconnected, only reported */
+
+    trace_status_t status;
+    int stop_tp;
+
+    /* The read-only memory GDB told of, which is read from the target when
+     * a frame does not have it */
+    mem_range_t *ro;
+    int nr_ro;
+
+    /* The frame QTFrame selected, which 'g', 'p', 'm' and 'x' look into */
+    bool selected;
+    trace_frame_t frame;
+} trace_t;
+
+void trace_init(trace_t *trace);
+/* Forget the tracepoints and the frames, as QTinit does */
+void trace_clear(trace_t *trace);
+void trace_destroy(trace_t *trace);
+
+tracepoint_t *trace_tp_find(trace_t *trace, int num, size_t addr);
+/* Add tp, or replace the one with its number and address, and take over
+ * its condition and actions. Return zero or an errno. */
+int trace_tp_add(trace_t *trace, const tracepoint_t *tp);
+/* Append action to tp, and take over its expression */
+int trace_tp_add_action(tracepoint_t *tp, const trace_action_t *action);
+int trace_ro_add(trace_t *trace, size_t addr, size_t len);
+
+/* Allocate size bytes for the frames up front, so that collecting never
+ * allocates */
+bool trace_buf_init(trace_buf_t *buf, size_t size, bool circular);
+void trace_buf_destroy(trace_buf_t *buf);
+
+/* Collect a frame: blocks are added to it after trace_frame_begin(), then it
+ * is committed, or aborted once one of them returns false as it does not
+ * fit. trace_frame_commit() returns the size of the frame. */
+bool trace_frame_begin(trace_buf_t *buf);
+bool trace_frame_add(trace_buf_t *buf,
+                     char type,
+                     uint64_t addr,
+                     const void *data,
+                     size_t len);
+size_t trace_frame_commit(trace_buf_t *buf, int tpnum, uint64_t addr);
+void trace_frame_abort(trace_buf_t *buf);
+
+/* Look frame number num up, or the one following frame */
+bool trace_frame_get(const trace_buf_t *buf, size_t num, trace_frame_t *frame);
+bool trace_frame_next(const trace_buf_t *buf, trace_frame_t *frame);
+/* Copy the len bytes of the registers collected in frame to regs */
+bool trace_frame_regs(const trace_buf_t *buf,
+                      const trace_frame_t *frame,
+                      void *regs,
+                      size_t len);
+/* Copy what frame collected of the len bytes at addr, up to the first byte
+ * it does not have, and return how many bytes it was */
+size_t trace_frame_mem(const trace_buf_t *buf,
+                       const trace_frame_t *frame,
+                       uint64_t addr,
+                       size_t len,
+                       void *out);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef URING_H
+#define URING_H
+
+#ifdef CONFIG_IO_URING
+
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A minimal io_uring instance driven by raw system calls, so no liburing
+ * is needed. Every instance is used by one thread at a time. */
+typedef struct {
+    int fd;
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned to_submit;
+    struct io_uring_sqe *sqes;
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *ring_ptr; /* both queues, mapped at once */
+    size_t ring_size;
+    size_t sqes_size;
+} uring_t;
+
+/* Buffers handed to the kernel, which picks one for each multishot recv
+ * completion and reports its id in the CQE flags */
+typedef struct {
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    uint8_t *data;
+    unsigned nr;
+    unsigned size;
+    uint16_t bgid;
+    uint16_t tail;
+} uring_bufs_t;
+
+bool uring_init(uring_t *ring, unsigned entries);
+void uring_destroy(uring_t *ring);
+
+/* Return a zeroed SQE to fill, or NULL if the submission queue is full */
+struct io_uring_sqe *uring_get_sqe(uring_t *ring);
+
+/* Submit the SQEs got so far and wait for wait_nr completions. Return 0 or
+ * -1 with errno set. */
+int uring_submit(uring_t *ring, unsigned wait_nr);
+
+/* Return the oldest completion, or NULL, and let it go with uring_cqe_seen */
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring);
+void uring_cqe_seen(uring_t *ring);
+
+bool uring_bufs_init(uring_bufs_t *bufs,
+                     uring_t *ring,
+                     uint16_t bgid,
+                     unsigned nr,
+                     unsigned size);
+void uring_bufs_destroy(uring_bufs_t *bufs, uring_t *ring);
+
+/* Give the buffer back to the kernel once its data has been consumed */
+void uring_bufs_recycle(uring_bufs_t *bufs, uint16_t bid);
+
+static inline uint8_t *uring_bufs_get(uring_bufs_t *bufs, uint16_t bid)
+{
+    return bufs->data + (size_t) bid * bufs->size;
+}
+
+#endif
+
+#endif
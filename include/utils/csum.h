@@ -6,4 +6,14 @@
 
 uint8_t compute_checksum(char *buf, size_t len);
 
+/* Add up the bytes of buf into *csum until the first occurrence of stop.
+ * Return the offset of stop, or len if it does not appear. */
+size_t checksum_until(const uint8_t *buf,
+                      size_t len,
+                      uint8_t stop,
+                      uint8_t *csum);
+
+/* Return the offset of the first byte equal to either a or b, or len */
+size_t scan_for_either(const uint8_t *buf, size_t len, uint8_t a, uint8_t b);
+
 #endif
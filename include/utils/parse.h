@@ -0,0 +1,48 @@
+#ifndef PARSE_H
+#define PARSE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A cursor over the arguments of a packet. Each function consumes what it
+ * recognizes and returns true, or returns false and leaves the cursor where
+ * it was, so a malformed packet is answered with an error rather than
+ * aborting. No locale or allocation is involved. */
+typedef struct {
+    const char *pos;
+    const char *end;
+} parse_t;
+
+static inline void parse_init(parse_t *p, const char *buf, size_t len)
+{
+    p->pos = buf;
+    p->end = buf + len;
+}
+
+static inline size_t parse_remaining(const parse_t *p)
+{
+    return p->end - p->pos;
+}
+
+static inline bool parse_at_end(const parse_t *p)
+{
+    return p->pos == p->end;
+}
+
+/* Consume ch if it is next */
+static inline bool parse_expect_char(parse_t *p, char ch)
+{
+    if (p->pos == p->end || *p->pos != ch)
+        return false;
+    p->pos++;
+    return true;
+}
+
+/* Consume a hexadecimal number of 1 to 16 digits, either case */
+bool parse_hex_u64(parse_t *p, uint64_t *val);
+
+/* Consume a decimal int, possibly negative */
+bool parse_dec_int(parse_t *p, int *val);
+
+#endif
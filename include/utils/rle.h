@@ -0,0 +1,12 @@
+#ifndef RLE_H
+#define RLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Run-length encode the payload buf[0..len) in place with the '*' notation
+ * of the remote protocol, and return the new length. The checksum of the
+ * encoded payload is stored to *csum. */
+size_t rle_encode(char *buf, size_t len, uint8_t *csum);
+
+#endif
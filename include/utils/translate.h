@@ -1,10 +1,38 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include <stddef.h>
 #include <stdint.h>
 
-void hex_to_str(uint8_t *num, char *str, int bytes);
-void str_to_hex(char *str, uint8_t *num, int bytes);
+/* One implementation of the hex conversion. The scalar kernel is always
+ * available and is the reference the vectorized ones must agree with. */
+typedef struct {
+    const char *name;
+    void (*encode)(const uint8_t *num, char *str, size_t bytes);
+    void (*decode)(const char *str, uint8_t *num, size_t bytes);
+} hex_kernel_t;
+
+/* Return the kernels this CPU can run, from the slowest to the fastest */
+const hex_kernel_t *hex_kernels(int *num);
+
+/* Pick the fastest kernel for hex_to_str() and str_to_hex() */
+void translate_init(void);
+
+void hex_to_str(uint8_t *num, char *str, size_t bytes);
+void str_to_hex(char *str, uint8_t *num, size_t bytes);
 int unescape(char *msg, char *end);
+/* Unescape the binary data from msg up to end to out, which may be msg
+ * itself, or only count its bytes if out is NULL. A '}' at the very end
+ * is left out. */
+size_t unescape_to(const char *msg, const char *end, uint8_t *out);
+/* Escape binary data, each of '#', '$', '}' and '*' becoming '}' followed
+ * by the byte xor 0x20, to at most room bytes of str, or only count them
+ * if str is NULL. Return how many bytes of data fit, and store the length
+ * they take in *str_len. */
+size_t escape(const uint8_t *data,
+              size_t len,
+              char *str,
+              size_t room,
+              size_t *str_len);
 
 #endif
@@ -0,0 +1,23 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "gdbstub.h"
+
+/* Maintain the gdbstub_watches_t of gdbstub_watch_check(), type being one of
+ * the WP_* types. watch_insert() returns zero or an errno, adding a
+ * watchpoint which is already there being fine, and watch_remove() returns
+ * whether the watchpoint was there. */
+int watch_insert(gdbstub_watches_t *watches,
+                 size_t addr,
+                 size_t len,
+                 bp_type_t type);
+bool watch_remove(gdbstub_watches_t *watches,
+                  size_t addr,
+                  size_t len,
+                  bp_type_t type);
+void watch_destroy(gdbstub_watches_t *watches);
+
+#endif
@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Generate include/cmd_table.h, the perfect hash of the named q/Q/v packets
+the stub implements itself.
+
+Each command is looked up by its packet letter followed by its name, e.g.
+"qSupported". The seed of an FNV-1a hash is searched until every key lands
+in its own slot of a power-of-two table, so a lookup is one hash and one
+memcmp().
+
+    scripts/gen-cmd-table.py > include/cmd_table.h
+"""
+
+import sys
+
+# (key, enum name), keep the enum names sorted by key
+COMMANDS = [
+    ("QStartNoAckMode", "CMD_START_NO_ACK_MODE"),
+    ("QTBuffer", "CMD_TRACE_BUFFER"),
+    ("QTDP", "CMD_TRACE_DP"),
+    ("QTDisconnected", "CMD_TRACE_DISCONNECTED"),
+    ("QTFrame", "CMD_TRACE_FRAME"),
+    ("QTStart", "CMD_TRACE_START"),
+    ("QTStop", "CMD_TRACE_STOP"),
+    ("QTinit", "CMD_TRACE_INIT"),
+    ("QTro", "CMD_TRACE_RO"),
+    ("qAttached", "CMD_ATTACHED"),
+    ("qC", "CMD_CURRENT_THREAD"),
+    ("qSupported", "CMD_SUPPORTED"),
+    ("qSymbol", "CMD_SYMBOL"),
+    ("qTP", "CMD_TRACE_POINT"),
+    ("qTStatus", "CMD_TRACE_STATUS"),
+    ("qXfer", "CMD_XFER"),
+    ("qfThreadInfo", "CMD_THREAD_INFO_FIRST"),
+    ("qsThreadInfo", "CMD_THREAD_INFO_NEXT"),
+    ("vCont", "CMD_VCONT"),
+    ("vCont?", "CMD_VCONT_SUPPORTED"),
+]
+
+FNV_PRIME = 0x01000193
+
+
+def fnv1a(seed, key):
+    h = seed
+    for c in key.encode():
+        h = ((h ^ c) * FNV_PRIME) & 0xFFFFFFFF
+    return h
+
+
+def find_seed(keys, bits):
+    for seed in range(1, 1 << 20):
+        slots = {fnv1a(seed, k) >> (32 - bits) for k in keys}
+        if len(slots) == len(keys):
+            return seed
+    return None
+
+
+def main():
+    keys = [k for k, _ in COMMANDS]
+    bits = max(len(keys) - 1, 1).bit_length()
+    seed = None
+    while seed is None:
+        seed = find_seed(keys, bits)
+        bits += 1
+    bits -= 1
+
+    slots = [None] * (1 << bits)
+    for key, name in COMMANDS:
+        slots[fnv1a(seed, key) >> (32 - bits)] = (key, name)
+
+    out = sys.stdout
+    out.write("/* Generated by scripts/gen-cmd-table.py, do not edit */\n\n")
+    out.write("#ifndef CMD_TABLE_H\n#define CMD_TABLE_H\n\n")
+    out.write("#include <stddef.h>\n#include <stdint.h>\n#include <string.h>\n\n")
+
+    out.write("typedef enum {\n    CMD_NONE,\n")
+    for _, name in COMMANDS:
+        out.write(f"    {name},\n")
+    out.write("    CMD_NR,\n} cmd_id_t;\n\n")
+
+    out.write(f"#define CMD_HASH_SEED 0x{seed:08x}u\n")
+    out.write(f"#define CMD_HASH_BITS {bits}\n\n")
+
+    out.write("static const struct {\n")
+    out.write("    const char *key;\n    uint8_t len;\n    uint8_t id;\n")
+    out.write("} cmd_slots[1 << CMD_HASH_BITS] = {\n")
+    for i, slot in enumerate(slots):
+        if slot:
+            key, name = slot
+            out.write(f'    [{i}] = {{"{key}", {len(key)}, {name}}},\n')
+    out.write("};\n\n")
+
+    out.write(
+        """/* Look a named packet up, the name being len bytes long and not
+ * necessarily terminated. Return CMD_NONE if the stub has no such command. */
+static inline cmd_id_t cmd_lookup(char type, const char *name, size_t len)
+{
+    uint32_t h = (CMD_HASH_SEED ^ (uint8_t) type) * 0x01000193u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ (uint8_t) name[i]) * 0x01000193u;
+
+    unsigned slot = h >> (32 - CMD_HASH_BITS);
+    if (cmd_slots[slot].len != len + 1 || cmd_slots[slot].key[0] != type ||
+        memcmp(cmd_slots[slot].key + 1, name, len))
+        return CMD_NONE;
+    return cmd_slots[slot].id;
+}
+
+#endif
+"""
+    )
+
+
+if __name__ == "__main__":
+    main()
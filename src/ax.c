@@ -0,0 +1,322 @@
+#include "ax.h"
+
+#include <errno.h>
+
+enum {
+    AX_ADD = 0x02,
+    AX_SUB = 0x03,
+    AX_MUL = 0x04,
+    AX_DIV_SIGNED = 0x05,
+    AX_DIV_UNSIGNED = 0x06,
+    AX_REM_SIGNED = 0x07,
+    AX_REM_UNSIGNED = 0x08,
+    AX_LSH = 0x09,
+    AX_RSH_SIGNED = 0x0a,
+    AX_RSH_UNSIGNED = 0x0b,
+    AX_TRACE = 0x0c,
+    AX_TRACE_QUICK = 0x0d,
+    AX_LOG_NOT = 0x0e,
+    AX_BIT_AND = 0x0f,
+    AX_BIT_OR = 0x10,
+    AX_BIT_XOR = 0x11,
+    AX_BIT_NOT = 0x12,
+    AX_EQUAL = 0x13,
+    AX_LESS_SIGNED = 0x14,
+    AX_LESS_UNSIGNED = 0x15,
+    AX_EXT = 0x16,
+    AX_REF8 = 0x17,
+    AX_REF16 = 0x18,
+    AX_REF32 = 0x19,
+    AX_REF64 = 0x1a,
+    AX_IF_GOTO = 0x20,
+    AX_GOTO = 0x21,
+    AX_CONST8 = 0x22,
+    AX_CONST16 = 0x23,
+    AX_CONST32 = 0x24,
+    AX_CONST64 = 0x25,
+    AX_REG = 0x26,
+    AX_END = 0x27,
+    AX_DUP = 0x28,
+    AX_POP = 0x29,
+    AX_ZERO_EXT = 0x2a,
+    AX_SWAP = 0x2b,
+    AX_TRACENZ = 0x2f,
+    AX_TRACE16 = 0x30,
+    AX_PICK = 0x32,
+    AX_ROT = 0x33,
+};
+
+/* Operands are big-endian */
+static bool ax_operand(const ax_expr_t *expr,
+                       size_t *pc,
+                       int bytes,
+                       uint64_t *val)
+{
+    if (expr->len - *pc < (size_t) bytes)
+        return false;
+
+    *val = 0;
+    for (int i = 0; i < bytes; i++)
+        *val = *val << 8 | expr->code[(*pc)++];
+    return true;
+}
+
+static uint64_t ax_sign_extend(uint64_t val, uint64_t bits)
+{
+    if (bits == 0 || bits >= 64)
+        return val;
+    uint64_t sign = (uint64_t) 1 << (bits - 1);
+    val &= (sign << 1) - 1;
+    return (val ^ sign) - sign;
+}
+
+/* The length of the string at addr, the zero byte included, if it is
+ * shorter than max */
+static int ax_strnlen(const ax_env_t *env,
+                      uint64_t addr,
+                      uint64_t max,
+                      uint64_t *len)
+{
+    uint8_t buf[64];
+
+    for (*len = 0; *len < max;) {
+        size_t n = max - *len < sizeof(buf) ? max - *len : sizeof(buf);
+        int err = env->read_mem(env->ctx, addr + *len, n, buf);
+        if (err)
+            return err;
+        for (size_t i = 0; i < n; i++) {
+            if (!buf[i]) {
+                *len += i + 1;
+                return 0;
+            }
+        }
+        *len += n;
+    }
+    return 0;
+}
+
+int ax_eval(const ax_expr_t *expr, const ax_env_t *env, uint64_t *result)
+{
+    uint64_t stack[AX_MAX_STACK];
+    int sp = 0; /* the number of values on the stack */
+    size_t pc = 0;
+
+/* Check the stack holds the n values the bytecode pops */
+#define NEED(n)            \
+    do {                   \
+        if (sp < (n))      \
+            return EINVAL; \
+    } while (0)
+#define TOP stack[sp - 1]
+#define NEXT stack[sp - 2]
+#define PUSH(v)                 \
+    do {                        \
+        uint64_t pushed = (v);  \
+        if (sp == AX_MAX_STACK) \
+            return EOVERFLOW;   \
+        stack[sp++] = pushed;   \
+    } while (0)
+#define BINARY(v)   \
+    do {            \
+        NEED(2);    \
+        NEXT = (v); \
+        sp--;       \
+    } while (0)
+
+    for (int steps = 0; steps < AX_MAX_STEPS; steps++) {
+        if (pc >= expr->len)
+            return EINVAL;
+
+        uint8_t op = expr->code[pc++];
+        uint64_t val, a, b;
+        int err;
+
+        switch (op) {
+        case AX_ADD:
+            BINARY(NEXT + TOP);
+            break;
+        case AX_SUB:
+            BINARY(NEXT - TOP);
+            break;
+        case AX_MUL:
+            BINARY(NEXT * TOP);
+            break;
+        case AX_DIV_SIGNED:
+        case AX_REM_SIGNED:
+            NEED(2);
+            if (!TOP || ((int64_t) NEXT == INT64_MIN && (int64_t) TOP == -1))
+                return EDOM;
+            a = NEXT, b = TOP;
+            val = op == AX_DIV_SIGNED ? (uint64_t) ((int64_t) a / (int64_t) b)
+                                      : (uint64_t) ((int64_t) a % (int64_t) b);
+            BINARY(val);
+            break;
+        case AX_DIV_UNSIGNED:
+        case AX_REM_UNSIGNED:
+            NEED(2);
+            if (!TOP)
+                return EDOM;
+            BINARY(op == AX_DIV_UNSIGNED ? NEXT / TOP : NEXT % TOP);
+            break;
+        case AX_LSH:
+            BINARY(TOP >= 64 ? 0 : NEXT << TOP);
+            break;
+        case AX_RSH_SIGNED:
+            BINARY((uint64_t) ((int64_t) NEXT >> (TOP >= 64 ? 63 : TOP)));
+            break;
+        case AX_RSH_UNSIGNED:
+            BINARY(TOP >= 64 ? 0 : NEXT >> TOP);
+            break;
+        case AX_LOG_NOT:
+            NEED(1);
+            TOP = !TOP;
+            break;
+        case AX_BIT_AND:
+            BINARY(NEXT & TOP);
+            break;
+        case AX_BIT_OR:
+            BINARY(NEXT | TOP);
+            break;
+        case AX_BIT_XOR:
+            BINARY(NEXT ^ TOP);
+            break;
+        case AX_BIT_NOT:
+            NEED(1);
+            TOP = ~TOP;
+            break;
+        case AX_EQUAL:
+            BINARY(NEXT == TOP);
+            break;
+        case AX_LESS_SIGNED:
+            BINARY((int64_t) NEXT < (int64_t) TOP);
+            break;
+        case AX_LESS_UNSIGNED:
+            BINARY(NEXT < TOP);
+            break;
+        case AX_EXT:
+        case AX_ZERO_EXT:
+            NEED(1);
+            if (!ax_operand(expr, &pc, 1, &val))
+                return EINVAL;
+            if (op == AX_EXT)
+                TOP = ax_sign_extend(TOP, val);
+            else if (val < 64)
+                TOP &= ((uint64_t) 1 << val) - 1;
+            break;
+        case AX_REF8:
+        case AX_REF16:
+        case AX_REF32:
+        case AX_REF64: {
+            uint8_t buf[8];
+            int bytes = 1 << (op - AX_REF8);
+            NEED(1);
+            if ((err = env->read_mem(env->ctx, TOP, bytes, buf)))
+                return err;
+            TOP = 0;
+            for (int i = bytes - 1; i >= 0; i--)
+                TOP = TOP << 8 | buf[i];
+            break;
+        }
+        case AX_IF_GOTO:
+        case AX_GOTO:
+            if (!ax_operand(expr, &pc, 2, &val))
+                return EINVAL;
+            if (op == AX_IF_GOTO) {
+                NEED(1);
+                if (!stack[--sp])
+                    break;
+            }
+            pc = val;
+            break;
+        case AX_CONST8:
+        case AX_CONST16:
+        case AX_CONST32:
+        case AX_CONST64:
+            if (!ax_operand(expr, &pc, 1 << (op - AX_CONST8), &val))
+                return EINVAL;
+            PUSH(val);
+            break;
+        case AX_REG:
+            if (!ax_operand(expr, &pc, 2, &val))
+                return EINVAL;
+            if ((err = env->read_reg(env->ctx, val, &val)))
+                return err;
+            PUSH(val);
+            break;
+        case AX_END:
+            if (!result)
+                return 0;
+            NEED(1);
+            *result = TOP;
+            return 0;
+        case AX_DUP:
+            NEED(1);
+            PUSH(TOP);
+            break;
+        case AX_POP:
+            NEED(1);
+            sp--;
+            break;
+        case AX_SWAP:
+            NEED(2);
+            val = TOP;
+            TOP = NEXT;
+            NEXT = val;
+            break;
+        case AX_PICK:
+            if (!ax_operand(expr, &pc, 1, &val))
+                return EINVAL;
+            NEED((int) val + 1);
+            PUSH(stack[sp - 1 - val]);
+            break;
+        case AX_ROT:
+            /* a b c => c a b */
+            NEED(3);
+            val = TOP;
+            TOP = NEXT;
+            NEXT = stack[sp - 3];
+            stack[sp - 3] = val;
+            break;
+        case AX_TRACE:
+            /* addr size => */
+            if (!env->trace)
+                return ENOTSUP;
+            NEED(2);
+            if ((err = env->trace(env->ctx, NEXT, TOP)))
+                return err;
+            sp -= 2;
+            break;
+        case AX_TRACE_QUICK:
+        case AX_TRACE16:
+            /* addr => addr */
+            if (!env->trace)
+                return ENOTSUP;
+            if (!ax_operand(expr, &pc, op == AX_TRACE16 ? 2 : 1, &val))
+                return EINVAL;
+            NEED(1);
+            if ((err = env->trace(env->ctx, TOP, val)))
+                return err;
+            break;
+        case AX_TRACENZ:
+            /* addr size =>, up to the first zero byte, which is included */
+            if (!env->trace)
+                return ENOTSUP;
+            NEED(2);
+            if ((err = ax_strnlen(env, NEXT, TOP, &val)) ||
+                (err = env->trace(env->ctx, NEXT, val)))
+                return err;
+            sp -= 2;
+            break;
+        default:
+            /* Floating point, state variables and printf */
+            return ENOTSUP;
+        }
+    }
+
+#undef BINARY
+#undef PUSH
+#undef NEXT
+#undef TOP
+#undef NEED
+    return ELOOP;
+}
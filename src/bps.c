@@ -0,0 +1,188 @@
+#include "bps.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define BPS_MIN_BITS 6
+
+gdbstub_bp_cond_t *bps_cond_alloc(int nr)
+{
+    gdbstub_bp_cond_t *cond =
+        calloc(1, sizeof(gdbstub_bp_cond_t) + nr * sizeof(ax_expr_t));
+    if (cond)
+        cond->nr = nr;
+    return cond;
+}
+
+void bps_cond_free(gdbstub_bp_cond_t *cond)
+{
+    if (!cond)
+        return;
+    for (int i = 0; i < cond->nr; i++)
+        free(cond->exprs[i].code);
+    free(cond);
+}
+
+static void bps_filter_set(gdbstub_bps_t *bps, size_t addr)
+{
+    size_t bucket = (addr >> 1) & (GDBSTUB_BP_FILTER_BITS - 1);
+    bps->filter[bucket / 64] |= (uint64_t) 1 << (bucket % 64);
+}
+
+/* Clear the buckets of the removed breakpoints, which a bucket does not tell
+ * apart from the others in it */
+static void bps_filter_rebuild(gdbstub_bps_t *bps)
+{
+    memset(bps->filter, 0, GDBSTUB_BP_FILTER_BITS / 8);
+    for (size_t i = 0; i < (size_t) 1 << bps->bits; i++) {
+        if (bps->slots[i] != GDBSTUB_BP_FREE)
+            bps_filter_set(bps, bps->slots[i]);
+    }
+    bps->nr_stale = 0;
+}
+
+/* The free slot for addr in slots, laid out for bps->bits */
+static size_t bps_place(size_t *slots, gdbstub_bps_t *bps, size_t addr)
+{
+    size_t mask = ((size_t) 1 << bps->bits) - 1;
+    size_t i = gdbstub_bp_slot(bps, addr);
+
+    while (slots[i] != GDBSTUB_BP_FREE)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static bool bps_grow(gdbstub_bps_t *bps)
+{
+    if (!bps->filter) {
+        bps->filter = calloc(GDBSTUB_BP_FILTER_BITS / 64, sizeof(uint64_t));
+        if (!bps->filter)
+            return false;
+    }
+
+    int old_bits = bps->bits;
+    int bits = old_bits ? old_bits + 1 : BPS_MIN_BITS;
+    size_t *slots = malloc(sizeof(size_t) << bits);
+    gdbstub_bp_cond_t **conds = NULL;
+    if (bps->conds)
+        conds = calloc((size_t) 1 << bits, sizeof(gdbstub_bp_cond_t *));
+    if (!slots || (bps->conds && !conds)) {
+        free(slots);
+        free(conds);
+        return false;
+    }
+
+    /* Every byte of GDBSTUB_BP_FREE is 0xff */
+    memset(slots, 0xff, sizeof(size_t) << bits);
+    bps->bits = bits;
+    if (old_bits) {
+        for (size_t i = 0; i < (size_t) 1 << old_bits; i++) {
+            if (bps->slots[i] == GDBSTUB_BP_FREE)
+                continue;
+            size_t j = bps_place(slots, bps, bps->slots[i]);
+            slots[j] = bps->slots[i];
+            if (conds)
+                conds[j] = bps->conds[i];
+        }
+    }
+    free(bps->slots);
+    free(bps->conds);
+    bps->slots = slots;
+    bps->conds = conds;
+    return true;
+}
+
+/* The slot holding addr, or -1 */
+static ssize_t bps_find(gdbstub_bps_t *bps, size_t addr)
+{
+    if (!bps->nr)
+        return -1;
+
+    size_t mask = ((size_t) 1 << bps->bits) - 1;
+    for (size_t i = gdbstub_bp_slot(bps, addr);; i = (i + 1) & mask) {
+        if (bps->slots[i] == addr)
+            return i;
+        if (bps->slots[i] == GDBSTUB_BP_FREE)
+            return -1;
+    }
+}
+
+int bps_insert(gdbstub_bps_t *bps, size_t addr, gdbstub_bp_cond_t *cond)
+{
+    if (addr == GDBSTUB_BP_FREE)
+        return EINVAL;
+
+    ssize_t found = bps_find(bps, addr);
+    /* Keep the table at most half full, so that probes stay short */
+    if (found < 0 && (bps->nr + 1) * 2 > ((size_t) 1 << bps->bits) &&
+        !bps_grow(bps))
+        return ENOMEM;
+    if (cond && !bps->conds) {
+        bps->conds = calloc((size_t) 1 << bps->bits,
+                            sizeof(gdbstub_bp_cond_t *));
+        if (!bps->conds)
+            return ENOMEM;
+    }
+
+    size_t i = found;
+    if (found < 0) {
+        i = bps_place(bps->slots, bps, addr);
+        bps->slots[i] = addr;
+        bps->nr++;
+        bps_filter_set(bps, addr);
+    }
+    if (bps->conds) {
+        bps_cond_free(bps->conds[i]);
+        bps->conds[i] = cond;
+    }
+    return 0;
+}
+
+bool bps_remove(gdbstub_bps_t *bps, size_t addr)
+{
+    ssize_t found = bps_find(bps, addr);
+    if (found < 0)
+        return false;
+
+    /* Shift the entries after it back, so that no probe stops early at
+     * the hole: an entry moves unless its own slot lies between the hole
+     * and where it is, cyclically */
+    size_t mask = ((size_t) 1 << bps->bits) - 1;
+    size_t hole = found;
+    if (bps->conds)
+        bps_cond_free(bps->conds[hole]);
+    for (size_t i = (hole + 1) & mask; bps->slots[i] != GDBSTUB_BP_FREE;
+         i = (i + 1) & mask) {
+        size_t home = gdbstub_bp_slot(bps, bps->slots[i]);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            bps->slots[hole] = bps->slots[i];
+            if (bps->conds)
+                bps->conds[hole] = bps->conds[i];
+            hole = i;
+        }
+    }
+    bps->slots[hole] = GDBSTUB_BP_FREE;
+    if (bps->conds)
+        bps->conds[hole] = NULL;
+    bps->nr--;
+
+    /* GDB removes and adds all of them at every stop by default, so the
+     * rebuilds are kept to one for as many removals as are left */
+    if (++bps->nr_stale > bps->nr)
+        bps_filter_rebuild(bps);
+    return true;
+}
+
+void bps_destroy(gdbstub_bps_t *bps)
+{
+    if (bps->conds) {
+        for (size_t i = 0; i < (size_t) 1 << bps->bits; i++)
+            bps_cond_free(bps->conds[i]);
+    }
+    free(bps->conds);
+    free(bps->filter);
+    free(bps->slots);
+    memset(bps, 0, sizeof(*bps));
+}
@@ -2,16 +2,26 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <poll.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#include "conn_uring.h"
 #include "utils/csum.h"
 #include "utils/log.h"
+#include "utils/rle.h"
+#include "utils/translate.h"
 
 static bool socket_poll(int socket_fd, int timeout, int events)
 {
@@ -23,19 +33,195 @@ static bool socket_poll(int socket_fd, int timeout, int events)
     return (poll(&pfd, 1, timeout) > 0) && (pfd.revents & events);
 }
 
-static bool socket_writable(int socket_fd, int timeout)
+static bool socket_writable(conn_t *conn, int timeout)
+{
+    conn->nr_send_syscalls++;
+    return socket_poll(conn->socket_fd, timeout, POLLOUT);
+}
+
+#ifdef __linux__
+static bool conn_wake_init(conn_t *conn)
+{
+    conn->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (conn->epoll_fd < 0)
+        return false;
+
+    conn->wake_rfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (conn->wake_rfd < 0)
+        goto epoll_fail;
+    conn->wake_wfd = conn->wake_rfd;
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = conn->wake_rfd};
+    if (epoll_ctl(conn->epoll_fd, EPOLL_CTL_ADD, conn->wake_rfd, &ev) < 0)
+        goto eventfd_fail;
+
+    return true;
+
+eventfd_fail:
+    close(conn->wake_rfd);
+epoll_fail:
+    close(conn->epoll_fd);
+    return false;
+}
+
+static void conn_wake_destroy(conn_t *conn)
 {
-    return socket_poll(socket_fd, timeout, POLLOUT);
+    close(conn->wake_rfd);
+    close(conn->epoll_fd);
+}
+
+int conn_wait(conn_t *conn, int events)
+{
+#ifdef CONFIG_IO_URING
+    if (conn->uring)
+        return conn_uring_wait(conn, events);
+#endif
+
+    /* Unwatch the socket rather than asking for no event, as epoll would
+     * still report a hang up over and over */
+    if (events != conn->wait_events) {
+        struct epoll_event ev = {
+            .events = ((events & CONN_READABLE) ? EPOLLIN : 0) |
+                      ((events & CONN_WRITABLE) ? EPOLLOUT : 0),
+            .data.fd = conn->socket_fd,
+        };
+        int op = !events              ? EPOLL_CTL_DEL
+                 : !conn->wait_events ? EPOLL_CTL_ADD
+                                      : EPOLL_CTL_MOD;
+        conn->nr_recv_syscalls++;
+        if (epoll_ctl(conn->epoll_fd, op, conn->socket_fd, &ev) < 0)
+            return -1;
+        conn->wait_events = events;
+    }
+
+    struct epoll_event evs[2];
+    conn->nr_recv_syscalls++;
+    int nfds = epoll_wait(conn->epoll_fd, evs, 2, -1);
+    if (nfds < 0)
+        return -1;
+
+    int ret = 0;
+    for (int i = 0; i < nfds; i++) {
+        if (evs[i].data.fd == conn->wake_rfd) {
+            uint64_t count;
+            conn->nr_recv_syscalls++;
+            if (read(conn->wake_rfd, &count, sizeof(count)) < 0 &&
+                errno != EAGAIN)
+                return -1;
+            ret |= CONN_WOKEN;
+            continue;
+        }
+
+        /* A hang up or an error shows up on the next recv or send */
+        if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            ret |= events & CONN_READABLE;
+        if (evs[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+            ret |= events & CONN_WRITABLE;
+    }
+    return ret;
+}
+
+void conn_wake(conn_t *conn)
+{
+    uint64_t one = 1;
+    /* Fails only if the counter would overflow, a wakeup is pending then */
+    (void) !write(conn->wake_wfd, &one, sizeof(one));
+}
+#else
+static bool conn_wake_init(conn_t *conn)
+{
+    int fds[2];
+    if (pipe(fds) < 0)
+        return false;
+
+    for (int i = 0; i < 2; i++) {
+        if (fcntl(fds[i], F_SETFL, O_NONBLOCK) < 0 ||
+            fcntl(fds[i], F_SETFD, FD_CLOEXEC) < 0) {
+            close(fds[0]);
+            close(fds[1]);
+            return false;
+        }
+    }
+
+    conn->epoll_fd = -1;
+    conn->wake_rfd = fds[0];
+    conn->wake_wfd = fds[1];
+    return true;
+}
+
+static void conn_wake_destroy(conn_t *conn)
+{
+    close(conn->wake_rfd);
+    close(conn->wake_wfd);
+}
+
+int conn_wait(conn_t *conn, int events)
+{
+    /* poll() skips a negative fd, so a hang up is not reported over and over
+     * while we do not watch the socket */
+    struct pollfd pfds[2] = {
+        {
+            .fd = events ? conn->socket_fd : -1,
+            .events = ((events & CONN_READABLE) ? POLLIN : 0) |
+                      ((events & CONN_WRITABLE) ? POLLOUT : 0),
+        },
+        {.fd = conn->wake_rfd, .events = POLLIN},
+    };
+    conn->wait_events = events;
+
+    conn->nr_recv_syscalls++;
+    if (poll(pfds, 2, -1) < 0)
+        return -1;
+
+    int ret = 0;
+    if (pfds[1].revents) {
+        char buf[64];
+        do
+            conn->nr_recv_syscalls++;
+        while (read(conn->wake_rfd, buf, sizeof(buf)) > 0);
+        ret |= CONN_WOKEN;
+    }
+    if (pfds[0].revents & ~POLLOUT)
+        ret |= events & CONN_READABLE;
+    if (pfds[0].revents & ~POLLIN)
+        ret |= events & CONN_WRITABLE;
+    return ret;
+}
+
+void conn_wake(conn_t *conn)
+{
+    /* Fails only if the pipe is full, a wakeup is pending then */
+    (void) !write(conn->wake_wfd, "", 1);
+}
+#endif
+
+ssize_t conn_recv(conn_t *conn, pktbuf_t *pktbuf)
+{
+#ifdef CONFIG_IO_URING
+    if (conn->uring)
+        return conn_uring_recv(conn, pktbuf);
+#endif
+
+    conn->nr_recv_syscalls++;
+    return pktbuf_fill_from_file(pktbuf, conn->socket_fd);
 }
 
 bool conn_init(conn_t *conn, char *addr_str, int port)
 {
-    if (pthread_mutex_init(&conn->send_mutex, NULL) != 0)
+    if (!outq_init(&conn->outq, CONN_OUTQ_SLOTS))
         return false;
+    conn->writing = false;
+    conn->want_writable = false;
 
     /* Initialize protocol state */
     conn->no_ack_mode = false;
     conn->failure_count = 0;
+    memset(&conn->reply, 0, sizeof(conn->reply));
+    conn->rle = false;
+    conn->wait_events = 0;
+    conn->uring = NULL;
+    conn->nr_recv_syscalls = 0;
+    conn->nr_send_syscalls = 0;
 
     int optval = 1;
     struct in_addr addr_ip;
@@ -47,7 +233,7 @@ bool conn_init(conn_t *conn, char *addr_str, int port)
         addr.sin_port = htons(port);
         conn->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
         if (conn->listen_fd < 0)
-            goto mutex_fail;
+            goto outq_fail;
 
         if (setsockopt(conn->listen_fd, SOL_SOCKET, SO_REUSEADDR, &optval,
                        sizeof(optval)) < 0) {
@@ -67,7 +253,7 @@ bool conn_init(conn_t *conn, char *addr_str, int port)
         unlink(addr_str);
         conn->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
         if (conn->listen_fd < 0)
-            goto mutex_fail;
+            goto outq_fail;
 
         if (bind(conn->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) <
             0) {
@@ -92,105 +278,341 @@ bool conn_init(conn_t *conn, char *addr_str, int port)
         warn("Set TCP_NODELAY fail.\n");
     }
 
+    if (!conn_wake_init(conn)) {
+        warn("Create wakeup fail.\n");
+        goto socket_fail;
+    }
+
+#ifdef CONFIG_IO_URING
+    if (!conn_set_io_uring(conn, true))
+        warn("io_uring unavailable, fall back to poll.\n");
+#endif
+
     return true;
 
+socket_fail:
+    close(conn->socket_fd);
 fail:
     close(conn->listen_fd);
-mutex_fail:
-    pthread_mutex_destroy(&conn->send_mutex);
+outq_fail:
+    outq_destroy(&conn->outq);
     return false;
 }
 
 /* Timeout for socket write operations (milliseconds).
- * Prevents indefinite blocking if connection is congested or broken. */
+ * A frame which cannot be queued for that long is dropped, and so are the
+ * queued ones when the connection is closed. */
 #define CONN_SEND_TIMEOUT_MS 5000
 #define CONN_SEND_POLL_MS 100
 
-static bool __conn_send_str(conn_t *conn, char *str, size_t timeout)
+/* Frames sent by a single system call at most */
+#define CONN_SEND_BATCH 64
+
+/* Send what is queued without ever blocking, adjacent frames together.
+ * Return false if the socket cannot take more for now. Only the holder of
+ * the writer role may call this. */
+static bool __conn_send_queued(conn_t *conn)
+{
+    struct iovec iov[CONN_SEND_BATCH];
+    int iovcnt;
+
+    while ((iovcnt = outq_peek(&conn->outq, iov, CONN_SEND_BATCH)) > 0) {
+        size_t total = 0;
+        for (int i = 0; i < iovcnt; i++)
+            total += iov[i].iov_len;
+
+        ssize_t nsent;
+#ifdef CONFIG_IO_URING
+        if (conn->uring) {
+            nsent = conn_uring_send(conn, iov, iovcnt);
+        } else
+#endif
+        {
+            struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+            conn->nr_send_syscalls++;
+            nsent = sendmsg(conn->socket_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (nsent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                nsent = 0;
+        }
+
+        if (nsent < 0) {
+            if (errno == EINTR)
+                continue;
+            nsent = total; /* Fatal error, nobody is going to read these */
+        }
+
+        outq_consume(&conn->outq, nsent);
+        if ((size_t) nsent < total)
+            return false;
+    }
+    return true;
+}
+
+void conn_flush(conn_t *conn)
+{
+    /* Whoever holds the writer role sends for everyone. A frame queued
+     * while it is held is either seen by the holder after it gives the
+     * role up, or finds the role free here. */
+    while (outq_pending(&conn->outq)) {
+        if (__atomic_exchange_n(&conn->writing, true, __ATOMIC_SEQ_CST))
+            return;
+
+        bool done = __conn_send_queued(conn);
+        __atomic_store_n(&conn->writing, false, __ATOMIC_SEQ_CST);
+
+        /* Let the reader thread wait until the socket takes more */
+        if (!done) {
+            if (!__atomic_exchange_n(&conn->want_writable, true,
+                                     __ATOMIC_SEQ_CST))
+                conn_wake(conn);
+            return;
+        }
+    }
+}
+
+bool conn_want_writable(conn_t *conn)
+{
+    return __atomic_load_n(&conn->want_writable, __ATOMIC_SEQ_CST);
+}
+
+void conn_on_writable(conn_t *conn)
+{
+    __atomic_store_n(&conn->want_writable, false, __ATOMIC_SEQ_CST);
+    conn_flush(conn);
+}
+
+/* Flush until the ring is empty or timeout ms pass without the socket
+ * taking anything */
+static bool conn_drain(conn_t *conn, size_t timeout)
 {
-    size_t len = strlen(str);
     size_t total_waited = 0;
 
-    /* Use short timeout for non-blocking send */
-    while (len > 0) {
-        if (!socket_writable(conn->socket_fd, CONN_SEND_POLL_MS)) {
+    conn_flush(conn);
+    while (outq_pending(&conn->outq)) {
+        if (!socket_writable(conn, CONN_SEND_POLL_MS)) {
             total_waited += CONN_SEND_POLL_MS;
             if (total_waited >= timeout)
                 return false;
-            continue; /* Retry until timeout */
+            continue;
         }
+        total_waited = 0;
+        conn_flush(conn);
+    }
+    return true;
+}
 
-        ssize_t nwrite = write(conn->socket_fd, str, len);
-        if (nwrite == -1) {
-            if ((errno == EINTR) ||
-                (timeout && (errno == EAGAIN || errno == EWOULDBLOCK))) {
-                continue;
+/* Push a frame, waiting for the socket to take older ones while the ring
+ * is full */
+static bool conn_queue(conn_t *conn, char **buf, size_t *cap, size_t len)
+{
+    size_t total_waited = 0;
+
+    while (true) {
+        bool ok = cap && len > OUTQ_INLINE_SIZE
+                      ? outq_push_buf(&conn->outq, buf, cap, len)
+                      : outq_push(&conn->outq, *buf, len);
+        if (ok)
+            return true;
+
+        conn_flush(conn);
+        if (!socket_writable(conn, CONN_SEND_POLL_MS)) {
+            total_waited += CONN_SEND_POLL_MS;
+            if (total_waited >= CONN_SEND_TIMEOUT_MS) {
+                warn("Send timeout, frame dropped\n");
+                return false;
             }
-            return false; /* Fatal error */
         }
-        str += nwrite;
-        len -= nwrite;
-        total_waited = 0; /* Reset wait time after successful write */
     }
+}
 
-    return true;
+bool conn_queue_str(conn_t *conn, char *str)
+{
+    return conn_queue(conn, &str, NULL, strlen(str));
 }
 
-bool conn_try_send_str(conn_t *conn, char *str)
+void conn_send_str(conn_t *conn, char *str)
 {
-    /* Try to acquire mutex without blocking.
-     * This prevents priority inversion where the reader thread
-     * blocks on send_mutex while trying to send ACKs. */
-    if (pthread_mutex_trylock(&conn->send_mutex) != 0)
-        return false; /* Mutex held by another thread */
+    if (conn_queue_str(conn, str))
+        conn_flush(conn);
+}
 
-    bool ret = __conn_send_str(conn, str, 0);
+void conn_send_pktstr(conn_t *conn, char *pktstr)
+{
+    conn_reply_begin(conn);
+    conn_reply_append_str(conn, pktstr);
+    conn_reply_send(conn);
+}
 
-    pthread_mutex_unlock(&conn->send_mutex);
-    return ret;
+void conn_set_packet_size(conn_t *conn, size_t size)
+{
+    conn->reply.max_size = size;
 }
 
-void conn_send_str(conn_t *conn, char *str)
+void conn_set_rle(conn_t *conn, bool enable)
 {
-    pthread_mutex_lock(&conn->send_mutex);
+    conn->rle = enable;
+}
 
-    __conn_send_str(conn, str, CONN_SEND_TIMEOUT_MS);
+bool conn_set_io_uring(conn_t *conn, bool enable)
+{
+#ifdef CONFIG_IO_URING
+    if (enable == (conn->uring != NULL))
+        return true;
+    if (!enable) {
+        conn_uring_destroy(conn);
+        return true;
+    }
+    return conn_uring_init(conn);
+#else
+    (void) conn;
+    return !enable;
+#endif
+}
 
-    pthread_mutex_unlock(&conn->send_mutex);
+void conn_reply_begin(conn_t *conn)
+{
+    conn_reply_t *reply = &conn->reply;
+
+    reply->len = 1; /* the leading '$' */
+    reply->csum = 0;
+    reply->overflow = false;
 }
 
-void conn_send_pktstr(conn_t *conn, char *pktstr)
+/* The number of payload bytes which can still be appended */
+size_t conn_reply_room(conn_t *conn)
+{
+    conn_reply_t *reply = &conn->reply;
+    size_t used = reply->len + 1 + CSUM_SIZE;
+
+    if (reply->overflow || used >= reply->max_size)
+        return 0;
+    return reply->max_size - used;
+}
+
+/* Make room for len more payload bytes and return where they go, or NULL if
+ * they do not fit in the packet size */
+static char *conn_reply_reserve(conn_t *conn, size_t len)
+{
+    conn_reply_t *reply = &conn->reply;
+
+    if (len > conn_reply_room(conn)) {
+        reply->overflow = true;
+        return NULL;
+    }
+
+    /* The trailing "#xx" goes in place as well, and hex_to_str() adds a
+     * terminating '\0' to the checksum */
+    size_t need = reply->len + len + 1 + CSUM_SIZE + 1;
+    if (need > reply->cap) {
+        size_t cap = reply->cap ? reply->cap : 256;
+        while (cap < need)
+            cap <<= 1;
+
+        char *buf = realloc(reply->buf, cap);
+        if (!buf) {
+            reply->overflow = true;
+            return NULL;
+        }
+        buf[0] = '$';
+        reply->buf = buf;
+        reply->cap = cap;
+    }
+
+    return reply->buf + reply->len;
+}
+
+void conn_reply_append_bin(conn_t *conn, const void *data, size_t len)
 {
-    char packet[MAX_SEND_PACKET_SIZE];
-    size_t len = strlen(pktstr);
+    conn_reply_t *reply = &conn->reply;
+    char *dst = conn_reply_reserve(conn, len);
+    if (!dst)
+        return;
+
+    memcpy(dst, data, len);
+    reply->csum += compute_checksum(dst, len);
+    reply->len += len;
+}
 
-    /* 2: '$' + '#'
-     * 2: checksum digits(maximum)
-     * 1: '\0' */
-    assert(len + 2 + CSUM_SIZE + 1 < MAX_SEND_PACKET_SIZE);
+void conn_reply_append_str(conn_t *conn, const char *str)
+{
+    conn_reply_append_bin(conn, str, strlen(str));
+}
 
-    packet[0] = '$';
-    memcpy(packet + 1, pktstr, len);
-    packet[len + 1] = '#';
+void conn_reply_append_hex(conn_t *conn, const void *data, size_t len)
+{
+    conn_reply_t *reply = &conn->reply;
+    char *dst = conn_reply_reserve(conn, len * 2);
+    if (!dst)
+        return;
+
+    hex_to_str((uint8_t *) data, dst, len);
+    reply->csum += compute_checksum(dst, len * 2);
+    reply->len += len * 2;
+}
 
-    char csum_str[4];
-    uint8_t csum = compute_checksum(pktstr, len);
-    size_t csum_len = snprintf(csum_str, sizeof(csum_str) - 1, "%02x", csum);
-    assert(csum_len == CSUM_SIZE);
-    memcpy(packet + len + 2, csum_str, csum_len);
-    packet[len + 2 + csum_len] = '\0';
+size_t conn_reply_append_escaped(conn_t *conn, const void *data, size_t len)
+{
+    conn_reply_t *reply = &conn->reply;
+    size_t room = conn_reply_room(conn);
+    size_t str_len;
+
+    /* Each byte takes two characters at worst */
+    char *dst = conn_reply_reserve(conn, len < room / 2 ? len * 2 : room);
+    if (!dst)
+        return 0;
+
+    len = escape(data, len, dst, room, &str_len);
+    reply->csum += compute_checksum(dst, str_len);
+    reply->len += str_len;
+    return len;
+}
+
+void conn_reply_send(conn_t *conn)
+{
+    conn_reply_t *reply = &conn->reply;
+
+    /* An empty reply may not have any buffer yet */
+    conn_reply_reserve(conn, 0);
+    if (reply->overflow) {
+        warn("Reply does not fit in %zu bytes\n", reply->max_size);
+        conn_reply_begin(conn);
+        conn_reply_append_str(conn, REPLY_OVERFLOW_ERR);
+        if (reply->overflow)
+            return;
+    }
+
+    if (conn->rle)
+        reply->len = 1 + rle_encode(reply->buf + 1, reply->len - 1,
+                                    &reply->csum);
+
+    char *trailer = reply->buf + reply->len;
+    trailer[0] = '#';
+    hex_to_str(&reply->csum, &trailer[1], sizeof(uint8_t));
+    size_t len = reply->len + 1 + CSUM_SIZE;
 
 #ifdef DEBUG
-    printf("send packet = %s,", packet);
-    printf(" checksum = %d\n", csum);
+    printf("send packet = %.*s,", (int) len, reply->buf);
+    printf(" checksum = %d\n", reply->csum);
 #endif
-    conn_send_str(conn, packet);
+    /* A large frame is handed over rather than copied, and the buffer of
+     * an older one comes back for the next reply */
+    if (!conn_queue(conn, &reply->buf, &reply->cap, len))
+        return;
+    if (reply->buf)
+        reply->buf[0] = '$';
+
+    conn_flush(conn);
 }
 
-
 void conn_close(conn_t *conn)
 {
+    if (!conn_drain(conn, CONN_SEND_TIMEOUT_MS))
+        warn("Send timeout, frames dropped\n");
+
+    conn_set_io_uring(conn, false);
+    conn_wake_destroy(conn);
     close(conn->socket_fd);
     close(conn->listen_fd);
-    pthread_mutex_destroy(&conn->send_mutex);
+    outq_destroy(&conn->outq);
+    free(conn->reply.buf);
 }
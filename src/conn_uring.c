@@ -0,0 +1,279 @@
+#ifdef CONFIG_IO_URING
+
+#include "conn_uring.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "uring.h"
+
+#define RECV_RING_ENTRIES 8
+#define SEND_RING_ENTRIES 2
+
+/* Buffers for the multishot recv, each completion takes one of them */
+#define RECV_NR_BUFS 32
+#define RECV_BUF_SIZE (8 * 1024)
+#define RECV_BGID 0
+
+enum {
+    URING_RECV,
+    URING_WAKE,
+    URING_WRITABLE,
+};
+
+struct conn_uring {
+    uring_t recv_ring; /* used by the reader thread only */
+    uring_bufs_t bufs;
+    bool recv_armed;
+    bool wake_armed;
+    bool writable_armed;
+
+    /* Received buffers not yet copied into the pktbuf_t, oldest first */
+    struct {
+        uint16_t bid;
+        uint32_t len;
+    } pending[RECV_NR_BUFS];
+    unsigned pending_head;
+    unsigned pending_tail;
+    uint32_t pending_off; /* bytes of the oldest one already copied */
+    int recv_err;
+    bool recv_eof;
+
+    uring_t send_ring; /* used by the holder of the writer role */
+};
+
+bool conn_uring_init(conn_t *conn)
+{
+    struct conn_uring *uring = calloc(1, sizeof(struct conn_uring));
+    if (!uring)
+        return false;
+
+    if (!uring_init(&uring->recv_ring, RECV_RING_ENTRIES))
+        goto uring_fail;
+
+    if (!uring_bufs_init(&uring->bufs, &uring->recv_ring, RECV_BGID,
+                         RECV_NR_BUFS, RECV_BUF_SIZE))
+        goto recv_ring_fail;
+
+    if (!uring_init(&uring->send_ring, SEND_RING_ENTRIES))
+        goto bufs_fail;
+
+    conn->uring = uring;
+    return true;
+
+bufs_fail:
+    uring_bufs_destroy(&uring->bufs, &uring->recv_ring);
+recv_ring_fail:
+    uring_destroy(&uring->recv_ring);
+uring_fail:
+    free(uring);
+    return false;
+}
+
+void conn_uring_destroy(conn_t *conn)
+{
+    struct conn_uring *uring = conn->uring;
+
+    /* Closing the ring cancels the multishot requests */
+    uring_destroy(&uring->send_ring);
+    uring_bufs_destroy(&uring->bufs, &uring->recv_ring);
+    uring_destroy(&uring->recv_ring);
+    free(uring);
+    conn->uring = NULL;
+}
+
+/* Get an SQE, submitting the ones queued so far to make room if the ring
+ * is full. Return NULL with errno set if there is still none. */
+static struct io_uring_sqe *conn_uring_get_sqe(uring_t *ring,
+                                               size_t *nr_syscalls)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(ring);
+    if (sqe)
+        return sqe;
+
+    (*nr_syscalls)++;
+    if (uring_submit(ring, 0) < 0)
+        return NULL;
+    sqe = uring_get_sqe(ring);
+    if (!sqe)
+        errno = EBUSY;
+    return sqe;
+}
+
+static unsigned pending_count(struct conn_uring *uring)
+{
+    return uring->pending_tail - uring->pending_head;
+}
+
+static void conn_uring_reap(conn_t *conn, int *ret)
+{
+    struct conn_uring *uring = conn->uring;
+    struct io_uring_cqe *cqe;
+
+    while ((cqe = uring_peek_cqe(&uring->recv_ring))) {
+        bool more = cqe->flags & IORING_CQE_F_MORE;
+
+        if (cqe->user_data == URING_WAKE) {
+            uint64_t count;
+            conn->nr_recv_syscalls++;
+            if (read(conn->wake_rfd, &count, sizeof(count)) < 0 &&
+                errno != EAGAIN)
+                uring->recv_err = errno;
+            *ret |= CONN_WOKEN;
+            uring->wake_armed &= more;
+        } else if (cqe->user_data == URING_WRITABLE) {
+            /* An error shows up on the next send */
+            *ret |= CONN_WRITABLE;
+            uring->writable_armed = false;
+        } else {
+            if (cqe->res > 0) {
+                unsigned idx = uring->pending_tail++ % RECV_NR_BUFS;
+                uring->pending[idx].bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                uring->pending[idx].len = cqe->res;
+            } else if (cqe->res == 0) {
+                uring->recv_eof = true;
+            } else if (cqe->res != -ENOBUFS) {
+                /* Running out of buffers only stops the multishot recv,
+                 * which is armed again once some are given back */
+                uring->recv_err = -cqe->res;
+            }
+            uring->recv_armed &= more;
+        }
+
+        uring_cqe_seen(&uring->recv_ring);
+    }
+}
+
+int conn_uring_wait(conn_t *conn, int events)
+{
+    struct conn_uring *uring = conn->uring;
+    int ret = 0;
+
+    while (true) {
+        conn_uring_reap(conn, &ret);
+        if ((events & CONN_READABLE) &&
+            (pending_count(uring) || uring->recv_eof || uring->recv_err))
+            ret |= CONN_READABLE;
+        ret &= events | CONN_WOKEN;
+        if (ret)
+            return ret;
+
+        /* Each data completion holds a buffer until it is copied out, so
+         * the recv may only be armed while some buffer is free */
+        if (!uring->recv_armed && !uring->recv_eof && !uring->recv_err &&
+            pending_count(uring) < RECV_NR_BUFS) {
+            struct io_uring_sqe *sqe =
+                conn_uring_get_sqe(&uring->recv_ring, &conn->nr_recv_syscalls);
+            if (!sqe)
+                return -1;
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = conn->socket_fd;
+            sqe->ioprio = IORING_RECV_MULTISHOT;
+            sqe->flags = IOSQE_BUFFER_SELECT;
+            sqe->buf_group = RECV_BGID;
+            sqe->user_data = URING_RECV;
+            uring->recv_armed = true;
+        }
+
+        if (!uring->wake_armed) {
+            struct io_uring_sqe *sqe =
+                conn_uring_get_sqe(&uring->recv_ring, &conn->nr_recv_syscalls);
+            if (!sqe)
+                return -1;
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = conn->wake_rfd;
+            sqe->poll32_events = POLLIN;
+            sqe->len = IORING_POLL_ADD_MULTI;
+            sqe->user_data = URING_WAKE;
+            uring->wake_armed = true;
+        }
+
+        if ((events & CONN_WRITABLE) && !uring->writable_armed) {
+            struct io_uring_sqe *sqe =
+                conn_uring_get_sqe(&uring->recv_ring, &conn->nr_recv_syscalls);
+            if (!sqe)
+                return -1;
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = conn->socket_fd;
+            sqe->poll32_events = POLLOUT;
+            sqe->user_data = URING_WRITABLE;
+            uring->writable_armed = true;
+        }
+
+        conn->nr_recv_syscalls++;
+        if (uring_submit(&uring->recv_ring, 1) < 0)
+            return -1;
+    }
+}
+
+ssize_t conn_uring_recv(conn_t *conn, pktbuf_t *pktbuf)
+{
+    struct conn_uring *uring = conn->uring;
+
+    if (!pending_count(uring)) {
+        if (uring->recv_err) {
+            errno = uring->recv_err;
+            return -1;
+        }
+        if (uring->recv_eof)
+            return 0;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    unsigned idx = uring->pending_head % RECV_NR_BUFS;
+    uint16_t bid = uring->pending[idx].bid;
+    uint32_t left = uring->pending[idx].len - uring->pending_off;
+    uint8_t *data = uring_bufs_get(&uring->bufs, bid) + uring->pending_off;
+
+    ssize_t ncopy = pktbuf_fill_from_mem(pktbuf, data, left);
+    if (ncopy < 0)
+        return -1;
+
+    uring->pending_off += ncopy;
+    if (uring->pending_off == uring->pending[idx].len) {
+        uring_bufs_recycle(&uring->bufs, bid);
+        uring->pending_head++;
+        uring->pending_off = 0;
+    }
+    return ncopy;
+}
+
+ssize_t conn_uring_send(conn_t *conn, struct iovec *iov, int iovcnt)
+{
+    uring_t *ring = &conn->uring->send_ring;
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = iovcnt};
+
+    /* One sendmsg rather than a send per iovec, which would put each of
+     * them in its own segment */
+    struct io_uring_sqe *sqe =
+        conn_uring_get_sqe(ring, &conn->nr_send_syscalls);
+    if (!sqe)
+        return -1;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->socket_fd;
+    sqe->addr = (uint64_t) (uintptr_t) &msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+
+    struct io_uring_cqe *cqe;
+    do {
+        conn->nr_send_syscalls++;
+        if (uring_submit(ring, 1) < 0 && errno != EINTR)
+            return -1;
+    } while (!(cqe = uring_peek_cqe(ring)));
+
+    int res = cqe->res;
+    uring_cqe_seen(ring);
+
+    if (res == -EAGAIN)
+        return 0;
+    if (res < 0) {
+        errno = -res;
+        return -1;
+    }
+    return res;
+}
+
+#endif
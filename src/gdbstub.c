@@ -1,26 +1,48 @@
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
-#include <poll.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "bps.h"
+#include "cmd_table.h"
 #include "conn.h"
 #include "gdb_signal.h"
 #include "gdbstub.h"
+#include "memcache.h"
 #include "packet.h"
 #include "pktqueue.h"
 #include "regbuf.h"
-#include "utils/csum.h"
+#include "regcache.h"
+#include "tdesc.h"
+#include "trace.h"
 #include "utils/log.h"
+#include "utils/parse.h"
 #include "utils/translate.h"
+#include "watch.h"
 
-/* Poll timeout for reader thread (milliseconds) */
-#define READER_POLL_TIMEOUT_MS 100
+/* Maximum consecutive checksum failures before disconnecting */
+#define CONN_MAX_FAILURES 50
+
+/* The name of a q, Q or v packet ends at the first of these, e.g.
+ * "qSupported:...", "qRcmd,..." and "vCont;c" */
+#define CMD_NAME_END ":;,"
+
+/* The most memory ranges taken from get_dirty_ranges() after a resume */
+#define MAX_DIRTY_RANGES 64
+
+typedef struct {
+    char type; /* 'q', 'Q' or 'v' */
+    char *name;
+    gdbstub_handler_t handler;
+} user_cmd_t;
 
 struct gdbstub_private {
     conn_t conn;
     regbuf_t regbuf;
+    pktbuf_t pktbuf; /* Filled by the reader, released by the main thread */
     pktqueue_t pktqueue;
 
     pthread_t tid;
@@ -29,8 +51,27 @@ struct gdbstub_private {
     bool async_io_enable;
     void *args;
 
-    /* Cached register size totals (computed once at init) */
-    size_t total_reg_bytes;
+    /* Registers read since the target last ran, and the CPU selected by
+     * 'H' they are kept for, -1 if not known */
+    regcache_t regcache;
+    int cur_cpu;
+
+    tdesc_t tdesc; /* Served by qXfer:features:read */
+
+    /* Memory read since the target last ran, see gdbstub_set_mem_cache() */
+    memcache_t memcache;
+
+    size_t packet_size; /* Advertised as PacketSize, the framing left out */
+
+    /* The tracepoints and the frames they collected */
+    trace_t trace;
+
+    /* The addresses vCont;r steps through, end excluded */
+    size_t range_start, range_end;
+
+    /* q, Q and v packets added by gdbstub_register_handler() */
+    user_cmd_t *cmds;
+    int nr_cmds;
 };
 
 static inline void async_io_enable(struct gdbstub_private *priv)
@@ -48,98 +89,152 @@ static inline bool async_io_is_enable(struct gdbstub_private *priv)
     return __atomic_load_n(&priv->async_io_enable, __ATOMIC_RELAXED);
 }
 
+/* Frame complete packets, the checksum is verified on the way, and hand
+ * them over to the main thread until its queue is full. Return false if
+ * the peer is given up on. */
+static bool socket_reader_frame(gdbstub_t *gdbstub)
+{
+    struct gdbstub_private *priv = gdbstub->priv;
+    conn_t *conn = &priv->conn;
+    pktbuf_t *pktbuf = &priv->pktbuf;
+
+    while (!pktqueue_is_full(&priv->pktqueue) && pktbuf_is_complete(pktbuf)) {
+        packet_t pkt;
+        if (!pktbuf_pop_packet(pktbuf, &pkt))
+            break;
+
+        bool ack = !__atomic_load_n(&conn->no_ack_mode, __ATOMIC_RELAXED);
+        if (!pkt.csum_ok) {
+            pktbuf_discard(pktbuf);
+            if (ack)
+                conn_send_str(conn, STR_NACK);
+            if (++conn->failure_count >= CONN_MAX_FAILURES) {
+                warn("Too many consecutive failures (%d), disconnecting\n",
+                     conn->failure_count);
+                return false;
+            }
+            continue; /* Wait for retransmission */
+        }
+        conn->failure_count = 0;
+
+        /* ACK before the main thread may reply to the packet, so GDB
+         * never sees the reply first. An idle main thread handles the
+         * packet right away, so the ACK can go out with the reply. */
+        if (ack) {
+            if (pktqueue_is_idle(&priv->pktqueue))
+                conn_queue_str(conn, STR_ACK);
+            else
+                conn_send_str(conn, STR_ACK);
+        }
+        pktqueue_push(&priv->pktqueue, &pkt);
+    }
+
+    /* Interrupts are signaled after the packets received before them */
+    if (pktbuf->nr_intr) {
+        pktbuf->nr_intr = 0;
+        if (async_io_is_enable(priv) && gdbstub->ops->on_interrupt)
+            gdbstub->ops->on_interrupt(priv->args);
+        pktqueue_signal_interrupt(&priv->pktqueue);
+    }
+    return true;
+}
+
 /* Reader thread: sole owner of all recv() calls on the socket.
  *
- * This thread reads from the socket, assembles complete packets,
- * pushes them to the queue, and detects interrupt characters (0x03).
+ * This thread reads from the socket, assembles and verifies complete
+ * packets, answers them with '+'/'-', pushes them to the queue, and detects
+ * interrupt characters (0x03).
  */
 static void *socket_reader(void *arg)
 {
     gdbstub_t *gdbstub = (gdbstub_t *) arg;
     struct gdbstub_private *priv = gdbstub->priv;
-    int socket_fd = priv->conn.socket_fd;
-    pktbuf_t pktbuf;
-
-    if (!pktbuf_init(&pktbuf)) {
-        pktqueue_signal_shutdown(&priv->pktqueue);
-        return NULL;
-    }
-
-    struct pollfd pfd = {.fd = socket_fd, .events = POLLIN};
+    conn_t *conn = &priv->conn;
+    pktbuf_t *pktbuf = &priv->pktbuf;
 
     while (!__atomic_load_n(&priv->thread_stop, __ATOMIC_RELAXED)) {
-        int result = poll(&pfd, 1, READER_POLL_TIMEOUT_MS);
+        /* Complete packets are left in the ring while the queue is full,
+         * and framed as soon as the main thread pops some. Nothing more is
+         * read until then, as the framing assumes every complete packet
+         * before the one being framed is handed over. */
+        bool stalled = pktqueue_is_full(&priv->pktqueue);
+        if (stalled && !pktqueue_want_space(&priv->pktqueue))
+            goto frame;
+
+        /* Stop reading while the ring is full of packets which are not yet
+         * released by the main thread, which wakes us up on the next
+         * release. It also wakes us up on a pop from a full queue, and
+         * gdbstub_close() wakes us up as well. */
+        int events = 0;
+        if (!stalled &&
+            (pktbuf_has_space(pktbuf) || !pktbuf_want_release(pktbuf)))
+            events |= CONN_READABLE;
+        if (conn_want_writable(conn))
+            events |= CONN_WRITABLE;
+        int result = conn_wait(conn, events);
 
         if (result < 0) {
             if (errno == EINTR)
                 continue;
-            perror("poll error in socket_reader");
+            perror("wait error in socket_reader");
             break;
         }
 
-        if (result == 0)
-            continue; /* Timeout, check thread_stop */
-
-        if (!(pfd.revents & POLLIN))
-            continue;
+        if (result & CONN_WRITABLE)
+            conn_on_writable(conn);
 
-        /* Read available data into buffer */
-        ssize_t nread = pktbuf_fill_from_file(&pktbuf, socket_fd);
+        if (result & CONN_READABLE) {
+            /* Read available data into buffer */
+            ssize_t nread = conn_recv(conn, pktbuf);
 
-        if (nread == 0) {
-            /* EOF - clean disconnect */
-            break;
-        }
+            if (nread == 0) {
+                /* EOF - clean disconnect */
+                break;
+            }
 
-        if (nread < 0) {
-            if (errno == EINTR)
-                continue;
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-                continue;
             /* Fatal error: ECONNRESET, EPIPE, etc. */
-            break;
+            if (nread < 0 && errno != EINTR && errno != EAGAIN &&
+                errno != EWOULDBLOCK && errno != ENOBUFS)
+                break;
         }
 
-        /* Check for interrupt character in the received data.
-         * The interrupt char (0x03) can appear outside packet framing,
-         * so we scan the raw buffer before packet assembly. */
-        uint8_t *buf_start = pktbuf.data + pktbuf.size - nread;
-        for (ssize_t i = 0; i < nread; i++) {
-            if (buf_start[i] == INTR_CHAR) {
-                /* Signal interrupt to main thread */
-                if (async_io_is_enable(priv) && gdbstub->ops->on_interrupt) {
-                    gdbstub->ops->on_interrupt(priv->args);
-                }
-                pktqueue_signal_interrupt(&priv->pktqueue);
-            }
-        }
-
-        /* Process complete packets */
-        while (pktbuf_is_complete(&pktbuf)) {
-            packet_t *pkt = pktbuf_pop_packet(&pktbuf);
-            if (pkt) {
-                /* Push to queue first, only ACK after successful push.
-                 * This ensures ACK timing reflects actual packet acceptance. */
-                if (pktqueue_push(&priv->pktqueue, pkt)) {
-                    /* Use non-blocking send for ACK to prevent priority
-                     * inversion. If main thread holds send_mutex, ACK is
-                     * skipped and GDB will retransmit on timeout. This
-                     * keeps the reader thread responsive for interrupts. */
-                    conn_try_send_str(&priv->conn, STR_ACK);
-                } else {
-                    /* Allocation failure - free packet, skip ACK.
-                     * GDB will timeout and retransmit. */
-                    free(pkt);
-                }
-            }
-        }
+    frame:
+        if (!socket_reader_frame(gdbstub))
+            break;
     }
 
-    pktbuf_destroy(&pktbuf);
     pktqueue_signal_shutdown(&priv->pktqueue);
     return NULL;
 }
 
+/* The size of each register comes from its descriptor, else from
+ * get_reg_bytes() */
+static bool regcache_setup(gdbstub_t *gdbstub)
+{
+    arch_info_t *arch = &gdbstub->arch;
+    size_t *reg_bytes = NULL;
+
+    if (arch->reg_num > 0) {
+        if (!arch->reg_descs && !gdbstub->ops->get_reg_bytes)
+            return false;
+        reg_bytes = malloc(arch->reg_num * sizeof(size_t));
+        if (!reg_bytes)
+            return false;
+    }
+
+    for (int i = 0; i < arch->reg_num; i++) {
+        if (arch->reg_descs)
+            reg_bytes[i] = (size_t) (arch->reg_descs[i].bitsize + 7) / 8;
+        else
+            reg_bytes[i] = gdbstub->ops->get_reg_bytes(i);
+    }
+
+    bool ret = regcache_init(&gdbstub->priv->regcache, reg_bytes,
+                             arch->reg_num, arch->smp ? arch->smp : 1);
+    free(reg_bytes);
+    return ret;
+}
+
 bool gdbstub_init(gdbstub_t *gdbstub,
                   struct target_ops *ops,
                   arch_info_t arch,
@@ -151,16 +246,21 @@ bool gdbstub_init(gdbstub_t *gdbstub,
         return false;
 
     memset(gdbstub, 0, sizeof(gdbstub_t));
+    translate_init();
     gdbstub->ops = ops;
     gdbstub->arch = arch;
-    gdbstub->priv = calloc(1, sizeof(struct gdbstub_private));
-    if (gdbstub->priv == NULL)
+    /* Aligned for pktqueue_t, which keeps its producer and consumer sides
+     * on cache lines of their own */
+    void *priv;
+    if (posix_memalign(&priv, _Alignof(struct gdbstub_private),
+                       sizeof(struct gdbstub_private)))
         return false;
+    memset(priv, 0, sizeof(struct gdbstub_private));
+    gdbstub->priv = priv;
 
-    /* Precompute total register storage size (register sizes are constant) */
-    gdbstub->priv->total_reg_bytes = 0;
-    for (int i = 0; i < arch.reg_num; i++)
-        gdbstub->priv->total_reg_bytes += ops->get_reg_bytes(i);
+    gdbstub->priv->packet_size = GDBSTUB_DEFAULT_PACKET_SIZE;
+    memcache_init(&gdbstub->priv->memcache, 0, 0); /* off, cannot fail */
+    trace_init(&gdbstub->priv->trace);
 
     /* Parse address string (format: "host:port" or "path") */
     addr_str = strdup(s);
@@ -181,17 +281,36 @@ bool gdbstub_init(gdbstub_t *gdbstub,
     if (!regbuf_init(&gdbstub->priv->regbuf))
         goto addr_fail;
 
-    if (!pktqueue_init(&gdbstub->priv->pktqueue))
+    /* Register sizes are constant, so their layout is computed once */
+    if (!regcache_setup(gdbstub))
         goto regbuf_fail;
 
+    if (!tdesc_init(&gdbstub->priv->tdesc, &gdbstub->arch))
+        goto regcache_fail;
+
+    if (!pktbuf_init(&gdbstub->priv->pktbuf,
+                     PKTBUF_CAP_FOR(gdbstub->priv->packet_size)))
+        goto tdesc_fail;
+
+    if (!pktqueue_init(&gdbstub->priv->pktqueue))
+        goto pktbuf_fail;
+
     if (!conn_init(&gdbstub->priv->conn, addr_str, port))
         goto pktqueue_fail;
+    conn_set_packet_size(&gdbstub->priv->conn,
+                         gdbstub->priv->packet_size + PACKET_OVERHEAD);
 
     free(addr_str);
     return true;
 
 pktqueue_fail:
     pktqueue_destroy(&gdbstub->priv->pktqueue);
+pktbuf_fail:
+    pktbuf_destroy(&gdbstub->priv->pktbuf);
+tdesc_fail:
+    tdesc_destroy(&gdbstub->priv->tdesc);
+regcache_fail:
+    regcache_destroy(&gdbstub->priv->regcache);
 regbuf_fail:
     regbuf_destroy(&gdbstub->priv->regbuf);
 addr_fail:
@@ -202,13 +321,221 @@ priv_fail:
     return false;
 }
 
+bool gdbstub_set_packet_size(gdbstub_t *gdbstub, size_t size)
+{
+    struct gdbstub_private *priv = gdbstub->priv;
+
+    if (size < GDBSTUB_MIN_PACKET_SIZE || size > GDBSTUB_MAX_PACKET_SIZE ||
+        priv->reader_running)
+        return false;
+
+    /* Nothing has been received yet, so the ring can simply be replaced */
+    pktbuf_t pktbuf;
+    if (!pktbuf_init(&pktbuf, PKTBUF_CAP_FOR(size)))
+        return false;
+    pktbuf_destroy(&priv->pktbuf);
+    priv->pktbuf = pktbuf;
+
+    priv->packet_size = size;
+    conn_set_packet_size(&priv->conn, size + PACKET_OVERHEAD);
+    return true;
+}
+
+void gdbstub_set_rle(gdbstub_t *gdbstub, bool enable)
+{
+    conn_set_rle(&gdbstub->priv->conn, enable);
+}
+
+bool gdbstub_set_io_uring(gdbstub_t *gdbstub, bool enable)
+{
+    struct gdbstub_private *priv = gdbstub->priv;
+
+    if (priv->reader_running)
+        return false;
+    return conn_set_io_uring(&priv->conn, enable);
+}
+
+void gdbstub_get_io_stats(gdbstub_t *gdbstub, gdbstub_io_stats_t *stats)
+{
+    conn_t *conn = &gdbstub->priv->conn;
+
+    stats->nr_recv_syscalls = conn->nr_recv_syscalls;
+    stats->nr_send_syscalls = conn->nr_send_syscalls;
+}
+
+bool gdbstub_set_mem_cache(gdbstub_t *gdbstub, size_t line_size, int nr_lines)
+{
+    struct gdbstub_private *priv = gdbstub->priv;
+
+    if (priv->reader_running)
+        return false;
+    if (line_size != 0 &&
+        (line_size < GDBSTUB_MIN_MEM_CACHE_LINE ||
+         line_size > GDBSTUB_MAX_MEM_CACHE_LINE ||
+         (line_size & (line_size - 1)) || nr_lines <= 0 ||
+         (nr_lines & (nr_lines - 1))))
+        return false;
+
+    memcache_t memcache;
+    if (!memcache_init(&memcache, line_size, nr_lines))
+        return false;
+    memcache_destroy(&priv->memcache);
+    priv->memcache = memcache;
+    return true;
+}
+
+void gdbstub_get_mem_stats(gdbstub_t *gdbstub, gdbstub_mem_stats_t *stats)
+{
+    memcache_t *memcache = &gdbstub->priv->memcache;
+
+    stats->nr_hits = memcache->nr_hits;
+    stats->nr_misses = memcache->nr_misses;
+}
+
+bool gdbstub_register_handler(gdbstub_t *gdbstub,
+                              char type,
+                              const char *name,
+                              gdbstub_handler_t handler)
+{
+    struct gdbstub_private *priv = gdbstub->priv;
+    size_t name_len = strlen(name);
+
+    if ((type != 'q' && type != 'Q' && type != 'v') || !name_len ||
+        name[strcspn(name, CMD_NAME_END)] || !handler)
+        return false;
+
+    /* The stub's own commands are found first and cannot be replaced */
+    if (cmd_lookup(type, name, name_len) != CMD_NONE)
+        return false;
+
+    for (int i = 0; i < priv->nr_cmds; i++) {
+        if (priv->cmds[i].type == type && !strcmp(priv->cmds[i].name, name)) {
+            priv->cmds[i].handler = handler;
+            return true;
+        }
+    }
+
+    user_cmd_t *cmds =
+        realloc(priv->cmds, (priv->nr_cmds + 1) * sizeof(user_cmd_t));
+    if (!cmds)
+        return false;
+    priv->cmds = cmds;
+
+    char *dup = strdup(name);
+    if (!dup)
+        return false;
+
+    cmds[priv->nr_cmds++] = (user_cmd_t){
+        .type = type,
+        .name = dup,
+        .handler = handler,
+    };
+    return true;
+}
+
+void gdbstub_send_reply(gdbstub_t *gdbstub, const char *reply)
+{
+    conn_t *conn = &gdbstub->priv->conn;
+
+    conn_reply_begin(conn);
+    conn_reply_append_str(conn, reply);
+    conn_reply_send(conn);
+}
+
 #define SEND_ERR(gdbstub, err) conn_send_pktstr(&gdbstub->priv->conn, err)
 #define SEND_EPERM(gdbstub) SEND_ERR(gdbstub, "E01")
 #define SEND_EINVAL(gdbstub) SEND_ERR(gdbstub, "E22")
 
-static gdb_event_t process_cont(gdbstub_t *gdbstub)
+/* Reply with the error code returned by a target operation */
+static void send_errno(gdbstub_t *gdbstub, int err)
+{
+    char err_str[16];
+    snprintf(err_str, sizeof(err_str), "E%d", err);
+    conn_send_pktstr(&gdbstub->priv->conn, err_str);
+}
+
+/* Tell GDB the target stopped, and at which watchpoint if one was hit, so
+ * that it does not have to find out */
+static void send_stop_reply(gdbstub_t *gdbstub)
+{
+    static const char *watch_names[] = {
+        [WP_WRITE] = "watch",
+        [WP_READ] = "rwatch",
+        [WP_ACCESS] = "awatch",
+    };
+    const gdbstub_watches_t *watches = &gdbstub->watches;
+    char packet_str[64];
+
+    if (watches->hit)
+        snprintf(packet_str, sizeof(packet_str), "T%02x%s:%zx;",
+                 GDB_SIGNAL_TRAP, watch_names[watches->hit_type],
+                 watches->hit_addr);
+    else
+        snprintf(packet_str, sizeof(packet_str), "S%02x", GDB_SIGNAL_TRAP);
+    conn_send_pktstr(&gdbstub->priv->conn, packet_str);
+}
+
+/* Every packet is handled by one of these, picked by its first byte. The
+ * payload is what follows that byte, terminated where the checksum was;
+ * len does not count the terminator. */
+typedef gdb_event_t (*packet_handler_t)(gdbstub_t *gdbstub,
+                                        char *payload,
+                                        size_t len,
+                                        void *args);
+
+/* Parse the register number of a 'p' or 'P' packet */
+static bool parse_regno(gdbstub_t *gdbstub, parse_t *p, int *regno)
+{
+    uint64_t val;
+
+    if (!parse_hex_u64(p, &val) || val >= (uint64_t) gdbstub->arch.reg_num)
+        return false;
+    *regno = val;
+    return true;
+}
+
+/* Parse the "addr,length" which memory packets begin with */
+static bool parse_addr_len(parse_t *p, uint64_t *addr, uint64_t *len)
+{
+    return parse_hex_u64(p, addr) && parse_expect_char(p, ',') &&
+           parse_hex_u64(p, len);
+}
+
+/* Consume word if it is next */
+static bool parse_keyword(parse_t *p, const char *word)
+{
+    size_t len = strlen(word);
+
+    if (parse_remaining(p) < len || memcmp(p->pos, word, len))
+        return false;
+    p->pos += len;
+    return true;
+}
+
+/* Parse an agent expression, "Xlen,bytes" with the bytes in hex */
+static bool parse_ax_expr(parse_t *p, ax_expr_t *expr)
+{
+    uint64_t len;
+
+    if (!parse_expect_char(p, 'X') || !parse_hex_u64(p, &len) ||
+        !parse_expect_char(p, ',') || parse_remaining(p) / 2 < len)
+        return false;
+    expr->code = malloc(len ? len : 1);
+    if (!expr->code)
+        return false;
+    str_to_hex((char *) p->pos, expr->code, len);
+    expr->len = len;
+    p->pos += 2 * len;
+    return true;
+}
+
+static gdb_event_t process_cont(gdbstub_t *gdbstub,
+                                char *payload,
+                                size_t len,
+                                void *args)
 {
     gdb_event_t event = EVENT_NONE;
+    (void) payload, (void) len, (void) args;
 
     if (gdbstub->ops->cont != NULL)
         event = EVENT_CONT;
@@ -218,9 +545,13 @@ static gdb_event_t process_cont(gdbstub_t *gdbstub)
     return event;
 }
 
-static gdb_event_t process_stepi(gdbstub_t *gdbstub)
+static gdb_event_t process_stepi(gdbstub_t *gdbstub,
+                                 char *payload,
+                                 size_t len,
+                                 void *args)
 {
     gdb_event_t event = EVENT_NONE;
+    (void) payload, (void) len, (void) args;
 
     if (gdbstub->ops->stepi != NULL)
         event = EVENT_STEP;
@@ -230,173 +561,289 @@ static gdb_event_t process_stepi(gdbstub_t *gdbstub)
     return event;
 }
 
-static void process_reg_read(gdbstub_t *gdbstub, void *args)
+/* Forget what was read from the target, which may have changed it all */
+static void gdbstub_invalidate_caches(gdbstub_t *gdbstub)
+{
+    regcache_invalidate(&gdbstub->priv->regcache);
+    memcache_invalidate(&gdbstub->priv->memcache);
+}
+
+/* The register file the packets refer to: the one of the CPU selected by
+ * 'H', or the scratch one when that CPU is unknown, which is not kept */
+static int regcache_cpu(gdbstub_t *gdbstub)
+{
+    regcache_t *cache = &gdbstub->priv->regcache;
+    int cpu = gdbstub->priv->cur_cpu;
+
+    if (cpu < 0 || cpu >= cache->nr_cpus) {
+        cpu = regcache_scratch(cache);
+        regcache_drop_cpu(cache, cpu);
+    }
+    return cpu;
+}
+
+/* Read the registers of cpu missing in the cache from the target, regno or
+ * all of them if regno is -1. Return zero or an errno. */
+static int regcache_fetch(gdbstub_t *gdbstub, int cpu, int regno, void *args)
 {
-    char packet_str[MAX_SEND_PACKET_SIZE];
+    regcache_t *cache = &gdbstub->priv->regcache;
+    uint8_t *regs = regcache_regs(cache, cpu);
+
+    if (!regs)
+        return ENOMEM;
+    if (gdbstub->ops->read_reg == NULL && gdbstub->ops->read_regs == NULL)
+        return EPERM;
+    if (regno < 0 ? regcache_all_valid(cache, cpu)
+                  : regcache_valid(cache, cpu, regno))
+        return 0;
+
+    /* The whole register file in one call if the target can */
+    if (gdbstub->ops->read_regs != NULL &&
+        (regno < 0 || gdbstub->ops->read_reg == NULL)) {
+        int ret =
+            gdbstub->ops->read_regs(args, regs, regcache_size(cache));
+        if (ret)
+            return ret;
+        regcache_set_all_valid(cache, cpu);
+        return 0;
+    }
 
-    for (int i = 0; i < gdbstub->arch.reg_num; i++) {
-        size_t reg_sz = gdbstub->ops->get_reg_bytes(i);
-        void *reg_value = regbuf_get(&gdbstub->priv->regbuf, reg_sz);
+    int first = regno < 0 ? 0 : regno;
+    int last = regno < 0 ? cache->reg_num : regno + 1;
+    for (int i = first; i < last; i++) {
+        if (regcache_valid(cache, cpu, i))
+            continue;
 
-        int ret = gdbstub->ops->read_reg(args, i, reg_value);
+        int ret = gdbstub->ops->read_reg(args, i, &regs[cache->offset[i]]);
 #ifdef DEBUG
-        char debug_hex[MAX_SEND_PACKET_SIZE];
-        hex_to_str((uint8_t *) reg_value, debug_hex, reg_sz);
+        size_t reg_sz = cache->offset[i + 1] - cache->offset[i];
+        char debug_hex[2 * reg_sz + 1];
+        hex_to_str(&regs[cache->offset[i]], debug_hex, reg_sz);
         printf("reg read = regno %d data 0x%s (size %zu)\n", i, debug_hex,
                reg_sz);
 #endif
-        if (!ret) {
-            hex_to_str((uint8_t *) reg_value, &packet_str[i * reg_sz * 2],
-                       reg_sz);
-        } else {
-            sprintf(packet_str, "E%d", ret);
-            break;
-        }
+        if (ret)
+            return ret;
+        regcache_set_valid(cache, cpu, i);
     }
+    return 0;
+}
 
-    conn_send_pktstr(&gdbstub->priv->conn, packet_str);
+/* Reply to 'g', or to 'p' for regno, with the registers collected in the
+ * selected trace frame */
+static void trace_regs_reply(gdbstub_t *gdbstub, int regno)
+{
+    trace_t *trace = &gdbstub->priv->trace;
+    regcache_t *cache = &gdbstub->priv->regcache;
+    conn_t *conn = &gdbstub->priv->conn;
+    size_t size = regcache_size(cache);
+    uint8_t *regs = regbuf_get(&gdbstub->priv->regbuf, size);
+
+    if (!regs) {
+        send_errno(gdbstub, ENOMEM);
+        return;
+    }
+    if (!trace_frame_regs(&trace->buf, &trace->frame, regs, size)) {
+        SEND_EPERM(gdbstub);
+        return;
+    }
+
+    conn_reply_begin(conn);
+    if (regno < 0)
+        conn_reply_append_hex(conn, regs, size);
+    else
+        conn_reply_append_hex(conn, regs + cache->offset[regno],
+                              cache->offset[regno + 1] - cache->offset[regno]);
+    conn_reply_send(conn);
+}
+
+static gdb_event_t process_reg_read(gdbstub_t *gdbstub,
+                                    char *payload,
+                                    size_t len,
+                                    void *args)
+{
+    (void) payload, (void) len;
+    if (gdbstub->ops->read_reg == NULL && gdbstub->ops->read_regs == NULL) {
+        SEND_EPERM(gdbstub);
+        return EVENT_NONE;
+    }
+
+    if (gdbstub->priv->trace.selected) {
+        trace_regs_reply(gdbstub, -1);
+        return EVENT_NONE;
+    }
+
+    conn_t *conn = &gdbstub->priv->conn;
+    regcache_t *cache = &gdbstub->priv->regcache;
+    int cpu = regcache_cpu(gdbstub);
+
+    int ret = regcache_fetch(gdbstub, cpu, -1, args);
+    if (ret) {
+        send_errno(gdbstub, ret);
+        return EVENT_NONE;
+    }
+
+    conn_reply_begin(conn);
+    conn_reply_append_hex(conn, regcache_regs(cache, cpu),
+                          regcache_size(cache));
+    conn_reply_send(conn);
+    return EVENT_NONE;
 }
 
-static void process_reg_read_one(gdbstub_t *gdbstub, char *payload, void *args)
+static gdb_event_t process_reg_read_one(gdbstub_t *gdbstub,
+                                        char *payload,
+                                        size_t len,
+                                        void *args)
 {
-    char packet_str[MAX_SEND_PACKET_SIZE];
+    if (gdbstub->ops->read_reg == NULL && gdbstub->ops->read_regs == NULL) {
+        SEND_EPERM(gdbstub);
+        return EVENT_NONE;
+    }
+
+    conn_t *conn = &gdbstub->priv->conn;
+    regcache_t *cache = &gdbstub->priv->regcache;
+    parse_t p;
     int regno;
 
-    assert(sscanf(payload, "%x", &regno) == 1);
-    size_t reg_sz = gdbstub->ops->get_reg_bytes(regno);
-    void *reg_value = regbuf_get(&gdbstub->priv->regbuf, reg_sz);
+    parse_init(&p, payload, len);
+    if (!parse_regno(gdbstub, &p, &regno) || !parse_at_end(&p)) {
+        SEND_EINVAL(gdbstub);
+        return EVENT_NONE;
+    }
+    if (gdbstub->priv->trace.selected) {
+        trace_regs_reply(gdbstub, regno);
+        return EVENT_NONE;
+    }
 
-    int ret = gdbstub->ops->read_reg(args, regno, reg_value);
-#ifdef DEBUG
-    char debug_hex[MAX_SEND_PACKET_SIZE];
-    hex_to_str((uint8_t *) reg_value, debug_hex, reg_sz);
-    printf("reg read = regno %d data 0x%s (size %zu)\n", regno, debug_hex,
-           reg_sz);
-#endif
-    if (!ret) {
-        hex_to_str((uint8_t *) reg_value, packet_str, reg_sz);
-    } else {
-        sprintf(packet_str, "E%d", ret);
+    int cpu = regcache_cpu(gdbstub);
+    int ret = regcache_fetch(gdbstub, cpu, regno, args);
+    if (ret) {
+        send_errno(gdbstub, ret);
+        return EVENT_NONE;
     }
-    conn_send_pktstr(&gdbstub->priv->conn, packet_str);
+
+    conn_reply_begin(conn);
+    conn_reply_append_hex(conn,
+                          regcache_regs(cache, cpu) + cache->offset[regno],
+                          cache->offset[regno + 1] - cache->offset[regno]);
+    conn_reply_send(conn);
+    return EVENT_NONE;
 }
 
-static void process_reg_write(gdbstub_t *gdbstub, char *payload, void *args)
+/* A target may not keep what is written to a register as is, think of a
+ * hardwired zero register, so a write drops the cached value rather than
+ * updating it, and the next read gets it from the target again. */
+static gdb_event_t process_reg_write(gdbstub_t *gdbstub,
+                                     char *payload,
+                                     size_t len,
+                                     void *args)
 {
-    int reg_num = gdbstub->arch.reg_num;
+    if (gdbstub->ops->write_reg == NULL && gdbstub->ops->write_regs == NULL) {
+        SEND_EPERM(gdbstub);
+        return EVENT_NONE;
+    }
 
-    /* Use cached total_reg_bytes computed at init time */
-    size_t total_reg_bytes = gdbstub->priv->total_reg_bytes;
-    size_t expected_hex_len = total_reg_bytes * 2;
+    regcache_t *cache = &gdbstub->priv->regcache;
+    size_t total_reg_bytes = regcache_size(cache);
 
     if (total_reg_bytes == 0) {
         conn_send_pktstr(&gdbstub->priv->conn, "OK");
-        return;
+        return EVENT_NONE;
     }
 
     /* Validate payload length matches expected register count */
-    size_t payload_len = strlen(payload);
-    if (payload_len != expected_hex_len) {
+    if (len != total_reg_bytes * 2) {
         conn_send_pktstr(&gdbstub->priv->conn, "E22"); /* EINVAL */
-        return;
+        return EVENT_NONE;
     }
 
-    /* Allocate storage for new values and backup (for rollback) */
-    uint8_t *new_values = malloc(total_reg_bytes);
-    uint8_t *backup_values = malloc(total_reg_bytes);
-    if (!new_values || !backup_values) {
-        free(new_values);
-        free(backup_values);
+    uint8_t *new_values = regbuf_get(&gdbstub->priv->regbuf, total_reg_bytes);
+    if (!new_values) {
         conn_send_pktstr(&gdbstub->priv->conn, "E12"); /* ENOMEM */
-        return;
+        return EVENT_NONE;
     }
+    str_to_hex(payload, new_values, total_reg_bytes);
 
-    /* Parse all new values and save current values for rollback */
-    size_t payload_offset = 0;
-    size_t storage_offset = 0;
-    for (int i = 0; i < reg_num; i++) {
-        size_t reg_sz = gdbstub->ops->get_reg_bytes(i);
+    int cpu = regcache_cpu(gdbstub);
+    int ret;
 
-        /* Parse new value from payload */
-        str_to_hex(&payload[payload_offset], &new_values[storage_offset],
-                   reg_sz);
+    /* The target writes all of them or none in one call if it can */
+    if (gdbstub->ops->write_regs != NULL) {
+        ret = gdbstub->ops->write_regs(args, new_values, total_reg_bytes);
+        regcache_drop_cpu(cache, cpu);
+        goto reply;
+    }
 
-        /* Save current value for potential rollback */
-        int ret =
-            gdbstub->ops->read_reg(args, i, &backup_values[storage_offset]);
-        if (ret) {
-            /* Cannot read current state; abort without modifying */
-            free(new_values);
-            free(backup_values);
-            char packet_str[16];
-            sprintf(packet_str, "E%d", ret);
-            conn_send_pktstr(&gdbstub->priv->conn, packet_str);
-            return;
-        }
+    /* Keep the current values in the cache for the rollback */
+    ret = regcache_fetch(gdbstub, cpu, -1, args);
+    if (ret) {
+        /* Cannot read current state; abort without modifying */
+        goto reply;
+    }
+    uint8_t *backup_values = regcache_regs(cache, cpu);
 
+    /* Commit all registers atomically */
+    int failed_regno = -1;
+    for (int i = 0; i < cache->reg_num; i++) {
 #ifdef DEBUG
-        char debug_hex[MAX_SEND_PACKET_SIZE];
-        hex_to_str(&new_values[storage_offset], debug_hex, reg_sz);
+        size_t reg_sz = cache->offset[i + 1] - cache->offset[i];
+        char debug_hex[2 * reg_sz + 1];
+        hex_to_str(&new_values[cache->offset[i]], debug_hex, reg_sz);
         printf("reg write = regno %d data 0x%s (size %zu)\n", i, debug_hex,
                reg_sz);
 #endif
-        payload_offset += reg_sz * 2;
-        storage_offset += reg_sz;
-    }
-
-    /* Commit all registers atomically */
-    storage_offset = 0;
-    int failed_regno = -1;
-    int error_code = 0;
-    for (int i = 0; i < reg_num; i++) {
-        size_t reg_sz = gdbstub->ops->get_reg_bytes(i);
-        int ret = gdbstub->ops->write_reg(args, i, &new_values[storage_offset]);
+        ret = gdbstub->ops->write_reg(args, i, &new_values[cache->offset[i]]);
         if (ret) {
             failed_regno = i;
-            error_code = ret;
             break;
         }
-        storage_offset += reg_sz;
     }
 
     /* Rollback on failure */
     if (failed_regno >= 0) {
         /* Restore all registers written before the failure */
-        storage_offset = 0;
-        for (int i = 0; i < failed_regno; i++) {
-            size_t reg_sz = gdbstub->ops->get_reg_bytes(i);
-            gdbstub->ops->write_reg(args, i, &backup_values[storage_offset]);
-            storage_offset += reg_sz;
-        }
-        free(new_values);
-        free(backup_values);
-        char packet_str[16];
-        sprintf(packet_str, "E%d", error_code);
-        conn_send_pktstr(&gdbstub->priv->conn, packet_str);
-        return;
+        for (int i = 0; i < failed_regno; i++)
+            gdbstub->ops->write_reg(args, i,
+                                    &backup_values[cache->offset[i]]);
     }
+    regcache_drop_cpu(cache, cpu);
 
-    free(new_values);
-    free(backup_values);
-    conn_send_pktstr(&gdbstub->priv->conn, "OK");
+reply:
+    if (ret)
+        send_errno(gdbstub, ret);
+    else
+        conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_NONE;
 }
 
-static void process_reg_write_one(gdbstub_t *gdbstub, char *payload, void *args)
+static gdb_event_t process_reg_write_one(gdbstub_t *gdbstub,
+                                         char *payload,
+                                         size_t len,
+                                         void *args)
 {
-    int regno;
-    char *regno_str = payload;
-    char *data_str = strchr(payload, '=');
-    if (data_str) {
-        *data_str = '\0';
-        data_str++;
+    if (gdbstub->ops->write_reg == NULL) {
+        SEND_EPERM(gdbstub);
+        return EVENT_NONE;
     }
 
-    assert(sscanf(regno_str, "%x", &regno) == 1);
-    size_t reg_sz = gdbstub->ops->get_reg_bytes(regno);
-    void *data = regbuf_get(&gdbstub->priv->regbuf, reg_sz);
+    regcache_t *cache = &gdbstub->priv->regcache;
+    parse_t p;
+    int regno;
+
+    parse_init(&p, payload, len);
+    if (!parse_regno(gdbstub, &p, &regno) || !parse_expect_char(&p, '=')) {
+        SEND_EINVAL(gdbstub);
+        return EVENT_NONE;
+    }
 
-    assert(strlen(data_str) == reg_sz * 2);
+    size_t reg_sz = cache->offset[regno + 1] - cache->offset[regno];
+    if (parse_remaining(&p) != reg_sz * 2) {
+        SEND_EINVAL(gdbstub);
+        return EVENT_NONE;
+    }
 
+    char *data_str = (char *) p.pos;
+    void *data = regbuf_get(&gdbstub->priv->regbuf, reg_sz);
     str_to_hex(data_str, (uint8_t *) data, reg_sz);
 #ifdef DEBUG
     printf("reg write = regno %d data 0x%s (size %zu)\n", regno, data_str,
@@ -404,208 +851,442 @@ static void process_reg_write_one(gdbstub_t *gdbstub, char *payload, void *args)
 #endif
 
     int ret = gdbstub->ops->write_reg(args, regno, data);
+    regcache_drop_reg(cache, regcache_cpu(gdbstub), regno);
 
-    if (!ret) {
+    if (!ret)
         conn_send_pktstr(&gdbstub->priv->conn, "OK");
-    } else {
-        char packet_str[MAX_SEND_PACKET_SIZE];
-        sprintf(packet_str, "E%d", ret);
-        conn_send_pktstr(&gdbstub->priv->conn, packet_str);
-    }
+    else
+        send_errno(gdbstub, ret);
+    return EVENT_NONE;
 }
 
-static void process_mem_read(gdbstub_t *gdbstub, char *payload, void *args)
+/* Read memory through the cache when it is on, a whole line being read
+ * from the target on a miss */
+static int mem_read(gdbstub_t *gdbstub,
+                    uint64_t addr,
+                    size_t len,
+                    uint8_t *buf,
+                    void *args)
 {
-    size_t maddr, mlen;
-    assert(sscanf(payload, "%lx,%lx", &maddr, &mlen) == 2);
-#ifdef DEBUG
-    printf("mem read = addr %lx / len %lx\n", maddr, mlen);
-#endif
-    char packet_str[MAX_SEND_PACKET_SIZE];
+    memcache_t *cache = &gdbstub->priv->memcache;
+    uint64_t end = addr + len;
+
+    if (!memcache_enabled(cache) || len == 0 || end < addr)
+        return gdbstub->ops->read_mem(args, addr, len, buf);
+
+    uint64_t first = memcache_line_addr(cache, addr);
+    uint64_t nr = (end - 1 - first) / cache->line_size + 1;
+    for (uint64_t i = 0; i < nr; i++) {
+        uint64_t line_addr = first + i * cache->line_size;
+        uint8_t *line = memcache_find(cache, line_addr);
+        if (!line) {
+            line = memcache_slot(cache, line_addr);
+            /* The line may reach further than readable memory, e.g. past
+             * the end of RAM, so only the request itself is read then */
+            if (gdbstub->ops->read_mem(args, line_addr, cache->line_size,
+                                       line))
+                return gdbstub->ops->read_mem(args, addr, len, buf);
+            memcache_set_valid(cache, line_addr);
+        }
 
-    uint8_t *mval = malloc(mlen);
-    int ret = gdbstub->ops->read_mem(args, maddr, mlen, mval);
-    if (!ret) {
-        hex_to_str(mval, packet_str, mlen);
-    } else {
-        sprintf(packet_str, "E%d", ret);
+        uint64_t from = addr > line_addr ? addr : line_addr;
+        uint64_t to = end - line_addr < cache->line_size
+                          ? end
+                          : line_addr + cache->line_size;
+        memcpy(buf + (from - addr), line + (from - line_addr), to - from);
     }
-    conn_send_pktstr(&gdbstub->priv->conn, packet_str);
-    free(mval);
+    return 0;
 }
 
-static void process_mem_write(gdbstub_t *gdbstub, char *payload, void *args)
+/* The memory at addr if the target lets it be accessed in place */
+static uint8_t *mem_ptr(gdbstub_t *gdbstub,
+                        uint64_t addr,
+                        size_t len,
+                        void *args)
 {
-    size_t maddr, mlen;
-    char *content = strchr(payload, ':');
-    if (content) {
-        *content = '\0';
-        content++;
-    }
-    assert(sscanf(payload, "%lx,%lx", &maddr, &mlen) == 2);
-#ifdef DEBUG
-    printf("mem write = addr %lx / len %lx\n", maddr, mlen);
-    printf("mem write = content %s\n", content);
-#endif
-    uint8_t *mval = malloc(mlen);
-    str_to_hex(content, mval, mlen);
-    int ret = gdbstub->ops->write_mem(args, maddr, mlen, mval);
+    void *ptr;
 
-    if (!ret) {
-        conn_send_pktstr(&gdbstub->priv->conn, "OK");
-    } else {
-        char packet_str[MAX_SEND_PACKET_SIZE];
-        sprintf(packet_str, "E%d", ret);
-        conn_send_pktstr(&gdbstub->priv->conn, packet_str);
+    if (gdbstub->ops->get_mem_ptr == NULL || len == 0 ||
+        addr + len < addr ||
+        !gdbstub->ops->get_mem_ptr(args, addr, len, &ptr))
+        return NULL;
+    return ptr;
+}
+
+/* Read memory from the selected trace frame, as much of len as it has at
+ * addr. What is read-only is read from the target if the frame does not
+ * have it. */
+static int trace_mem_read(gdbstub_t *gdbstub,
+                          uint64_t addr,
+                          uint64_t *len,
+                          uint8_t *buf,
+                          void *args)
+{
+    trace_t *trace = &gdbstub->priv->trace;
+    size_t n = trace_frame_mem(&trace->buf, &trace->frame, addr, *len, buf);
+
+    if (n || !*len) {
+        *len = n;
+        return 0;
+    }
+    for (int i = 0; i < trace->nr_ro; i++) {
+        const mem_range_t *ro = &trace->ro[i];
+        if (addr >= ro->addr && addr - ro->addr <= ro->len &&
+            *len <= ro->len - (addr - ro->addr))
+            return mem_read(gdbstub, addr, *len, buf, args);
     }
-    free(mval);
+    return EFAULT;
 }
 
-static void process_mem_xwrite(gdbstub_t *gdbstub,
-                               char *payload,
-                               uint8_t *packet_end,
-                               void *args)
+/* Reply to 'm' in hex, or to 'x' in binary, which takes half the room
+ * unless the memory is full of bytes to escape */
+static void mem_read_reply(gdbstub_t *gdbstub,
+                           char *payload,
+                           size_t len,
+                           void *args,
+                           bool binary)
 {
-    size_t maddr, mlen;
-    char *content = strchr(payload, ':');
-    if (content) {
-        *content = '\0';
-        content++;
+    if (gdbstub->ops->read_mem == NULL) {
+        SEND_EPERM(gdbstub);
+        return;
     }
-    assert(sscanf(payload, "%lx,%lx", &maddr, &mlen) == 2);
-    assert(unescape(content, (char *) packet_end) == (int) mlen);
-#ifdef DEBUG
-    printf("mem xwrite = addr %lx / len %lx\n", maddr, mlen);
-    for (size_t i = 0; i < mlen; i++) {
-        printf("\tmem xwrite, byte %ld: %x\n", i, content[i]);
+
+    uint64_t maddr, mlen;
+    parse_t p;
+
+    parse_init(&p, payload, len);
+    if (!parse_addr_len(&p, &maddr, &mlen) || !parse_at_end(&p)) {
+        SEND_EINVAL(gdbstub);
+        return;
     }
+#ifdef DEBUG
+    printf("mem read = addr %lx / len %lx\n", maddr, mlen);
 #endif
+    conn_t *conn = &gdbstub->priv->conn;
 
-    gdbstub->ops->write_mem(args, maddr, mlen, content);
-    conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    /* GDB takes a short read and asks for the rest in another packet */
+    conn_reply_begin(conn);
+    size_t room = conn_reply_room(conn);
+    size_t max = binary ? (room ? room - 1 : 0) : room / 2; /* 1: 'b' */
+    if (mlen > max)
+        mlen = max;
+
+    bool in_frame = gdbstub->priv->trace.selected;
+    uint8_t *mval = in_frame ? NULL : mem_ptr(gdbstub, maddr, mlen, args);
+    if (!mval) {
+        mval = regbuf_get(&gdbstub->priv->regbuf, mlen);
+        if (!mval) {
+            send_errno(gdbstub, ENOMEM);
+            return;
+        }
+
+        int ret = in_frame ? trace_mem_read(gdbstub, maddr, &mlen, mval, args)
+                           : mem_read(gdbstub, maddr, mlen, mval, args);
+        if (ret) {
+            send_errno(gdbstub, ret);
+            return;
+        }
+    }
+
+    if (binary) {
+        conn_reply_append_str(conn, "b");
+        conn_reply_append_escaped(conn, mval, mlen);
+    } else {
+        conn_reply_append_hex(conn, mval, mlen);
+    }
+    conn_reply_send(conn);
 }
 
+static gdb_event_t process_mem_read(gdbstub_t *gdbstub,
+                                    char *payload,
+                                    size_t len,
+                                    void *args)
+{
+    mem_read_reply(gdbstub, payload, len, args, false);
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_mem_xread(gdbstub_t *gdbstub,
+                                     char *payload,
+                                     size_t len,
+                                     void *args)
+{
+    mem_read_reply(gdbstub, payload, len, args, true);
+    return EVENT_NONE;
+}
 
-void process_xfer(gdbstub_t *gdbstub, char *s)
+static gdb_event_t process_mem_write(gdbstub_t *gdbstub,
+                                     char *payload,
+                                     size_t len,
+                                     void *args)
 {
-    char *name = s;
-    char *args = strchr(s, ':');
-    if (args) {
-        *args = '\0';
-        args++;
+    if (gdbstub->ops->write_mem == NULL) {
+        SEND_EPERM(gdbstub);
+        return EVENT_NONE;
+    }
+
+    uint64_t maddr, mlen;
+    parse_t p;
+
+    parse_init(&p, payload, len);
+    if (!parse_addr_len(&p, &maddr, &mlen) || !parse_expect_char(&p, ':') ||
+        parse_remaining(&p) / 2 != mlen || parse_remaining(&p) % 2) {
+        SEND_EINVAL(gdbstub);
+        return EVENT_NONE;
     }
+    char *content = (char *) p.pos;
 #ifdef DEBUG
-    printf("xfer = %s %s\n", name, args);
+    printf("mem write = addr %lx / len %lx\n", maddr, mlen);
+    printf("mem write = content %s\n", content);
 #endif
-    if (!strcmp(name, "features") && gdbstub->arch.target_desc != NULL) {
-        /* Check the args */
-        char *action = strtok(args, ":");
-        assert(strcmp(action, "read") == 0);
-        char *annex = strtok(NULL, ":");
-        assert(strcmp(annex, "target.xml") == 0);
-
-        char buf[MAX_SEND_PACKET_SIZE];
-        int offset = 0, length = 0;
-        sscanf(strtok(NULL, ":"), "%x,%x", &offset, &length);
-
-        int total_len = strlen(gdbstub->arch.target_desc);
-        int payload_length =
-            MAX_DATA_PAYLOAD > length ? length : MAX_DATA_PAYLOAD;
-
-        // Determine if the remaining data fits within the buffer
-        buf[0] = (total_len - offset < payload_length) ? 'l' : 'm';
-        snprintf(buf + 1, payload_length, "%s",
-                 gdbstub->arch.target_desc + offset);
-
-        conn_send_pktstr(&gdbstub->priv->conn, buf);
+    int ret = 0;
+    uint8_t *mval = mem_ptr(gdbstub, maddr, mlen, args);
+    if (mval) {
+        str_to_hex(content, mval, mlen);
     } else {
-        conn_send_pktstr(&gdbstub->priv->conn, "");
+        mval = regbuf_get(&gdbstub->priv->regbuf, mlen);
+        if (!mval) {
+            send_errno(gdbstub, ENOMEM);
+            return EVENT_NONE;
+        }
+        str_to_hex(content, mval, mlen);
+        ret = gdbstub->ops->write_mem(args, maddr, mlen, mval);
     }
+    memcache_write(&gdbstub->priv->memcache, maddr, mlen, ret ? NULL : mval);
+
+    if (!ret)
+        conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    else
+        send_errno(gdbstub, ret);
+    return EVENT_NONE;
 }
 
-static void process_query(gdbstub_t *gdbstub, char *payload, void *args)
+static gdb_event_t process_mem_xwrite(gdbstub_t *gdbstub,
+                                      char *payload,
+                                      size_t len,
+                                      void *args)
 {
-    char packet_str[MAX_SEND_PACKET_SIZE];
-    char *name = payload;
-    char *qargs = strchr(payload, ':');
-    if (qargs) {
-        *qargs = '\0';
-        qargs++;
+    if (gdbstub->ops->write_mem == NULL) {
+        SEND_EPERM(gdbstub);
+        return EVENT_NONE;
+    }
+
+    /* It is important for xwrite to know the end position of packet,
+     * because there're escape characters which block us interpreting
+     * the packet as a string just like other packets do. */
+    char *packet_end = payload + len;
+    uint64_t maddr, mlen;
+    parse_t p;
+
+    parse_init(&p, payload, len);
+    if (!parse_addr_len(&p, &maddr, &mlen) || !parse_expect_char(&p, ':') ||
+        unescape_to(p.pos, packet_end, NULL) != mlen) {
+        SEND_EINVAL(gdbstub);
+        return EVENT_NONE;
     }
 #ifdef DEBUG
-    printf("query = %s %s\n", name, qargs);
+    printf("mem xwrite = addr %lx / len %lx\n", maddr, mlen);
 #endif
 
-    if (!strcmp(name, "C")) {
-        if (gdbstub->ops->get_cpu != NULL) {
-            int cpuid = gdbstub->ops->get_cpu(args);
-            sprintf(packet_str, "QC%04d", cpuid);
-            conn_send_pktstr(&gdbstub->priv->conn, packet_str);
-        } else
-            conn_send_pktstr(&gdbstub->priv->conn, "");
-    } else if (!strcmp(name, "Supported")) {
-        if (gdbstub->arch.target_desc != NULL)
-            conn_send_pktstr(
-                &gdbstub->priv->conn,
-                "PacketSize=1024;qXfer:features:read+;QStartNoAckMode+");
-        else
-            conn_send_pktstr(&gdbstub->priv->conn,
-                             "PacketSize=1024;QStartNoAckMode+");
-    } else if (!strcmp(name, "Attached")) {
-        /* assume attached to an existing process */
-        conn_send_pktstr(&gdbstub->priv->conn, "1");
-    } else if (!strcmp(name, "Xfer")) {
-        process_xfer(gdbstub, qargs);
-    } else if (!strcmp(name, "Symbol")) {
-        conn_send_pktstr(&gdbstub->priv->conn, "OK");
-    } else if (!strcmp(name, "fThreadInfo")) {
-        /* Assume at least 1 CPU if user didn't specific
-         * the CPU counts */
-        int smp = gdbstub->arch.smp ? gdbstub->arch.smp : 1;
-        char *ptr;
-        char cpuid_str[6];
-
-        /* Make assumption on the CPU counts, so
-         * that we can use the buffer very simply. */
-        assert(smp < 10000);
-
-        packet_str[0] = 'm';
-        ptr = packet_str + 1;
-        for (int cpuid = 0; cpuid < smp; cpuid++) {
-            sprintf(cpuid_str, "%04d,", cpuid);
-            memcpy(ptr, cpuid_str, 5);
-            ptr += 5;
-        }
-        *ptr = 0;
-        conn_send_pktstr(&gdbstub->priv->conn, packet_str);
-    } else if (!strcmp(name, "sThreadInfo")) {
-        conn_send_pktstr(&gdbstub->priv->conn, "l");
+    /* Unescaped straight to the target memory if it allows */
+    int ret = 0;
+    uint8_t *content = mem_ptr(gdbstub, maddr, mlen, args);
+    if (content) {
+        unescape_to(p.pos, packet_end, content);
     } else {
-        conn_send_pktstr(&gdbstub->priv->conn, "");
+        content = (uint8_t *) p.pos;
+        unescape_to(p.pos, packet_end, content);
+        ret = gdbstub->ops->write_mem(args, maddr, mlen, content);
     }
+    memcache_write(&gdbstub->priv->memcache, maddr, mlen,
+                   ret ? NULL : content);
+
+    if (!ret)
+        conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    else
+        send_errno(gdbstub, ret);
+    return EVENT_NONE;
 }
 
-static void process_general_set(gdbstub_t *gdbstub, char *payload)
+
+/* Handlers of the named q, Q and v packets, found through cmd_lookup().
+ * params is what follows the name and its separator, or "". */
+typedef gdb_event_t (*cmd_handler_t)(gdbstub_t *gdbstub,
+                                     char *params,
+                                     void *args);
+
+#define XFER_FEATURES "features:"
+#define XFER_READ "read:"
+
+static gdb_event_t process_xfer(gdbstub_t *gdbstub, char *params, void *args)
 {
-    char *name = payload;
-    char *qargs = strchr(payload, ':');
-    if (qargs) {
-        *qargs = '\0';
-        qargs++;
-    }
+    conn_t *conn = &gdbstub->priv->conn;
+    tdesc_t *tdesc = &gdbstub->priv->tdesc;
+    uint64_t offset, length;
+    parse_t p;
+    (void) args;
 #ifdef DEBUG
-    printf("general set = %s %s\n", name, qargs);
+    printf("xfer = %s\n", params);
 #endif
 
-    if (!strcmp(name, "StartNoAckMode")) {
-        gdbstub->priv->conn.no_ack_mode = true;
-        conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    if (tdesc->nr_annexes == 0 ||
+        strncmp(params, XFER_FEATURES, strlen(XFER_FEATURES))) {
+        conn_send_pktstr(conn, "");
+        return EVENT_NONE;
+    }
+
+    /* target.xml or one of the features it includes */
+    params += strlen(XFER_FEATURES);
+    if (strncmp(params, XFER_READ, strlen(XFER_READ))) {
+        conn_send_pktstr(conn, "E00");
+        return EVENT_NONE;
+    }
+
+    params += strlen(XFER_READ);
+    char *annex_end = strchr(params, ':');
+    const tdesc_annex_t *annex =
+        annex_end ? tdesc_find(tdesc, params, annex_end - params) : NULL;
+    if (!annex) {
+        conn_send_pktstr(conn, "E00");
+        return EVENT_NONE;
+    }
+
+    params = annex_end + 1;
+    parse_init(&p, params, strlen(params));
+    if (!parse_addr_len(&p, &offset, &length) || !parse_at_end(&p)) {
+        SEND_EINVAL(gdbstub);
+        return EVENT_NONE;
+    }
+
+    conn_reply_begin(conn);
+    size_t room = conn_reply_room(conn) - 1; /* 1: 'l' or 'm' */
+    size_t remain = (offset < annex->len) ? annex->len - offset : 0;
+    const uint8_t *data = (uint8_t *) annex->data + (remain ? offset : 0);
+    size_t str_len;
+
+    // Determine if the remaining data fits within the buffer, escaped
+    size_t fit = escape(data, remain < length ? remain : length, NULL, room,
+                        &str_len);
+    conn_reply_append_str(conn, fit == remain ? "l" : "m");
+    conn_reply_append_escaped(conn, data, fit);
+    conn_reply_send(conn);
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_current_thread(gdbstub_t *gdbstub,
+                                          char *params,
+                                          void *args)
+{
+    conn_t *conn = &gdbstub->priv->conn;
+    (void) params;
+
+    if (gdbstub->ops->get_cpu != NULL) {
+        char packet_str[16];
+        int cpuid = gdbstub->ops->get_cpu(args);
+        snprintf(packet_str, sizeof(packet_str), "QC%04d", cpuid);
+        conn_send_pktstr(conn, packet_str);
+    } else
+        conn_send_pktstr(conn, "");
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_supported(gdbstub_t *gdbstub,
+                                     char *params,
+                                     void *args)
+{
+    conn_t *conn = &gdbstub->priv->conn;
+    char packet_size[32];
+    (void) params, (void) args;
+
+    snprintf(packet_size, sizeof(packet_size), "PacketSize=%zx;",
+             gdbstub->priv->packet_size);
+
+    conn_reply_begin(conn);
+    conn_reply_append_str(conn, packet_size);
+    if (gdbstub->priv->tdesc.nr_annexes > 0)
+        conn_reply_append_str(conn, "qXfer:features:read+;");
+    if (gdbstub->ops->set_bp == NULL)
+        conn_reply_append_str(conn,
+                              "ConditionalBreakpoints+;"
+                              "ConditionalTracepoints+;QTBuffer:size+;"
+                              "tracenz+;");
+    conn_reply_append_str(conn, "binary-upload+;QStartNoAckMode+");
+    conn_reply_send(conn);
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_attached(gdbstub_t *gdbstub,
+                                    char *params,
+                                    void *args)
+{
+    (void) params, (void) args;
+    /* assume attached to an existing process */
+    conn_send_pktstr(&gdbstub->priv->conn, "1");
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_symbol(gdbstub_t *gdbstub, char *params, void *args)
+{
+    (void) params, (void) args;
+    conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_thread_info_first(gdbstub_t *gdbstub,
+                                             char *params,
+                                             void *args)
+{
+    conn_t *conn = &gdbstub->priv->conn;
+    (void) params, (void) args;
+
+    /* Assume at least 1 CPU if user didn't specific
+     * the CPU counts */
+    int smp = gdbstub->arch.smp ? gdbstub->arch.smp : 1;
+    char cpuid_str[6];
+
+    /* Make assumption on the CPU counts, so
+     * that we can use the buffer very simply. */
+    assert(smp < 10000);
+
+    conn_reply_begin(conn);
+    conn_reply_append_str(conn, "m");
+    for (int cpuid = 0; cpuid < smp; cpuid++) {
+        sprintf(cpuid_str, "%04d,", cpuid);
+        conn_reply_append_bin(conn, cpuid_str, 5);
+    }
+    conn_reply_send(conn);
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_thread_info_next(gdbstub_t *gdbstub,
+                                            char *params,
+                                            void *args)
+{
+    (void) params, (void) args;
+    conn_send_pktstr(&gdbstub->priv->conn, "l");
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_start_no_ack_mode(gdbstub_t *gdbstub,
+                                             char *params,
+                                             void *args)
+{
+    (void) params, (void) args;
+    /* Read by the reader thread, which answers the packets */
+    __atomic_store_n(&gdbstub->priv->conn.no_ack_mode, true, __ATOMIC_RELAXED);
+    conn_send_pktstr(&gdbstub->priv->conn, "OK");
 #ifdef DEBUG
-        printf("No-ack mode enabled\n");
+    printf("No-ack mode enabled\n");
 #endif
-    } else {
-        conn_send_pktstr(&gdbstub->priv->conn, "");
-    }
+    return EVENT_NONE;
+}
+
+/* Range stepping needs the PC, and the breakpoints kept by the stub to be
+ * looked up between the steps */
+static bool range_step_supported(gdbstub_t *gdbstub)
+{
+    return gdbstub->ops->stepi != NULL && gdbstub->ops->get_pc != NULL &&
+           gdbstub->ops->set_bp == NULL;
 }
 
 /* Process vCont action (single action only, no thread selectors)
@@ -613,17 +1294,22 @@ static void process_general_set(gdbstub_t *gdbstub, char *payload)
  * Currently supported:
  *   'c' - continue
  *   's' - step
+ *   'r' - step while the PC is in [start, end), "rstart,end"
  *
  * TODO: Multi-action support (e.g., "c:all;s:tid") requires:
  * - Loop through ';'-separated actions
  * - Parse thread selector after ':'
  * - Call set_cpu() for each thread-specific action
  */
-static inline gdb_event_t process_vcont(gdbstub_t *gdbstub, char *args)
+static gdb_event_t process_vcont(gdbstub_t *gdbstub, char *params, void *args)
 {
+    struct gdbstub_private *priv = gdbstub->priv;
     gdb_event_t event = EVENT_NONE;
+    uint64_t start, end;
+    parse_t p;
+    (void) args;
 
-    switch (args[0]) {
+    switch (params[0]) {
     case 'c':
         if (gdbstub->ops->cont != NULL)
             event = EVENT_CONT;
@@ -636,6 +1322,20 @@ static inline gdb_event_t process_vcont(gdbstub_t *gdbstub, char *args)
         else
             SEND_EPERM(gdbstub);
         break;
+    case 'r':
+        /* The thread selector after the range is ignored like above */
+        parse_init(&p, params + 1, strlen(params + 1));
+        if (!range_step_supported(gdbstub)) {
+            SEND_EPERM(gdbstub);
+        } else if (!parse_hex_u64(&p, &start) || !parse_expect_char(&p, ',') ||
+                   !parse_hex_u64(&p, &end)) {
+            SEND_EINVAL(gdbstub);
+        } else {
+            priv->range_start = start;
+            priv->range_end = end;
+            event = EVENT_RANGE_STEP;
+        }
+        break;
     default:
         /* Reject unsupported actions (including 'C'/'S' with signal) */
         SEND_EPERM(gdbstub);
@@ -645,12 +1345,12 @@ static inline gdb_event_t process_vcont(gdbstub_t *gdbstub, char *args)
     return event;
 }
 
-#define VCONT_DESC "vCont;%s%s"
+#define VCONT_DESC "vCont;"
 
 /* Report vCont actions supported by this stub
  *
- * This stub advertises only 'c' (continue) and 's' (step), matching
- * the behavior of other hardware emulators.
+ * This stub advertises only 'c' (continue), 's' (step) and 'r' (range
+ * step), matching the behavior of other hardware emulators.
  *
  * NOT advertised:
  * - 'C' (continue with signal) / 'S' (step with signal)
@@ -660,104 +1360,917 @@ static inline gdb_event_t process_vcont(gdbstub_t *gdbstub, char *args)
  *   Reason: Current implementation processes single action only
  *   set_cpu() must be called separately via 'H' packet
  */
-static inline void process_vcont_support(gdbstub_t *gdbstub)
+static gdb_event_t process_vcont_support(gdbstub_t *gdbstub,
+                                         char *params,
+                                         void *args)
 {
-    char packet_str[MAX_SEND_PACKET_SIZE];
-    /* Only advertise 'c' and 's' (no signal support for hardware emulation) */
+    conn_t *conn = &gdbstub->priv->conn;
+    (void) params, (void) args;
+    /* List 's', 'c' and 'r' if range_step_supported(), but none of their
+     * signal variants, as hardware emulation has no signals */
     char *str_s = (gdbstub->ops->stepi == NULL) ? "" : "s;";
     char *str_c = (gdbstub->ops->cont == NULL) ? "" : "c;";
-    sprintf(packet_str, VCONT_DESC, str_s, str_c);
+    char *str_r = range_step_supported(gdbstub) ? "r;" : "";
+
+    conn_reply_begin(conn);
+    conn_reply_append_str(conn, VCONT_DESC);
+    conn_reply_append_str(conn, str_s);
+    conn_reply_append_str(conn, str_c);
+    conn_reply_append_str(conn, str_r);
+    conn_reply_send(conn);
+    return EVENT_NONE;
+}
+
+/* Stop collecting, the frames are kept for QTFrame */
+static void trace_stop(gdbstub_t *gdbstub, trace_status_t status, int tpnum)
+{
+    trace_t *trace = &gdbstub->priv->trace;
+
+    if (trace->status != TRACE_RUNNING)
+        return;
+    trace->status = status;
+    trace->stop_tp = tpnum;
+    bps_destroy(&gdbstub->tps);
+}
+
+static gdb_event_t process_trace_init(gdbstub_t *gdbstub,
+                                      char *params,
+                                      void *args)
+{
+    (void) params, (void) args;
+    trace_stop(gdbstub, TRACE_STOP, 0);
+    trace_clear(&gdbstub->priv->trace);
+    conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_NONE;
+}
+
+/* Parse what follows the address of a tracepoint, "E|D:step:pass" then
+ * ":" and its condition if it has one. Neither while-stepping nor fast
+ * tracepoints are supported. */
+static bool parse_tracepoint(parse_t *p, tracepoint_t *tp)
+{
+    uint64_t step;
+
+    if (parse_expect_char(p, 'E'))
+        tp->enabled = true;
+    else if (!parse_expect_char(p, 'D'))
+        return false;
+    if (!parse_expect_char(p, ':') || !parse_hex_u64(p, &step) || step ||
+        !parse_expect_char(p, ':') || !parse_hex_u64(p, &tp->pass))
+        return false;
+    if (parse_expect_char(p, ':') && !parse_ax_expr(p, &tp->cond))
+        return false;
+    return parse_at_end(p);
+}
+
+/* Parse the actions of a tracepoint: "R" then the mask of the registers,
+ * which are all collected anyway, "Mbasereg,offset,len" and an agent
+ * expression. The while-stepping ones, 'S' first, are not supported.
+ * Return zero or an errno. */
+static int parse_trace_actions(parse_t *p, tracepoint_t *tp)
+{
+    while (!parse_at_end(p)) {
+        trace_action_t action = {.basereg = -1};
+        uint64_t val;
+
+        if (parse_expect_char(p, 'R')) {
+            while (!parse_at_end(p) && isxdigit((unsigned char) *p->pos))
+                p->pos++;
+            continue;
+        }
+
+        if (parse_expect_char(p, 'M')) {
+            bool neg = parse_expect_char(p, '-');
+            if (!parse_hex_u64(p, &val) || !parse_expect_char(p, ',') ||
+                !parse_addr_len(p, &action.offset, &action.len))
+                return EINVAL;
+            /* GDB may send -1 as ffffffff too */
+            action.basereg = neg ? -(int) val : (int) (uint32_t) val;
+            action.type = 'M';
+        } else if (parse_ax_expr(p, &action.expr)) {
+            action.type = 'X';
+        } else {
+            return EINVAL;
+        }
+
+        int err = trace_tp_add_action(tp, &action);
+        if (err) {
+            free(action.expr.code);
+            return err;
+        }
+    }
+    return 0;
+}
+
+/* Define tracepoint n, "n:addr:" then what parse_tracepoint() takes, or add
+ * actions to it, "-n:addr:" then what parse_trace_actions() takes. A '-' at
+ * the end tells that more actions follow. */
+static gdb_event_t process_trace_dp(gdbstub_t *gdbstub,
+                                    char *params,
+                                    void *args)
+{
+    trace_t *trace = &gdbstub->priv->trace;
+    size_t len = strlen(params);
+    uint64_t num, addr;
+    int err = EINVAL;
+    parse_t p;
+    (void) args;
+
+    if (len && params[len - 1] == '-')
+        len--;
+    parse_init(&p, params, len);
+    bool is_action = parse_expect_char(&p, '-');
+    if (!parse_hex_u64(&p, &num) || !parse_expect_char(&p, ':') ||
+        !parse_hex_u64(&p, &addr) || !parse_expect_char(&p, ':'))
+        goto reply;
+
+    if (is_action) {
+        tracepoint_t *tp = trace_tp_find(trace, num, addr);
+        if (tp)
+            err = parse_trace_actions(&p, tp);
+    } else {
+        tracepoint_t tp = {.num = num, .addr = addr};
+        if (parse_tracepoint(&p, &tp))
+            err = trace_tp_add(trace, &tp);
+        if (err)
+            free(tp.cond.code);
+    }
+
+reply:
+    if (err)
+        send_errno(gdbstub, err);
+    else
+        conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_NONE;
+}
 
+/* Start collecting into a new buffer, allocated now so that collecting
+ * never does */
+static gdb_event_t process_trace_start(gdbstub_t *gdbstub,
+                                       char *params,
+                                       void *args)
+{
+    trace_t *trace = &gdbstub->priv->trace;
+    int err = 0;
+    (void) params, (void) args;
+
+    /* The tracepoints are found along with the breakpoints the stub keeps */
+    if (gdbstub->ops->set_bp != NULL) {
+        SEND_EPERM(gdbstub);
+        return EVENT_NONE;
+    }
+
+    trace_stop(gdbstub, TRACE_STOP, 0);
+    trace->selected = false;
+    trace_buf_destroy(&trace->buf);
+    if (!trace_buf_init(&trace->buf, trace->buf_size, trace->circular)) {
+        send_errno(gdbstub, ENOMEM);
+        return EVENT_NONE;
+    }
+
+    for (int i = 0; i < trace->nr_tps && !err; i++) {
+        tracepoint_t *tp = &trace->tps[i];
+        tp->hits = tp->bytes = 0;
+        if (tp->enabled)
+            err = bps_insert(&gdbstub->tps, tp->addr, NULL);
+    }
+    if (err) {
+        bps_destroy(&gdbstub->tps);
+        send_errno(gdbstub, err);
+        return EVENT_NONE;
+    }
+
+    trace->status = TRACE_RUNNING;
+    conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_trace_stop(gdbstub_t *gdbstub,
+                                      char *params,
+                                      void *args)
+{
+    (void) params, (void) args;
+    trace_stop(gdbstub, TRACE_STOP, 0);
+    conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_NONE;
+}
+
+/* "circular:0|1", or "size:" then the size of the buffer of the next start,
+ * -1 for the default */
+static gdb_event_t process_trace_buffer(gdbstub_t *gdbstub,
+                                        char *params,
+                                        void *args)
+{
+    trace_t *trace = &gdbstub->priv->trace;
+    uint64_t val;
+    parse_t p;
+    (void) args;
+
+    parse_init(&p, params, strlen(params));
+    if (parse_keyword(&p, "circular:")) {
+        if (!parse_hex_u64(&p, &val) || !parse_at_end(&p))
+            goto einval;
+        trace->circular = val;
+        trace->buf.circular = val;
+    } else if (parse_keyword(&p, "size:")) {
+        if (parse_keyword(&p, "-1"))
+            val = TRACE_DEFAULT_BUF_SIZE;
+        else if (!parse_hex_u64(&p, &val))
+            goto einval;
+        if (!parse_at_end(&p) || val < TRACE_MIN_BUF_SIZE ||
+            val > TRACE_MAX_BUF_SIZE)
+            goto einval;
+        trace->buf_size = val;
+    } else {
+        goto einval;
+    }
+    conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_NONE;
+
+einval:
+    SEND_EINVAL(gdbstub);
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_trace_disconnected(gdbstub_t *gdbstub,
+                                              char *params,
+                                              void *args)
+{
+    uint64_t val;
+    parse_t p;
+    (void) args;
+
+    parse_init(&p, params, strlen(params));
+    if (!parse_hex_u64(&p, &val) || !parse_at_end(&p)) {
+        SEND_EINVAL(gdbstub);
+        return EVENT_NONE;
+    }
+    gdbstub->priv->trace.disconnected = val;
+    conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_NONE;
+}
+
+/* The read-only memory, "start,end" separated by ':' */
+static gdb_event_t process_trace_ro(gdbstub_t *gdbstub,
+                                    char *params,
+                                    void *args)
+{
+    trace_t *trace = &gdbstub->priv->trace;
+    uint64_t start, end;
+    int err = 0;
+    parse_t p;
+    (void) args;
+
+    trace->nr_ro = 0;
+    parse_init(&p, params, strlen(params));
+    do {
+        if (!parse_hex_u64(&p, &start) || !parse_expect_char(&p, ',') ||
+            !parse_hex_u64(&p, &end) || end < start)
+            err = EINVAL;
+        else
+            err = trace_ro_add(trace, start, end - start);
+    } while (!err && parse_expect_char(&p, ':'));
+    if (!err && !parse_at_end(&p))
+        err = EINVAL;
+
+    if (err)
+        send_errno(gdbstub, err);
+    else
+        conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_NONE;
+}
+
+typedef enum {
+    FIND_NUM,
+    FIND_PC,
+    FIND_TDP,
+    FIND_RANGE,
+    FIND_OUTSIDE,
+} trace_find_t;
+
+static bool trace_frame_match(const trace_frame_t *frame,
+                              trace_find_t find,
+                              uint64_t a,
+                              uint64_t b)
+{
+    switch (find) {
+    case FIND_PC:
+        return frame->addr == a;
+    case FIND_TDP:
+        return (uint64_t) frame->tpnum == a;
+    case FIND_RANGE:
+        return frame->addr >= a && frame->addr <= b;
+    case FIND_OUTSIDE:
+        return frame->addr < a || frame->addr > b;
+    default:
+        return frame->num == a;
+    }
+}
+
+/* Select trace frame "n", or the first one after the selected frame which
+ * is at "pc:addr", of "tdp:t", or at a PC in "range:start:end", or
+ * "outside:start:end" of it, both ends included. Reply "FnTt", or "F-1"
+ * when there is none, which selects none. */
+static gdb_event_t process_trace_frame(gdbstub_t *gdbstub,
+                                       char *params,
+                                       void *args)
+{
+    trace_t *trace = &gdbstub->priv->trace;
+    trace_find_t find = FIND_NUM;
+    uint64_t a, b = 0;
+    bool ok;
+    parse_t p;
+    (void) args;
+
+    parse_init(&p, params, strlen(params));
+    if (parse_keyword(&p, "pc:"))
+        find = FIND_PC;
+    else if (parse_keyword(&p, "tdp:"))
+        find = FIND_TDP;
+    else if (parse_keyword(&p, "range:"))
+        find = FIND_RANGE;
+    else if (parse_keyword(&p, "outside:"))
+        find = FIND_OUTSIDE;
+    ok = parse_hex_u64(&p, &a);
+    if (find == FIND_RANGE || find == FIND_OUTSIDE)
+        ok = ok && parse_expect_char(&p, ':') && parse_hex_u64(&p, &b);
+    if (!ok || !parse_at_end(&p)) {
+        SEND_EINVAL(gdbstub);
+        return EVENT_NONE;
+    }
+
+    trace_frame_t frame = trace->frame;
+    bool found;
+    if (find == FIND_NUM)
+        found = trace_frame_get(&trace->buf, a, &frame);
+    else if (trace->selected)
+        found = trace_frame_next(&trace->buf, &frame);
+    else
+        found = trace_frame_get(&trace->buf, 0, &frame);
+    while (found && !trace_frame_match(&frame, find, a, b))
+        found = trace_frame_next(&trace->buf, &frame);
+
+    trace->selected = found;
+    if (!found) {
+        conn_send_pktstr(&gdbstub->priv->conn, "F-1");
+        return EVENT_NONE;
+    }
+
+    char packet_str[48];
+    trace->frame = frame;
+    snprintf(packet_str, sizeof(packet_str), "F%zxT%x", frame.num,
+             frame.tpnum);
     conn_send_pktstr(&gdbstub->priv->conn, packet_str);
+    return EVENT_NONE;
 }
 
-static gdb_event_t process_vpacket(gdbstub_t *gdbstub, char *payload)
+static gdb_event_t process_trace_status(gdbstub_t *gdbstub,
+                                        char *params,
+                                        void *args)
 {
-    gdb_event_t event = EVENT_NONE;
-    char *name = payload;
-    char *args = strchr(payload, ';');
-    if (args) {
-        *args = '\0';
-        args++;
+    static const char *stop_reasons[] = {
+        [TRACE_NOT_RUN] = "tnotrun:",
+        [TRACE_STOP] = "tstop:",
+        [TRACE_FULL] = "tfull:",
+        [TRACE_PASSCOUNT] = "tpasscount:",
+        [TRACE_ERROR] = "terror::", /* without a message */
+    };
+    trace_t *trace = &gdbstub->priv->trace;
+    const trace_buf_t *buf = &trace->buf;
+    size_t size = buf->data ? buf->size : trace->buf_size;
+    char packet_str[192];
+    int n;
+    (void) params, (void) args;
+
+    if (trace->status == TRACE_RUNNING)
+        n = snprintf(packet_str, sizeof(packet_str), "T1;");
+    else
+        n = snprintf(packet_str, sizeof(packet_str), "T0;%s%x;",
+                     stop_reasons[trace->status], trace->stop_tp);
+    snprintf(packet_str + n, sizeof(packet_str) - n,
+             "tframes:%zx;tcreated:%zx;tsize:%zx;tfree:%zx;circular:%d;"
+             "disconn:%d",
+             buf->nr_frames, buf->nr_created, size, size - buf->used,
+             trace->circular, trace->disconnected);
+    conn_send_pktstr(&gdbstub->priv->conn, packet_str);
+    return EVENT_NONE;
+}
+
+/* The hits of tracepoint "t:addr" and the bytes it collected */
+static gdb_event_t process_trace_point(gdbstub_t *gdbstub,
+                                       char *params,
+                                       void *args)
+{
+    uint64_t num, addr;
+    tracepoint_t *tp = NULL;
+    parse_t p;
+    (void) args;
+
+    parse_init(&p, params, strlen(params));
+    if (parse_hex_u64(&p, &num) && parse_expect_char(&p, ':') &&
+        parse_hex_u64(&p, &addr) && parse_at_end(&p))
+        tp = trace_tp_find(&gdbstub->priv->trace, num, addr);
+    if (!tp) {
+        SEND_EINVAL(gdbstub);
+        return EVENT_NONE;
+    }
+
+    char packet_str[48];
+    snprintf(packet_str, sizeof(packet_str), "V%" PRIx64 ":%" PRIx64,
+             tp->hits, tp->bytes);
+    conn_send_pktstr(&gdbstub->priv->conn, packet_str);
+    return EVENT_NONE;
+}
+
+static const cmd_handler_t cmd_handlers[CMD_NR] = {
+    [CMD_START_NO_ACK_MODE] = process_start_no_ack_mode,
+    [CMD_TRACE_BUFFER] = process_trace_buffer,
+    [CMD_TRACE_DP] = process_trace_dp,
+    [CMD_TRACE_DISCONNECTED] = process_trace_disconnected,
+    [CMD_TRACE_FRAME] = process_trace_frame,
+    [CMD_TRACE_START] = process_trace_start,
+    [CMD_TRACE_STOP] = process_trace_stop,
+    [CMD_TRACE_INIT] = process_trace_init,
+    [CMD_TRACE_RO] = process_trace_ro,
+    [CMD_ATTACHED] = process_attached,
+    [CMD_CURRENT_THREAD] = process_current_thread,
+    [CMD_SUPPORTED] = process_supported,
+    [CMD_SYMBOL] = process_symbol,
+    [CMD_TRACE_POINT] = process_trace_point,
+    [CMD_TRACE_STATUS] = process_trace_status,
+    [CMD_XFER] = process_xfer,
+    [CMD_THREAD_INFO_FIRST] = process_thread_info_first,
+    [CMD_THREAD_INFO_NEXT] = process_thread_info_next,
+    [CMD_VCONT] = process_vcont,
+    [CMD_VCONT_SUPPORTED] = process_vcont_support,
+};
+
+/* Handle q, Q and v packets: the stub's own commands through the perfect
+ * hash, then those registered by the target */
+static gdb_event_t process_named(gdbstub_t *gdbstub,
+                                 char type,
+                                 char *payload,
+                                 void *args)
+{
+    size_t name_len = strcspn(payload, CMD_NAME_END);
+    char *params = payload + name_len;
+    if (*params) {
+        *params = '\0';
+        params++;
     }
 #ifdef DEBUG
-    printf("vpacket = %s %s\n", name, args);
+    printf("%c packet = %s %s\n", type, payload, params);
 #endif
 
-    if (!strcmp("Cont", name))
-        event = process_vcont(gdbstub, args);
-    else if (!strcmp("Cont?", name))
-        process_vcont_support(gdbstub);
-    else
+    cmd_id_t id = cmd_lookup(type, payload, name_len);
+    if (id != CMD_NONE)
+        return cmd_handlers[id](gdbstub, params, args);
+
+    for (int i = 0; i < gdbstub->priv->nr_cmds; i++) {
+        user_cmd_t *cmd = &gdbstub->priv->cmds[i];
+        if (cmd->type != type || strcmp(cmd->name, payload))
+            continue;
+
+        int ret = cmd->handler(gdbstub, params, args);
+        if (ret)
+            send_errno(gdbstub, ret);
+        /* A monitor command may well change the registers or memory */
+        gdbstub_invalidate_caches(gdbstub);
+        return EVENT_NONE;
+    }
+
+    conn_send_pktstr(&gdbstub->priv->conn, "");
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_query(gdbstub_t *gdbstub,
+                                 char *payload,
+                                 size_t len,
+                                 void *args)
+{
+    (void) len;
+    return process_named(gdbstub, 'q', payload, args);
+}
+
+static gdb_event_t process_general_set(gdbstub_t *gdbstub,
+                                       char *payload,
+                                       size_t len,
+                                       void *args)
+{
+    (void) len;
+    return process_named(gdbstub, 'Q', payload, args);
+}
+
+static gdb_event_t process_vpacket(gdbstub_t *gdbstub,
+                                   char *payload,
+                                   size_t len,
+                                   void *args)
+{
+    (void) len;
+    return process_named(gdbstub, 'v', payload, args);
+}
+
+static int ax_read_reg(void *ctx, int regno, uint64_t *value)
+{
+    gdbstub_t *gdbstub = ctx;
+    regcache_t *cache = &gdbstub->priv->regcache;
+    int cpu = regcache_cpu(gdbstub);
+
+    if (regno < 0 || regno >= cache->reg_num)
+        return EINVAL;
+    size_t bytes = cache->offset[regno + 1] - cache->offset[regno];
+    if (bytes > sizeof(*value))
+        return ENOTSUP;
+    int ret = regcache_fetch(gdbstub, cpu, regno, gdbstub->priv->args);
+    if (ret)
+        return ret;
+
+    /* Little-endian, like the memory */
+    const uint8_t *reg = regcache_regs(cache, cpu) + cache->offset[regno];
+    *value = 0;
+    for (size_t i = bytes; i > 0; i--)
+        *value = *value << 8 | reg[i - 1];
+    return 0;
+}
+
+static int ax_read_mem(void *ctx, size_t addr, size_t len, void *buf)
+{
+    gdbstub_t *gdbstub = ctx;
+    void *args = gdbstub->priv->args;
+    uint8_t *ptr = mem_ptr(gdbstub, addr, len, args);
+
+    if (ptr) {
+        memcpy(buf, ptr, len);
+        return 0;
+    }
+    if (gdbstub->ops->read_mem == NULL)
+        return EPERM;
+    return gdbstub->ops->read_mem(args, addr, len, buf);
+}
+
+bool gdbstub_bp_cond_eval(gdbstub_t *gdbstub, const gdbstub_bp_cond_t *cond)
+{
+    ax_env_t env = {
+        .read_reg = ax_read_reg,
+        .read_mem = ax_read_mem,
+        .ctx = gdbstub,
+    };
+    bool hit = false;
+
+    /* The target is in the middle of running, so what is cached only holds
+     * for this evaluation */
+    regcache_invalidate(&gdbstub->priv->regcache);
+    for (int i = 0; i < cond->nr && !hit; i++) {
+        uint64_t result;
+        /* Let GDB look into a condition which cannot be evaluated */
+        hit = ax_eval(&cond->exprs[i], &env, &result) || result;
+    }
+    regcache_invalidate(&gdbstub->priv->regcache);
+    return hit;
+}
+
+/* Add the len bytes at addr to the frame being collected, or return an
+ * errno, ENOSPC if they do not fit */
+static int trace_collect_mem(gdbstub_t *gdbstub, size_t addr, size_t len)
+{
+    trace_buf_t *buf = &gdbstub->priv->trace.buf;
+    void *args = gdbstub->priv->args;
+
+    if (len > buf->size)
+        return ENOSPC;
+    uint8_t *data = mem_ptr(gdbstub, addr, len, args);
+    if (!data) {
+        if (gdbstub->ops->read_mem == NULL)
+            return EPERM;
+        data = regbuf_get(&gdbstub->priv->regbuf, len);
+        if (!data)
+            return ENOMEM;
+        int ret = gdbstub->ops->read_mem(args, addr, len, data);
+        if (ret)
+            return ret;
+    }
+    return trace_frame_add(buf, 'M', addr, data, len) ? 0 : ENOSPC;
+}
+
+static int ax_trace(void *ctx, size_t addr, size_t len)
+{
+    return trace_collect_mem(ctx, addr, len);
+}
+
+/* Collect a frame of tp, the registers then its actions. What cannot be
+ * read is left out, and GDB shows it as unavailable. Return zero, or
+ * ENOSPC if the buffer is full. */
+static int trace_collect_frame(gdbstub_t *gdbstub,
+                               tracepoint_t *tp,
+                               size_t pc,
+                               const ax_env_t *env)
+{
+    trace_buf_t *buf = &gdbstub->priv->trace.buf;
+    regcache_t *cache = &gdbstub->priv->regcache;
+    int cpu = regcache_cpu(gdbstub);
+
+    if (!trace_frame_begin(buf))
+        return ENOSPC;
+    if (!regcache_fetch(gdbstub, cpu, -1, gdbstub->priv->args) &&
+        !trace_frame_add(buf, 'R', 0, regcache_regs(cache, cpu),
+                         regcache_size(cache)))
+        goto full;
+
+    for (int i = 0; i < tp->nr_actions; i++) {
+        const trace_action_t *action = &tp->actions[i];
+        uint64_t base = 0;
+        int err;
+
+        if (action->type == 'X') {
+            err = ax_eval(&action->expr, env, NULL);
+        } else {
+            if (action->basereg >= 0 &&
+                ax_read_reg(gdbstub, action->basereg, &base))
+                continue;
+            err = trace_collect_mem(gdbstub, base + action->offset,
+                                    action->len);
+        }
+        if (err == ENOSPC)
+            goto full;
+    }
+
+    tp->bytes += trace_frame_commit(buf, tp->num, pc);
+    return 0;
+
+full:
+    trace_frame_abort(buf);
+    return ENOSPC;
+}
+
+void gdbstub_trace_collect(gdbstub_t *gdbstub, size_t pc)
+{
+    trace_t *trace = &gdbstub->priv->trace;
+    ax_env_t env = {
+        .read_reg = ax_read_reg,
+        .read_mem = ax_read_mem,
+        .trace = ax_trace,
+        .ctx = gdbstub,
+    };
+
+    /* Like for the conditions of a breakpoint */
+    regcache_invalidate(&gdbstub->priv->regcache);
+    for (int i = 0; i < trace->nr_tps && trace->status == TRACE_RUNNING;
+         i++) {
+        tracepoint_t *tp = &trace->tps[i];
+        uint64_t result;
+
+        if (tp->addr != pc || !tp->enabled)
+            continue;
+        if (tp->cond.code) {
+            if (ax_eval(&tp->cond, &env, &result)) {
+                trace_stop(gdbstub, TRACE_ERROR, tp->num);
+                break;
+            }
+            if (!result)
+                continue;
+        }
+
+        tp->hits++;
+        if (trace_collect_frame(gdbstub, tp, pc, &env))
+            trace_stop(gdbstub, TRACE_FULL, tp->num);
+        else if (tp->pass && tp->hits >= tp->pass)
+            trace_stop(gdbstub, TRACE_PASSCOUNT, tp->num);
+    }
+    regcache_invalidate(&gdbstub->priv->regcache);
+}
+
+/* Parse the "type,addr,kind" of a 'Z' or 'z' packet, kind being the length
+ * of a watchpoint. Reply and return false if it is malformed, or if the
+ * type is not one GDB knows, which is an empty reply. */
+static bool parse_break_point(gdbstub_t *gdbstub,
+                              parse_t *p,
+                              bp_type_t *type,
+                              uint64_t *addr,
+                              uint64_t *kind)
+{
+    uint64_t val;
+
+    if (!parse_hex_u64(p, &val) || !parse_expect_char(p, ',') ||
+        !parse_addr_len(p, addr, kind)) {
+        SEND_EINVAL(gdbstub);
+        return false;
+    }
+    if (val > WP_ACCESS) {
         conn_send_pktstr(&gdbstub->priv->conn, "");
+        return false;
+    }
+    *type = val;
+    return true;
+}
 
-    return event;
+/* Parse the conditions which may follow the kind of a 'Z' packet, ";" then
+ * the agent expressions back to back, as GDB sends all the conditions of a
+ * location at once. *cond is NULL if there is none. */
+static bool parse_bp_conds(parse_t *p, gdbstub_bp_cond_t **cond)
+{
+    int nr = 0;
+
+    *cond = NULL;
+    if (parse_at_end(p))
+        return true;
+    if (!parse_expect_char(p, ';'))
+        return false;
+
+    /* Count them first on a copy of the cursor */
+    for (parse_t scan = *p; !parse_at_end(&scan); nr++) {
+        ax_expr_t expr;
+        if (!parse_ax_expr(&scan, &expr))
+            return false;
+        free(expr.code);
+    }
+    if (!nr)
+        return false;
+
+    *cond = bps_cond_alloc(nr);
+    if (!*cond)
+        return false;
+    for (int i = 0; i < nr; i++) {
+        if (!parse_ax_expr(p, &(*cond)->exprs[i])) {
+            bps_cond_free(*cond);
+            *cond = NULL;
+            return false;
+        }
+    }
+    return true;
 }
 
-static void process_del_break_points(gdbstub_t *gdbstub,
-                                     char *payload,
-                                     void *args)
+static gdb_event_t process_del_break_points(gdbstub_t *gdbstub,
+                                            char *payload,
+                                            size_t len,
+                                            void *args)
 {
-    size_t type, addr, kind;
-    assert(sscanf(payload, "%zx,%zx,%zx", &type, &addr, &kind) == 3);
+    bp_type_t type;
+    uint64_t addr, kind;
+    parse_t p;
+
+    parse_init(&p, payload, len);
+    if (!parse_break_point(gdbstub, &p, &type, &addr, &kind))
+        return EVENT_NONE;
+    if (!parse_at_end(&p)) {
+        SEND_EINVAL(gdbstub);
+        return EVENT_NONE;
+    }
 
 #ifdef DEBUG
-    printf("remove breakpoints = %zx %zx %zx\n", type, addr, kind);
+    printf("remove breakpoints = %x %lx %lx\n", type, addr, kind);
 #endif
 
+    /* Without del_bp() the stub keeps the breakpoints and watchpoints
+     * itself, and like adding one twice, removing one which is not there
+     * is fine */
+    if (gdbstub->ops->del_bp == NULL) {
+        if (type <= BP_HARDWARE)
+            bps_remove(&gdbstub->bps, addr);
+        else
+            watch_remove(&gdbstub->watches, addr, kind, type);
+        conn_send_pktstr(&gdbstub->priv->conn, "OK");
+        return EVENT_NONE;
+    }
+
     bool ret = gdbstub->ops->del_bp(args, addr, type);
     if (ret)
         conn_send_pktstr(&gdbstub->priv->conn, "OK");
     else
         SEND_EINVAL(gdbstub);
+    return EVENT_NONE;
 }
 
-static void process_set_break_points(gdbstub_t *gdbstub,
-                                     char *payload,
-                                     void *args)
+static gdb_event_t process_set_break_points(gdbstub_t *gdbstub,
+                                            char *payload,
+                                            size_t len,
+                                            void *args)
 {
-    size_t type, addr, kind;
-    assert(sscanf(payload, "%zx,%zx,%zx", &type, &addr, &kind) == 3);
+    bp_type_t type;
+    uint64_t addr, kind;
+    gdbstub_bp_cond_t *cond;
+    parse_t p;
+
+    parse_init(&p, payload, len);
+    if (!parse_break_point(gdbstub, &p, &type, &addr, &kind))
+        return EVENT_NONE;
+    /* Conditions are only advertised for the breakpoints the stub keeps */
+    if (!parse_bp_conds(&p, &cond) ||
+        (cond && (gdbstub->ops->set_bp != NULL || type > BP_HARDWARE))) {
+        bps_cond_free(cond);
+        SEND_EINVAL(gdbstub);
+        return EVENT_NONE;
+    }
 
 #ifdef DEBUG
-    printf("set breakpoints = %zx %zx %zx\n", type, addr, kind);
+    printf("set breakpoints = %x %lx %lx\n", type, addr, kind);
 #endif
 
+    if (gdbstub->ops->set_bp == NULL) {
+        int err = type <= BP_HARDWARE
+                      ? bps_insert(&gdbstub->bps, addr, cond)
+                      : watch_insert(&gdbstub->watches, addr, kind, type);
+        if (!err) {
+            conn_send_pktstr(&gdbstub->priv->conn, "OK");
+        } else {
+            bps_cond_free(cond);
+            send_errno(gdbstub, err);
+        }
+        return EVENT_NONE;
+    }
+
     bool ret = gdbstub->ops->set_bp(args, addr, type);
     if (ret)
         conn_send_pktstr(&gdbstub->priv->conn, "OK");
     else
         SEND_EINVAL(gdbstub);
+    return EVENT_NONE;
 }
 
-static void process_set_cpu(gdbstub_t *gdbstub, char *payload, void *args)
+static gdb_event_t process_set_cpu(gdbstub_t *gdbstub,
+                                   char *payload,
+                                   size_t len,
+                                   void *args)
 {
+    if (gdbstub->ops->set_cpu == NULL) {
+        SEND_EPERM(gdbstub);
+        return EVENT_NONE;
+    }
+
     int cpuid;
+    parse_t p;
+
     /* We don't support deprecated Hc packet, GDB
-     * should send only send vCont;c and vCont;s here. */
-    if (payload[0] == 'g') {
-        assert(sscanf(payload, "g%d", &cpuid) == 1);
+     * should send only send vCont;c and vCont;s here. The thread IDs are
+     * the decimal ones qfThreadInfo reported. */
+    parse_init(&p, payload, len);
+    if (parse_expect_char(&p, 'g')) {
+        if (!parse_dec_int(&p, &cpuid) || !parse_at_end(&p)) {
+            SEND_EINVAL(gdbstub);
+            return EVENT_NONE;
+        }
         gdbstub->ops->set_cpu(args, cpuid);
+        gdbstub->priv->cur_cpu = cpuid;
     }
     conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_NONE;
 }
 
-static bool packet_csum_verify(packet_t *inpkt)
+static gdb_event_t process_stop_reason(gdbstub_t *gdbstub,
+                                       char *payload,
+                                       size_t len,
+                                       void *args)
 {
-    /* We add extra 1 for leading '$' and minus extra 1 for trailing '#' */
-    uint8_t csum_rslt = compute_checksum((char *) inpkt->data + 1,
-                                         inpkt->end_pos - CSUM_SIZE - 1);
-    uint8_t csum_expected;
-    str_to_hex((char *) &inpkt->data[inpkt->end_pos - CSUM_SIZE + 1],
-               &csum_expected, sizeof(uint8_t));
-#ifdef DEBUG
-    printf("csum rslt = %x / csum expected = %s / ", csum_rslt,
-           &inpkt->data[inpkt->end_pos - CSUM_SIZE + 1]);
-    printf("csum expected = %x \n", csum_expected);
-#endif
-    return csum_rslt == csum_expected;
+    (void) payload, (void) len, (void) args;
+    send_stop_reply(gdbstub);
+    return EVENT_NONE;
+}
+
+static gdb_event_t process_detach(gdbstub_t *gdbstub,
+                                  char *payload,
+                                  size_t len,
+                                  void *args)
+{
+    (void) payload, (void) len, (void) args;
+    /* Send OK before detaching per GDB Remote Serial Protocol */
+    conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_DETACH;
 }
 
+static gdb_event_t process_thread_alive(gdbstub_t *gdbstub,
+                                        char *payload,
+                                        size_t len,
+                                        void *args)
+{
+    (void) payload, (void) len, (void) args;
+    /* FIXME: Assume all CPUs are alive here, any exception case
+     * that user may want to handle? */
+    conn_send_pktstr(&gdbstub->priv->conn, "OK");
+    return EVENT_NONE;
+}
+
+/* Indexed by the first byte of the packet, a hole means unsupported */
+static const packet_handler_t packet_handlers[128] = {
+    ['c'] = process_cont,
+    ['g'] = process_reg_read,
+    ['m'] = process_mem_read,
+    ['p'] = process_reg_read_one,
+    ['q'] = process_query,
+    ['Q'] = process_general_set,
+    ['s'] = process_stepi,
+    ['v'] = process_vpacket,
+    ['x'] = process_mem_xread,
+    ['z'] = process_del_break_points,
+    ['?'] = process_stop_reason,
+    ['D'] = process_detach,
+    ['G'] = process_reg_write,
+    ['H'] = process_set_cpu,
+    ['M'] = process_mem_write,
+    ['P'] = process_reg_write_one,
+    ['T'] = process_thread_alive,
+    ['X'] = process_mem_xwrite,
+    ['Z'] = process_set_break_points,
+};
+
 static gdb_event_t gdbstub_process_packet(gdbstub_t *gdbstub,
                                           packet_t *inpkt,
                                           void *args)
@@ -767,117 +2280,83 @@ static gdb_event_t gdbstub_process_packet(gdbstub_t *gdbstub,
     inpkt->data[inpkt->end_pos - CSUM_SIZE] = 0;
     uint8_t request = inpkt->data[1];
     char *payload = (char *) &inpkt->data[2];
-    gdb_event_t event = EVENT_NONE;
+    size_t len = inpkt->end_pos - CSUM_SIZE - 2;
 
-    switch (request) {
-    case 'c':
-        event = process_cont(gdbstub);
-        break;
-    case 'g':
-        if (gdbstub->ops->read_reg != NULL) {
-            process_reg_read(gdbstub, args);
-        } else {
-            SEND_EPERM(gdbstub);
-        }
-        break;
-    case 'm':
-        if (gdbstub->ops->read_mem != NULL) {
-            process_mem_read(gdbstub, payload, args);
-        } else {
-            SEND_EPERM(gdbstub);
-        }
-        break;
-    case 'p':
-        if (gdbstub->ops->read_reg != NULL) {
-            process_reg_read_one(gdbstub, payload, args);
-        } else {
-            SEND_EPERM(gdbstub);
-        }
-        break;
-    case 'q':
-        process_query(gdbstub, payload, args);
-        break;
-    case 'Q':
-        process_general_set(gdbstub, payload);
-        break;
-    case 's':
-        event = process_stepi(gdbstub);
-        break;
-    case 'v':
-        event = process_vpacket(gdbstub, payload);
-        break;
-    case 'z':
-        if (gdbstub->ops->del_bp != NULL) {
-            process_del_break_points(gdbstub, payload, args);
-        } else {
-            SEND_EPERM(gdbstub);
-        }
-        break;
-    case '?':
-        conn_send_pktstr(&gdbstub->priv->conn, "S05");
-        break;
-    case 'D':
-        /* Send OK before detaching per GDB Remote Serial Protocol */
-        conn_send_pktstr(&gdbstub->priv->conn, "OK");
-        event = EVENT_DETACH;
-        break;
-    case 'G':
-        if (gdbstub->ops->write_reg != NULL) {
-            process_reg_write(gdbstub, payload, args);
-        } else {
-            SEND_EPERM(gdbstub);
-        }
-        break;
-    case 'H':
-        if (gdbstub->ops->set_cpu != NULL) {
-            process_set_cpu(gdbstub, payload, args);
-        } else {
-            SEND_EPERM(gdbstub);
-        }
-        break;
-    case 'M':
-        if (gdbstub->ops->write_mem != NULL) {
-            process_mem_write(gdbstub, payload, args);
-        } else {
-            SEND_EPERM(gdbstub);
-        }
-        break;
-    case 'P':
-        if (gdbstub->ops->write_reg != NULL) {
-            process_reg_write_one(gdbstub, payload, args);
-        } else {
-            SEND_EPERM(gdbstub);
-        }
-        break;
-    case 'T':
-        /* FIXME: Assume all CPUs are alive here, any exception case
-         * that user may want to handle? */
-        conn_send_pktstr(&gdbstub->priv->conn, "OK");
-        break;
-    case 'X':
-        if (gdbstub->ops->write_mem != NULL) {
-            /* It is important for xwrite to know the end position of packet,
-             * because there're escape characters which block us interpreting
-             * the packet as a string just like other packets do. */
-            process_mem_xwrite(gdbstub, payload,
-                               &inpkt->data[inpkt->end_pos - CSUM_SIZE], args);
-        } else {
-            SEND_EPERM(gdbstub);
-        }
-        break;
-    case 'Z':
-        if (gdbstub->ops->set_bp != NULL) {
-            process_set_break_points(gdbstub, payload, args);
-        } else {
-            SEND_EPERM(gdbstub);
-        }
-        break;
-    default:
+    if (request >= 128 || packet_handlers[request] == NULL) {
         conn_send_pktstr(&gdbstub->priv->conn, "");
-        break;
+        return EVENT_NONE;
     }
+    return packet_handlers[request](gdbstub, payload, len, args);
+}
 
-    return event;
+/* Learn which CPU the target stopped on, its registers are cached for it */
+static void gdbstub_sync_cpu(gdbstub_t *gdbstub, void *args)
+{
+    if (gdbstub->arch.smp <= 1)
+        gdbstub->priv->cur_cpu = 0;
+    else if (gdbstub->ops->get_cpu != NULL)
+        gdbstub->priv->cur_cpu = gdbstub->ops->get_cpu(args);
+    else
+        gdbstub->priv->cur_cpu = -1;
+}
+
+/* Drop the cached memory the target wrote while it ran, or all of it if
+ * the target cannot tell */
+static void gdbstub_sync_mem(gdbstub_t *gdbstub, void *args)
+{
+    memcache_t *cache = &gdbstub->priv->memcache;
+    mem_range_t ranges[MAX_DIRTY_RANGES];
+
+    if (!memcache_enabled(cache))
+        return;
+
+    int nr = -1;
+    if (gdbstub->ops->get_dirty_ranges != NULL)
+        nr = gdbstub->ops->get_dirty_ranges(args, ranges, MAX_DIRTY_RANGES);
+    if (nr < 0 || nr > MAX_DIRTY_RANGES) {
+        memcache_invalidate(cache);
+        return;
+    }
+
+    for (int i = 0; i < nr; i++)
+        memcache_write(cache, ranges[i].addr, ranges[i].len, NULL);
+}
+
+/* Collect the tracepoint at pc, which a step has just reached. Like cont(),
+ * a step collects the tracepoints where it stops but not where it starts, so
+ * that each is collected once. */
+static void gdbstub_step_collect(gdbstub_t *gdbstub, size_t pc)
+{
+    size_t slot;
+
+    if (gdbstub_bps_find(&gdbstub->tps, pc, &slot))
+        gdbstub_trace_collect(gdbstub, pc);
+}
+
+/* Step until the PC leaves the range of vCont;r, a breakpoint or a
+ * watchpoint is hit, or GDB interrupts, with no packet in between. The first
+ * instruction is stepped over like 's' does even if it has a breakpoint. */
+static gdb_action_t gdbstub_range_step(gdbstub_t *gdbstub, void *args)
+{
+    struct gdbstub_private *priv = gdbstub->priv;
+    gdb_action_t act;
+
+    while (true) {
+        act = gdbstub->ops->stepi(args);
+        if (act != ACT_RESUME)
+            break;
+
+        size_t pc = gdbstub->ops->get_pc(args);
+        if (pc < priv->range_start || pc >= priv->range_end ||
+            gdbstub->watches.hit) {
+            gdbstub_step_collect(gdbstub, pc);
+            break;
+        }
+        if (gdbstub_bp_hit(gdbstub, pc) ||
+            pktqueue_check_interrupt(&priv->pktqueue))
+            break;
+    }
+    return act;
 }
 
 static gdb_action_t gdbstub_handle_event(gdbstub_t *gdbstub,
@@ -888,12 +2367,32 @@ static gdb_action_t gdbstub_handle_event(gdbstub_t *gdbstub,
 
     switch (event) {
     case EVENT_CONT:
+        regcache_invalidate(&gdbstub->priv->regcache);
+        gdbstub->watches.hit = false;
+        gdbstub->priv->trace.selected = false;
         async_io_enable(gdbstub->priv);
         act = gdbstub->ops->cont(args);
         async_io_disable(gdbstub->priv);
+        gdbstub_sync_cpu(gdbstub, args);
+        gdbstub_sync_mem(gdbstub, args);
         break;
     case EVENT_STEP:
+        regcache_invalidate(&gdbstub->priv->regcache);
+        gdbstub->watches.hit = false;
+        gdbstub->priv->trace.selected = false;
         act = gdbstub->ops->stepi(args);
+        if (act == ACT_RESUME && gdbstub->ops->get_pc)
+            gdbstub_step_collect(gdbstub, gdbstub->ops->get_pc(args));
+        gdbstub_sync_cpu(gdbstub, args);
+        gdbstub_sync_mem(gdbstub, args);
+        break;
+    case EVENT_RANGE_STEP:
+        regcache_invalidate(&gdbstub->priv->regcache);
+        gdbstub->watches.hit = false;
+        gdbstub->priv->trace.selected = false;
+        act = gdbstub_range_step(gdbstub, args);
+        gdbstub_sync_cpu(gdbstub, args);
+        gdbstub_sync_mem(gdbstub, args);
         break;
     case EVENT_DETACH:
         act = ACT_SHUTDOWN;
@@ -907,18 +2406,14 @@ static gdb_action_t gdbstub_handle_event(gdbstub_t *gdbstub,
 
 static void gdbstub_act_resume(gdbstub_t *gdbstub)
 {
-    char packet_str[32];
-    sprintf(packet_str, "S%02x", GDB_SIGNAL_TRAP);
-    conn_send_pktstr(&gdbstub->priv->conn, packet_str);
+    send_stop_reply(gdbstub);
 }
 
-/* Maximum consecutive checksum failures before disconnecting */
-#define CONN_MAX_FAILURES 50
-
 bool gdbstub_run(gdbstub_t *gdbstub, void *args)
 {
     /* Store user-provided argument in the gdbstub_t structure */
     gdbstub->priv->args = args;
+    gdbstub_sync_cpu(gdbstub, args);
 
     /* Create reader thread - it's the sole owner of all socket recv() calls.
      * This eliminates the race condition where both threads read the socket. */
@@ -938,42 +2433,32 @@ bool gdbstub_run(gdbstub_t *gdbstub, void *args)
 
     while (true) {
         /* Pop packet from queue (blocks until available or shutdown) */
-        packet_t *pkt = pktqueue_pop(&gdbstub->priv->pktqueue);
+        packet_t pkt;
 
-        if (!pkt) {
+        if (!pktqueue_pop(&gdbstub->priv->pktqueue, &pkt)) {
             /* Check if shutdown or just interrupt */
-            if (pktqueue_is_shutdown(&gdbstub->priv->pktqueue))
-                return true; /* Clean shutdown */
+            if (pktqueue_is_shutdown(&gdbstub->priv->pktqueue)) {
+                /* Clean shutdown unless the reader gave up on the peer */
+                return conn->failure_count < CONN_MAX_FAILURES;
+            }
             /* Clear interrupt flag to prevent busy loop */
             pktqueue_check_interrupt(&gdbstub->priv->pktqueue);
             continue;
         }
 
-        /* Verify checksum before processing */
-        bool csum_ok = packet_csum_verify(pkt);
-        if (!conn->no_ack_mode)
-            conn_send_str(conn, csum_ok ? STR_ACK : STR_NACK);
-
-        if (!csum_ok) {
-            free(pkt);
-
-            conn->failure_count++;
-            if (conn->failure_count >= CONN_MAX_FAILURES) {
-                warn("Too many consecutive failures (%d), disconnecting\n",
-                     conn->failure_count);
-                return false;
-            }
-            continue; /* Discard packet and wait for retransmission */
-        }
-
-        /* Checksum OK - reset failure counter */
-        conn->failure_count = 0;
-
 #ifdef DEBUG
-        printf("packet = %s\n", pkt->data);
+        printf("packet = %.*s\n", pkt.end_pos + 1, pkt.data);
 #endif
-        gdb_event_t event = gdbstub_process_packet(gdbstub, pkt, args);
-        free(pkt);
+        /* The reader may wait for room in the queue */
+        if (pktqueue_space_wanted(&gdbstub->priv->pktqueue))
+            conn_wake(conn);
+
+        gdb_event_t event = gdbstub_process_packet(gdbstub, &pkt, args);
+        if (pktbuf_release(&gdbstub->priv->pktbuf, &pkt))
+            conn_wake(conn);
+
+        /* Send the ACKs left to us before the target may run for long */
+        conn_flush(conn);
 
         gdb_action_t act = gdbstub_handle_event(gdbstub, event, args);
         switch (act) {
@@ -993,12 +2478,24 @@ void gdbstub_close(gdbstub_t *gdbstub)
     /* Signal reader thread to stop and wait for it */
     if (gdbstub->priv->reader_running) {
         __atomic_store_n(&gdbstub->priv->thread_stop, true, __ATOMIC_RELAXED);
+        conn_wake(&gdbstub->priv->conn);
         pktqueue_signal_shutdown(&gdbstub->priv->pktqueue);
         pthread_join(gdbstub->priv->tid, NULL);
         gdbstub->priv->reader_running = false;
     }
 
+    for (int i = 0; i < gdbstub->priv->nr_cmds; i++)
+        free(gdbstub->priv->cmds[i].name);
+    free(gdbstub->priv->cmds);
     pktqueue_destroy(&gdbstub->priv->pktqueue);
+    pktbuf_destroy(&gdbstub->priv->pktbuf);
+    memcache_destroy(&gdbstub->priv->memcache);
+    bps_destroy(&gdbstub->bps);
+    watch_destroy(&gdbstub->watches);
+    bps_destroy(&gdbstub->tps);
+    trace_destroy(&gdbstub->priv->trace);
+    tdesc_destroy(&gdbstub->priv->tdesc);
+    regcache_destroy(&gdbstub->priv->regcache);
     regbuf_destroy(&gdbstub->priv->regbuf);
     conn_close(&gdbstub->priv->conn);
     free(gdbstub->priv);
@@ -0,0 +1,117 @@
+#include "memcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool memcache_init(memcache_t *cache, size_t line_size, int nr_lines)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->gen = 1; /* 0 is never valid */
+    if (line_size == 0)
+        return true;
+
+    cache->lines = calloc(nr_lines, sizeof(struct memcache_line));
+    cache->data = malloc(line_size * nr_lines);
+    if (!cache->lines || !cache->data) {
+        free(cache->lines);
+        free(cache->data);
+        return false;
+    }
+    cache->line_size = line_size;
+    cache->nr_lines = nr_lines;
+    return true;
+}
+
+void memcache_destroy(memcache_t *cache)
+{
+    free(cache->lines);
+    free(cache->data);
+    cache->lines = NULL;
+    cache->data = NULL;
+    cache->line_size = 0;
+}
+
+static inline int memcache_index(memcache_t *cache, uint64_t line_addr)
+{
+    return (line_addr / cache->line_size) & (cache->nr_lines - 1);
+}
+
+uint8_t *memcache_find(memcache_t *cache, uint64_t line_addr)
+{
+    int idx = memcache_index(cache, line_addr);
+    struct memcache_line *line = &cache->lines[idx];
+
+    if (line->gen != cache->gen || line->addr != line_addr)
+        return NULL;
+    cache->nr_hits++;
+    return cache->data + idx * cache->line_size;
+}
+
+uint8_t *memcache_slot(memcache_t *cache, uint64_t line_addr)
+{
+    int idx = memcache_index(cache, line_addr);
+
+    /* Not valid until it is filled, in case the read fails */
+    cache->lines[idx].gen = 0;
+    return cache->data + idx * cache->line_size;
+}
+
+void memcache_set_valid(memcache_t *cache, uint64_t line_addr)
+{
+    struct memcache_line *line =
+        &cache->lines[memcache_index(cache, line_addr)];
+
+    line->addr = line_addr;
+    line->gen = cache->gen;
+    cache->nr_misses++;
+}
+
+void memcache_write(memcache_t *cache,
+                    uint64_t addr,
+                    size_t len,
+                    const void *data)
+{
+    const uint8_t *src = data;
+
+    if (!memcache_enabled(cache) || len == 0)
+        return;
+
+    /* A write larger than the cache goes through every line */
+    uint64_t end = addr + len;
+    if (len > cache->line_size * cache->nr_lines || end < addr) {
+        memcache_invalidate(cache);
+        return;
+    }
+
+    uint64_t first = memcache_line_addr(cache, addr);
+    uint64_t nr = (end - 1 - first) / cache->line_size + 1;
+    for (uint64_t i = 0; i < nr; i++) {
+        uint64_t line_addr = first + i * cache->line_size;
+        int idx = memcache_index(cache, line_addr);
+        struct memcache_line *line = &cache->lines[idx];
+        if (line->gen != cache->gen || line->addr != line_addr)
+            continue;
+        if (!src) {
+            line->gen = 0;
+            continue;
+        }
+
+        uint64_t from = addr > line_addr ? addr : line_addr;
+        uint64_t to = end - line_addr < cache->line_size
+                          ? end
+                          : line_addr + cache->line_size;
+        memcpy(cache->data + idx * cache->line_size + (from - line_addr),
+               src + (from - addr), to - from);
+    }
+}
+
+void memcache_invalidate(memcache_t *cache)
+{
+    if (++cache->gen)
+        return;
+
+    /* The generations wrapped around, start over from 1 */
+    for (int i = 0; i < cache->nr_lines; i++)
+        cache->lines[i].gen = 0;
+    cache->gen = 1;
+}
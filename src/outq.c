@@ -0,0 +1,176 @@
+#include "outq.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool outq_init(outq_t *q, size_t nr_slots)
+{
+    /* nr_slots must be a power of two */
+    q->slots = calloc(nr_slots, sizeof(outq_slot_t));
+    if (!q->slots)
+        return false;
+
+    for (size_t i = 0; i < nr_slots; i++)
+        q->slots[i].seq = i;
+    q->mask = nr_slots - 1;
+    q->tail = 0;
+    q->head = 0;
+    q->off = 0;
+    q->spare_head = 0;
+    q->spare_tail = 0;
+    return true;
+}
+
+void outq_destroy(outq_t *q)
+{
+    for (size_t i = 0; i <= q->mask; i++)
+        free(q->slots[i].buf);
+    for (size_t i = q->spare_head; i != q->spare_tail; i++)
+        free(q->spare[i % OUTQ_NR_SPARE].buf);
+    free(q->slots);
+}
+
+static outq_slot_t *outq_claim(outq_t *q, size_t *pos)
+{
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+
+    while (true) {
+        outq_slot_t *slot = &q->slots[tail & q->mask];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t) seq - (intptr_t) tail;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&q->tail, &tail, tail + 1, true,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                *pos = tail;
+                return slot;
+            }
+        } else if (diff < 0) {
+            return NULL; /* the slot of the previous lap is not sent yet */
+        } else {
+            tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Sequentially consistent, so a consumer checking outq_pending() after
+ * giving up its role cannot miss the frame, see conn_flush() */
+static void outq_publish(outq_slot_t *slot, size_t pos)
+{
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+}
+
+bool outq_push(outq_t *q, const void *frame, size_t len)
+{
+    char *buf = NULL;
+    if (len > OUTQ_INLINE_SIZE) {
+        buf = malloc(len);
+        if (!buf)
+            return false;
+        memcpy(buf, frame, len);
+    }
+
+    size_t pos;
+    outq_slot_t *slot = outq_claim(q, &pos);
+    if (!slot) {
+        free(buf);
+        return false;
+    }
+
+    if (buf) {
+        slot->buf = buf;
+        slot->cap = len;
+    } else {
+        memcpy(slot->data, frame, len);
+    }
+    slot->len = len;
+    outq_publish(slot, pos);
+    return true;
+}
+
+bool outq_push_buf(outq_t *q, char **buf, size_t *cap, size_t len)
+{
+    size_t pos;
+    outq_slot_t *slot = outq_claim(q, &pos);
+    if (!slot)
+        return false;
+
+    slot->buf = *buf;
+    slot->cap = *cap;
+    slot->len = len;
+    outq_publish(slot, pos);
+
+    *buf = NULL;
+    *cap = 0;
+    size_t spare_head = q->spare_head;
+    if (spare_head != __atomic_load_n(&q->spare_tail, __ATOMIC_ACQUIRE)) {
+        outq_spare_t *spare = &q->spare[spare_head % OUTQ_NR_SPARE];
+        *buf = spare->buf;
+        *cap = spare->cap;
+        __atomic_store_n(&q->spare_head, spare_head + 1, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+bool outq_pending(outq_t *q)
+{
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_SEQ_CST);
+    outq_slot_t *slot = &q->slots[head & q->mask];
+    return __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) == head + 1;
+}
+
+int outq_peek(outq_t *q, struct iovec *iov, int max)
+{
+    int n = 0;
+
+    for (; n < max; n++) {
+        size_t pos = q->head + n;
+        outq_slot_t *slot = &q->slots[pos & q->mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+            break;
+
+        char *frame = slot->buf ? slot->buf : slot->data;
+        size_t off = n ? 0 : q->off;
+        iov[n].iov_base = frame + off;
+        iov[n].iov_len = slot->len - off;
+    }
+    return n;
+}
+
+/* Keep the buffer for outq_push_buf() if there is room, free it if not */
+static void outq_recycle(outq_t *q, outq_slot_t *slot)
+{
+    size_t spare_tail = q->spare_tail;
+
+    if (spare_tail - __atomic_load_n(&q->spare_head, __ATOMIC_ACQUIRE) <
+        OUTQ_NR_SPARE) {
+        outq_spare_t *spare = &q->spare[spare_tail % OUTQ_NR_SPARE];
+        spare->buf = slot->buf;
+        spare->cap = slot->cap;
+        __atomic_store_n(&q->spare_tail, spare_tail + 1, __ATOMIC_RELEASE);
+    } else {
+        free(slot->buf);
+    }
+    slot->buf = NULL;
+}
+
+void outq_consume(outq_t *q, size_t n)
+{
+    while (n > 0) {
+        outq_slot_t *slot = &q->slots[q->head & q->mask];
+        size_t left = slot->len - q->off;
+
+        if (n < left) {
+            q->off += n;
+            return;
+        }
+
+        n -= left;
+        if (slot->buf)
+            outq_recycle(q, slot);
+        q->off = 0;
+        __atomic_store_n(&slot->seq, q->head + q->mask + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&q->head, q->head + 1, __ATOMIC_SEQ_CST);
+    }
+}
@@ -1,99 +1,239 @@
 #include "packet.h"
-#include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 
-static void pktbuf_clear(pktbuf_t *pktbuf)
+#include "utils/csum.h"
+#include "utils/translate.h"
+
+bool pktbuf_init(pktbuf_t *pktbuf, size_t cap)
 {
-    pktbuf->end_pos = -1;
-    pktbuf->size = 0;
+    /* Round up to the power of two so positions map with a simple mask */
+    pktbuf->cap = 1;
+    while (pktbuf->cap < cap)
+        pktbuf->cap <<= 1;
+
+    pktbuf->data = malloc(pktbuf->cap);
+    if (!pktbuf->data)
+        return false;
+
+    pktbuf->wr = 0;
+    pktbuf->scan = 0;
+    pktbuf->head = PKTBUF_NONE;
+    pktbuf->csum_pos = PKTBUF_NONE;
+    pktbuf->csum = 0;
+    pktbuf->nr_intr = 0;
+    pktbuf->nr_popped = 0;
+    pktbuf->released = 0;
+    pktbuf->nr_released = 0;
+    pktbuf->want_release = false;
+    return true;
 }
 
-#define DEFAULT_CAP (10)
-bool pktbuf_init(pktbuf_t *pktbuf)
+/* The oldest position which is still in use */
+static uint64_t pktbuf_tail(pktbuf_t *pktbuf)
 {
-    pktbuf->cap = DEFAULT_CAP;
-    pktbuf->data = calloc(1, (1 << pktbuf->cap) * sizeof(uint8_t));
-    pktbuf_clear(pktbuf);
+    /* Once every view has been handed back, nothing before the packet being
+     * framed is needed anymore. */
+    if (__atomic_load_n(&pktbuf->nr_released, __ATOMIC_ACQUIRE) ==
+        pktbuf->nr_popped)
+        return (pktbuf->head != PKTBUF_NONE) ? pktbuf->head : pktbuf->scan;
 
-    return true;
+    return __atomic_load_n(&pktbuf->released, __ATOMIC_ACQUIRE);
 }
 
-ssize_t pktbuf_fill_from_file(pktbuf_t *pktbuf, int fd)
+/* Look for the next '$' from the scan cursor and move the cursor past it,
+ * counting the interrupt characters on the way. The bytes after the cursor
+ * are always contiguous because reads never cross the end of the ring. */
+static bool pktbuf_scan_head(pktbuf_t *pktbuf)
 {
-    assert((1 << pktbuf->cap) >= pktbuf->size);
+    while (pktbuf->scan < pktbuf->wr) {
+        uint8_t *start = pktbuf_ptr(pktbuf, pktbuf->scan);
+        size_t len = pktbuf->wr - pktbuf->scan;
+        size_t off = scan_for_either(start, len, '$', INTR_CHAR);
 
-    /* enlarge the buffer to read from file when it is full */
-    if ((1 << pktbuf->cap) == pktbuf->size) {
-        pktbuf->cap++;
-        pktbuf->data =
-            realloc(pktbuf->data, (1 << pktbuf->cap) * sizeof(uint8_t));
+        pktbuf->scan += off;
+        if (off == len)
+            break;
+
+        pktbuf->scan++;
+        if (start[off] == INTR_CHAR) {
+            pktbuf->nr_intr++;
+            continue;
+        }
+
+        pktbuf->head = pktbuf->scan - 1;
+        pktbuf->csum = 0;
+        return true;
     }
 
-    int left = (1 << pktbuf->cap) - pktbuf->size;
-    uint8_t *buf = pktbuf->data + pktbuf->size;
-    ssize_t nread = read(fd, buf, left);
+    return false;
+}
 
-    if (nread > 0)
-        pktbuf->size += nread;
+/* Accumulate the checksum of the payload up to the '#' of the packet */
+static bool pktbuf_scan_payload(pktbuf_t *pktbuf)
+{
+    uint8_t *start = pktbuf_ptr(pktbuf, pktbuf->scan);
+    size_t len = pktbuf->wr - pktbuf->scan;
+    size_t off = checksum_until(start, len, '#', &pktbuf->csum);
 
-    return nread;
+    pktbuf->scan += off;
+    if (off == len)
+        return false;
+
+    pktbuf->csum_pos = pktbuf->scan++;
+    return true;
 }
 
-bool pktbuf_is_complete(pktbuf_t *pktbuf)
+/* Return the number of bytes which can be read at pktbuf->wr in one go */
+static size_t pktbuf_writable(pktbuf_t *pktbuf)
 {
-    int head = -1;
+    size_t mask = pktbuf->cap - 1;
+    bool at_end = (pktbuf->wr & mask) == 0;
+
+    /* Make sure no packet head is left behind at the end of the ring */
+    if (at_end && pktbuf->head == PKTBUF_NONE)
+        pktbuf_scan_head(pktbuf);
+
+    /* A packet which takes half of the ring can never be moved to the
+     * beginning of it. Drop it and resync on the next '$'. */
+    if (pktbuf->head != PKTBUF_NONE &&
+        pktbuf->wr - pktbuf->head >= pktbuf->cap / 2) {
+        pktbuf->head = PKTBUF_NONE;
+        pktbuf->csum_pos = PKTBUF_NONE;
+        pktbuf->scan = pktbuf->wr;
+    }
 
-    /* skip to the head of next packet */
-    for (int i = 0; i < pktbuf->size; i++) {
-        if (pktbuf->data[i] == '$') {
-            head = i;
-            break;
-        }
+    /* We are at the end of the ring with a partial packet, move it to the
+     * beginning so every packet stays contiguous. */
+    if (at_end && pktbuf->head != PKTBUF_NONE && pktbuf->head < pktbuf->wr) {
+        uint64_t len = pktbuf->wr - pktbuf->head;
+        if (pktbuf->wr + len - pktbuf_tail(pktbuf) > pktbuf->cap)
+            return 0;
+
+        memcpy(pktbuf_ptr(pktbuf, pktbuf->wr),
+               pktbuf_ptr(pktbuf, pktbuf->head), len);
+        pktbuf->head += len;
+        pktbuf->scan += len;
+        if (pktbuf->csum_pos != PKTBUF_NONE)
+            pktbuf->csum_pos += len;
+        pktbuf->wr += len;
     }
 
-    if (head < 0) {
-        pktbuf_clear(pktbuf);
-        return false;
+    size_t free_sz = pktbuf->cap - (pktbuf->wr - pktbuf_tail(pktbuf));
+    size_t contig_sz = pktbuf->cap - (pktbuf->wr & mask);
+    return free_sz < contig_sz ? free_sz : contig_sz;
+}
+
+bool pktbuf_has_space(pktbuf_t *pktbuf)
+{
+    return pktbuf_writable(pktbuf) > 0;
+}
+
+ssize_t pktbuf_fill_from_file(pktbuf_t *pktbuf, int fd)
+{
+    size_t left = pktbuf_writable(pktbuf);
+    if (left == 0) {
+        /* Wait for the main thread to release some packets */
+        errno = ENOBUFS;
+        return -1;
     }
 
-    if (head > 0) {
-        /* moving memory for a valid packet */
-        memmove(pktbuf->data, pktbuf->data + head, pktbuf->size - head);
-        pktbuf->size -= head;
+    ssize_t nread = read(fd, pktbuf_ptr(pktbuf, pktbuf->wr), left);
+
+    if (nread > 0)
+        pktbuf->wr += nread;
+
+    return nread;
+}
+
+ssize_t pktbuf_fill_from_mem(pktbuf_t *pktbuf, const void *data, size_t len)
+{
+    size_t left = pktbuf_writable(pktbuf);
+    if (left == 0) {
+        errno = ENOBUFS;
+        return -1;
     }
 
-    /* check the end of the buffer */
-    uint8_t *end_pos_ptr = memchr(pktbuf->data, '#', pktbuf->size);
-    if (end_pos_ptr == NULL)
+    if (len > left)
+        len = left;
+    memcpy(pktbuf_ptr(pktbuf, pktbuf->wr), data, len);
+    pktbuf->wr += len;
+
+    return len;
+}
+
+/* Frame the bytes after the scan cursor, which is the only pass over them:
+ * interrupt characters outside of packets are counted into nr_intr and the
+ * checksum of the payload is summed up on the way to its '#'. */
+bool pktbuf_is_complete(pktbuf_t *pktbuf)
+{
+    if (pktbuf->head == PKTBUF_NONE && !pktbuf_scan_head(pktbuf))
+        return false;
+
+    if (pktbuf->csum_pos == PKTBUF_NONE && !pktbuf_scan_payload(pktbuf))
         return false;
 
-    int end_pos = (end_pos_ptr - pktbuf->data) + CSUM_SIZE;
-    if (end_pos > pktbuf->size)
+    return pktbuf->wr > pktbuf->csum_pos + CSUM_SIZE;
+}
+
+bool pktbuf_pop_packet(pktbuf_t *pktbuf, packet_t *pkt)
+{
+    if (pktbuf->csum_pos == PKTBUF_NONE ||
+        pktbuf->wr <= pktbuf->csum_pos + CSUM_SIZE)
         return false;
 
-    pktbuf->end_pos = end_pos;
+    pkt->data = pktbuf_ptr(pktbuf, pktbuf->head);
+    pkt->end_pos = pktbuf->csum_pos + CSUM_SIZE - pktbuf->head;
+    pkt->ring_end = pktbuf->csum_pos + CSUM_SIZE + 1;
 
+    uint8_t csum_expected;
+    str_to_hex((char *) pktbuf_ptr(pktbuf, pktbuf->csum_pos + 1),
+               &csum_expected, sizeof(uint8_t));
+    pkt->csum_ok = (pktbuf->csum == csum_expected);
+
+    pktbuf->scan = pkt->ring_end;
+    pktbuf->head = PKTBUF_NONE;
+    pktbuf->csum_pos = PKTBUF_NONE;
+    pktbuf->nr_popped++;
     return true;
 }
 
-packet_t *pktbuf_pop_packet(pktbuf_t *pktbuf)
+/* Drop the packet just popped by the reader without handing it out. Its
+ * bytes become garbage which is reclaimed along with the later packets. */
+void pktbuf_discard(pktbuf_t *pktbuf)
+{
+    pktbuf->nr_popped--;
+}
+
+/* Called by the reader once the ring is full. Return true if it may sleep:
+ * the next pktbuf_release() then tells the consumer to wake it up. Return
+ * false if some space was released in the meantime. */
+bool pktbuf_want_release(pktbuf_t *pktbuf)
 {
-    if (pktbuf->end_pos == -1) {
-        return NULL;
+    __atomic_store_n(&pktbuf->want_release, true, __ATOMIC_RELAXED);
+    /* Pairs with the fence in pktbuf_release(): either we see the release
+     * here or the consumer sees want_release there */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (pktbuf_has_space(pktbuf)) {
+        __atomic_store_n(&pktbuf->want_release, false, __ATOMIC_RELAXED);
+        return false;
     }
+    return true;
+}
+
+/* Called by the consumer, which must release the views in popping order.
+ * Return true if the reader is waiting for it and needs a wakeup. */
+bool pktbuf_release(pktbuf_t *pktbuf, packet_t *pkt)
+{
+    __atomic_store_n(&pktbuf->released, pkt->ring_end, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&pktbuf->nr_released, 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-    int old_pkt_size = pktbuf->end_pos + 1;
-    packet_t *pkt = calloc(1, sizeof(packet_t) + old_pkt_size + 1);
-    memcpy(pkt->data, pktbuf->data, old_pkt_size);
-    pkt->end_pos = pktbuf->end_pos;
-    pkt->data[old_pkt_size] = 0;
-
-    memmove(pktbuf->data, pktbuf->data + old_pkt_size + 1,
-            pktbuf->size - old_pkt_size);
-    pktbuf->size -= old_pkt_size;
-    pktbuf->end_pos = -1;
-    return pkt;
+    return __atomic_load_n(&pktbuf->want_release, __ATOMIC_RELAXED) &&
+           __atomic_exchange_n(&pktbuf->want_release, false,
+                               __ATOMIC_RELAXED);
 }
 
 void pktbuf_destroy(pktbuf_t *pktbuf)
@@ -1,133 +1,191 @@
 #include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include "pktqueue.h"
 
+#ifdef __linux__
+static void pktqueue_sleep(pktqueue_t *queue, uint32_t wakeups)
+{
+    /* Returns at once if a wakeup came after wakeups was read */
+    syscall(SYS_futex, &queue->wakeups, FUTEX_WAIT_PRIVATE, wakeups, NULL,
+            NULL, 0);
+}
+
+static void pktqueue_wake(pktqueue_t *queue)
+{
+    __atomic_add_fetch(&queue->wakeups, 1, __ATOMIC_SEQ_CST);
+    syscall(SYS_futex, &queue->wakeups, FUTEX_WAKE_PRIVATE, 1, NULL, NULL,
+            0);
+}
+#else
+static void pktqueue_sleep(pktqueue_t *queue, uint32_t wakeups)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (__atomic_load_n(&queue->wakeups, __ATOMIC_SEQ_CST) == wakeups)
+        pthread_cond_wait(&queue->cond, &queue->mutex);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static void pktqueue_wake(pktqueue_t *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    __atomic_add_fetch(&queue->wakeups, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+#endif
+
 bool pktqueue_init(pktqueue_t *queue)
 {
-    queue->head = queue->tail = NULL;
-    queue->shutdown = false;
-    queue->interrupted = false;
+    memset(queue, 0, sizeof(*queue));
+    queue->ring = malloc(PKTQUEUE_SIZE * sizeof(packet_t));
+    if (!queue->ring)
+        return false;
 
+#ifndef __linux__
     if (pthread_mutex_init(&queue->mutex, NULL) != 0)
-        return false;
+        goto ring_fail;
 
     if (pthread_cond_init(&queue->cond, NULL) != 0) {
         pthread_mutex_destroy(&queue->mutex);
-        return false;
+        goto ring_fail;
     }
+#endif
 
     return true;
+
+#ifndef __linux__
+ring_fail:
+    free(queue->ring);
+    return false;
+#endif
 }
 
 void pktqueue_destroy(pktqueue_t *queue)
 {
-    pthread_mutex_lock(&queue->mutex);
-
-    /* Free all pending packets */
-    pktqueue_node_t *node = queue->head;
-    while (node) {
-        pktqueue_node_t *next = node->next;
-        free(node->pkt);
-        free(node);
-        node = next;
-    }
-    queue->head = NULL;
-    queue->tail = NULL;
-
-    pthread_mutex_unlock(&queue->mutex);
+    /* The packet bytes belong to the pktbuf_t, only the ring goes */
+    free(queue->ring);
+    queue->ring = NULL;
 
+#ifndef __linux__
     pthread_cond_destroy(&queue->cond);
     pthread_mutex_destroy(&queue->mutex);
+#endif
+}
+
+bool pktqueue_is_full(pktqueue_t *queue)
+{
+    if (queue->tail - queue->head_cache < PKTQUEUE_SIZE)
+        return false;
+
+    queue->head_cache = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+    return queue->tail - queue->head_cache == PKTQUEUE_SIZE;
 }
 
 bool pktqueue_push(pktqueue_t *queue, packet_t *pkt)
 {
-    pktqueue_node_t *node = malloc(sizeof(pktqueue_node_t));
-    if (!node)
-        return false; /* Caller retains ownership of pkt */
+    if (pktqueue_is_full(queue))
+        return false;
 
-    node->pkt = pkt;
-    node->next = NULL;
+    queue->ring[queue->tail & (PKTQUEUE_SIZE - 1)] = *pkt;
+    __atomic_store_n(&queue->tail, queue->tail + 1, __ATOMIC_RELEASE);
 
-    pthread_mutex_lock(&queue->mutex);
+    /* Pairs with the fence in pktqueue_pop(): either the consumer sees the
+     * packet before it sleeps or we see it is idle. Clear idle, so the
+     * packets pushed until it runs again do not wake it once more. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&queue->idle, __ATOMIC_RELAXED) &&
+        __atomic_exchange_n(&queue->idle, false, __ATOMIC_RELAXED))
+        pktqueue_wake(queue);
+    return true;
+}
 
-    if (queue->tail) {
-        queue->tail->next = node;
-        queue->tail = node;
-    } else {
-        queue->head = node;
-        queue->tail = node;
-    }
+bool pktqueue_want_space(pktqueue_t *queue)
+{
+    __atomic_store_n(&queue->want_space, true, __ATOMIC_RELAXED);
+    /* Pairs with the fence in pktqueue_space_wanted() */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
 
-    pthread_cond_signal(&queue->cond);
-    pthread_mutex_unlock(&queue->mutex);
+    if (!pktqueue_is_full(queue)) {
+        __atomic_store_n(&queue->want_space, false, __ATOMIC_RELAXED);
+        return false;
+    }
     return true;
 }
 
-packet_t *pktqueue_pop(pktqueue_t *queue)
+bool pktqueue_space_wanted(pktqueue_t *queue)
 {
-    pthread_mutex_lock(&queue->mutex);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return __atomic_load_n(&queue->want_space, __ATOMIC_RELAXED) &&
+           __atomic_exchange_n(&queue->want_space, false, __ATOMIC_RELAXED);
+}
 
-    /* Wait until packet available, interrupted, or shutdown */
-    while (!queue->head && !queue->shutdown && !queue->interrupted)
-        pthread_cond_wait(&queue->cond, &queue->mutex);
+/* Check whether pktqueue_pop() has something to return, a packet or one of
+ * the conditions it reports with false */
+static bool pktqueue_ready(pktqueue_t *queue)
+{
+    if (queue->head != queue->tail_cache)
+        return true;
 
-    /* Return NULL on shutdown with empty queue */
-    if (queue->shutdown && !queue->head) {
-        pthread_mutex_unlock(&queue->mutex);
-        return NULL;
-    }
+    queue->tail_cache = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+    return queue->head != queue->tail_cache ||
+           __atomic_load_n(&queue->shutdown, __ATOMIC_ACQUIRE) ||
+           __atomic_load_n(&queue->interrupted, __ATOMIC_ACQUIRE);
+}
 
-    /* If only interrupted (no packet), return NULL but don't clear flag
-     * The caller should check pktqueue_check_interrupt()
-     */
-    if (!queue->head) {
-        pthread_mutex_unlock(&queue->mutex);
-        return NULL;
+bool pktqueue_pop(pktqueue_t *queue, packet_t *pkt)
+{
+    /* Wait until packet available, interrupted, or shutdown */
+    while (!pktqueue_ready(queue)) {
+        uint32_t wakeups = __atomic_load_n(&queue->wakeups, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&queue->idle, true, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (!pktqueue_ready(queue))
+            pktqueue_sleep(queue, wakeups);
+        __atomic_store_n(&queue->idle, false, __ATOMIC_RELAXED);
     }
 
-    pktqueue_node_t *node = queue->head;
-    queue->head = node->next;
-    if (!queue->head)
-        queue->tail = NULL;
-
-    pthread_mutex_unlock(&queue->mutex);
+    /* Return false on shutdown with empty queue. If only interrupted, the
+     * flag is left for pktqueue_check_interrupt(). */
+    if (queue->head == queue->tail_cache)
+        return false;
 
-    packet_t *pkt = node->pkt;
-    free(node);
-    return pkt;
+    *pkt = queue->ring[queue->head & (PKTQUEUE_SIZE - 1)];
+    __atomic_store_n(&queue->head, queue->head + 1, __ATOMIC_RELEASE);
+    return true;
 }
 
 void pktqueue_signal_shutdown(pktqueue_t *queue)
 {
-    pthread_mutex_lock(&queue->mutex);
-    queue->shutdown = true;
-    pthread_cond_broadcast(&queue->cond);
-    pthread_mutex_unlock(&queue->mutex);
+    __atomic_store_n(&queue->shutdown, true, __ATOMIC_RELEASE);
+    pktqueue_wake(queue);
 }
 
 void pktqueue_signal_interrupt(pktqueue_t *queue)
 {
-    pthread_mutex_lock(&queue->mutex);
-    queue->interrupted = true;
-    pthread_cond_signal(&queue->cond);
-    pthread_mutex_unlock(&queue->mutex);
+    __atomic_store_n(&queue->interrupted, true, __ATOMIC_RELEASE);
+    pktqueue_wake(queue);
 }
 
 bool pktqueue_check_interrupt(pktqueue_t *queue)
 {
-    pthread_mutex_lock(&queue->mutex);
-    bool was_interrupted = queue->interrupted;
-    queue->interrupted = false;
-    pthread_mutex_unlock(&queue->mutex);
-    return was_interrupted;
+    return __atomic_exchange_n(&queue->interrupted, false, __ATOMIC_ACQUIRE);
 }
 
 bool pktqueue_is_shutdown(pktqueue_t *queue)
 {
-    pthread_mutex_lock(&queue->mutex);
-    bool shutdown = queue->shutdown;
-    pthread_mutex_unlock(&queue->mutex);
-    return shutdown;
+    return __atomic_load_n(&queue->shutdown, __ATOMIC_ACQUIRE);
+}
+
+bool pktqueue_is_idle(pktqueue_t *queue)
+{
+    return __atomic_load_n(&queue->idle, __ATOMIC_RELAXED);
 }
@@ -0,0 +1,127 @@
+#include "regcache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+bool regcache_init(regcache_t *cache,
+                   const size_t *reg_bytes,
+                   int reg_num,
+                   int nr_cpus)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->reg_num = reg_num;
+    cache->nr_cpus = nr_cpus;
+    cache->gen = 1; /* 0 is never valid */
+
+    cache->offset = malloc((reg_num + 1) * sizeof(size_t));
+    if (!cache->offset)
+        return false;
+
+    cache->offset[0] = 0;
+    for (int i = 0; i < reg_num; i++)
+        cache->offset[i + 1] = cache->offset[i] + reg_bytes[i];
+
+    cache->cpus = calloc(nr_cpus + 1, sizeof(struct regcache_cpu));
+    if (!cache->cpus) {
+        free(cache->offset);
+        return false;
+    }
+    return true;
+}
+
+void regcache_destroy(regcache_t *cache)
+{
+    for (int i = 0; i <= cache->nr_cpus; i++) {
+        free(cache->cpus[i].regs);
+        free(cache->cpus[i].gen);
+    }
+    free(cache->cpus);
+    free(cache->offset);
+}
+
+uint8_t *regcache_regs(regcache_t *cache, int cpu)
+{
+    struct regcache_cpu *c = &cache->cpus[cpu];
+
+    if (c->regs)
+        return c->regs;
+
+    /* One byte at least, an empty register file is still cached */
+    c->regs = malloc(regcache_size(cache) + 1);
+    c->gen = calloc(cache->reg_num + 1, sizeof(uint32_t));
+    if (!c->regs || !c->gen) {
+        free(c->regs);
+        free(c->gen);
+        c->regs = NULL;
+        c->gen = NULL;
+    }
+    return c->regs;
+}
+
+bool regcache_valid(regcache_t *cache, int cpu, int regno)
+{
+    struct regcache_cpu *c = &cache->cpus[cpu];
+    return c->gen && c->gen[regno] == cache->gen;
+}
+
+bool regcache_all_valid(regcache_t *cache, int cpu)
+{
+    struct regcache_cpu *c = &cache->cpus[cpu];
+    return c->nr_valid_gen == cache->gen && c->nr_valid == cache->reg_num;
+}
+
+void regcache_set_valid(regcache_t *cache, int cpu, int regno)
+{
+    struct regcache_cpu *c = &cache->cpus[cpu];
+
+    if (c->gen[regno] == cache->gen)
+        return;
+
+    if (c->nr_valid_gen != cache->gen) {
+        c->nr_valid_gen = cache->gen;
+        c->nr_valid = 0;
+    }
+    c->gen[regno] = cache->gen;
+    c->nr_valid++;
+}
+
+void regcache_set_all_valid(regcache_t *cache, int cpu)
+{
+    struct regcache_cpu *c = &cache->cpus[cpu];
+
+    for (int i = 0; i < cache->reg_num; i++)
+        c->gen[i] = cache->gen;
+    c->nr_valid_gen = cache->gen;
+    c->nr_valid = cache->reg_num;
+}
+
+void regcache_drop_reg(regcache_t *cache, int cpu, int regno)
+{
+    struct regcache_cpu *c = &cache->cpus[cpu];
+
+    if (!regcache_valid(cache, cpu, regno))
+        return;
+    c->gen[regno] = 0;
+    c->nr_valid--;
+}
+
+void regcache_drop_cpu(regcache_t *cache, int cpu)
+{
+    struct regcache_cpu *c = &cache->cpus[cpu];
+
+    if (c->gen)
+        memset(c->gen, 0, cache->reg_num * sizeof(uint32_t));
+    c->nr_valid_gen = 0;
+    c->nr_valid = 0;
+}
+
+void regcache_invalidate(regcache_t *cache)
+{
+    if (++cache->gen)
+        return;
+
+    /* The generations wrapped around, start over from 1 */
+    for (int i = 0; i <= cache->nr_cpus; i++)
+        regcache_drop_cpu(cache, i);
+    cache->gen = 1;
+}
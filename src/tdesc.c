@@ -0,0 +1,186 @@
+#include "tdesc.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Registers without a feature go in this one */
+#define TDESC_DEFAULT_FEATURE "org.mini-gdbstub.regs"
+
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool oom;
+} strbuf_t;
+
+static void strbuf_printf(strbuf_t *sb, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (sb->oom)
+        return;
+
+    while (true) {
+        size_t room = sb->cap - sb->len;
+        va_start(ap, fmt);
+        int n = vsnprintf(sb->buf + sb->len, room, fmt, ap);
+        va_end(ap);
+        if (n < 0) {
+            sb->oom = true;
+            return;
+        }
+        if ((size_t) n < room) {
+            sb->len += n;
+            return;
+        }
+
+        size_t cap = sb->cap ? sb->cap : 1024;
+        while (cap - sb->len <= (size_t) n)
+            cap <<= 1;
+        char *buf = realloc(sb->buf, cap);
+        if (!buf) {
+            sb->oom = true;
+            return;
+        }
+        sb->buf = buf;
+        sb->cap = cap;
+    }
+}
+
+static const char *reg_feature(const reg_desc_t *desc)
+{
+    return desc->feature ? desc->feature : TDESC_DEFAULT_FEATURE;
+}
+
+/* Whether reg_descs[i] is the first register of its feature */
+static bool feature_starts_at(const arch_info_t *arch, int i)
+{
+    const char *feature = reg_feature(&arch->reg_descs[i]);
+
+    for (int j = 0; j < i; j++) {
+        if (!strcmp(reg_feature(&arch->reg_descs[j]), feature))
+            return false;
+    }
+    return true;
+}
+
+static bool tdesc_add(tdesc_t *tdesc, char *name, strbuf_t *sb)
+{
+    if (!name || sb->oom) {
+        free(name);
+        free(sb->buf);
+        return false;
+    }
+
+    tdesc_annex_t *annex = &tdesc->annexes[tdesc->nr_annexes++];
+    annex->name = name;
+    annex->data = sb->buf;
+    annex->len = sb->len;
+    return true;
+}
+
+/* The annex of the feature of reg_descs[first], with every register in it */
+static bool tdesc_add_feature(tdesc_t *tdesc,
+                              const arch_info_t *arch,
+                              int first)
+{
+    const char *feature = reg_feature(&arch->reg_descs[first]);
+    strbuf_t sb = {0};
+
+    strbuf_printf(&sb,
+                  "<?xml version=\"1.0\"?>"
+                  "<!DOCTYPE feature SYSTEM \"gdb-target.dtd\">"
+                  "<feature name=\"%s\">",
+                  feature);
+    for (int i = first; i < arch->reg_num; i++) {
+        const reg_desc_t *desc = &arch->reg_descs[i];
+        if (strcmp(reg_feature(desc), feature))
+            continue;
+
+        strbuf_printf(&sb, "<reg name=\"%s\" bitsize=\"%d\" type=\"%s\"",
+                      desc->name, desc->bitsize,
+                      desc->type ? desc->type : "int");
+        if (desc->group)
+            strbuf_printf(&sb, " group=\"%s\"", desc->group);
+        strbuf_printf(&sb, " regnum=\"%d\"/>", i);
+    }
+    strbuf_printf(&sb, "</feature>");
+
+    char *name = malloc(strlen(feature) + sizeof(".xml"));
+    if (name)
+        sprintf(name, "%s.xml", feature);
+    return tdesc_add(tdesc, name, &sb);
+}
+
+bool tdesc_init(tdesc_t *tdesc, const arch_info_t *arch)
+{
+    strbuf_t sb = {0};
+
+    memset(tdesc, 0, sizeof(*tdesc));
+    if (!arch->target_desc && !arch->reg_descs)
+        return true;
+
+    /* target.xml and at most one annex per register */
+    int nr_annexes = 1 + (arch->target_desc ? 0 : arch->reg_num);
+    tdesc->annexes = calloc(nr_annexes, sizeof(tdesc_annex_t));
+    if (!tdesc->annexes)
+        return false;
+
+    if (arch->target_desc) {
+        strbuf_printf(&sb, "%s", arch->target_desc);
+        if (!tdesc_add(tdesc, strdup("target.xml"), &sb))
+            goto fail;
+        return true;
+    }
+
+    strbuf_printf(&sb,
+                  "<?xml version=\"1.0\"?>"
+                  "<!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+                  "<target version=\"1.0\">");
+    if (arch->arch_name)
+        strbuf_printf(&sb, "<architecture>%s</architecture>",
+                      arch->arch_name);
+
+    /* Include the features in the order they first appear */
+    for (int i = 0; i < arch->reg_num; i++) {
+        if (feature_starts_at(arch, i))
+            strbuf_printf(&sb, "<xi:include href=\"%s.xml\"/>",
+                          reg_feature(&arch->reg_descs[i]));
+    }
+    strbuf_printf(&sb, "</target>");
+    if (!tdesc_add(tdesc, strdup("target.xml"), &sb))
+        goto fail;
+
+    for (int i = 0; i < arch->reg_num; i++) {
+        if (feature_starts_at(arch, i) && !tdesc_add_feature(tdesc, arch, i))
+            goto fail;
+    }
+    return true;
+
+fail:
+    tdesc_destroy(tdesc);
+    return false;
+}
+
+void tdesc_destroy(tdesc_t *tdesc)
+{
+    for (int i = 0; i < tdesc->nr_annexes; i++) {
+        free(tdesc->annexes[i].name);
+        free(tdesc->annexes[i].data);
+    }
+    free(tdesc->annexes);
+    tdesc->annexes = NULL;
+    tdesc->nr_annexes = 0;
+}
+
+const tdesc_annex_t *tdesc_find(tdesc_t *tdesc, const char *name, size_t len)
+{
+    for (int i = 0; i < tdesc->nr_annexes; i++) {
+        tdesc_annex_t *annex = &tdesc->annexes[i];
+        if (strlen(annex->name) == len && !memcmp(annex->name, name, len))
+            return annex;
+    }
+    return NULL;
+}
@@ -0,0 +1,330 @@
+#include "trace.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Frames and blocks start with these in the ring */
+typedef struct {
+    uint32_t size; /* of the whole frame */
+    uint32_t tpnum;
+    uint64_t addr;
+} frame_hdr_t;
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint32_t type; /* 'R' or 'M' */
+} block_hdr_t;
+
+void trace_init(trace_t *trace)
+{
+    memset(trace, 0, sizeof(*trace));
+    trace->buf_size = TRACE_DEFAULT_BUF_SIZE;
+}
+
+static void trace_action_free(trace_action_t *action)
+{
+    free(action->expr.code);
+}
+
+static void trace_tp_free(tracepoint_t *tp)
+{
+    for (int i = 0; i < tp->nr_actions; i++)
+        trace_action_free(&tp->actions[i]);
+    free(tp->actions);
+    free(tp->cond.code);
+}
+
+void trace_clear(trace_t *trace)
+{
+    for (int i = 0; i < trace->nr_tps; i++)
+        trace_tp_free(&trace->tps[i]);
+    free(trace->tps);
+    trace->tps = NULL;
+    trace->nr_tps = 0;
+
+    free(trace->ro);
+    trace->ro = NULL;
+    trace->nr_ro = 0;
+
+    trace_buf_destroy(&trace->buf);
+    trace->status = TRACE_NOT_RUN;
+    trace->selected = false;
+}
+
+void trace_destroy(trace_t *trace)
+{
+    trace_clear(trace);
+}
+
+tracepoint_t *trace_tp_find(trace_t *trace, int num, size_t addr)
+{
+    for (int i = 0; i < trace->nr_tps; i++) {
+        if (trace->tps[i].num == num && trace->tps[i].addr == addr)
+            return &trace->tps[i];
+    }
+    return NULL;
+}
+
+int trace_tp_add(trace_t *trace, const tracepoint_t *tp)
+{
+    tracepoint_t *old = trace_tp_find(trace, tp->num, tp->addr);
+
+    if (old) {
+        trace_tp_free(old);
+        *old = *tp;
+        return 0;
+    }
+
+    tracepoint_t *tps =
+        realloc(trace->tps, (trace->nr_tps + 1) * sizeof(tracepoint_t));
+    if (!tps)
+        return ENOMEM;
+    trace->tps = tps;
+    tps[trace->nr_tps++] = *tp;
+    return 0;
+}
+
+int trace_tp_add_action(tracepoint_t *tp, const trace_action_t *action)
+{
+    trace_action_t *actions =
+        realloc(tp->actions, (tp->nr_actions + 1) * sizeof(trace_action_t));
+    if (!actions)
+        return ENOMEM;
+    tp->actions = actions;
+    actions[tp->nr_actions++] = *action;
+    return 0;
+}
+
+int trace_ro_add(trace_t *trace, size_t addr, size_t len)
+{
+    mem_range_t *ro = realloc(trace->ro, (trace->nr_ro + 1) * sizeof(*ro));
+    if (!ro)
+        return ENOMEM;
+    trace->ro = ro;
+    ro[trace->nr_ro++] = (mem_range_t){.addr = addr, .len = len};
+    return 0;
+}
+
+bool trace_buf_init(trace_buf_t *buf, size_t size, bool circular)
+{
+    memset(buf, 0, sizeof(*buf));
+    buf->data = malloc(size);
+    if (!buf->data)
+        return false;
+    buf->size = size;
+    buf->circular = circular;
+    return true;
+}
+
+void trace_buf_destroy(trace_buf_t *buf)
+{
+    free(buf->data);
+    memset(buf, 0, sizeof(*buf));
+}
+
+/* Copy to and from pos in the ring, wrapping around its end */
+static void ring_write(trace_buf_t *buf,
+                       size_t pos,
+                       const void *data,
+                       size_t len)
+{
+    size_t first = buf->size - pos < len ? buf->size - pos : len;
+
+    memcpy(buf->data + pos, data, first);
+    memcpy(buf->data, (const uint8_t *) data + first, len - first);
+}
+
+static void ring_read(const trace_buf_t *buf,
+                      size_t pos,
+                      void *data,
+                      size_t len)
+{
+    size_t first = buf->size - pos < len ? buf->size - pos : len;
+
+    memcpy(data, buf->data + pos, first);
+    memcpy((uint8_t *) data + first, buf->data, len - first);
+}
+
+static size_t ring_pos(const trace_buf_t *buf, size_t pos, size_t off)
+{
+    return (pos + off) % buf->size;
+}
+
+/* Make room for len more bytes of the pending frame */
+static bool trace_buf_reserve(trace_buf_t *buf, size_t len)
+{
+    if (len > buf->size - buf->pending)
+        return false;
+
+    while (buf->size - buf->used - buf->pending < len) {
+        frame_hdr_t hdr;
+
+        if (!buf->circular || !buf->nr_frames)
+            return false;
+        ring_read(buf, buf->head, &hdr, sizeof(hdr));
+        buf->head = ring_pos(buf, buf->head, hdr.size);
+        buf->used -= hdr.size;
+        buf->nr_frames--;
+    }
+    return true;
+}
+
+bool trace_frame_begin(trace_buf_t *buf)
+{
+    buf->pending = 0;
+    if (!buf->data || !trace_buf_reserve(buf, sizeof(frame_hdr_t)))
+        return false;
+    buf->pending = sizeof(frame_hdr_t);
+    return true;
+}
+
+bool trace_frame_add(trace_buf_t *buf,
+                     char type,
+                     uint64_t addr,
+                     const void *data,
+                     size_t len)
+{
+    block_hdr_t hdr = {.addr = addr, .len = len, .type = type};
+
+    if (len > UINT32_MAX || !trace_buf_reserve(buf, sizeof(hdr) + len))
+        return false;
+
+    size_t pos = ring_pos(buf, buf->head, buf->used + buf->pending);
+    ring_write(buf, pos, &hdr, sizeof(hdr));
+    ring_write(buf, ring_pos(buf, pos, sizeof(hdr)), data, len);
+    buf->pending += sizeof(hdr) + len;
+    return true;
+}
+
+size_t trace_frame_commit(trace_buf_t *buf, int tpnum, uint64_t addr)
+{
+    frame_hdr_t hdr = {.size = buf->pending, .tpnum = tpnum, .addr = addr};
+
+    ring_write(buf, ring_pos(buf, buf->head, buf->used), &hdr, sizeof(hdr));
+    buf->used += buf->pending;
+    buf->pending = 0;
+    buf->nr_frames++;
+    buf->nr_created++;
+    return hdr.size;
+}
+
+void trace_frame_abort(trace_buf_t *buf)
+{
+    buf->pending = 0;
+}
+
+static void trace_frame_load(const trace_buf_t *buf,
+                             size_t num,
+                             size_t pos,
+                             trace_frame_t *frame)
+{
+    frame_hdr_t hdr;
+
+    ring_read(buf, pos, &hdr, sizeof(hdr));
+    *frame = (trace_frame_t){
+        .num = num,
+        .pos = pos,
+        .size = hdr.size,
+        .tpnum = hdr.tpnum,
+        .addr = hdr.addr,
+    };
+}
+
+bool trace_frame_get(const trace_buf_t *buf, size_t num, trace_frame_t *frame)
+{
+    if (num >= buf->nr_frames)
+        return false;
+
+    trace_frame_load(buf, 0, buf->head, frame);
+    while (frame->num < num) {
+        if (!trace_frame_next(buf, frame))
+            return false;
+    }
+    return true;
+}
+
+bool trace_frame_next(const trace_buf_t *buf, trace_frame_t *frame)
+{
+    if (frame->num + 1 >= buf->nr_frames)
+        return false;
+    trace_frame_load(buf, frame->num + 1,
+                     ring_pos(buf, frame->pos, frame->size), frame);
+    return true;
+}
+
+/* Find the first block of type after *off in frame, leaving *off at its
+ * data */
+static bool trace_block_find(const trace_buf_t *buf,
+                             const trace_frame_t *frame,
+                             char type,
+                             size_t *off,
+                             block_hdr_t *hdr)
+{
+    while (*off + sizeof(*hdr) <= frame->size) {
+        ring_read(buf, ring_pos(buf, frame->pos, *off), hdr, sizeof(*hdr));
+        *off += sizeof(*hdr);
+        if (hdr->type == (uint32_t) type)
+            return true;
+        *off += hdr->len;
+    }
+    return false;
+}
+
+bool trace_frame_regs(const trace_buf_t *buf,
+                      const trace_frame_t *frame,
+                      void *regs,
+                      size_t len)
+{
+    size_t off = sizeof(frame_hdr_t);
+    block_hdr_t hdr;
+
+    if (!trace_block_find(buf, frame, 'R', &off, &hdr) || hdr.len != len)
+        return false;
+    ring_read(buf, ring_pos(buf, frame->pos, off), regs, len);
+    return true;
+}
+
+/* Find the memory block of frame which has the byte at addr */
+static bool trace_block_at(const trace_buf_t *buf,
+                           const trace_frame_t *frame,
+                           uint64_t addr,
+                           size_t *off,
+                           block_hdr_t *hdr)
+{
+    *off = sizeof(frame_hdr_t);
+    while (trace_block_find(buf, frame, 'M', off, hdr)) {
+        if (addr >= hdr->addr && addr - hdr->addr < hdr->len)
+            return true;
+        *off += hdr->len;
+    }
+    return false;
+}
+
+size_t trace_frame_mem(const trace_buf_t *buf,
+                       const trace_frame_t *frame,
+                       uint64_t addr,
+                       size_t len,
+                       void *out)
+{
+    size_t done = 0;
+
+    /* The blocks may overlap or follow one another in any order */
+    while (done < len) {
+        uint64_t cur = addr + done;
+        block_hdr_t hdr;
+        size_t off;
+
+        if (!trace_block_at(buf, frame, cur, &off, &hdr))
+            break;
+
+        size_t n = hdr.len - (cur - hdr.addr);
+        if (n > len - done)
+            n = len - done;
+        ring_read(buf, ring_pos(buf, frame->pos, off + (cur - hdr.addr)),
+                  (uint8_t *) out + done, n);
+        done += n;
+    }
+    return done;
+}
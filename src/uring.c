@@ -0,0 +1,184 @@
+#ifdef CONFIG_IO_URING
+
+#include "uring.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+bool uring_init(uring_t *ring, unsigned entries)
+{
+    struct io_uring_params params;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&params, 0, sizeof(params));
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return false;
+
+    /* The multishot recv and the provided buffer ring used on top of this
+     * are newer than single mmap, so there is no need for the older way */
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        errno = ENOSYS;
+        goto fd_fail;
+    }
+
+    size_t sq_size =
+        params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_size = sq_size > cq_size ? sq_size : cq_size;
+
+    ring->ring_ptr =
+        mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->ring_ptr == MAP_FAILED)
+        goto fd_fail;
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        goto ring_fail;
+
+    uint8_t *sq = ring->ring_ptr;
+    ring->sq_head = (unsigned *) (sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+    ring->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    ring->sq_entries = params.sq_entries;
+
+    uint8_t *cq = ring->ring_ptr;
+    ring->cq_head = (unsigned *) (cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    /* Map the SQ array one to one to the SQEs once and for all */
+    for (unsigned i = 0; i < ring->sq_entries; i++)
+        ring->sq_array[i] = i;
+
+    return true;
+
+ring_fail:
+    munmap(ring->ring_ptr, ring->ring_size);
+fd_fail:
+    close(ring->fd);
+    return false;
+}
+
+void uring_destroy(uring_t *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->ring_ptr, ring->ring_size);
+    close(ring->fd);
+}
+
+struct io_uring_sqe *uring_get_sqe(uring_t *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail + ring->to_submit;
+
+    if (tail - head >= ring->sq_entries)
+        return NULL;
+
+    struct io_uring_sqe *sqe = &ring->sqes[tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->to_submit++;
+    return sqe;
+}
+
+int uring_submit(uring_t *ring, unsigned wait_nr)
+{
+    unsigned to_submit = ring->to_submit;
+
+    if (to_submit) {
+        __atomic_store_n(ring->sq_tail, *ring->sq_tail + to_submit,
+                         __ATOMIC_RELEASE);
+        ring->to_submit = 0;
+    }
+
+    unsigned flags = wait_nr ? IORING_ENTER_GETEVENTS : 0;
+    int ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, wait_nr,
+                      flags, NULL, 0);
+    return ret < 0 ? -1 : 0;
+}
+
+struct io_uring_cqe *uring_peek_cqe(uring_t *ring)
+{
+    unsigned head = *ring->cq_head;
+
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & ring->cq_mask];
+}
+
+void uring_cqe_seen(uring_t *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+bool uring_bufs_init(uring_bufs_t *bufs,
+                     uring_t *ring,
+                     uint16_t bgid,
+                     unsigned nr,
+                     unsigned size)
+{
+    memset(bufs, 0, sizeof(*bufs));
+    bufs->nr = nr; /* a power of two */
+    bufs->size = size;
+    bufs->bgid = bgid;
+
+    bufs->br_size = nr * sizeof(struct io_uring_buf);
+    bufs->br = mmap(NULL, bufs->br_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs->br == MAP_FAILED)
+        return false;
+
+    bufs->data = mmap(NULL, (size_t) nr * size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs->data == MAP_FAILED)
+        goto br_fail;
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t) (uintptr_t) bufs->br,
+        .ring_entries = nr,
+        .bgid = bgid,
+    };
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING,
+                &reg, 1) < 0)
+        goto data_fail;
+
+    for (unsigned i = 0; i < nr; i++)
+        uring_bufs_recycle(bufs, i);
+    return true;
+
+data_fail:
+    munmap(bufs->data, (size_t) nr * size);
+br_fail:
+    munmap(bufs->br, bufs->br_size);
+    return false;
+}
+
+void uring_bufs_destroy(uring_bufs_t *bufs, uring_t *ring)
+{
+    struct io_uring_buf_reg reg = {.bgid = bufs->bgid};
+    syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PBUF_RING,
+            &reg, 1);
+    munmap(bufs->data, (size_t) bufs->nr * bufs->size);
+    munmap(bufs->br, bufs->br_size);
+}
+
+void uring_bufs_recycle(uring_bufs_t *bufs, uint16_t bid)
+{
+    struct io_uring_buf *buf = &bufs->br->bufs[bufs->tail & (bufs->nr - 1)];
+
+    buf->addr = (uint64_t) (uintptr_t) uring_bufs_get(bufs, bid);
+    buf->len = bufs->size;
+    buf->bid = bid;
+    bufs->tail++;
+    __atomic_store_n(&bufs->br->tail, bufs->tail, __ATOMIC_RELEASE);
+}
+
+#endif
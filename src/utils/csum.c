@@ -1,5 +1,9 @@
 #include "utils/csum.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 uint8_t compute_checksum(char *buf, size_t len)
 {
     uint8_t csum = 0;
@@ -7,3 +11,59 @@ uint8_t compute_checksum(char *buf, size_t len)
         csum += buf[i];
     return csum;
 }
+
+size_t checksum_until(const uint8_t *buf,
+                      size_t len,
+                      uint8_t stop,
+                      uint8_t *csum)
+{
+    uint8_t sum = *csum;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i stop_v = _mm_set1_epi8(stop);
+    __m128i acc = zero;
+
+    /* Sum up whole blocks with psadbw until the one holding stop, which is
+     * left to the scalar loop below. */
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, stop_v)))
+            break;
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    sum += _mm_cvtsi128_si32(acc) +
+           _mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+#endif
+
+    for (; i < len && buf[i] != stop; i++)
+        sum += buf[i];
+
+    *csum = sum;
+    return i;
+}
+
+size_t scan_for_either(const uint8_t *buf, size_t len, uint8_t a, uint8_t b)
+{
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i a_v = _mm_set1_epi8(a);
+    const __m128i b_v = _mm_set1_epi8(b);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+        int mask = _mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(v, a_v), _mm_cmpeq_epi8(v, b_v)));
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (buf[i] == a || buf[i] == b)
+            break;
+    }
+    return i;
+}
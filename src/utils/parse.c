@@ -0,0 +1,62 @@
+#include "utils/parse.h"
+#include <limits.h>
+
+/* The value of a hex digit, or -1 for any other character */
+static inline int hex_digit(char ch)
+{
+    if (ch >= '0' && ch <= '9')
+        return ch - '0';
+    ch |= 0x20; /* lower case */
+    if (ch >= 'a' && ch <= 'f')
+        return ch - 'a' + 10;
+    return -1;
+}
+
+bool parse_hex_u64(parse_t *p, uint64_t *val)
+{
+    const char *pos = p->pos;
+    uint64_t v = 0;
+
+    while (pos < p->end) {
+        int digit = hex_digit(*pos);
+        if (digit < 0)
+            break;
+        /* More than 16 digits overflow */
+        if (pos - p->pos == 16)
+            return false;
+        v = (v << 4) | digit;
+        pos++;
+    }
+    if (pos == p->pos)
+        return false;
+
+    *val = v;
+    p->pos = pos;
+    return true;
+}
+
+bool parse_dec_int(parse_t *p, int *val)
+{
+    const char *pos = p->pos;
+    bool neg = false;
+    long v = 0;
+
+    if (pos < p->end && *pos == '-') {
+        neg = true;
+        pos++;
+    }
+
+    const char *digits = pos;
+    while (pos < p->end && *pos >= '0' && *pos <= '9') {
+        v = v * 10 + (*pos - '0');
+        if (v > (long) INT_MAX + neg)
+            return false;
+        pos++;
+    }
+    if (pos == digits)
+        return false;
+
+    *val = neg ? (int) -v : (int) v;
+    p->pos = pos;
+    return true;
+}
@@ -0,0 +1,131 @@
+#include "utils/rle.h"
+#include <stdbool.h>
+#include <string.h>
+
+#include "utils/csum.h"
+
+/* A repeat count n is sent as the character n + 29, so it ranges from 3,
+ * the shortest run worth encoding, to 97. */
+#define RLE_MIN_REPEAT 3
+#define RLE_MAX_REPEAT 97
+#define RLE_BIAS 29
+
+#define ONES (0x0101010101010101ULL)
+#define HIGHS (0x8080808080808080ULL)
+
+/* '#' and '$' would break the framing, while '+' and '-' may be taken as
+ * acknowledgements by a careless reader. */
+static bool repeat_forbidden(int n)
+{
+    char ch = n + RLE_BIAS;
+    return ch == '#' || ch == '$' || ch == '+' || ch == '-';
+}
+
+static inline uint64_t load64(const char *ptr)
+{
+    uint64_t v;
+    memcpy(&v, ptr, sizeof(v));
+    return v;
+}
+
+/* Set the high bit of every byte of v which is zero, and only of those */
+static inline uint64_t zero_bytes(uint64_t v)
+{
+    return ~(((v & ~HIGHS) + ~HIGHS) | v | ~HIGHS);
+}
+
+/* Return the number of bytes before the first run of RLE_MIN_REPEAT + 1
+ * equal bytes, or len if there is none. Eight positions are checked at a
+ * time by comparing the buffer with itself shifted by one byte. */
+static size_t literal_span(const char *buf, size_t len)
+{
+    size_t i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    /* The second pair of loads reaches buf[i + 16] */
+    for (; i + 17 <= len; i += 8) {
+        /* Bit 8k + 7 tells whether buf[i + k] == buf[i + k + 1] */
+        uint64_t eq = zero_bytes(load64(buf + i) ^ load64(buf + i + 1));
+        uint64_t eq_next = zero_bytes(load64(buf + i + 8) ^
+                                      load64(buf + i + 9));
+        uint64_t run = eq & ((eq >> 8) | (eq_next << 56)) &
+                       ((eq >> 16) | (eq_next << 48));
+        if (run)
+            return i + __builtin_ctzll(run) / 8;
+    }
+#endif
+
+    for (; i + RLE_MIN_REPEAT < len; i++) {
+        if (buf[i] == buf[i + 1] && buf[i] == buf[i + 2] &&
+            buf[i] == buf[i + 3])
+            return i;
+    }
+    return len;
+}
+
+/* Return the number of bytes from buf[0] on which are equal to buf[0] */
+static size_t run_length(const char *buf, size_t len)
+{
+    uint64_t pattern = ONES * (uint8_t) buf[0];
+    size_t i = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= len; i += 8) {
+        uint64_t diff = load64(buf + i) ^ pattern;
+        if (diff)
+            return i + __builtin_ctzll(diff) / 8;
+    }
+#endif
+
+    while (i < len && buf[i] == buf[0])
+        i++;
+    return i;
+}
+
+size_t rle_encode(char *buf, size_t len, uint8_t *csum)
+{
+    uint8_t sum = 0;
+    size_t r = 0, w = 0;
+
+    /* The output never gets longer than the input, so it can be written
+     * over the part already read. */
+    while (r < len) {
+        size_t lit = literal_span(buf + r, len - r);
+        if (w != r)
+            memmove(buf + w, buf + r, lit);
+        sum += compute_checksum(buf + w, lit);
+        r += lit;
+        w += lit;
+        if (r == len)
+            break;
+
+        char ch = buf[r];
+        size_t repeat = run_length(buf + r, len - r) - 1;
+        r += repeat + 1;
+
+        buf[w++] = ch;
+        sum += ch;
+        while (repeat > 0) {
+            if (repeat < RLE_MIN_REPEAT) {
+                buf[w++] = ch;
+                sum += ch;
+                repeat--;
+                continue;
+            }
+
+            /* A long run is split, a forbidden count is made shorter and
+             * the rest of the run is sent on the next round */
+            int n = repeat > RLE_MAX_REPEAT ? RLE_MAX_REPEAT : repeat;
+            while (repeat_forbidden(n))
+                n--;
+
+            buf[w++] = '*';
+            buf[w++] = n + RLE_BIAS;
+            sum += '*' + n + RLE_BIAS;
+            repeat -= n;
+        }
+    }
+
+    *csum = sum;
+    return w;
+}
@@ -1,15 +1,22 @@
 #include "utils/translate.h"
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEX_X86
+#endif
 
 static char hexchars[] = "0123456789abcdef";
 
-void hex_to_str(uint8_t *num, char *str, int bytes)
+static void hex_encode_scalar(const uint8_t *num, char *str, size_t bytes)
 {
-    for (int i = 0; i < bytes; i++) {
+    for (size_t i = 0; i < bytes; i++) {
         uint8_t ch = *(num + i);
         *(str + i * 2) = hexchars[ch >> 4];
         *(str + i * 2 + 1) = hexchars[ch & 0xf];
     }
-    str[bytes * 2] = '\0';
 }
 
 static uint8_t char_to_hex(char ch)
@@ -19,9 +26,9 @@ static uint8_t char_to_hex(char ch)
     return (ch + offset) & 0xf;
 }
 
-void str_to_hex(char *str, uint8_t *num, int bytes)
+static void hex_decode_scalar(const char *str, uint8_t *num, size_t bytes)
 {
-    for (int i = 0; i < bytes; i++) {
+    for (size_t i = 0; i < bytes; i++) {
         uint8_t ch_high = char_to_hex(*(str + i * 2));
         uint8_t ch_low = char_to_hex(*(str + i * 2 + 1));
 
@@ -29,20 +36,367 @@ void str_to_hex(char *str, uint8_t *num, int bytes)
     }
 }
 
+#ifdef HEX_X86
+/* The vector kernels below compute exactly what char_to_hex() does, so any
+ * input, including a malformed one, decodes the same way on every kernel:
+ * a character with bit 6 set is treated as a letter and gets 9 added before
+ * its low nibble is taken. */
+
+__attribute__((target("sse2"))) static inline __m128i sse2_nibble_to_char(
+    __m128i nibble)
+{
+    __m128i letter = _mm_cmpgt_epi8(nibble, _mm_set1_epi8(9));
+    __m128i offset = _mm_and_si128(letter, _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(nibble, _mm_set1_epi8('0')), offset);
+}
+
+__attribute__((target("sse2"))) static inline __m128i sse2_char_to_nibble(
+    __m128i ch)
+{
+    __m128i letter = _mm_and_si128(ch, _mm_set1_epi8(0x40));
+    letter = _mm_cmpeq_epi8(letter, _mm_set1_epi8(0x40));
+    __m128i offset = _mm_and_si128(letter, _mm_set1_epi8(9));
+    return _mm_and_si128(_mm_add_epi8(ch, offset), _mm_set1_epi8(0xf));
+}
+
+__attribute__((target("sse2"))) static void hex_encode_sse2(const uint8_t *num,
+                                                            char *str,
+                                                            size_t bytes)
+{
+    const __m128i mask = _mm_set1_epi8(0xf);
+    size_t i = 0;
+
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (num + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        __m128i lo = _mm_and_si128(v, mask);
+        __m128i c0 = sse2_nibble_to_char(_mm_unpacklo_epi8(hi, lo));
+        __m128i c1 = sse2_nibble_to_char(_mm_unpackhi_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *) (str + i * 2), c0);
+        _mm_storeu_si128((__m128i *) (str + i * 2 + 16), c1);
+    }
+
+    hex_encode_scalar(num + i, str + i * 2, bytes - i);
+}
+
+__attribute__((target("sse2"))) static void hex_decode_sse2(const char *str,
+                                                            uint8_t *num,
+                                                            size_t bytes)
+{
+    const __m128i low_byte = _mm_set1_epi16(0x00ff);
+    size_t i = 0;
+
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i n0 = sse2_char_to_nibble(
+            _mm_loadu_si128((const __m128i *) (str + i * 2)));
+        __m128i n1 = sse2_char_to_nibble(
+            _mm_loadu_si128((const __m128i *) (str + i * 2 + 16)));
+        /* Each 16-bit lane holds the high nibble in its low byte */
+        n0 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n0, low_byte), 4),
+                          _mm_srli_epi16(n0, 8));
+        n1 = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n1, low_byte), 4),
+                          _mm_srli_epi16(n1, 8));
+        _mm_storeu_si128((__m128i *) (num + i), _mm_packus_epi16(n0, n1));
+    }
+
+    hex_decode_scalar(str + i * 2, num + i, bytes - i);
+}
+
+__attribute__((target("ssse3"))) static void hex_encode_ssse3(
+    const uint8_t *num,
+    char *str,
+    size_t bytes)
+{
+    const __m128i mask = _mm_set1_epi8(0xf);
+    const __m128i lut = _mm_loadu_si128((const __m128i *) hexchars);
+    size_t i = 0;
+
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (num + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        __m128i lo = _mm_and_si128(v, mask);
+        __m128i c0 = _mm_shuffle_epi8(lut, _mm_unpacklo_epi8(hi, lo));
+        __m128i c1 = _mm_shuffle_epi8(lut, _mm_unpackhi_epi8(hi, lo));
+        _mm_storeu_si128((__m128i *) (str + i * 2), c0);
+        _mm_storeu_si128((__m128i *) (str + i * 2 + 16), c1);
+    }
+
+    hex_encode_scalar(num + i, str + i * 2, bytes - i);
+}
+
+__attribute__((target("ssse3"))) static void hex_decode_ssse3(const char *str,
+                                                              uint8_t *num,
+                                                              size_t bytes)
+{
+    /* Multiply the high nibble by 16 and add the low one in a single step */
+    const __m128i weight = _mm_set1_epi16(0x0110);
+    size_t i = 0;
+
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i n0 = sse2_char_to_nibble(
+            _mm_loadu_si128((const __m128i *) (str + i * 2)));
+        __m128i n1 = sse2_char_to_nibble(
+            _mm_loadu_si128((const __m128i *) (str + i * 2 + 16)));
+        n0 = _mm_maddubs_epi16(n0, weight);
+        n1 = _mm_maddubs_epi16(n1, weight);
+        _mm_storeu_si128((__m128i *) (num + i), _mm_packus_epi16(n0, n1));
+    }
+
+    hex_decode_scalar(str + i * 2, num + i, bytes - i);
+}
+
+__attribute__((target("avx2"))) static inline __m256i avx2_char_to_nibble(
+    __m256i ch)
+{
+    __m256i letter = _mm256_and_si256(ch, _mm256_set1_epi8(0x40));
+    letter = _mm256_cmpeq_epi8(letter, _mm256_set1_epi8(0x40));
+    __m256i offset = _mm256_and_si256(letter, _mm256_set1_epi8(9));
+    return _mm256_and_si256(_mm256_add_epi8(ch, offset),
+                            _mm256_set1_epi8(0xf));
+}
+
+__attribute__((target("avx2"))) static void hex_encode_avx2(const uint8_t *num,
+                                                            char *str,
+                                                            size_t bytes)
+{
+    const __m256i mask = _mm256_set1_epi8(0xf);
+    const __m256i lut = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *) hexchars));
+    size_t i = 0;
+
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (num + i));
+        /* Unpacking works within 128-bit lanes, so put bytes 0-7 and 16-23
+         * in the low lane and 8-15 and 24-31 in the high one first. */
+        v = _mm256_permute4x64_epi64(v, 0xd8);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+        __m256i lo = _mm256_and_si256(v, mask);
+        __m256i c0 = _mm256_shuffle_epi8(lut, _mm256_unpacklo_epi8(hi, lo));
+        __m256i c1 = _mm256_shuffle_epi8(lut, _mm256_unpackhi_epi8(hi, lo));
+        _mm256_storeu_si256((__m256i *) (str + i * 2), c0);
+        _mm256_storeu_si256((__m256i *) (str + i * 2 + 32), c1);
+    }
+
+    /* GCC does not always clear the upper halves before the tail call, and
+     * the legacy SSE code of the tail would pay the transition penalty. */
+    _mm256_zeroupper();
+    hex_encode_ssse3(num + i, str + i * 2, bytes - i);
+}
+
+__attribute__((target("avx2"))) static void hex_decode_avx2(const char *str,
+                                                            uint8_t *num,
+                                                            size_t bytes)
+{
+    const __m256i weight = _mm256_set1_epi16(0x0110);
+    size_t i = 0;
+
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i n0 = avx2_char_to_nibble(
+            _mm256_loadu_si256((const __m256i *) (str + i * 2)));
+        __m256i n1 = avx2_char_to_nibble(
+            _mm256_loadu_si256((const __m256i *) (str + i * 2 + 32)));
+        n0 = _mm256_maddubs_epi16(n0, weight);
+        n1 = _mm256_maddubs_epi16(n1, weight);
+        /* Packing works within 128-bit lanes as well, fix the order up */
+        __m256i v = _mm256_packus_epi16(n0, n1);
+        v = _mm256_permute4x64_epi64(v, 0xd8);
+        _mm256_storeu_si256((__m256i *) (num + i), v);
+    }
+
+    _mm256_zeroupper();
+    hex_decode_ssse3(str + i * 2, num + i, bytes - i);
+}
+#endif
+
+/* From the slowest to the fastest one */
+static const hex_kernel_t kernels[] = {
+    {"scalar", hex_encode_scalar, hex_decode_scalar},
+#ifdef HEX_X86
+    {"sse2", hex_encode_sse2, hex_decode_sse2},
+    {"ssse3", hex_encode_ssse3, hex_decode_ssse3},
+    {"avx2", hex_encode_avx2, hex_decode_avx2},
+#endif
+};
+
+/* Check whether the CPU can run kernels[idx]. Every kernel requires the
+ * instruction sets of the ones before it in the table. */
+static bool kernel_supported(int idx)
+{
+#ifdef HEX_X86
+    __builtin_cpu_init();
+    switch (idx) {
+    case 1:
+        return __builtin_cpu_supports("sse2");
+    case 2:
+        return __builtin_cpu_supports("ssse3");
+    case 3:
+        return __builtin_cpu_supports("avx2");
+    default:
+        break;
+    }
+#endif
+    return idx == 0;
+}
+
+static const hex_kernel_t *hex_kernel = &kernels[0];
+
+const hex_kernel_t *hex_kernels(int *num)
+{
+    int n = 0;
+    while (n < (int) (sizeof(kernels) / sizeof(kernels[0])) &&
+           kernel_supported(n))
+        n++;
+
+    *num = n;
+    return kernels;
+}
+
+static pthread_once_t hex_kernel_once = PTHREAD_ONCE_INIT;
+
+static void hex_kernel_pick(void)
+{
+    int num;
+    const hex_kernel_t *list = hex_kernels(&num);
+    hex_kernel = &list[num - 1];
+}
+
+/* Stubs may be initialised from several threads */
+void translate_init(void)
+{
+    pthread_once(&hex_kernel_once, hex_kernel_pick);
+}
+
+void hex_to_str(uint8_t *num, char *str, size_t bytes)
+{
+    hex_kernel->encode(num, str, bytes);
+    str[bytes * 2] = '\0';
+}
+
+void str_to_hex(char *str, uint8_t *num, size_t bytes)
+{
+    hex_kernel->decode(str, num, bytes);
+}
+
+static inline bool escaped(uint8_t c)
+{
+    return c == '#' || c == '$' || c == '}' || c == '*';
+}
+
+/* escape_block() copies a block of data to str, unless it is NULL, and
+ * returns the number of bytes in it before the first one to escape */
+#if defined(__SSE2__)
+#define ESCAPE_BLOCK 16
+
+static inline size_t escape_block(const uint8_t *data, char *str)
+{
+    __m128i v = _mm_loadu_si128((const __m128i *) data);
+    if (str)
+        _mm_storeu_si128((__m128i *) str, v);
+
+    __m128i hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('#')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('$'))),
+        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('}')),
+                     _mm_cmpeq_epi8(v, _mm_set1_epi8('*'))));
+    int mask = _mm_movemask_epi8(hit);
+    return mask ? (size_t) __builtin_ctz(mask) : ESCAPE_BLOCK;
+}
+#elif __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ESCAPE_BLOCK 8
+#define ONES (0x0101010101010101ULL)
+#define HIGHS (0x8080808080808080ULL)
+
+/* Set the high bit of every byte of v which is zero, and only of those */
+static inline uint64_t zero_bytes(uint64_t v)
+{
+    return ~(((v & ~HIGHS) + ~HIGHS) | v | ~HIGHS);
+}
+
+static inline size_t escape_block(const uint8_t *data, char *str)
+{
+    uint64_t v;
+    memcpy(&v, data, sizeof(v));
+    if (str)
+        memcpy(str, &v, sizeof(v));
+
+    uint64_t hit = zero_bytes(v ^ (ONES * '#')) | zero_bytes(v ^ (ONES * '$')) |
+                   zero_bytes(v ^ (ONES * '}')) | zero_bytes(v ^ (ONES * '*'));
+    return hit ? (size_t) __builtin_ctzll(hit) / 8 : ESCAPE_BLOCK;
+}
+#endif
+
+size_t escape(const uint8_t *data,
+              size_t len,
+              char *str,
+              size_t room,
+              size_t *str_len)
+{
+    size_t r = 0, w = 0;
+
+#ifdef ESCAPE_BLOCK
+    /* A whole block is copied even when only its bytes before the first
+     * to escape are kept, which the room allows */
+    while (r + ESCAPE_BLOCK <= len && w + ESCAPE_BLOCK <= room) {
+        size_t plain = escape_block(data + r, str ? str + w : NULL);
+        r += plain;
+        w += plain;
+        if (plain == ESCAPE_BLOCK)
+            continue;
+        if (w + 2 > room)
+            break;
+
+        if (str) {
+            str[w] = '}';
+            str[w + 1] = data[r] ^ 0x20;
+        }
+        r++;
+        w += 2;
+    }
+#endif
+
+    for (; r < len; r++) {
+        size_t need = escaped(data[r]) ? 2 : 1;
+        if (w + need > room)
+            break;
+        if (str && need == 2) {
+            str[w] = '}';
+            str[w + 1] = data[r] ^ 0x20;
+        } else if (str) {
+            str[w] = data[r];
+        }
+        w += need;
+    }
+
+    *str_len = w;
+    return r;
+}
+
 int unescape(char *msg, char *end)
 {
-    char *w = msg;
-    char *r = msg;
+    return unescape_to(msg, end, (uint8_t *) msg);
+}
+
+size_t unescape_to(const char *msg, const char *end, uint8_t *out)
+{
+    const char *r = msg;
+    size_t w = 0;
+
     while (r < end) {
-        if (*r == '}') {
-            *w = *(r + 1) ^ 0x20;
-            r += 2;
-        } else {
-            *w = *r;
-            r += 1;
-        }
-        w += 1;
+        /* Copy up to the next escape in one go */
+        const char *esc = memchr(r, '}', end - r);
+        size_t span = (esc ? esc : end) - r;
+        if (out)
+            memmove(out + w, r, span);
+        r += span;
+        w += span;
+        if (!esc || esc + 1 == end)
+            break;
+
+        if (out)
+            out[w] = esc[1] ^ 0x20;
+        r += 2;
+        w++;
     }
 
-    return w - msg;
+    return w;
 }
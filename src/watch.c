@@ -0,0 +1,193 @@
+#include "watch.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The last byte of range, which stops at the end of the address space
+ * rather than wrap around */
+static size_t range_last(const mem_range_t *range)
+{
+    if (range->len - 1 > SIZE_MAX - range->addr)
+        return SIZE_MAX;
+    return range->addr + range->len - 1;
+}
+
+static bool watch_triggers(bp_type_t type, bool is_write)
+{
+    return type == WP_ACCESS || type == (is_write ? WP_WRITE : WP_READ);
+}
+
+static int range_cmp(const void *a, const void *b)
+{
+    const mem_range_t *ra = a, *rb = b;
+    return (ra->addr > rb->addr) - (ra->addr < rb->addr);
+}
+
+static bool watch_index_build(gdbstub_watch_index_t *index,
+                              const gdbstub_watches_t *watches,
+                              bool is_write)
+{
+    int nr = 0;
+    for (int i = 0; i < watches->nr; i++)
+        nr += watch_triggers(watches->watches[i].type, is_write);
+
+    memset(index, 0, sizeof(*index));
+    if (!nr)
+        return true;
+
+    index->ranges = malloc(nr * sizeof(mem_range_t));
+    index->max_lasts = malloc(nr * sizeof(size_t));
+    if (!index->ranges || !index->max_lasts) {
+        free(index->ranges);
+        free(index->max_lasts);
+        return false;
+    }
+
+    for (int i = 0; i < watches->nr; i++) {
+        if (watch_triggers(watches->watches[i].type, is_write))
+            index->ranges[index->nr++] = watches->watches[i].range;
+    }
+    qsort(index->ranges, nr, sizeof(mem_range_t), range_cmp);
+
+    size_t max_last = 0;
+    for (int i = 0; i < nr; i++) {
+        size_t last = range_last(&index->ranges[i]);
+        max_last = last > max_last ? last : max_last;
+        index->max_lasts[i] = max_last;
+    }
+    index->lo = index->ranges[0].addr;
+    index->last = max_last;
+    return true;
+}
+
+static void watch_index_destroy(gdbstub_watch_index_t *index)
+{
+    free(index->ranges);
+    free(index->max_lasts);
+}
+
+/* Replace both indexes, or keep the old ones if that fails */
+static bool watch_rebuild(gdbstub_watches_t *watches)
+{
+    gdbstub_watch_index_t reads, writes;
+
+    if (!watch_index_build(&reads, watches, false))
+        return false;
+    if (!watch_index_build(&writes, watches, true)) {
+        watch_index_destroy(&reads);
+        return false;
+    }
+
+    watch_index_destroy(&watches->reads);
+    watch_index_destroy(&watches->writes);
+    watches->reads = reads;
+    watches->writes = writes;
+    return true;
+}
+
+static int watch_find(gdbstub_watches_t *watches,
+                      size_t addr,
+                      size_t len,
+                      bp_type_t type)
+{
+    for (int i = 0; i < watches->nr; i++) {
+        gdbstub_watch_t *w = &watches->watches[i];
+        if (w->range.addr == addr && w->range.len == len && w->type == type)
+            return i;
+    }
+    return -1;
+}
+
+int watch_insert(gdbstub_watches_t *watches,
+                 size_t addr,
+                 size_t len,
+                 bp_type_t type)
+{
+    if (!len || type < WP_WRITE || type > WP_ACCESS)
+        return EINVAL;
+    if (watch_find(watches, addr, len, type) >= 0)
+        return 0;
+
+    gdbstub_watch_t *new_watches = realloc(
+        watches->watches, (watches->nr + 1) * sizeof(gdbstub_watch_t));
+    if (!new_watches)
+        return ENOMEM;
+    watches->watches = new_watches;
+    watches->watches[watches->nr++] = (gdbstub_watch_t){{addr, len}, type};
+
+    if (!watch_rebuild(watches)) {
+        watches->nr--;
+        return ENOMEM;
+    }
+    watches->gen++;
+    return 0;
+}
+
+bool watch_remove(gdbstub_watches_t *watches,
+                  size_t addr,
+                  size_t len,
+                  bp_type_t type)
+{
+    int i = watch_find(watches, addr, len, type);
+    if (i < 0)
+        return false;
+
+    memmove(&watches->watches[i], &watches->watches[i + 1],
+            (watches->nr - i - 1) * sizeof(gdbstub_watch_t));
+    watches->nr--;
+    watches->gen++;
+    /* Old indexes only let more accesses through to the list */
+    watch_rebuild(watches);
+    return true;
+}
+
+void watch_destroy(gdbstub_watches_t *watches)
+{
+    watch_index_destroy(&watches->reads);
+    watch_index_destroy(&watches->writes);
+    free(watches->watches);
+    memset(watches, 0, sizeof(*watches));
+}
+
+bool gdbstub_watch_lookup(gdbstub_t *gdbstub,
+                          size_t addr,
+                          size_t len,
+                          bool is_write)
+{
+    gdbstub_watches_t *watches = &gdbstub->watches;
+    const gdbstub_watch_index_t *index =
+        is_write ? &watches->writes : &watches->reads;
+    mem_range_t access = {addr, len};
+    size_t last = range_last(&access);
+
+    /* Of the ranges starting up to the last byte of the access, one
+     * overlaps it if any reaches its first byte */
+    int lo = 0, hi = index->nr;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (index->ranges[mid].addr <= last)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (!lo || index->max_lasts[lo - 1] < addr)
+        return false;
+
+    /* Tell which one it is, in the order GDB set them */
+    for (int i = 0; i < watches->nr; i++) {
+        const gdbstub_watch_t *w = &watches->watches[i];
+        if (!watch_triggers(w->type, is_write) ||
+            addr > range_last(&w->range) || last < w->range.addr)
+            continue;
+
+        if (!watches->hit) {
+            watches->hit = true;
+            watches->hit_type = w->type;
+            watches->hit_addr = addr > w->range.addr ? addr : w->range.addr;
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,143 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ax.h"
+
+static uint64_t regs[4] = {7, (uint64_t) -2, 0x1000, 0};
+static uint8_t mem[16] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x88};
+
+static int read_reg(void *ctx, int regno, uint64_t *value)
+{
+    (void) ctx;
+    if (regno < 0 || regno >= 4)
+        return EINVAL;
+    *value = regs[regno];
+    return 0;
+}
+
+static int read_mem(void *ctx, size_t addr, size_t len, void *buf)
+{
+    (void) ctx;
+    if (addr < 0x1000 || addr - 0x1000 + len > sizeof(mem))
+        return EFAULT;
+    memcpy(buf, mem + (addr - 0x1000), len);
+    return 0;
+}
+
+/* The memory collected by the trace bytecodes */
+static size_t traced[4][2];
+static int nr_traced;
+
+static int trace(void *ctx, size_t addr, size_t len)
+{
+    (void) ctx;
+    if (nr_traced == 4)
+        return ENOSPC;
+    traced[nr_traced][0] = addr;
+    traced[nr_traced++][1] = len;
+    return 0;
+}
+
+static int eval(const char *code, size_t len, uint64_t *result)
+{
+    ax_env_t env = {.read_reg = read_reg, .read_mem = read_mem};
+    ax_expr_t expr = {(uint8_t *) code, len};
+    return ax_eval(&expr, &env, result);
+}
+
+static int collect(const char *code, size_t len)
+{
+    ax_env_t env = {
+        .read_reg = read_reg,
+        .read_mem = read_mem,
+        .trace = trace,
+    };
+    ax_expr_t expr = {(uint8_t *) code, len};
+    return ax_eval(&expr, &env, NULL);
+}
+
+#define EVAL(code, result) eval(code, sizeof(code) - 1, result)
+#define COLLECT(code) collect(code, sizeof(code) - 1)
+
+int main()
+{
+    uint64_t val;
+
+    /* reg 0 == 7 */
+    assert(!EVAL("\x26\x00\x00\x22\x07\x13\x27", &val) && val == 1);
+    /* (reg 1 < 0) signed but not unsigned */
+    assert(!EVAL("\x26\x00\x01\x22\x00\x14\x27", &val) && val == 1);
+    assert(!EVAL("\x26\x00\x01\x22\x00\x15\x27", &val) && val == 0);
+    /* 100 - 7 * 3, and 0x12345678 / 0x10 % 0x100 */
+    assert(!EVAL("\x22\x64\x22\x07\x22\x03\x04\x03\x27", &val) && val == 79);
+    assert(!EVAL("\x24\x12\x34\x56\x78\x22\x10\x06\x23\x01\x00\x08\x27",
+                 &val) &&
+           val == 0x67);
+    /* -7 / 2 rounds toward zero, -7 % 2 */
+    assert(!EVAL("\x22\x07\x12\x22\x01\x02\x22\x02\x05\x27", &val) &&
+           (int64_t) val == -3);
+    assert(!EVAL("\x22\x07\x12\x22\x01\x02\x22\x02\x07\x27", &val) &&
+           (int64_t) val == -1);
+    /* Shifts, and sign and zero extension of the low byte */
+    assert(!EVAL("\x22\x01\x22\x3f\x09\x22\x3f\x0a\x27", &val) &&
+           val == UINT64_MAX);
+    assert(!EVAL("\x22\x01\x22\x3f\x09\x22\x3f\x0b\x27", &val) && val == 1);
+    assert(!EVAL("\x23\x01\x80\x16\x08\x27", &val) && val == (uint64_t) -128);
+    assert(!EVAL("\x26\x00\x01\x2a\x08\x27", &val) && val == 0xfe);
+    /* Memory through a register, little-endian */
+    assert(!EVAL("\x26\x00\x02\x19\x27", &val) && val == 0x04030201);
+    assert(!EVAL("\x26\x00\x02\x1a\x27", &val) && val == 0x8807060504030201);
+    assert(!EVAL("\x26\x00\x02\x22\x07\x02\x17\x16\x08\x27", &val) &&
+           val == (uint64_t) -120);
+    /* Stack shuffling: 1 2 3 rot => 3 1 2, then swap, pick 2, pop */
+    assert(!EVAL("\x22\x01\x22\x02\x22\x03\x33\x27", &val) && val == 2);
+    assert(!EVAL("\x22\x01\x22\x02\x22\x03\x33\x2b\x27", &val) && val == 1);
+    assert(!EVAL("\x22\x01\x22\x02\x22\x03\x32\x02\x27", &val) && val == 1);
+    assert(!EVAL("\x22\x01\x22\x02\x28\x29\x29\x27", &val) && val == 1);
+    /* Sum 1..10 with a loop: n acc on the stack */
+    assert(!EVAL("\x22\x0a\x22\x00"         /* 0: n = 10, acc = 0 */
+                 "\x32\x01\x02"             /* 4: acc += n */
+                 "\x2b\x22\x01\x03\x2b"     /* 7: n -= 1 */
+                 "\x32\x01\x20\x00\x04"     /* 12: loop while n */
+                 "\x27",
+                 &val) &&
+           val == 55);
+    /* Logical and bitwise operators */
+    assert(!EVAL("\x22\x00\x0e\x22\x06\x22\x03\x0f\x10\x22\x05\x11\x27",
+                 &val) &&
+           val == 6);
+
+    /* Collecting: trace_quick then ref32 of reg 2, trace16, a string up
+     * to its zero byte, and trace, which may leave the stack empty */
+    assert(!COLLECT("\x26\x00\x02\x0d\x04\x19\x29"
+                    "\x26\x00\x02\x30\x01\x00\x29"
+                    "\x24\x00\x00\x10\x04\x22\x0c\x2f"
+                    "\x22\x08\x22\x02\x0c\x27"));
+    assert(nr_traced == 4);
+    assert(traced[0][0] == 0x1000 && traced[0][1] == 4);
+    assert(traced[1][0] == 0x1000 && traced[1][1] == 0x100);
+    assert(traced[2][0] == 0x1004 && traced[2][1] == 5);
+    assert(traced[3][0] == 8 && traced[3][1] == 2);
+    assert(COLLECT("\x22\x08\x22\x02\x0c\x27") == ENOSPC);
+    assert(EVAL("\x27", &val) == EINVAL);
+
+    /* Errors */
+    assert(EVAL("\x22\x01\x22\x00\x06\x27", &val) == EDOM);
+    assert(EVAL("\x02\x27", &val) == EINVAL);
+    assert(EVAL("\x22\x01", &val) == EINVAL);
+    assert(EVAL("\x23\x01", &val) == EINVAL);
+    assert(EVAL("\x26\x00\x09\x27", &val) == EINVAL);
+    assert(EVAL("\x22\x00\x19\x27", &val) == EFAULT);
+    assert(EVAL("\x21\x00\x00", &val) == ELOOP);
+    assert(EVAL("\x21\x01\x00", &val) == EINVAL);
+    assert(EVAL("\x0c\x27", &val) == ENOTSUP);
+    char overflow[AX_MAX_STACK * 2 + 2];
+    for (int i = 0; i <= AX_MAX_STACK; i++)
+        memcpy(&overflow[i * 2], "\x22\x01", 2);
+    assert(eval(overflow, sizeof(overflow), &val) == EOVERFLOW);
+
+    printf("ax_test: PASS\n");
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include "stub_client.h"
+
+/* A loop of LOOP_LEN instructions counting its iterations in a0, with the
+ * breakpoints of the Z0 packets on its first instruction */
+#define REG_A0 10
+#define LOOP_PC 0x1000
+#define LOOP_LEN 4
+
+static stub_t stub;
+
+static gdb_action_t cont(void *args __attribute__((unused)))
+{
+    uint64_t *pc = &stub.regs[STUB_REG_PC];
+
+    do {
+        if (*pc == LOOP_PC)
+            stub.regs[REG_A0]++;
+        *pc += 4;
+        if (*pc == LOOP_PC + 4 * LOOP_LEN)
+            *pc = LOOP_PC;
+    } while (!gdbstub_bp_hit(&stub.gdbstub, *pc));
+    return ACT_RESUME;
+}
+
+/* "$a0 == value": reg a0; const32 value; equal; end */
+static void cond_expr(char *buf, size_t size, uint32_t value)
+{
+    snprintf(buf, size, "Xa,260%03x24%08x1327", REG_A0, value);
+}
+
+static void check(client_t *client, const char *req, const char *reply)
+{
+    size_t len;
+    assert(!strcmp(client_cmd(client, req, &len), reply));
+}
+
+int main()
+{
+    struct target_ops ops = stub_target_ops();
+    client_t client;
+    char req[128], x3[32], x5[32], x9[32];
+
+    ops.cont = cont;
+    stub.ops = &ops;
+    stub.arch = (arch_info_t){.smp = 1, .reg_num = STUB_NR_REGS};
+    stub.regs[STUB_REG_PC] = LOOP_PC;
+
+    stub_start(&stub);
+    client_connect(&client, stub.path);
+    client_noack(&client);
+
+    cond_expr(x3, sizeof(x3), 3);
+    cond_expr(x5, sizeof(x5), 5);
+    cond_expr(x9, sizeof(x9), 9);
+
+    /* Two conditions of one location, back to back after a single ';' */
+    snprintf(req, sizeof(req), "Z0,1000,4;%s%s", x3, x5);
+    check(&client, req, "OK");
+    check(&client, "c", "S05");
+    assert(stub.regs[REG_A0] == 3);
+    check(&client, "c", "S05");
+    assert(stub.regs[REG_A0] == 5);
+
+    /* A single condition replaces them */
+    snprintf(req, sizeof(req), "Z0,1000,4;%s", x9);
+    check(&client, req, "OK");
+    check(&client, "c", "S05");
+    assert(stub.regs[REG_A0] == 9);
+
+    /* Malformed, the breakpoint is left as it is */
+    snprintf(req, sizeof(req), "Z0,1000,4;%s;%s", x3, x5);
+    check(&client, req, "E22");
+    check(&client, "Z0,1000,4;", "E22");
+    check(&client, "Z0,1000,4;X1", "E22");
+    check(&client, "Z0,1000,4;Xa,26", "E22");
+    stub.regs[REG_A0] = 0;
+    check(&client, "c", "S05");
+    assert(stub.regs[REG_A0] == 9);
+
+    /* Without conditions it stops at every pass */
+    check(&client, "Z0,1000,4", "OK");
+    check(&client, "c", "S05");
+    assert(stub.regs[REG_A0] == 10);
+    check(&client, "z0,1000,4", "OK");
+
+    client_close(&client);
+    stub_join(&stub);
+    printf("bp_cond_test: PASS\n");
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bps.h"
+
+#define NR_BPS 10000
+
+/* The i-th breakpoint is in the bucket i % 8 of the filter */
+#define STRIDE (2 * GDBSTUB_BP_FILTER_BITS)
+#define BP_ADDR(i) ((size_t) (i) * STRIDE + (size_t) ((i) % 8) * 2)
+
+static bool is_bp(size_t addr)
+{
+    size_t i = addr / STRIDE;
+    return i < NR_BPS && addr == BP_ADDR(i);
+}
+
+int main()
+{
+    static gdbstub_t gdbstub;
+    static size_t addrs[NR_BPS];
+    gdbstub_bps_t *bps = &gdbstub.bps;
+
+    /* Empty */
+    assert(!gdbstub_bp_hit(&gdbstub, 0) && !gdbstub_bp_hit(&gdbstub, 0x1000));
+    assert(!bps_remove(bps, 0x1000));
+
+    /* One, added twice */
+    assert(bps_insert(bps, 0x1000, NULL) == 0);
+    assert(bps_insert(bps, 0x1000, NULL) == 0);
+    assert(bps->nr == 1 && gdbstub_bp_hit(&gdbstub, 0x1000));
+    assert(!gdbstub_bp_hit(&gdbstub, 0x1002));
+    /* In the same bucket of the filter but not in the table */
+    assert(!gdbstub_bp_hit(&gdbstub, 0x1000 + 2 * GDBSTUB_BP_FILTER_BITS));
+    assert(bps_remove(bps, 0x1000) && !bps_remove(bps, 0x1000));
+    assert(!gdbstub_bp_hit(&gdbstub, 0x1000));
+    assert(bps_insert(bps, GDBSTUB_BP_FREE, NULL) == EINVAL);
+
+    /* Conditions go with their breakpoint, and are replaced when it is
+     * added again */
+    gdbstub_bp_cond_t *cond = bps_cond_alloc(1);
+    assert(bps_insert(bps, 0x2000, cond) == 0 && bps->conds);
+    assert(bps->conds[gdbstub_bp_slot(bps, 0x2000)] == cond);
+    assert(bps_insert(bps, 0x2000, NULL) == 0);
+    assert(!bps->conds[gdbstub_bp_slot(bps, 0x2000)]);
+    assert(gdbstub_bp_hit(&gdbstub, 0x2000));
+    assert(bps_insert(bps, 0x2000, bps_cond_alloc(2)) == 0);
+    assert(bps_remove(bps, 0x2000));
+
+    /* Many, all in a few buckets of the filter so that it lets lookups
+     * through to the table, and removed in another order than they came so
+     * that entries get shifted back over the holes */
+    for (int i = 0; i < NR_BPS; i++) {
+        addrs[i] = BP_ADDR(i);
+        assert(bps_insert(bps, addrs[i], NULL) == 0);
+    }
+    assert(bps->nr == NR_BPS);
+    for (int i = 0; i < NR_BPS; i++)
+        assert(gdbstub_bp_hit(&gdbstub, addrs[i]));
+    for (size_t addr = 0; addr < 64 * STRIDE; addr += 2)
+        assert(gdbstub_bp_hit(&gdbstub, addr) == is_bp(addr));
+
+    for (int i = 0; i < NR_BPS; i += 3)
+        assert(bps_remove(bps, addrs[i]));
+    for (int i = 0; i < NR_BPS; i++)
+        assert(gdbstub_bp_hit(&gdbstub, addrs[i]) == (i % 3 != 0));
+    for (int i = 0; i < NR_BPS; i++)
+        assert(bps_remove(bps, addrs[i]) == (i % 3 != 0));
+    assert(bps->nr == 0);
+    for (int i = 0; i < NR_BPS; i++)
+        assert(!gdbstub_bp_hit(&gdbstub, addrs[i]));
+
+    bps_destroy(bps);
+    printf("bps_test: PASS\n");
+    return 0;
+}
@@ -0,0 +1,39 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cmd_table.h"
+
+static cmd_id_t lookup(const char *key)
+{
+    return cmd_lookup(key[0], key + 1, strlen(key + 1));
+}
+
+int main()
+{
+    /* Every command is found, also in a packet where it is not terminated */
+    for (unsigned i = 0; i < 1 << CMD_HASH_BITS; i++) {
+        const char *key = cmd_slots[i].key;
+        if (!key)
+            continue;
+
+        char packet[64];
+        snprintf(packet, sizeof(packet), "%s:1234", key);
+        assert(cmd_lookup(key[0], packet + 1, strlen(key) - 1) ==
+               cmd_slots[i].id);
+    }
+    assert(lookup("qSupported") == CMD_SUPPORTED);
+    assert(lookup("vCont?") == CMD_VCONT_SUPPORTED);
+
+    /* Neither prefixes, longer names nor another packet type match */
+    assert(lookup("vCon") == CMD_NONE);
+    assert(lookup("qSupportedX") == CMD_NONE);
+    assert(lookup("QSupported") == CMD_NONE);
+    assert(lookup("qStartNoAckMode") == CMD_NONE);
+    assert(lookup("q") == CMD_NONE);
+    assert(lookup("qRcmd") == CMD_NONE);
+    assert(lookup("vMustReplyEmpty") == CMD_NONE);
+
+    printf("cmd_table_test: PASS\n");
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "memcache.h"
+
+int main()
+{
+    memcache_t cache;
+    uint8_t *line;
+
+    /* Off */
+    assert(memcache_init(&cache, 0, 0) && !memcache_enabled(&cache));
+    memcache_write(&cache, 0x1000, 4, "abcd");
+    memcache_invalidate(&cache);
+    memcache_destroy(&cache);
+
+    /* 4 lines of 64 bytes */
+    assert(memcache_init(&cache, 64, 4) && memcache_enabled(&cache));
+    assert(memcache_line_addr(&cache, 0x107f) == 0x1040);
+    assert(!memcache_find(&cache, 0x1040));
+
+    line = memcache_slot(&cache, 0x1040);
+    memset(line, 0xaa, 64);
+    memcache_set_valid(&cache, 0x1040);
+    assert(memcache_find(&cache, 0x1040) == line);
+    assert(cache.nr_hits == 1 && cache.nr_misses == 1);
+
+    /* 0x1140 goes in the same slot and evicts it */
+    assert(!memcache_find(&cache, 0x1140));
+    assert(memcache_slot(&cache, 0x1140) == line);
+    assert(!memcache_find(&cache, 0x1040));
+    memset(line, 0xaa, 64);
+    memcache_set_valid(&cache, 0x1140);
+
+    /* Writes go to the lines they overlap, and only there */
+    line = memcache_slot(&cache, 0x1180);
+    memset(line, 0xbb, 64);
+    memcache_set_valid(&cache, 0x1180);
+    memcache_write(&cache, 0x117e, 4, "wxyz");
+    uint8_t *prev = memcache_find(&cache, 0x1140);
+    assert(prev[62] == 'w' && prev[63] == 'x' && prev[61] == 0xaa);
+    assert(line[0] == 'y' && line[1] == 'z' && line[2] == 0xbb);
+    memcache_write(&cache, 0x2000, 4, "abcd");
+
+    /* A failed write leaves nothing known of the memory it touched */
+    memcache_write(&cache, 0x11bf, 1, NULL);
+    assert(memcache_find(&cache, 0x1140) && !memcache_find(&cache, 0x1180));
+
+    /* A write larger than the cache, and the last line of the address
+     * space */
+    memcache_write(&cache, 0, 4096, NULL);
+    assert(!memcache_find(&cache, 0x1140));
+    line = memcache_slot(&cache, UINT64_MAX - 63);
+    memset(line, 0, 64);
+    memcache_set_valid(&cache, UINT64_MAX - 63);
+    memcache_write(&cache, UINT64_MAX - 2, 2, "hi");
+    assert(line[61] == 'h' && line[62] == 'i' && line[63] == 0);
+
+    /* The target ran */
+    memcache_invalidate(&cache);
+    assert(!memcache_find(&cache, UINT64_MAX - 63));
+
+    memcache_destroy(&cache);
+    printf("memcache_test: PASS\n");
+    return 0;
+}
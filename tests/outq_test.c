@@ -0,0 +1,148 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "outq.h"
+
+#define NR_FRAMES 100000
+
+/* Take one whole frame off the ring into buf and return its length, or 0
+ * if there is none */
+static size_t take(outq_t *q, char *buf)
+{
+    struct iovec iov;
+    if (outq_peek(q, &iov, 1) == 0)
+        return 0;
+
+    memcpy(buf, iov.iov_base, iov.iov_len);
+    outq_consume(q, iov.iov_len);
+    return iov.iov_len;
+}
+
+static void test_order(void)
+{
+    outq_t q;
+    char big[100], buf[128];
+    struct iovec iov[4];
+
+    assert(outq_init(&q, 4));
+    assert(!outq_pending(&q));
+
+    memset(big, 'x', sizeof(big));
+    assert(outq_push(&q, "+", 1));
+    assert(outq_push(&q, big, sizeof(big)));
+    assert(outq_push(&q, "$OK#9a", 6));
+    assert(outq_push(&q, "-", 1));
+    assert(!outq_push(&q, "+", 1)); /* full */
+    assert(outq_pending(&q));
+
+    /* Adjacent frames come out together, and partly sent ones resume */
+    assert(outq_peek(&q, iov, 4) == 4);
+    assert(iov[0].iov_len == 1 && iov[1].iov_len == sizeof(big));
+    outq_consume(&q, 1 + 40);
+    assert(outq_peek(&q, iov, 4) == 3);
+    assert(iov[0].iov_len == sizeof(big) - 40);
+    assert(!memcmp(iov[1].iov_base, "$OK#9a", 6));
+    outq_consume(&q, sizeof(big) - 40 + 6);
+
+    /* Room again for the next lap */
+    assert(outq_push(&q, "+", 1));
+    assert(take(&q, buf) == 1 && buf[0] == '-');
+    assert(take(&q, buf) == 1 && buf[0] == '+');
+    assert(take(&q, buf) == 0);
+    assert(!outq_pending(&q));
+    outq_destroy(&q);
+}
+
+static void test_handover(void)
+{
+    outq_t q;
+    char buf[128];
+
+    assert(outq_init(&q, 4));
+
+    /* The frame is sent from the buffer handed over, which comes back for
+     * a later frame once it is sent */
+    size_t cap = 64;
+    char *frame = malloc(cap);
+    char *first = frame;
+    memset(frame, 'y', cap);
+    assert(outq_push_buf(&q, &frame, &cap, 48));
+    assert(!frame && !cap);
+
+    frame = malloc(64);
+    cap = 64;
+    assert(take(&q, buf) == 48 && buf[47] == 'y');
+    assert(outq_push_buf(&q, &frame, &cap, 40));
+    assert(frame == first && cap == 64);
+
+    assert(take(&q, buf) == 40);
+    free(frame);
+    outq_destroy(&q);
+}
+
+/* Frames of each producer carry its id and a counter, which the consumer
+ * must see in order */
+static void *producer(void *arg)
+{
+    outq_t *q = arg;
+    static int next_id;
+    int id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    char frame[64];
+
+    for (int i = 0; i < NR_FRAMES; i++) {
+        /* Some frames go to the heap */
+        int len = snprintf(frame, sizeof(frame), "%d:%d:", id, i);
+        if (i % 7 == 0) {
+            memset(frame + len, 'z', 40);
+            len += 40;
+        }
+        while (!outq_push(q, frame, len))
+            sched_yield();
+    }
+    return NULL;
+}
+
+static void test_producers(void)
+{
+    outq_t q;
+    pthread_t tids[2];
+    int next[2] = {0, 0};
+    char buf[128];
+
+    assert(outq_init(&q, 16));
+    for (int i = 0; i < 2; i++)
+        assert(pthread_create(&tids[i], NULL, producer, &q) == 0);
+
+    for (int nr = 0; nr < 2 * NR_FRAMES;) {
+        size_t len = take(&q, buf);
+        if (!len) {
+            sched_yield();
+            continue;
+        }
+        buf[len] = '\0';
+
+        int id, seq;
+        assert(sscanf(buf, "%d:%d:", &id, &seq) == 2);
+        assert(id >= 0 && id < 2 && seq == next[id]);
+        next[id]++;
+        nr++;
+    }
+
+    for (int i = 0; i < 2; i++)
+        pthread_join(tids[i], NULL);
+    assert(!outq_pending(&q));
+    outq_destroy(&q);
+}
+
+int main()
+{
+    test_order();
+    test_handover();
+    test_producers();
+    printf("outq_test: PASS\n");
+    return 0;
+}
@@ -0,0 +1,57 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "utils/parse.h"
+
+static parse_t cursor(const char *str)
+{
+    parse_t p;
+    parse_init(&p, str, strlen(str));
+    return p;
+}
+
+int main()
+{
+    uint64_t addr, len;
+    int num;
+
+    parse_t p = cursor("80000000,1F:");
+    assert(parse_hex_u64(&p, &addr) && addr == 0x80000000);
+    assert(!parse_expect_char(&p, ':'));
+    assert(parse_expect_char(&p, ','));
+    assert(parse_hex_u64(&p, &len) && len == 0x1f);
+    assert(parse_remaining(&p) == 1 && parse_expect_char(&p, ':'));
+    assert(parse_at_end(&p) && !parse_expect_char(&p, ':'));
+
+    /* 16 digits at most, leaving the cursor alone otherwise */
+    p = cursor("ffffffffffffffff");
+    assert(parse_hex_u64(&p, &addr) && addr == UINT64_MAX);
+    p = cursor("10000000000000000");
+    assert(!parse_hex_u64(&p, &addr) && parse_remaining(&p) == 17);
+    p = cursor(",4");
+    assert(!parse_hex_u64(&p, &addr) && parse_remaining(&p) == 2);
+    p = cursor("");
+    assert(!parse_hex_u64(&p, &addr));
+
+    /* The cursor does not look past its end */
+    p = cursor("1234");
+    p.end -= 2;
+    assert(parse_hex_u64(&p, &addr) && addr == 0x12 && parse_at_end(&p));
+
+    p = cursor("-1");
+    assert(parse_dec_int(&p, &num) && num == -1 && parse_at_end(&p));
+    p = cursor("0012x");
+    assert(parse_dec_int(&p, &num) && num == 12 && parse_remaining(&p) == 1);
+    p = cursor("2147483647");
+    assert(parse_dec_int(&p, &num) && num == 2147483647);
+    p = cursor("-2147483648");
+    assert(parse_dec_int(&p, &num) && num == -2147483647 - 1);
+    p = cursor("2147483648");
+    assert(!parse_dec_int(&p, &num));
+    p = cursor("-");
+    assert(!parse_dec_int(&p, &num) && parse_remaining(&p) == 1);
+
+    printf("parse_test: PASS\n");
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "packet.h"
+
+/* Write str to the pipe and let the ring read it back */
+static void feed(pktbuf_t *pktbuf, int *fds, const char *str)
+{
+    size_t len = strlen(str);
+    while (len > 0) {
+        ssize_t nwrite = write(fds[1], str, len);
+        assert(nwrite > 0);
+        str += nwrite;
+        len -= nwrite;
+
+        ssize_t left = nwrite;
+        while (left > 0) {
+            ssize_t nread = pktbuf_fill_from_file(pktbuf, fds[0]);
+            assert(nread > 0);
+            left -= nread;
+        }
+    }
+}
+
+static bool pop(pktbuf_t *pktbuf, packet_t *pkt)
+{
+    return pktbuf_is_complete(pktbuf) && pktbuf_pop_packet(pktbuf, pkt);
+}
+
+static void expect(packet_t *pkt, const char *str)
+{
+    assert(pkt->end_pos + 1 == (int) strlen(str));
+    assert(!memcmp(pkt->data, str, pkt->end_pos + 1));
+}
+
+static void test_framing(int *fds)
+{
+    pktbuf_t pktbuf;
+    packet_t pkt;
+    assert(pktbuf_init(&pktbuf, 64));
+
+    /* Garbage and ACKs in front of a packet are skipped */
+    feed(&pktbuf, fds, "++\x03$g#67");
+    assert(pop(&pktbuf, &pkt));
+    expect(&pkt, "$g#67");
+    pktbuf_release(&pktbuf, &pkt);
+
+    /* A packet split between reads is framed once complete */
+    feed(&pktbuf, fds, "$m0,");
+    assert(!pop(&pktbuf, &pkt));
+    feed(&pktbuf, fds, "4#");
+    assert(!pop(&pktbuf, &pkt));
+    feed(&pktbuf, fds, "fd$?#3f");
+    assert(pop(&pktbuf, &pkt));
+    expect(&pkt, "$m0,4#fd");
+
+    /* Views stay valid while later packets arrive */
+    packet_t next;
+    assert(pop(&pktbuf, &next));
+    expect(&next, "$?#3f");
+    expect(&pkt, "$m0,4#fd");
+    pktbuf_release(&pktbuf, &pkt);
+    pktbuf_release(&pktbuf, &next);
+    assert(!pop(&pktbuf, &pkt));
+
+    pktbuf_destroy(&pktbuf);
+}
+
+static void test_scan(int *fds)
+{
+    pktbuf_t pktbuf;
+    packet_t pkt;
+    char str[128];
+    assert(pktbuf_init(&pktbuf, 256));
+
+    /* Interrupts count outside of packets only, binary data may hold 0x03 */
+    feed(&pktbuf, fds, "\x03+\x03$X0,1:\x03#22\x03");
+    assert(pop(&pktbuf, &pkt));
+    assert(pkt.csum_ok);
+    assert(!pop(&pktbuf, &pkt));
+    assert(pktbuf.nr_intr == 3);
+    pktbuf_release(&pktbuf, &pkt);
+
+    /* A wrong checksum is still framed but reported */
+    feed(&pktbuf, fds, "$g#00");
+    assert(pop(&pktbuf, &pkt));
+    assert(!pkt.csum_ok);
+    pktbuf_release(&pktbuf, &pkt);
+
+    /* Payloads long enough for the vectorized loop, split at any point */
+    for (int len = 0; len < 100; len++) {
+        uint8_t csum = 0;
+        str[0] = '$';
+        for (int i = 0; i < len; i++) {
+            str[i + 1] = 'A' + (i * 7 + len) % 50;
+            csum += str[i + 1];
+        }
+        snprintf(&str[len + 1], sizeof(str) - len - 1, "#%02x", csum);
+
+        char *split = &str[len % (len + 4)];
+        char saved = *split;
+        *split = '\0';
+        feed(&pktbuf, fds, str);
+        *split = saved;
+        feed(&pktbuf, fds, split);
+
+        assert(pop(&pktbuf, &pkt));
+        expect(&pkt, str);
+        assert(pkt.csum_ok);
+        pktbuf_release(&pktbuf, &pkt);
+    }
+
+    pktbuf_destroy(&pktbuf);
+}
+
+static void test_wrap(int *fds)
+{
+    pktbuf_t pktbuf;
+    packet_t pkt;
+    char str[32];
+    assert(pktbuf_init(&pktbuf, 64));
+
+    /* Packets which reach the end of the ring are moved to its beginning */
+    for (int i = 0; i < 100; i++) {
+        snprintf(str, sizeof(str), "$M%x,1:%02x#00", i * 7, i & 0xff);
+        feed(&pktbuf, fds, str);
+        assert(pop(&pktbuf, &pkt));
+        expect(&pkt, str);
+        pktbuf_release(&pktbuf, &pkt);
+    }
+
+    /* The ring refuses to read more while it is full of held views */
+    int held = 0, total = 0;
+    packet_t views[16];
+    for (int i = 0; i < 16; i++)
+        assert(write(fds[1], "$s#73", 5) == 5);
+    while (pktbuf_fill_from_file(&pktbuf, fds[0]) > 0) {
+        while (pop(&pktbuf, &views[held]))
+            held++;
+    }
+    assert(errno == ENOBUFS && held < 16);
+    for (int i = 0; i < held; i++) {
+        expect(&views[i], "$s#73");
+        pktbuf_release(&pktbuf, &views[i]);
+    }
+    total = held;
+    while (total < 16) {
+        assert(pktbuf_fill_from_file(&pktbuf, fds[0]) > 0);
+        while (pop(&pktbuf, &pkt)) {
+            expect(&pkt, "$s#73");
+            pktbuf_release(&pktbuf, &pkt);
+            total++;
+        }
+    }
+
+    /* A packet larger than half of the ring is dropped */
+    feed(&pktbuf, fds, "$X0,40:");
+    for (int i = 0; i < 4; i++)
+        feed(&pktbuf, fds, "0123456789");
+    assert(!pop(&pktbuf, &pkt));
+    feed(&pktbuf, fds, "#00$c#63");
+    assert(pop(&pktbuf, &pkt));
+    expect(&pkt, "$c#63");
+    pktbuf_release(&pktbuf, &pkt);
+
+    pktbuf_destroy(&pktbuf);
+}
+
+/* A packet with the largest payload the ring is sized for, in reads of 256
+ * bytes, so that a partial packet of the whole payload is kept waiting for
+ * its framing, and across the end of the ring */
+static void test_max_size(int *fds)
+{
+    enum { PAYLOAD_SIZE = 1024 };
+    static char str[PAYLOAD_SIZE + PACKET_OVERHEAD + 1];
+    pktbuf_t pktbuf;
+    packet_t pkt;
+    assert(pktbuf_init(&pktbuf, PKTBUF_CAP_FOR(PAYLOAD_SIZE)));
+
+    int head = snprintf(str, sizeof(str), "$X0,%x:",
+                        PAYLOAD_SIZE - 7 /* "X0,3f9:" */);
+    assert(head == 8);
+    uint8_t csum = 0;
+    for (int i = 1; i <= PAYLOAD_SIZE; i++) {
+        if (i >= head)
+            str[i] = 'a' + i % 26;
+        csum += (uint8_t) str[i];
+    }
+    snprintf(str + PAYLOAD_SIZE + 1, 4, "#%02x", csum);
+
+    for (int n = 0; n < 5; n++) {
+        char piece[256 + 1];
+        for (size_t off = 0; off < strlen(str); off += 256) {
+            snprintf(piece, sizeof(piece), "%s", str + off);
+            feed(&pktbuf, fds, piece);
+        }
+        assert(pop(&pktbuf, &pkt));
+        expect(&pkt, str);
+        assert(pkt.csum_ok);
+        pktbuf_release(&pktbuf, &pkt);
+    }
+
+    pktbuf_destroy(&pktbuf);
+}
+
+int main()
+{
+    int fds[2];
+    assert(pipe(fds) == 0);
+
+    test_framing(fds);
+    test_scan(fds);
+    test_wrap(fds);
+    test_max_size(fds);
+
+    close(fds[0]);
+    close(fds[1]);
+    printf("pktbuf_test: PASS\n");
+    return 0;
+}
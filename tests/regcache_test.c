@@ -0,0 +1,72 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "regcache.h"
+
+int main()
+{
+    regcache_t cache;
+    size_t reg_bytes[33];
+
+    /* x0-x31 of 8 bytes, then a 16 byte one */
+    for (int i = 0; i < 33; i++)
+        reg_bytes[i] = i < 32 ? 8 : 16;
+    assert(regcache_init(&cache, reg_bytes, 33, 2));
+    assert(regcache_size(&cache) == 32 * 8 + 16);
+    assert(cache.offset[32] == 256 && cache.offset[33] == 272);
+
+    /* Nothing is valid, not even before the first allocation */
+    assert(!regcache_valid(&cache, 0, 0) && !regcache_all_valid(&cache, 0));
+    uint8_t *regs = regcache_regs(&cache, 0);
+    assert(regs && regcache_regs(&cache, 0) == regs);
+
+    /* One by one up to the whole file */
+    for (int i = 0; i < 33; i++) {
+        assert(!regcache_all_valid(&cache, 0));
+        regcache_set_valid(&cache, 0, i);
+        regcache_set_valid(&cache, 0, i);
+        assert(regcache_valid(&cache, 0, i));
+    }
+    assert(regcache_all_valid(&cache, 0));
+
+    /* The CPUs are apart */
+    assert(regcache_regs(&cache, 1) && !regcache_valid(&cache, 1, 0));
+
+    regcache_drop_reg(&cache, 0, 5);
+    regcache_drop_reg(&cache, 0, 5);
+    assert(!regcache_valid(&cache, 0, 5) && !regcache_all_valid(&cache, 0));
+    regcache_set_valid(&cache, 0, 5);
+    assert(regcache_all_valid(&cache, 0));
+
+    /* Resuming drops everything, whatever was counted before */
+    regcache_invalidate(&cache);
+    assert(!regcache_valid(&cache, 0, 0) && !regcache_all_valid(&cache, 0));
+    regcache_set_valid(&cache, 0, 0);
+    assert(!regcache_all_valid(&cache, 0));
+    regcache_set_all_valid(&cache, 0);
+    assert(regcache_all_valid(&cache, 0));
+
+    regcache_drop_cpu(&cache, 0);
+    assert(!regcache_valid(&cache, 0, 32) && !regcache_all_valid(&cache, 0));
+
+    /* A generation from before the wrap around is not taken for new */
+    regcache_set_all_valid(&cache, 1);
+    cache.gen = UINT32_MAX;
+    regcache_set_valid(&cache, 0, 3);
+    regcache_invalidate(&cache);
+    assert(cache.gen == 1);
+    assert(!regcache_valid(&cache, 0, 3) && !regcache_valid(&cache, 1, 0));
+    assert(!regcache_all_valid(&cache, 1));
+
+    /* The scratch file after the CPUs */
+    int scratch = regcache_scratch(&cache);
+    assert(scratch == 2 && regcache_regs(&cache, scratch));
+    regcache_set_all_valid(&cache, scratch);
+    assert(regcache_all_valid(&cache, scratch));
+
+    regcache_destroy(&cache);
+    printf("regcache_test: PASS\n");
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "conn.h"
+
+/* Read back one frame sent on the other end of the socket pair */
+static size_t recv_frame(int fd, char *buf, size_t size)
+{
+    size_t len = 0;
+    while (len < 3 || buf[len - 3] != '#') {
+        ssize_t nread = read(fd, buf + len, size - len);
+        assert(nread > 0);
+        len += nread;
+    }
+    return len;
+}
+
+int main()
+{
+    static conn_t conn;
+    char buf[256];
+    int fds[2];
+
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    assert(outq_init(&conn.outq, CONN_OUTQ_SLOTS));
+    conn.socket_fd = fds[0];
+    conn.wake_wfd = -1;
+    conn_set_packet_size(&conn, 64);
+
+    conn_send_pktstr(&conn, "OK");
+    assert(recv_frame(fds[1], buf, sizeof(buf)) == 6);
+    assert(!memcmp(buf, "$OK#9a", 6));
+
+    /* Pieces of every kind, including a NUL byte */
+    const uint8_t bytes[] = {0xde, 0xad, 0x00, 0xef};
+    conn_reply_begin(&conn);
+    conn_reply_append_str(&conn, "m");
+    conn_reply_append_hex(&conn, bytes, sizeof(bytes));
+    conn_reply_append_bin(&conn, "a\0b", 3);
+    conn_reply_send(&conn);
+    assert(recv_frame(fds[1], buf, sizeof(buf)) == 16);
+    assert(!memcmp(buf, "$mdead00efa\0b#", 14));
+    uint8_t csum = 0;
+    for (int i = 1; i < 13; i++)
+        csum += buf[i];
+    char csum_str[3];
+    snprintf(csum_str, sizeof(csum_str), "%02x", csum);
+    assert(!memcmp(&buf[14], csum_str, 2));
+
+    /* An empty reply */
+    conn_send_pktstr(&conn, "");
+    assert(recv_frame(fds[1], buf, sizeof(buf)) == 4);
+    assert(!memcmp(buf, "$#00", 4));
+
+    /* The packet size holds the framing as well */
+    conn_reply_begin(&conn);
+    assert(conn_reply_room(&conn) == 60);
+    conn_reply_append_hex(&conn, buf, 30);
+    assert(conn_reply_room(&conn) == 0);
+    conn_reply_send(&conn);
+    assert(recv_frame(fds[1], buf, sizeof(buf)) == 64);
+
+    /* A reply which does not fit turns into an error */
+    conn_reply_begin(&conn);
+    conn_reply_append_str(&conn, "m");
+    conn_reply_append_hex(&conn, buf, 30);
+    conn_reply_send(&conn);
+    assert(recv_frame(fds[1], buf, sizeof(buf)) == 7);
+    assert(!memcmp(buf, "$" REPLY_OVERFLOW_ERR "#", 5));
+
+    /* Binary data is escaped, and cut where the packet is full */
+    const uint8_t special[] = {'#', 'a', '$', '}', '*', 0x03};
+    conn_reply_begin(&conn);
+    conn_reply_append_str(&conn, "b");
+    assert(conn_reply_append_escaped(&conn, special, sizeof(special)) == 6);
+    conn_reply_send(&conn);
+    assert(recv_frame(fds[1], buf, sizeof(buf)) == 15);
+    assert(!memcmp(buf, "$b}\x03" "a}\x04}]}\x0a\x03#", 13));
+
+    uint8_t stars[40];
+    memset(stars, '*', sizeof(stars));
+    conn_reply_begin(&conn);
+    conn_reply_append_str(&conn, "b");
+    assert(conn_reply_append_escaped(&conn, stars, sizeof(stars)) == 29);
+    assert(conn_reply_room(&conn) == 1);
+    assert(conn_reply_append_escaped(&conn, stars, 1) == 0);
+    conn_reply_append_str(&conn, "z");
+    conn_reply_send(&conn);
+    assert(recv_frame(fds[1], buf, sizeof(buf)) == 64);
+    assert(!memcmp(buf + 58, "}\x0az#", 4));
+
+    /* A queued ACK goes out with the reply in a single system call, and a
+     * large reply is sent from its own buffer */
+    size_t nr_syscalls = conn.nr_send_syscalls;
+    char *reply_buf = conn.reply.buf;
+    assert(conn_queue_str(&conn, "+"));
+    conn_reply_begin(&conn);
+    conn_reply_append_hex(&conn, bytes, sizeof(bytes));
+    conn_reply_append_hex(&conn, bytes, sizeof(bytes));
+    conn_reply_append_hex(&conn, bytes, sizeof(bytes));
+    conn_reply_append_hex(&conn, bytes, sizeof(bytes));
+    conn_reply_send(&conn);
+    assert(conn.nr_send_syscalls == nr_syscalls + 1);
+    assert(conn.reply.buf != reply_buf);
+    assert(recv_frame(fds[1], buf, sizeof(buf)) == 1 + 36);
+    assert(!memcmp(buf, "+$dead00ef", 10));
+
+    close(fds[0]);
+    close(fds[1]);
+    outq_destroy(&conn.outq);
+    free(conn.reply.buf);
+    printf("reply_test: PASS\n");
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/rle.h"
+
+/* Expand the encoded payload the way GDB does */
+static size_t rle_decode(const char *in, size_t len, char *out)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == '*') {
+            int repeat = in[++i] - 29;
+            assert(n > 0 && repeat >= 3 && repeat <= 97);
+            for (int j = 0; j < repeat; j++, n++)
+                out[n] = out[n - 1];
+        } else {
+            out[n++] = in[i];
+        }
+    }
+    return n;
+}
+
+static void check(const char *str, size_t len)
+{
+    static char buf[4096], out[4096];
+    uint8_t csum, sum = 0;
+
+    memcpy(buf, str, len);
+    size_t enc_len = rle_encode(buf, len, &csum);
+    assert(enc_len <= len);
+
+    for (size_t i = 0; i < enc_len; i++) {
+        sum += buf[i];
+        if (buf[i] == '*') {
+            char ch = buf[++i];
+            assert(ch != '#' && ch != '$' && ch != '+' && ch != '-');
+            sum += ch;
+        }
+    }
+    assert(sum == csum);
+    assert(rle_decode(buf, enc_len, out) == len);
+    assert(!memcmp(out, str, len));
+}
+
+int main()
+{
+    static char str[4096];
+
+    /* Zeroed registers shrink to a few bytes */
+    memset(str, '0', 256);
+    check(str, 256);
+    uint8_t csum;
+    assert(rle_encode(str, 256, &csum) == 7);
+
+    /* Every run length, including the ones with forbidden counts */
+    for (int len = 0; len < 300; len++) {
+        memset(str, 'a', len);
+        str[len] = 'b';
+        check(str, len + 1);
+    }
+
+    /* Random hex strings with runs of random lengths */
+    srand(1);
+    for (int round = 0; round < 1000; round++) {
+        size_t len = 0;
+        while (len < sizeof(str) - 200) {
+            char ch = "0123456789abcdef"[rand() % 16];
+            int run = (rand() % 4) ? 1 : rand() % 120;
+            memset(str + len, ch, run);
+            len += run;
+        }
+        check(str, len);
+    }
+
+    printf("rle_test: PASS\n");
+    return 0;
+}
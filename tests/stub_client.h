@@ -0,0 +1,211 @@
+#ifndef STUB_CLIENT_H
+#define STUB_CLIENT_H
+
+/* Run a gdbstub in a thread over a unix socket, and talk to it as a
+ * minimal GDB client */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "gdbstub.h"
+
+/* The registers of the default target, 64-bit with the PC last */
+#define STUB_NR_REGS 33
+#define STUB_REG_PC 32
+
+typedef struct {
+    gdbstub_t gdbstub;
+    struct target_ops *ops;
+    arch_info_t arch;
+    void *args; /* the stub itself unless set */
+    char path[64];
+    pthread_t tid;
+    uint64_t regs[STUB_NR_REGS]; /* of the default target */
+} stub_t;
+
+static inline size_t stub_get_reg_bytes(int regno __attribute__((unused)))
+{
+    return sizeof(uint64_t);
+}
+
+static inline int stub_read_reg(void *args, int regno, void *value)
+{
+    stub_t *stub = args;
+    memcpy(value, &stub->regs[regno], sizeof(uint64_t));
+    return 0;
+}
+
+static inline int stub_write_reg(void *args, int regno, void *value)
+{
+    stub_t *stub = args;
+    memcpy(&stub->regs[regno], value, sizeof(uint64_t));
+    return 0;
+}
+
+/* The default target, on the registers of the stub. A test starts from it
+ * and overrides the ops it exercises. */
+static inline struct target_ops stub_target_ops(void)
+{
+    return (struct target_ops){
+        .get_reg_bytes = stub_get_reg_bytes,
+        .read_reg = stub_read_reg,
+        .write_reg = stub_write_reg,
+    };
+}
+
+typedef struct {
+    int fd;
+    bool ack;
+    char *buf;
+    size_t cap;
+    size_t len;
+    size_t used; /* bytes of the packet returned last */
+} client_t;
+
+static void *stub_thread(void *arg)
+{
+    stub_t *stub = arg;
+
+    if (!gdbstub_init(&stub->gdbstub, stub->ops, stub->arch, stub->path)) {
+        fprintf(stderr, "stub: gdbstub_init failed\n");
+        exit(1);
+    }
+    gdbstub_run(&stub->gdbstub, stub->args);
+    gdbstub_close(&stub->gdbstub);
+    return NULL;
+}
+
+static inline void stub_start(stub_t *stub)
+{
+    if (!stub->args)
+        stub->args = stub;
+    snprintf(stub->path, sizeof(stub->path), "/tmp/gdbstub-test-%d.sock",
+             (int) getpid());
+    unlink(stub->path);
+    assert(pthread_create(&stub->tid, NULL, stub_thread, stub) == 0);
+}
+
+static inline void stub_join(stub_t *stub)
+{
+    pthread_join(stub->tid, NULL);
+    unlink(stub->path);
+}
+
+static inline void client_connect(client_t *client, const char *path)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    memset(client, 0, sizeof(*client));
+    client->ack = true;
+    client->cap = 1 << 16;
+    client->buf = malloc(client->cap);
+    assert(client->buf);
+
+    /* The stub thread may not be listening yet */
+    for (int retry = 0;; retry++) {
+        client->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        assert(client->fd >= 0);
+        if (!connect(client->fd, (struct sockaddr *) &addr, sizeof(addr)))
+            return;
+        close(client->fd);
+        assert(retry < 1000);
+        usleep(1000);
+    }
+}
+
+static inline void client_write(client_t *client, const void *data, size_t len)
+{
+    const char *ptr = data;
+    while (len > 0) {
+        ssize_t nwrite = write(client->fd, ptr, len);
+        assert(nwrite > 0);
+        ptr += nwrite;
+        len -= nwrite;
+    }
+}
+
+static inline void client_send(client_t *client,
+                               const char *payload,
+                               size_t len)
+{
+    char *frame = malloc(len + 5); /* the terminator of snprintf() too */
+    uint8_t csum = 0;
+
+    frame[0] = '$';
+    for (size_t i = 0; i < len; i++)
+        csum += (uint8_t) payload[i];
+    memcpy(frame + 1, payload, len);
+    snprintf(frame + len + 1, 4, "#%02x", csum);
+    client_write(client, frame, len + 4);
+    free(frame);
+}
+
+/* Receive the next packet and return its payload, which stays valid until
+ * the next call. The checksum is trusted. */
+static inline char *client_recv(client_t *client, size_t *len)
+{
+    /* Drop the packet returned by the last call */
+    memmove(client->buf, client->buf + client->used,
+            client->len - client->used);
+    client->len -= client->used;
+    client->used = 0;
+
+    while (true) {
+        char *head = memchr(client->buf, '$', client->len);
+        char *csum = head ? memchr(head, '#', client->buf + client->len - head)
+                          : NULL;
+        if (csum && csum + 3 <= client->buf + client->len) {
+            if (client->ack)
+                client_write(client, "+", 1);
+            *len = csum - head - 1;
+            *csum = '\0';
+            client->used = csum + 3 - client->buf;
+            return head + 1;
+        }
+
+        if (client->len == client->cap) {
+            client->cap *= 2;
+            client->buf = realloc(client->buf, client->cap);
+            assert(client->buf);
+        }
+        ssize_t nread = read(client->fd, client->buf + client->len,
+                             client->cap - client->len);
+        assert(nread > 0);
+        client->len += nread;
+    }
+}
+
+/* Send a request and wait for its reply */
+static inline char *client_cmd(client_t *client,
+                               const char *payload,
+                               size_t *len)
+{
+    client_send(client, payload, strlen(payload));
+    return client_recv(client, len);
+}
+
+static inline void client_noack(client_t *client)
+{
+    size_t len;
+    char *reply = client_cmd(client, "QStartNoAckMode", &len);
+    assert(!strcmp(reply, "OK"));
+    client->ack = false;
+}
+
+static inline void client_close(client_t *client)
+{
+    size_t len;
+    client_cmd(client, "D", &len);
+    close(client->fd);
+    free(client->buf);
+}
+
+#endif
@@ -0,0 +1,72 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "tdesc.h"
+
+#define FIND(tdesc, name) tdesc_find(tdesc, name, strlen(name))
+
+static bool contains(const tdesc_annex_t *annex, const char *s)
+{
+    return annex && strlen(annex->data) == annex->len &&
+           strstr(annex->data, s) != NULL;
+}
+
+int main()
+{
+    static const reg_desc_t descs[] = {
+        {"r0", 32, NULL, NULL, "org.test.core"},
+        {"f0", 64, "ieee_double", "float", "org.test.fpu"},
+        {"pc", 32, "code_ptr", NULL, "org.test.core"},
+        {"misc", 8, NULL, NULL, NULL},
+    };
+    arch_info_t arch = {
+        .reg_num = 4,
+        .reg_descs = descs,
+        .arch_name = "test:arch",
+    };
+    tdesc_t tdesc;
+
+    /* Nothing to describe */
+    assert(tdesc_init(&tdesc, &(arch_info_t){.reg_num = 4}));
+    assert(tdesc.nr_annexes == 0 && !FIND(&tdesc, "target.xml"));
+    tdesc_destroy(&tdesc);
+
+    /* A given description is served as is */
+    char xml[] = "<target version=\"1.0\"></target>";
+    assert(tdesc_init(&tdesc, &(arch_info_t){.target_desc = xml}));
+    assert(tdesc.nr_annexes == 1);
+    const tdesc_annex_t *annex = FIND(&tdesc, "target.xml");
+    assert(annex && annex->len == strlen(xml) && !strcmp(annex->data, xml));
+    tdesc_destroy(&tdesc);
+
+    /* Otherwise target.xml includes one annex for each feature, in order */
+    assert(tdesc_init(&tdesc, &arch));
+    assert(tdesc.nr_annexes == 4);
+    annex = FIND(&tdesc, "target.xml");
+    assert(contains(annex, "<architecture>test:arch</architecture>"));
+    assert(contains(annex,
+                    "<xi:include href=\"org.test.core.xml\"/>"
+                    "<xi:include href=\"org.test.fpu.xml\"/>"
+                    "<xi:include href=\"org.mini-gdbstub.regs.xml\"/>"));
+
+    annex = FIND(&tdesc, "org.test.core.xml");
+    assert(contains(annex, "<feature name=\"org.test.core\">"));
+    assert(contains(annex,
+                    "<reg name=\"r0\" bitsize=\"32\" type=\"int\" "
+                    "regnum=\"0\"/><reg name=\"pc\" bitsize=\"32\" "
+                    "type=\"code_ptr\" regnum=\"2\"/></feature>"));
+
+    annex = FIND(&tdesc, "org.test.fpu.xml");
+    assert(contains(annex,
+                    "<reg name=\"f0\" bitsize=\"64\" type=\"ieee_double\" "
+                    "group=\"float\" regnum=\"1\"/>"));
+    assert(contains(FIND(&tdesc, "org.mini-gdbstub.regs.xml"),
+                    "<reg name=\"misc\" bitsize=\"8\""));
+
+    assert(!FIND(&tdesc, "org.test.xml") && !FIND(&tdesc, "target.xm"));
+    tdesc_destroy(&tdesc);
+
+    printf("tdesc_test: PASS\n");
+    return 0;
+}
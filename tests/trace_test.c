@@ -0,0 +1,111 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+/* A frame of tracepoint tpnum at addr, with regs and then a block of len
+ * bytes at 0x1000 + tpnum, filled with tpnum */
+static bool collect(trace_buf_t *buf, int tpnum, size_t len)
+{
+    uint64_t regs[4] = {tpnum, tpnum + 1, tpnum + 2, tpnum + 3};
+    uint8_t mem[256];
+
+    memset(mem, tpnum, len);
+    if (!trace_frame_begin(buf) ||
+        !trace_frame_add(buf, 'R', 0, regs, sizeof(regs)) ||
+        !trace_frame_add(buf, 'M', 0x1000 + tpnum, mem, len)) {
+        trace_frame_abort(buf);
+        return false;
+    }
+    trace_frame_commit(buf, tpnum, 0x400 + 4 * tpnum);
+    return true;
+}
+
+int main()
+{
+    trace_buf_t buf;
+    trace_frame_t frame;
+    uint64_t regs[4];
+    uint8_t mem[16];
+
+    /* 16 bytes of frame header, then 16 for each block header */
+    assert(trace_buf_init(&buf, 1024, false));
+    assert(!trace_frame_get(&buf, 0, &frame));
+    assert(collect(&buf, 1, 100));
+    assert(buf.used == 16 + 16 + 32 + 16 + 100);
+    assert(collect(&buf, 2, 8));
+    assert(buf.nr_frames == 2);
+
+    assert(trace_frame_get(&buf, 1, &frame));
+    assert(frame.num == 1 && frame.tpnum == 2 && frame.addr == 0x408);
+    assert(trace_frame_regs(&buf, &frame, regs, sizeof(regs)) &&
+           regs[0] == 2 && regs[3] == 5);
+    assert(!trace_frame_regs(&buf, &frame, regs, 8));
+    assert(!trace_frame_next(&buf, &frame));
+
+    /* Memory up to the first byte which is not collected */
+    assert(trace_frame_get(&buf, 0, &frame));
+    memset(mem, 0, sizeof(mem));
+    assert(trace_frame_mem(&buf, &frame, 0x1001, 4, mem) == 4 &&
+           mem[0] == 1 && mem[3] == 1);
+    assert(trace_frame_mem(&buf, &frame, 0x1060, 16, mem) == 5);
+    assert(trace_frame_mem(&buf, &frame, 0x1000, 4, mem) == 0);
+
+    /* Full, the frame which does not fit is dropped */
+    while (collect(&buf, 3, 200))
+        ;
+    assert(buf.pending == 0 && buf.size - buf.used < 16 + 48 + 16 + 200);
+    while (collect(&buf, 3, 8))
+        ;
+    size_t nr = buf.nr_frames;
+    assert(!collect(&buf, 4, 8) && buf.nr_frames == nr);
+    assert(buf.size - buf.used < 16 + 48 + 16 + 8);
+    trace_buf_destroy(&buf);
+
+    /* Circular, the oldest frames make room, across the end of the ring */
+    assert(trace_buf_init(&buf, 1024, true));
+    for (int i = 0; i < 50; i++)
+        assert(collect(&buf, i, 16 + i));
+    assert(buf.nr_created == 50 && buf.nr_frames < 50);
+    assert(buf.used <= buf.size);
+    assert(trace_frame_get(&buf, buf.nr_frames - 1, &frame));
+    assert(frame.tpnum == 49);
+    assert(trace_frame_mem(&buf, &frame, 0x1000 + 49, 16, mem) == 16 &&
+           mem[15] == 49);
+    assert(trace_frame_get(&buf, 0, &frame));
+    assert(frame.tpnum == (int) (50 - buf.nr_frames));
+    for (size_t i = 1; i < buf.nr_frames; i++) {
+        int tpnum = frame.tpnum;
+        assert(trace_frame_next(&buf, &frame) && frame.tpnum == tpnum + 1);
+        assert(trace_frame_regs(&buf, &frame, regs, sizeof(regs)) &&
+               regs[1] == (uint64_t) frame.tpnum + 1);
+    }
+
+    trace_buf_destroy(&buf);
+
+    /* A frame larger than the whole ring */
+    assert(trace_buf_init(&buf, 128, true));
+    assert(!collect(&buf, 5, 100));
+    assert(buf.nr_frames == 0 && buf.pending == 0);
+    trace_buf_destroy(&buf);
+
+    /* Tracepoints, replaced when defined again */
+    trace_t trace;
+    trace_init(&trace);
+    tracepoint_t tp = {.num = 1, .addr = 0x400, .enabled = true};
+    trace_action_t action = {.type = 'M', .basereg = -1, .len = 4};
+    assert(trace_tp_add(&trace, &tp) == 0);
+    assert(trace_tp_add_action(trace_tp_find(&trace, 1, 0x400), &action) ==
+           0);
+    assert(trace_tp_find(&trace, 1, 0x400)->nr_actions == 1);
+    assert(trace_tp_add(&trace, &tp) == 0);
+    assert(trace.nr_tps == 1 && trace.tps[0].nr_actions == 0);
+    assert(!trace_tp_find(&trace, 1, 0x404));
+    trace_clear(&trace);
+    assert(trace.nr_tps == 0 && trace.status == TRACE_NOT_RUN);
+    trace_destroy(&trace);
+
+    printf("trace_test: PASS\n");
+    return 0;
+}
@@ -0,0 +1,97 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/translate.h"
+
+#define MAX_BYTES (1024)
+
+/* Compare every kernel against the scalar reference, including on
+ * characters which are not hex digits at all. */
+int main()
+{
+    static uint8_t num[MAX_BYTES], ref_num[MAX_BYTES], out_num[MAX_BYTES];
+    static char str[MAX_BYTES * 2], ref_str[MAX_BYTES * 2];
+    static char out_str[MAX_BYTES * 2];
+    int nr_kernels;
+    const hex_kernel_t *kernels = hex_kernels(&nr_kernels);
+
+    srand(1);
+    for (int round = 0; round < 64; round++) {
+        for (int i = 0; i < MAX_BYTES; i++)
+            num[i] = rand();
+        for (int i = 0; i < MAX_BYTES * 2; i++)
+            str[i] = (round & 1) ? "0123456789abcdefABCDEF"[rand() % 22]
+                                 : (char) rand();
+
+        for (size_t len = 0; len <= MAX_BYTES; len += (len < 80) ? 1 : 37) {
+            /* Start at an odd offset to exercise unaligned loads */
+            size_t off = round % 3;
+            if (len + off > MAX_BYTES)
+                continue;
+
+            kernels[0].encode(num + off, ref_str, len);
+            kernels[0].decode(str + off, ref_num, len);
+            for (int k = 1; k < nr_kernels; k++) {
+                memset(out_str, 0, sizeof(out_str));
+                memset(out_num, 0, sizeof(out_num));
+                kernels[k].encode(num + off, out_str, len);
+                kernels[k].decode(str + off, out_num, len);
+                if (memcmp(out_str, ref_str, len * 2) ||
+                    memcmp(out_num, ref_num, len)) {
+                    printf("translate_test: %s differs at length %zu\n",
+                           kernels[k].name, len);
+                    return 1;
+                }
+            }
+        }
+    }
+
+    /* The dispatched entry points round-trip */
+    translate_init();
+    hex_to_str(num, str, 100);
+    assert(strlen(str) == 200);
+    str_to_hex(str, out_num, 100);
+    assert(!memcmp(num, out_num, 100));
+
+    /* Escaping agrees with a byte at a time, whatever the room, and is
+     * undone by unescape() */
+    for (int round = 0; round < 4096; round++) {
+        static const char special[] = "#$}*";
+        size_t len = rand() % 80, room = rand() % 170;
+        for (size_t i = 0; i < len; i++)
+            num[i] = (rand() & 3) ? rand() : special[rand() % 4];
+
+        size_t ref_len = 0, ref_fit = 0;
+        for (; ref_fit < len; ref_fit++) {
+            bool esc = strchr(special, num[ref_fit]) && num[ref_fit];
+            if (ref_len + 1 + esc > room)
+                break;
+            if (esc)
+                ref_str[ref_len++] = '}';
+            ref_str[ref_len++] = num[ref_fit] ^ (esc ? 0x20 : 0);
+        }
+
+        size_t str_len, count_len;
+        assert(escape(num, len, out_str, room, &str_len) == ref_fit);
+        assert(str_len == ref_len && !memcmp(out_str, ref_str, ref_len));
+        assert(escape(num, len, NULL, room, &count_len) == ref_fit);
+        assert(count_len == ref_len);
+        assert(unescape_to(out_str, out_str + str_len, NULL) == ref_fit);
+        assert(unescape_to(out_str, out_str + str_len, out_num) == ref_fit);
+        assert(!memcmp(out_num, num, ref_fit));
+        assert(unescape(out_str, out_str + str_len) == (int) ref_fit);
+        assert(!memcmp(out_str, num, ref_fit));
+    }
+
+    /* A '}' cut off at the end of the packet is left out */
+    memcpy(str, "ab}]}", 5);
+    assert(unescape_to(str, str + 5, NULL) == 3);
+    assert(unescape_to(str, str + 5, out_num) == 3);
+    assert(!memcmp(out_num, "ab}", 3));
+
+    printf("translate_test: PASS (%d kernels)\n", nr_kernels);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "watch.h"
+
+int main()
+{
+    static gdbstub_t gdbstub;
+    gdbstub_watches_t *watches = &gdbstub.watches;
+
+    /* None */
+    assert(!gdbstub_watch_check(&gdbstub, 0, 8, true));
+    assert(!gdbstub_watch_check(&gdbstub, 0x1000, 8, false));
+    assert(!watch_remove(watches, 0x1000, 4, WP_WRITE));
+    assert(watch_insert(watches, 0x1000, 0, WP_WRITE) == EINVAL);
+    assert(watch_insert(watches, 0x1000, 4, BP_SOFTWARE) == EINVAL);
+
+    /* A write watchpoint, added twice, only sees writes overlapping it */
+    assert(watch_insert(watches, 0x1000, 4, WP_WRITE) == 0);
+    assert(watch_insert(watches, 0x1000, 4, WP_WRITE) == 0);
+    assert(watches->nr == 1);
+    assert(!gdbstub_watch_check(&gdbstub, 0x1000, 4, false));
+    assert(!gdbstub_watch_check(&gdbstub, 0xff8, 8, true));
+    assert(!gdbstub_watch_check(&gdbstub, 0x1004, 1, true));
+    assert(!watches->hit);
+    assert(gdbstub_watch_check(&gdbstub, 0xffc, 8, true));
+    assert(watches->hit && watches->hit_type == WP_WRITE);
+    assert(watches->hit_addr == 0x1000);
+
+    /* The first hit is the one reported */
+    assert(gdbstub_watch_check(&gdbstub, 0x1002, 1, true));
+    assert(watches->hit_addr == 0x1000);
+    watches->hit = false;
+    assert(gdbstub_watch_check(&gdbstub, 0x1002, 1, true));
+    assert(watches->hit_addr == 0x1002);
+    watches->hit = false;
+
+    /* Read and access ones, far apart, with a gap between them which is
+     * within the bounds of the index */
+    assert(watch_insert(watches, 0x2000, 8, WP_READ) == 0);
+    assert(watch_insert(watches, 0x8000, 0x100, WP_ACCESS) == 0);
+    assert(!gdbstub_watch_check(&gdbstub, 0x4000, 8, false));
+    assert(!gdbstub_watch_check(&gdbstub, 0x2000, 8, true));
+    assert(gdbstub_watch_check(&gdbstub, 0x2004, 8, false));
+    assert(watches->hit_type == WP_READ && watches->hit_addr == 0x2004);
+    watches->hit = false;
+    assert(gdbstub_watch_check(&gdbstub, 0x80f8, 8, true));
+    assert(watches->hit_type == WP_ACCESS && watches->hit_addr == 0x80f8);
+    watches->hit = false;
+
+    /* A large range before a small one, the small one ending before it */
+    assert(watch_insert(watches, 0x100, 0x10000, WP_READ) == 0);
+    assert(gdbstub_watch_check(&gdbstub, 0x3000, 4, false));
+    assert(watches->hit_type == WP_READ && watches->hit_addr == 0x3000);
+    watches->hit = false;
+    assert(!gdbstub_watch_check(&gdbstub, 0x3000, 4, true));
+
+    /* Removed ones no longer trigger */
+    assert(watch_remove(watches, 0x100, 0x10000, WP_READ));
+    assert(!gdbstub_watch_check(&gdbstub, 0x3000, 4, false));
+    assert(!watch_remove(watches, 0x1000, 4, WP_READ));
+    assert(watch_remove(watches, 0x1000, 4, WP_WRITE));
+    assert(!gdbstub_watch_check(&gdbstub, 0x1000, 4, true));
+    assert(watch_remove(watches, 0x2000, 8, WP_READ));
+    assert(watch_remove(watches, 0x8000, 0x100, WP_ACCESS));
+    assert(!gdbstub_watch_check(&gdbstub, 0x8000, 4, false));
+    assert(watches->nr == 0 && !watches->hit);
+
+    /* Up to the end of the address space */
+    assert(watch_insert(watches, SIZE_MAX - 7, 16, WP_WRITE) == 0);
+    assert(gdbstub_watch_check(&gdbstub, SIZE_MAX - 3, 2, true));
+    watches->hit = false;
+    assert(watch_remove(watches, SIZE_MAX - 7, 16, WP_WRITE));
+
+    /* Accesses which run past it do not wrap around to the beginning, and
+     * still see the last byte */
+    assert(watch_insert(watches, SIZE_MAX, 1, WP_WRITE) == 0);
+    assert(gdbstub_watch_check(&gdbstub, SIZE_MAX, 1, true));
+    assert(watches->hit_addr == SIZE_MAX);
+    watches->hit = false;
+    assert(gdbstub_watch_check(&gdbstub, SIZE_MAX - 3, 8, true));
+    assert(watches->hit_addr == SIZE_MAX);
+    watches->hit = false;
+    assert(!gdbstub_watch_check(&gdbstub, SIZE_MAX - 3, 3, true));
+    assert(watch_remove(watches, SIZE_MAX, 1, WP_WRITE));
+    assert(watch_insert(watches, 0x10, 4, WP_WRITE) == 0);
+    assert(!gdbstub_watch_check(&gdbstub, SIZE_MAX - 1, 32, true));
+    assert(!gdbstub_watch_check(&gdbstub, 0x8, 8, true));
+    assert(gdbstub_watch_check(&gdbstub, 0x8, 9, true));
+
+    watch_destroy(watches);
+    printf("watch_test: PASS\n");
+    return 0;
+}